@@ -42,6 +42,18 @@
 /** Default refactory period (time delay) for client reads in ms**/
 #define IP_DEFAULT_REFRACTORY_PERIOD 5
 
+/** Marks a fast field table that the host has initialized ("IPF2") **/
+#define IP_FAST_TABLE_MAGIC 0x49504632
+
+/** Times a fast field reader retries before giving up **/
+#define IP_FETCH_TRIES 1000
+
+/** Times a fast field writer spins waiting for another writer **/
+#define IP_PUBLISH_TRIES 100000
+
+/** Times ip_RegisterField() sleeps 1 ms waiting for the table **/
+#define IP_REGISTER_TRIES 1000
+
 /*
  * A field is the term I use for a variable that is stored in shared memory.
  */
@@ -60,6 +72,76 @@ struct SharedData_t {
 	struct field_t fields[(IP_BUF_SIZE / sizeof(struct field_t)) - 1];
 };
 
+/*
+ * A fast field. The sequence number is odd while a writer is copying in a
+ * new value and counts up by two for every value written.
+ */
+struct fastfield_t {
+	volatile LONG seq;
+	LONG size; /* bytes of data used */
+	char name[IP_FIELD_NAME_SIZE];
+	char data[IP_FAST_FIELD_DATA_SIZE];
+	char pad[24]; /* round up to whole 64 byte cache lines */
+};
+
+/*
+ * Table of fast fields, stored in shared memory right after the Shared Data.
+ * Fields are only ever added, so a handle stays good for the life of the
+ * shared memory.
+ */
+struct FastTable_t {
+	LONG magic;
+	volatile LONG usedFields;
+	volatile LONG registerLock; /* held only while adding a field */
+	char pad[52];
+	struct fastfield_t fields[IP_MAX_FAST_FIELDS];
+};
+
+/** The whole mapping: Shared Data and then the fast field table **/
+#define IP_MAP_SIZE (IP_BUF_SIZE + sizeof(struct FastTable_t))
+
+/** Marks a ring that the host has initialized ("IPR1") **/
+#define IP_RING_MAGIC 0x49505231
+
+/** Bytes in a ring's header and in a slot's stamp; one cache line each **/
+#define IP_RING_LINE 64
+
+/** Times a ring reader retries the most recent record while it is being written **/
+#define IP_RING_READ_TRIES 1000
+
+/*
+ * The start of a ring's shared memory. The slots follow, each
+ * IP_RING_LINE bytes of stamp and then the record.
+ */
+struct RingHeader_t {
+	LONG magic;
+	LONG recordSize;
+	LONG numRecords;
+	LONG slotSize; /* stamp plus record, rounded up to a whole cache line */
+	volatile LONG head; /* records pushed so far */
+	char pad[IP_RING_LINE - 5 * sizeof(LONG)];
+};
+
+/*
+ * Local object for a notifier. The host holds all of the events, a client
+ * only the one it claimed.
+ */
+struct Notifier_t {
+	HANDLE events[IP_MAX_WAITERS];
+	HANDLE claim; /* client only: a mutex it owns for as long as it holds its place */
+	int slot; /* client only: which event is its own */
+};
+
+/*
+ * Local object for a ring.
+ */
+struct Ring_t {
+	char name[IP_MAX_MEM_NAME_LENGTH];
+	HANDLE hMapFile;
+	LPCTSTR pBuf;
+	struct RingHeader_t* hd;
+};
+
 /*
  * Local object that provides information about the shared memory.
  */
@@ -72,6 +154,7 @@ struct SharedMemory_t {
 
 	/* Application Level Data */
 	struct SharedData_t* sd; /* pointer to the location of the shared data  (eventually will be pBuf)*/
+	struct FastTable_t* ft; /* fast fields, right after the shared data, or NULL */
 
 	/* Windows Level File Mapping **/
 	HANDLE hMapFile; /* handle to mapped file of the shared memroy */
@@ -401,6 +484,7 @@ SharedMemory_handle createSharedMemoryObj(char* name, HANDLE hMapFile,
 	sm->pBuf = pBuf;
 	sm->hMapFile = hMapFile;
 	sm->sd = NULL;
+	sm->ft = NULL;
 
 	/** Create Mutex for Shared Memory **/
 	// Create a mutex with no initial owner
@@ -584,7 +668,7 @@ SharedMemory_handle ip_CreateSharedMemoryHost(char* name) {
 			NULL, // default security
 			PAGE_READWRITE, // read/write access
 			0, // maximum object size (high-order DWORD)
-			IP_BUF_SIZE, // maximum object size (low-order DWORD)
+			IP_MAP_SIZE, // maximum object size (low-order DWORD)
 			name); // name of mapping object
 	if (hMapFile == NULL) {
 		_tprintf(TEXT("Could not create file mapping object (%d).\n"),
@@ -595,7 +679,7 @@ SharedMemory_handle ip_CreateSharedMemoryHost(char* name) {
 	/* Create a buffer for the map opbject*/
 	pBuf = (LPTSTR) MapViewOfFile(hMapFile, // handle to map object
 			FILE_MAP_ALL_ACCESS, // read/write permission
-			0, 0, IP_BUF_SIZE);
+			0, 0, IP_MAP_SIZE);
 
 	if (pBuf == NULL) {
 		_tprintf(TEXT("Could not map view of file (%d).\n"), GetLastError());
@@ -614,13 +698,20 @@ SharedMemory_handle ip_CreateSharedMemoryHost(char* name) {
 	/*Try to Attain Mutex Lock */
 	if (AcquireLock(sm) == IP_SUCCESS) {
 		/* Copy the local copy of the Shared Data Object into Shared Memory */
-		CopyMemory((PVOID) pBuf, &local_sd, sizeof(local_sd));
+		CopyMemory((PVOID) pBuf, local_sd, sizeof(struct SharedData_t));
 		// Release ownership of the mutex object
 		ReleaseLock(sm);
 
 		/* Update the Shared MEmory Obj to reflect that the local data is now in shared MEmory */
 		sm->sd = (SharedData_t*) pBuf;
 
+		/* Start an empty fast field table, unless a previous host left one */
+		sm->ft = (struct FastTable_t*) ((char*) pBuf + IP_BUF_SIZE);
+		if (sm->ft->magic != IP_FAST_TABLE_MAGIC) {
+			ZeroMemory((PVOID) sm->ft, sizeof(struct FastTable_t));
+			sm->ft->magic = IP_FAST_TABLE_MAGIC;
+		}
+
 	} else {
 		printf("The mutex appears to be busy!. Sad. \n");
 		sm = NULL;
@@ -656,7 +747,7 @@ SharedMemory_handle ip_CreateSharedMemoryClient(char* name) {
 	/* Create a buffer for the map opbject*/
 	pBuf = (LPTSTR) MapViewOfFile(hMapFile, // handle to map object
 			FILE_MAP_ALL_ACCESS, // read/write permission
-			0, 0, IP_BUF_SIZE);
+			0, 0, IP_MAP_SIZE);
 
 	if (pBuf == NULL) {
 		_tprintf(TEXT("Could not map view of file (%d).\n"), GetLastError());
@@ -671,8 +762,12 @@ SharedMemory_handle ip_CreateSharedMemoryClient(char* name) {
 	/* Update the Shared MEmory Obj to reflect that shared data  is now in shared MEmory */
 	sm->sd = (SharedData_t*) pBuf;
 
-
-
+	/* Fast fields are optional; without them the fast field functions return IP_ERROR */
+	sm->ft = (struct FastTable_t*) ((char*) pBuf + IP_BUF_SIZE);
+	if (sm->ft->magic != IP_FAST_TABLE_MAGIC) {
+		printf("The host did not set up a fast field table.\n");
+		sm->ft = NULL;
+	}
 
 	 /*Attain Mutex Lock */
 	if (AcquireLock(sm) == IP_SUCCESS) {
@@ -1010,3 +1105,568 @@ int ip_ClearField(SharedMemory_handle sm, char* fieldName) {
 
 }
 
+
+
+/*********************
+ *
+ *  Fast Fields
+ *
+ */
+
+/*
+ * Look up a fast field by handle. Returns NULL if the handle is bad.
+ */
+struct fastfield_t* getFastField(SharedMemory_handle sm, int field) {
+	if (sm == NULL || sm->ft == NULL)
+		return NULL;
+	if (field < 0 || field >= sm->ft->usedFields)
+		return NULL;
+	return &(sm->ft->fields[field]);
+}
+
+/*
+ * Register a fast field. Returns its handle or a negative error code.
+ */
+int ip_RegisterField(SharedMemory_handle sm, char* fieldName, int dataSize) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (sm->ft == NULL || fieldName == NULL)
+		return IP_ERROR;
+
+	if (strlen(fieldName) < 1 || strlen(fieldName) > IP_FIELD_NAME_SIZE - 1) {
+		printf("Field name must be 1 to %d characters.\n",
+				IP_FIELD_NAME_SIZE - 1);
+		return IP_ERROR;
+	}
+	if (dataSize < 1 || dataSize > IP_FAST_FIELD_DATA_SIZE) {
+		printf("Fast field %s must hold 1 to %d bytes.\n", fieldName,
+				IP_FAST_FIELD_DATA_SIZE);
+		return IP_ERROR;
+	}
+
+	struct FastTable_t* ft = sm->ft;
+
+	/* Registering is rare, so a simple spin lock keeps two processes from taking the same slot */
+	int k = 0;
+	while (InterlockedCompareExchange(&(ft->registerLock), 1, 0) != 0) {
+		if (++k > IP_REGISTER_TRIES) {
+			printf("The fast field table stayed busy.\n");
+			return IP_ERROR;
+		}
+		Sleep(1);
+	}
+
+	int ret = IP_NO_MORE_ROOM;
+	for (k = 0; k < ft->usedFields; ++k) {
+		if (strncmp(fieldName, ft->fields[k].name, IP_FIELD_NAME_SIZE) == 0)
+			break;
+	}
+
+	if (k < ft->usedFields) {
+		/* Already there */
+		if (ft->fields[k].size == dataSize) {
+			ret = k;
+		} else {
+			printf("Fast field %s is already registered with %ld bytes.\n",
+					fieldName, ft->fields[k].size);
+			ret = IP_ERROR;
+		}
+	} else if (k < IP_MAX_FAST_FIELDS) {
+		/* Fill in the new field before anyone can see it */
+		struct fastfield_t* f = &(ft->fields[k]);
+		strncpy(f->name, fieldName, IP_FIELD_NAME_SIZE - 1);
+		f->name[IP_FIELD_NAME_SIZE - 1] = '\0';
+		f->size = dataSize;
+		f->seq = 0;
+		MemoryBarrier();
+		InterlockedIncrement(&(ft->usedFields));
+		ret = k;
+	}
+
+	InterlockedExchange(&(ft->registerLock), 0);
+	return ret;
+}
+
+/*
+ * Write a fast field.
+ */
+int ip_Publish(SharedMemory_handle sm, int field, void *data) {
+	struct fastfield_t* f = getFastField(sm, field);
+	if (f == NULL || data == NULL)
+		return IP_ERROR;
+
+	/* Make the sequence number odd. Only one writer at a time gets to. */
+	LONG s;
+	int k = 0;
+	for (;;) {
+		s = f->seq;
+		if (!(s & 1) && InterlockedCompareExchange(&(f->seq), s + 1, s) == s)
+			break;
+		if (++k > IP_PUBLISH_TRIES)
+			return IP_BUSY;
+		YieldProcessor();
+	}
+
+	memcpy(f->data, data, f->size);
+
+	/* Even again: the new value is complete */
+	InterlockedExchange(&(f->seq), s + 2);
+	return IP_SUCCESS;
+}
+
+/*
+ * Read a fast field.
+ */
+int ip_Fetch(SharedMemory_handle sm, int field, void *data) {
+	struct fastfield_t* f = getFastField(sm, field);
+	if (f == NULL || data == NULL)
+		return IP_ERROR;
+
+	int k = 0;
+	for (k = 0; k < IP_FETCH_TRIES; ++k) {
+		LONG s = f->seq;
+		if (s & 1) {
+			/* A writer is in the middle of it */
+			YieldProcessor();
+			continue;
+		}
+		MemoryBarrier();
+		memcpy(data, f->data, f->size);
+		MemoryBarrier();
+
+		/* Only keep the copy if no writer started in the meantime */
+		if (f->seq == s)
+			return (s == 0) ? IP_DOES_NOT_EXIST : IP_SUCCESS;
+	}
+	return IP_BUSY;
+}
+
+/*
+ * How many times a fast field has been written.
+ */
+int ip_GetFieldVersion(SharedMemory_handle sm, int field) {
+	struct fastfield_t* f = getFastField(sm, field);
+	if (f == NULL)
+		return IP_ERROR;
+	return (int) (f->seq / 2);
+}
+
+/*
+ * Write a fast field only if it is still at version.
+ */
+int ip_PublishIfVersion(SharedMemory_handle sm, int field, void *data, int version) {
+	struct fastfield_t* f = getFastField(sm, field);
+	if (f == NULL || data == NULL || version < 0)
+		return IP_ERROR;
+
+	/* Make the sequence number odd, but only from the one it had at version.
+	 * Any other value means someone has written it, or is writing it, since. */
+	LONG s = 2 * (LONG) version;
+	if (InterlockedCompareExchange(&(f->seq), s + 1, s) != s)
+		return IP_CHANGED;
+
+	memcpy(f->data, data, f->size);
+
+	/* Even again: the new value is complete */
+	InterlockedExchange(&(f->seq), s + 2);
+	return IP_SUCCESS;
+}
+
+
+
+/*********************
+ *
+ *  Rings
+ *
+ */
+
+/*
+ * Stamp of the slot that record number index goes in.
+ * The stamp is 2*index+1 while the record is being written and 2*index+2
+ * once it is complete.
+ */
+volatile LONG* ringStamp(Ring_handle r, int index) {
+	return (volatile LONG*) ((char*) r->pBuf + IP_RING_LINE
+			+ (index % r->hd->numRecords) * r->hd->slotSize);
+}
+
+/*
+ * Create the local ring object around a mapped ring.
+ */
+Ring_handle createRingObj(char* name, HANDLE hMapFile, LPCTSTR pBuf) {
+	Ring_handle r = (Ring_handle) malloc(sizeof(struct Ring_t));
+	strncpy(r->name, name, IP_MAX_MEM_NAME_LENGTH - 1);
+	r->name[IP_MAX_MEM_NAME_LENGTH - 1] = '\0';
+	r->hMapFile = hMapFile;
+	r->pBuf = pBuf;
+	r->hd = (struct RingHeader_t*) pBuf;
+	return r;
+}
+
+/*
+ * Create a ring. To be run on the host process.
+ */
+Ring_handle ip_CreateRingHost(char* name, int recordSize, int numRecords) {
+	if (name == NULL || recordSize < 1 || numRecords < 1) {
+		printf("ip_CreateRingHost() needs a name, a record size and a length.\n");
+		return NULL;
+	}
+
+	LONG slotSize = ((IP_RING_LINE + recordSize + IP_RING_LINE - 1)
+			/ IP_RING_LINE) * IP_RING_LINE;
+	DWORD mapSize = IP_RING_LINE + numRecords * slotSize;
+
+	HANDLE hMapFile = CreateFileMapping(INVALID_HANDLE_VALUE, // use paging file
+			NULL, // default security
+			PAGE_READWRITE, // read/write access
+			0, // maximum object size (high-order DWORD)
+			mapSize, // maximum object size (low-order DWORD)
+			name); // name of mapping object
+	if (hMapFile == NULL) {
+		_tprintf(TEXT("Could not create file mapping object (%d).\n"),
+				GetLastError());
+		return NULL;
+	}
+
+	LPCTSTR pBuf = (LPTSTR) MapViewOfFile(hMapFile, // handle to map object
+			FILE_MAP_ALL_ACCESS, // read/write permission
+			0, 0, mapSize);
+	if (pBuf == NULL) {
+		_tprintf(TEXT("Could not map view of file (%d).\n"), GetLastError());
+		CloseHandle(hMapFile);
+		return NULL;
+	}
+
+	/* Start empty. Clients check the magic number last. */
+	ZeroMemory((PVOID) pBuf, mapSize);
+	Ring_handle r = createRingObj(name, hMapFile, pBuf);
+	r->hd->recordSize = recordSize;
+	r->hd->numRecords = numRecords;
+	r->hd->slotSize = slotSize;
+	r->hd->head = 0;
+	MemoryBarrier();
+	r->hd->magic = IP_RING_MAGIC;
+	return r;
+}
+
+/*
+ * Open a ring. To be run on a client process.
+ */
+Ring_handle ip_CreateRingClient(char* name) {
+	if (name == NULL)
+		return NULL;
+
+	/* Rings are optional, so a missing one is not worth a message */
+	HANDLE hMapFile = OpenFileMapping(FILE_MAP_READ, // read access
+			FALSE, // do not inherit the name
+			name); // name of mapping object
+	if (hMapFile == NULL)
+		return NULL;
+
+	/* Map the whole thing; the host decided the size */
+	LPCTSTR pBuf = (LPTSTR) MapViewOfFile(hMapFile, // handle to map object
+			FILE_MAP_READ, // read permission
+			0, 0, 0);
+	if (pBuf == NULL) {
+		_tprintf(TEXT("Could not map view of file (%d).\n"), GetLastError());
+		CloseHandle(hMapFile);
+		return NULL;
+	}
+
+	Ring_handle r = createRingObj(name, hMapFile, pBuf);
+	if (r->hd->magic != IP_RING_MAGIC) {
+		printf("Ring %s has not been set up by its host.\n", name);
+		ip_CloseRing(r);
+		return NULL;
+	}
+	return r;
+}
+
+/*
+ * Close a ring.
+ */
+int ip_CloseRing(Ring_handle r) {
+	if (r != NULL) {
+		if (r->pBuf != NULL)
+			UnmapViewOfFile((PVOID) r->pBuf);
+		if (r->hMapFile != NULL)
+			CloseHandle(r->hMapFile);
+		free(r);
+	}
+	return IP_SUCCESS;
+}
+
+int ip_GetRingRecordSize(Ring_handle r) {
+	if (r == NULL)
+		return IP_ERROR;
+	return r->hd->recordSize;
+}
+
+int ip_GetRingLength(Ring_handle r) {
+	if (r == NULL)
+		return IP_ERROR;
+	return r->hd->numRecords;
+}
+
+int ip_GetRingHead(Ring_handle r) {
+	if (r == NULL)
+		return IP_ERROR;
+	return r->hd->head;
+}
+
+/*
+ * Start writing the next record in place.
+ */
+void* ip_RingBeginPush(Ring_handle r) {
+	if (r == NULL)
+		return NULL;
+	LONG index = r->hd->head;
+	volatile LONG* stamp = ringStamp(r, index);
+
+	/* Odd: readers leave the slot alone until the record is done */
+	InterlockedExchange(stamp, 2 * index + 1);
+	return (void*) ((char*) stamp + IP_RING_LINE);
+}
+
+/*
+ * Publish the record started with ip_RingBeginPush().
+ */
+int ip_RingEndPush(Ring_handle r) {
+	if (r == NULL)
+		return IP_ERROR;
+	LONG index = r->hd->head;
+	volatile LONG* stamp = ringStamp(r, index);
+	if (*stamp != 2 * index + 1)
+		return IP_ERROR;
+
+	InterlockedExchange(stamp, 2 * index + 2);
+	InterlockedExchange(&(r->hd->head), index + 1);
+	return IP_SUCCESS;
+}
+
+/*
+ * Push the next record.
+ */
+int ip_RingPush(Ring_handle r, void *record) {
+	if (record == NULL)
+		return IP_ERROR;
+	void* slot = ip_RingBeginPush(r);
+	if (slot == NULL)
+		return IP_ERROR;
+	memcpy(slot, record, r->hd->recordSize);
+	return ip_RingEndPush(r);
+}
+
+/*
+ * Is record number index in its slot?
+ */
+int ip_RingCheck(Ring_handle r, int index) {
+	if (r == NULL || index < 0)
+		return IP_ERROR;
+
+	LONG want = 2 * index + 2;
+	LONG s = *ringStamp(r, index);
+	MemoryBarrier();
+
+	if (s == want - 1)
+		return IP_BUSY;
+	if (s < want)
+		return IP_DOES_NOT_EXIST;
+	if (s > want)
+		return IP_OVERWRITTEN;
+	return IP_SUCCESS;
+}
+
+/*
+ * Look at record number index in place.
+ */
+const void* ip_RingPeek(Ring_handle r, int index) {
+	if (ip_RingCheck(r, index) != IP_SUCCESS)
+		return NULL;
+	return (const void*) ((char*) ringStamp(r, index) + IP_RING_LINE);
+}
+
+/*
+ * Copy record number index.
+ */
+int ip_RingRead(Ring_handle r, int index, void *record) {
+	if (r == NULL || record == NULL || index < 0)
+		return IP_ERROR;
+
+	int ret = ip_RingCheck(r, index);
+	if (ret != IP_SUCCESS)
+		return ret;
+
+	memcpy(record, (char*) ringStamp(r, index) + IP_RING_LINE,
+			r->hd->recordSize);
+	MemoryBarrier();
+
+	/* The host came round again while we were copying */
+	if (ip_RingCheck(r, index) != IP_SUCCESS)
+		return IP_OVERWRITTEN;
+	return IP_SUCCESS;
+}
+
+/*
+ * Copy the most recent record.
+ */
+int ip_RingReadLatest(Ring_handle r, void *record, int* index) {
+	if (r == NULL || record == NULL)
+		return IP_ERROR;
+
+	int ret = IP_DOES_NOT_EXIST;
+	int k = 0;
+	for (k = 0; k < IP_RING_READ_TRIES; ++k) {
+		int latest = r->hd->head - 1;
+		if (latest < 0)
+			return IP_DOES_NOT_EXIST;
+		ret = ip_RingRead(r, latest, record);
+		if (ret == IP_SUCCESS) {
+			if (index != NULL)
+				*index = latest;
+			return IP_SUCCESS;
+		}
+		/* Otherwise the host is lapping us; look at the head again */
+		YieldProcessor();
+	}
+	return ret;
+}
+
+
+
+/*********************
+ *
+ *  Notifiers
+ *
+ */
+
+/*
+ * Name of the k'th event (what="event") or claim mutex (what="claim") of a notifier.
+ */
+void notifierName(char* dest, char* name, char* what, int k) {
+	_snprintf(dest, IP_MAX_MEM_NAME_LENGTH, "%s_%s_%d", name, what, k);
+	dest[IP_MAX_MEM_NAME_LENGTH - 1] = '\0';
+}
+
+/*
+ * Create a notifier. To be run on the host process.
+ */
+Notifier_handle ip_CreateNotifierHost(char* name) {
+	if (name == NULL)
+		return NULL;
+	Notifier_handle n = (Notifier_handle) malloc(sizeof(struct Notifier_t));
+	int k = 0;
+	for (k = 0; k < IP_MAX_WAITERS; ++k)
+		n->events[k] = NULL;
+	n->claim = NULL;
+	n->slot = -1;
+
+	char evname[IP_MAX_MEM_NAME_LENGTH];
+	for (k = 0; k < IP_MAX_WAITERS; ++k) {
+		notifierName(evname, name, "event", k);
+		n->events[k] = CreateEvent(NULL, // default security attributes
+				FALSE, // auto-reset: each set wakes its client once
+				FALSE, // not set
+				evname);
+		if (n->events[k] == NULL) {
+			printf("CreateEvent error: %d\n", GetLastError());
+			ip_CloseNotifier(n);
+			return NULL;
+		}
+	}
+	return n;
+}
+
+/*
+ * Claim a place to wait on a notifier.
+ */
+Notifier_handle ip_CreateNotifierClient(char* name) {
+	if (name == NULL)
+		return NULL;
+	Notifier_handle n = (Notifier_handle) malloc(sizeof(struct Notifier_t));
+	int k = 0;
+	for (k = 0; k < IP_MAX_WAITERS; ++k)
+		n->events[k] = NULL;
+	n->claim = NULL;
+	n->slot = -1;
+
+	/*
+	 * A place is ours if we are the first to create its claim mutex. When
+	 * a client exits, its handle goes and with it the mutex, so the place
+	 * frees itself.
+	 */
+	char mname[IP_MAX_MEM_NAME_LENGTH];
+	for (k = 0; k < IP_MAX_WAITERS; ++k) {
+		notifierName(mname, name, "claim", k);
+		HANDLE claim = CreateMutex(NULL, TRUE, mname);
+		if (claim == NULL)
+			continue;
+		if (GetLastError() == ERROR_ALREADY_EXISTS) {
+			CloseHandle(claim);
+			continue;
+		}
+		n->claim = claim;
+		n->slot = k;
+		break;
+	}
+	if (n->slot < 0) {
+		printf("All %d places to wait on %s are taken.\n", IP_MAX_WAITERS, name);
+		ip_CloseNotifier(n);
+		return NULL;
+	}
+
+	char evname[IP_MAX_MEM_NAME_LENGTH];
+	notifierName(evname, name, "event", n->slot);
+	n->events[n->slot] = OpenEvent(SYNCHRONIZE, FALSE, evname);
+	if (n->events[n->slot] == NULL) {
+		/* No host */
+		ip_CloseNotifier(n);
+		return NULL;
+	}
+	return n;
+}
+
+/*
+ * Wake every waiting client.
+ */
+int ip_Notify(Notifier_handle n) {
+	if (n == NULL || n->slot >= 0)
+		return IP_ERROR;
+	int k = 0;
+	for (k = 0; k < IP_MAX_WAITERS; ++k)
+		SetEvent(n->events[k]);
+	return IP_SUCCESS;
+}
+
+/*
+ * Wait to be notified.
+ */
+int ip_Wait(Notifier_handle n, int timeout_ms) {
+	if (n == NULL || n->slot < 0)
+		return IP_ERROR;
+	DWORD ret = WaitForSingleObject(n->events[n->slot], (DWORD) timeout_ms);
+	if (ret == WAIT_OBJECT_0)
+		return IP_SUCCESS;
+	if (ret == WAIT_TIMEOUT)
+		return IP_BUSY;
+	return IP_ERROR;
+}
+
+/*
+ * Close a notifier.
+ */
+int ip_CloseNotifier(Notifier_handle n) {
+	if (n != NULL) {
+		int k = 0;
+		for (k = 0; k < IP_MAX_WAITERS; ++k) {
+			if (n->events[k] != NULL)
+				CloseHandle(n->events[k]);
+		}
+		if (n->claim != NULL) {
+			ReleaseMutex(n->claim);
+			CloseHandle(n->claim);
+		}
+		free(n);
+	}
+	return IP_SUCCESS;
+}
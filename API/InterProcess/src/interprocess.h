@@ -52,6 +52,8 @@
 #define IP_BUSY 1
 #define IP_DOES_NOT_EXIST -2
 #define IP_NO_MORE_ROOM -3
+#define IP_OVERWRITTEN -4
+#define IP_CHANGED -5
 
 
 
@@ -230,6 +232,247 @@ int ip_ClearField(SharedMemory_handle sm, char* fieldName);
 
 
 
+/*********************
+ *
+ *  Fast Fields
+ *
+ * A second generation of fields for values that are read and written
+ * often. A fast field is registered once by name and from then on is
+ * referred to by the index ip_RegisterField() returns, so there is no
+ * search by name and nothing is allocated.
+ *
+ * Each fast field has its own sequence lock. A writer makes the sequence
+ * number odd, copies the value in and makes it even again. A reader
+ * copies the value out and tries again if the sequence number was odd or
+ * changed in the meantime. Readers never hold anything a writer waits
+ * for, the mutex is not used, and there is no Read Time Delay.
+ *
+ * Fast fields live in their own table after the ordinary fields, in the
+ * same shared memory. Host and clients must be built with the same
+ * interprocess.h.
+ *
+ */
+
+/** Room for fast fields **/
+#define IP_MAX_FAST_FIELDS 128
+#define IP_FAST_FIELD_DATA_SIZE 256
+
+/*
+ * Register a fast field of dataSize bytes (at most IP_FAST_FIELD_DATA_SIZE).
+ * Registering a name that already exists returns the existing field, so
+ * host and clients may register in any order.
+ *
+ * Returns the field's handle (0 or more), or one of the negative codes
+ *  IP_ERROR -1  bad name or size, a different size than already
+ *               registered, or the table stayed busy for a second
+ *  IP_DOES_NOT_EXIST -2  no shared memory
+ *  IP_NO_MORE_ROOM -3
+ */
+int ip_RegisterField(SharedMemory_handle sm, char* fieldName, int dataSize);
+
+/*
+ * Write a fast field. Never waits for a reader.
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  bad handle
+ *  IP_BUSY 1  another writer held the field for too long
+ */
+int ip_Publish(SharedMemory_handle sm, int field, void *data);
+
+/*
+ * Read a fast field. Never blocks a writer.
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  bad handle
+ *  IP_BUSY 1  the field was being written the whole time
+ *  IP_DOES_NOT_EXIST -2  the field has never been written
+ */
+int ip_Fetch(SharedMemory_handle sm, int field, void *data);
+
+/*
+ * How many times a fast field has been written, or IP_ERROR.
+ * Cheap; use it to see whether there is anything new to fetch.
+ */
+int ip_GetFieldVersion(SharedMemory_handle sm, int field);
+
+/*
+ * Write a fast field, but only if nobody has written it since it was at
+ * version. To change part of a field without losing another writer's
+ * change: get the version, fetch, change, publish if still at that version,
+ * and start over if not.
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  bad handle
+ *  IP_CHANGED -5  the field was written (or is being written) since version
+ */
+int ip_PublishIfVersion(SharedMemory_handle sm, int field, void *data, int version);
+
+
+
+/*********************
+ *
+ *  Rings
+ *
+ * A ring is a stream of fixed size records in its own named shared
+ * memory. One process (the host) pushes records; any number of clients
+ * read them, each keeping its own place in the stream. Records are
+ * numbered 0, 1, 2, ... in the order they are pushed.
+ *
+ * Every slot carries the number of the record in it, written like a
+ * sequence lock: odd while the record is being copied in. A reader that
+ * falls more than a ring length behind simply finds its record
+ * overwritten; it never holds up the host and nothing sleeps.
+ *
+ * Record numbers are LONGs and the stamps count two per record, so a ring
+ * is good for about a billion records.
+ *
+ * Clients map a ring read-only. Large records, like images, need not be
+ * copied at all: the host can write straight into a slot with
+ * ip_RingBeginPush()/ip_RingEndPush(), and a client can look at a record
+ * where it lies with ip_RingPeek() and afterwards ask ip_RingCheck()
+ * whether the host overwrote it in the meantime.
+ *
+ */
+
+typedef struct Ring_t *Ring_handle;
+
+/*
+ * Create a ring of numRecords records of recordSize bytes each.
+ * To be run by the one process that pushes records.
+ * Returns NULL if there is an error.
+ */
+Ring_handle ip_CreateRingHost(char* name, int recordSize, int numRecords);
+
+/*
+ * Open a ring that a host has created, read-only.
+ * Returns NULL, quietly, if there is no such ring.
+ */
+Ring_handle ip_CreateRingClient(char* name);
+
+/*
+ * Close a ring. Returns IP_SUCCESS.
+ */
+int ip_CloseRing(Ring_handle r);
+
+/*
+ * Size of a record in bytes, or IP_ERROR.
+ */
+int ip_GetRingRecordSize(Ring_handle r);
+
+/*
+ * Number of records the ring holds, or IP_ERROR.
+ */
+int ip_GetRingLength(Ring_handle r);
+
+/*
+ * Number of records pushed so far, which is also the number the next
+ * record will get. Returns IP_ERROR if the ring is bad.
+ */
+int ip_GetRingHead(Ring_handle r);
+
+/*
+ * Push the next record. Host only.
+ * Returns IP_SUCCESS or IP_ERROR.
+ */
+int ip_RingPush(Ring_handle r, void *record);
+
+/*
+ * Zero copy push. Host only.
+ * ip_RingBeginPush() marks the next slot as being written and returns a
+ * pointer to its record, or NULL if there is an error. Fill it in and
+ * call ip_RingEndPush() to publish it. Returns IP_SUCCESS or IP_ERROR.
+ */
+void* ip_RingBeginPush(Ring_handle r);
+int ip_RingEndPush(Ring_handle r);
+
+/*
+ * Copy record number index into record.
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1  the record is being written right now
+ *  IP_DOES_NOT_EXIST -2  the record has not been pushed yet
+ *  IP_OVERWRITTEN -4  the record has already been overwritten
+ */
+int ip_RingRead(Ring_handle r, int index, void *record);
+
+/*
+ * Copy the most recent record into record and, if index is not NULL,
+ * its number into index. Returns the same values as ip_RingRead().
+ */
+int ip_RingReadLatest(Ring_handle r, void *record, int* index);
+
+/*
+ * Zero copy read. Returns a pointer to record number index where it lies
+ * in shared memory, or NULL if it is not there (see ip_RingCheck() for
+ * why). The host may overwrite it at any time; call ip_RingCheck() when
+ * done with it and throw away anything computed from it unless that
+ * returns IP_SUCCESS.
+ */
+const void* ip_RingPeek(Ring_handle r, int index);
+
+/*
+ * Is record number index in its slot, complete? Returns the same values
+ * as ip_RingRead().
+ */
+int ip_RingCheck(Ring_handle r, int index);
+
+
+
+/*********************
+ *
+ *  Notifiers
+ *
+ * A notifier lets the host wake client processes that wait for something
+ * to change, so they need not poll. The host creates IP_MAX_WAITERS named
+ * auto-reset events; each client claims one of them for itself and waits
+ * on it, and ip_Notify() sets them all.
+ *
+ * A client can wake once for nothing, for instance the first time it
+ * waits on an event no one was waiting on before, so it should look at
+ * what changed rather than assume.
+ *
+ */
+
+/** Most clients that can wait on one notifier at the same time **/
+#define IP_MAX_WAITERS 8
+
+typedef struct Notifier_t *Notifier_handle;
+
+/*
+ * Create a notifier. To be run on the host process.
+ * Returns NULL if there is an error.
+ */
+Notifier_handle ip_CreateNotifierHost(char* name);
+
+/*
+ * Claim a place to wait on a host's notifier.
+ * Returns NULL if there is no such notifier or all IP_MAX_WAITERS places
+ * are taken.
+ */
+Notifier_handle ip_CreateNotifierClient(char* name);
+
+/*
+ * Wake every waiting client. Host only. Never waits.
+ * Returns IP_SUCCESS or IP_ERROR.
+ */
+int ip_Notify(Notifier_handle n);
+
+/*
+ * Wait up to timeout_ms (or INFINITE) to be notified. Client only.
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1  timed out
+ */
+int ip_Wait(Notifier_handle n, int timeout_ms);
+
+/*
+ * Close a notifier and give up the client's place. Returns IP_SUCCESS.
+ */
+int ip_CloseNotifier(Notifier_handle n);
+
+
 /**************************************************************/
 /**************************************************************/
 /** PRIVATE FUNCTIONS!! DONT FORGET TO DELETE THESE.. FOR DEVEL ONLY **/
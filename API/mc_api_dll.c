@@ -6,27 +6,133 @@
  */
 
 #include <stdio.h>
+#include <string.h>
+#include <stddef.h>
 #include "InterProcess/src/interprocess.h"
 #include "mc_api_dll.h"
 
 
+/*
+ * Fast field handles, registered once per process by MC_API_StartServer()
+ * or MC_API_StartClient(). MindControl writes the server state and reads
+ * the client state, each in one piece, once per frame.
+ */
+#define MC_SERVER_STATE_FIELD "mcServerState"
+#define MC_CLIENT_STATE_FIELD "mcClientState"
+static int MC_ServerStateField = -1;
+static int MC_ClientStateField = -1;
+
+/*
+ * Wakes clients waiting in MC_API_WaitForUpdate(). The server's, or the
+ * place this client claimed the first time it waited.
+ */
+#define MC_UPDATE_NOTIFIER "mcUpdate"
+static Notifier_handle MC_Updates = NULL;
+
+/** What the server published last, to tell whether anything changed **/
+static MC_API_ServerState MC_LastServerState = { -1, -1, { 0, 0 } };
+
+/*
+ * The worm state stream, created by the server and opened by clients
+ * along with the fields.
+ */
+#define MC_WORM_STATE_RING "mcWormState"
+static Ring_handle MC_WormStateRing = NULL;
+
+/*
+ * The image streams, if MindControl broadcasts them.
+ */
+static char* MC_ImageRingNames[MC_API_NUM_IMAGE_KINDS] = { "mcImageOriginal",
+		"mcImageThreshold", "mcImageHUD" };
+static Ring_handle MC_ImageRings[MC_API_NUM_IMAGE_KINDS] = { NULL, NULL, NULL };
+static struct { int width; int height; int widthStep; } MC_ImageSizes[MC_API_NUM_IMAGE_KINDS];
+
+/*
+ * Close the worm state stream and any image streams.
+ */
+static void CloseRings(){
+	int k=0;
+	for (k = 0; k < MC_API_NUM_IMAGE_KINDS; ++k) {
+		ip_CloseRing(MC_ImageRings[k]);
+		MC_ImageRings[k]=NULL;
+	}
+	ip_CloseRing(MC_WormStateRing);
+	MC_WormStateRing=NULL;
+}
+
+/*
+ * The stream for a kind of image, or NULL.
+ */
+static Ring_handle ImageRing(int kind){
+	if (kind<0 || kind>=MC_API_NUM_IMAGE_KINDS) return NULL;
+	return MC_ImageRings[kind];
+}
+
+/*
+ * Register the fast fields.
+ * Returns MC_API_OK or MC_API_ERROR
+ */
+static int RegisterFields(SharedMemory_handle sm){
+	MC_ServerStateField=ip_RegisterField(sm,MC_SERVER_STATE_FIELD,sizeof(MC_API_ServerState));
+	MC_ClientStateField=ip_RegisterField(sm,MC_CLIENT_STATE_FIELD,sizeof(MC_API_ClientState));
+	if (MC_ServerStateField<0 || MC_ClientStateField<0) return MC_API_ERROR;
+	return MC_API_OK;
+}
+
+/*
+ * Publish the server state, and wake waiting clients if it changed.
+ * Returns MC_API_OK or MC_API_ERROR
+ */
+static int PublishServerState(SharedMemory_handle sm, MC_API_ServerState* state){
+	if (ip_Publish(sm,MC_ServerStateField,(void *) state)!=IP_SUCCESS) return MC_API_ERROR;
+	if (state->frame!=MC_LastServerState.frame || state->DLPisOn!=MC_LastServerState.DLPisOn){
+		MC_LastServerState=*state;
+		ip_Notify(MC_Updates);
+	}
+	return MC_API_OK;
+}
+
+/*
+ * Read the client state.
+ * Returns MC_API_OK or MC_API_ERROR
+ */
+static int GetClientState(SharedMemory_handle sm, MC_API_ClientState* state){
+	if (ip_Fetch(sm,MC_ClientStateField,(void *) state)!=IP_SUCCESS) return MC_API_ERROR;
+	return MC_API_OK;
+}
+
+/** Give up on changing one client value after this many collisions **/
+#define MC_UPDATE_TRIES 1000
+
+/*
+ * Set the int at offset in the client state to value, without losing what
+ * another client sets at the same time: fetch, change and publish only if
+ * nobody published in between, otherwise start over.
+ * Returns MC_API_OK or MC_API_ERROR
+ */
+static int UpdateClientState(SharedMemory_handle sm, size_t offset, int value){
+	MC_API_ClientState state;
+	int k;
+	for (k = 0; k < MC_UPDATE_TRIES; ++k) {
+		int version=ip_GetFieldVersion(sm,MC_ClientStateField);
+		if (version<0 || GetClientState(sm,&state)!=MC_API_OK) return MC_API_ERROR;
+		*(int *) ((char *) &state + offset)=value;
+		int ret=ip_PublishIfVersion(sm,MC_ClientStateField,(void *) &state,version);
+		if (ret==IP_SUCCESS) return MC_API_OK;
+		if (ret!=IP_CHANGED) return MC_API_ERROR;
+	}
+	return MC_API_ERROR;
+}
+
 /*
  * Start Server
  *
  * To Be Used Only by MindControl
  *
- * The server has some unique properties. It does not wait to acquire a mutex.
- * If it tries to access shared memory, and the memory is busy, it will simply return
- * that the memory is busy.
- *
- * The server also has no refractory period. It can read or write in sequence
- * as often as it wants. If the server reads repeatedly in a loop it oculd theoretically
- * lock out other processes from accessing the shared memory, but thats ok, because its the server.
- *
- * By default the client has a 7ms refractory period.
- * When the client reads from shared memory, the process
- * sleeps for 7ms. This ensures that a client cannot lock up the shared memory
- * A client will also wait up to 4ms to acquire a mutex lock.
+ * The server creates the shared memory and registers the fields. All of
+ * the MC_API get and set calls use InterProcess fast fields: they never
+ * wait on a mutex and never sleep, so server and clients can call them
+ * as often as they like.
  *
  *
  * Returns handle to shared memory object
@@ -43,9 +149,25 @@ SharedMemory_handle  MC_API_StartServer(){
 	/** Set Refactory Period to 0 **/
 	ip_SetSharedMemoryReadRefractoryPeriodTimeDelay(sm,0);
 
-	/* Set Laser Controller to 0 */
-	int val=0;
-	ip_WriteValue(sm,"int_laserController",(void *) &val, sizeof(int));
+	if (RegisterFields(sm)!=MC_API_OK){
+		printf("Could not register the MindControl API fields.\n");
+		ip_CloseSharedMemory(sm);
+		return NULL;
+	}
+
+	/* No frame yet and no laser controller */
+	MC_API_ServerState server={-1,0,{0,0}};
+	PublishServerState(sm,&server);
+	MC_API_ClientState client={0,MC_API_ERROR,MC_API_ERROR,0};
+	MC_API_SetClientState(sm,&client);
+
+	/* Clients can still poll if they can't wait */
+	MC_Updates=ip_CreateNotifierHost(MC_UPDATE_NOTIFIER);
+	if (MC_Updates==NULL) printf("Could not create the update notifier.\n");
+
+	/* Carry on without the stream if it can't be made; the fields still work */
+	MC_WormStateRing=ip_CreateRingHost(MC_WORM_STATE_RING,sizeof(MC_API_WormState),MC_API_WORM_STATE_LENGTH);
+	if (MC_WormStateRing==NULL) printf("Could not create the worm state stream.\n");
 	return sm;
 
 }
@@ -58,6 +180,9 @@ SharedMemory_handle  MC_API_StartServer(){
  *
  */
 int MC_API_StopServer(SharedMemory_handle sm){
+	CloseRings();
+	ip_CloseNotifier(MC_Updates);
+	MC_Updates=NULL;
 	return ip_CloseSharedMemory(sm);
 }
 
@@ -67,16 +192,32 @@ int MC_API_StopServer(SharedMemory_handle sm){
  * Returns pointer to Shared Memory handle
  * Returns NULL otherwise.
  *
- * By default the client has a 7ms refractory period.
- * When the client reads from shared memory, the process
- * sleeps for 7ms. This ensures that a client cannot lock up the shared memory
- * A client will also wait up to 4ms to acquire a mutex lock.
-
+ * The client looks up the fields once here; after that reads and writes
+ * neither wait nor sleep.
  *
  */
 
 SharedMemory_handle MC_API_StartClient(){
 	SharedMemory_handle sm = ip_CreateSharedMemoryClient("mcMem");
+	if (sm==NULL) return NULL;
+	if (RegisterFields(sm)!=MC_API_OK){
+		printf("Could not find the MindControl API fields. Is the server up to date?\n");
+		ip_CloseSharedMemory(sm);
+		return NULL;
+	}
+
+	MC_WormStateRing=ip_CreateRingClient(MC_WORM_STATE_RING);
+	if (MC_WormStateRing!=NULL && ip_GetRingRecordSize(MC_WormStateRing)!=sizeof(MC_API_WormState)){
+		printf("The worm state stream has a different layout. Is the server up to date?\n");
+		ip_CloseRing(MC_WormStateRing);
+		MC_WormStateRing=NULL;
+	}
+
+	/* Only there if MindControl was asked to broadcast them */
+	int k=0;
+	for (k = 0; k < MC_API_NUM_IMAGE_KINDS; ++k) {
+		MC_ImageRings[k]=ip_CreateRingClient(MC_ImageRingNames[k]);
+	}
 	return sm;
 
 }
@@ -87,6 +228,9 @@ SharedMemory_handle MC_API_StartClient(){
  *
  */
 int MC_API_StopClient(SharedMemory_handle sm){
+	CloseRings();
+	ip_CloseNotifier(MC_Updates);
+	MC_Updates=NULL;
 	if (ip_CloseSharedMemory(sm)!=MC_API_OK) return MC_API_ERROR;
 	return MC_API_OK;
 }
@@ -105,11 +249,10 @@ int MC_API_StopClient(SharedMemory_handle sm){
  *
  */
 int MC_API_isLaserControllerPresent(SharedMemory_handle sm){
-	int val;
-	int ret=ip_ReadValue(sm,"int_laserController",(void *) &val);
-	if (ret!=MC_API_OK) return MC_API_ERROR;
-	if (val!=MC_API_FALSE &&  val!=MC_API_TRUE) return MC_API_ERROR;
-	return val;
+	MC_API_ClientState client;
+	if (GetClientState(sm,&client)!=MC_API_OK) return MC_API_ERROR;
+	if (client.laserControllerPresent!=MC_API_FALSE &&  client.laserControllerPresent!=MC_API_TRUE) return MC_API_ERROR;
+	return client.laserControllerPresent;
 }
 
 /*
@@ -119,13 +262,7 @@ int MC_API_isLaserControllerPresent(SharedMemory_handle sm){
  *
  */
 int MC_API_RegisterLaserController(SharedMemory_handle sm){
-
-	/* Set Laser Controller to 1 */
-	int val=1;
-	int ret=ip_WriteValue(sm,"int_laserController",(void *) &val, sizeof(int));
-	if (ret!=MC_API_OK) return MC_API_ERROR;
-	return MC_API_OK;
-
+	return UpdateClientState(sm,offsetof(MC_API_ClientState,laserControllerPresent),MC_API_TRUE);
 }
 
 
@@ -136,12 +273,7 @@ int MC_API_RegisterLaserController(SharedMemory_handle sm){
  *
  */
 int MC_API_UnRegisterLaserController(SharedMemory_handle sm){
-	/* Set Laser Controller to 1 */
-	int val=0;
-	int ret=ip_WriteValue(sm,"int_laserController",(void *) &val, sizeof(int));
-	if (ret!=MC_API_OK) return MC_API_ERROR;
-	return MC_API_OK;
-
+	return UpdateClientState(sm,offsetof(MC_API_ClientState,laserControllerPresent),MC_API_FALSE);
 }
 
 
@@ -150,10 +282,7 @@ int MC_API_UnRegisterLaserController(SharedMemory_handle sm){
  *
  */
 int MC_API_SetGreenLaserPower(SharedMemory_handle sm, int power){
-
-	int ret=ip_WriteValue(sm,"int_greenLaserPower",(void *) &power, sizeof(int));
-	if (ret!=MC_API_OK) return MC_API_ERROR;
-	return MC_API_OK;
+	return UpdateClientState(sm,offsetof(MC_API_ClientState,greenLaserPower),power);
 }
 
 
@@ -161,10 +290,7 @@ int MC_API_SetGreenLaserPower(SharedMemory_handle sm, int power){
  *  Set the Laser Power, an integer value between 1 and 100
  */
 int MC_API_SetBlueLaserPower(SharedMemory_handle sm, int power){
-
-	int ret=ip_WriteValue(sm,"int_blueLaserPower",(void *) &power, sizeof(int));
-	if (ret!=MC_API_OK) return MC_API_ERROR;
-	return MC_API_OK;
+	return UpdateClientState(sm,offsetof(MC_API_ClientState,blueLaserPower),power);
 }
 
 
@@ -173,11 +299,9 @@ int MC_API_SetBlueLaserPower(SharedMemory_handle sm, int power){
  * Returns MC_API_ERROR if the value cannot be acquired.
  */
 int MC_API_GetBlueLaserPower(SharedMemory_handle sm){
-	int val=0;
-	int ret=ip_ReadValue(sm,"int_blueLaserPower",(void *) &val);
-	if (ret!=MC_API_OK) return MC_API_ERROR;
-
-	return val;
+	MC_API_ClientState client;
+	if (GetClientState(sm,&client)!=MC_API_OK) return MC_API_ERROR;
+	return client.blueLaserPower;
 }
 
 
@@ -186,10 +310,9 @@ int MC_API_GetBlueLaserPower(SharedMemory_handle sm){
  * Returns MC_API_ERROR if the value cannot be acquired.
  */
 int MC_API_GetGreenLaserPower(SharedMemory_handle sm){
-	int val=0;
-	int ret=ip_ReadValue(sm,"int_greenLaserPower",(void *) &val);
-	if (ret!=MC_API_OK) return MC_API_ERROR;
-	return val;
+	MC_API_ClientState client;
+	if (GetClientState(sm,&client)!=MC_API_OK) return MC_API_ERROR;
+	return client.greenLaserPower;
 }
 
 /** Current Frame **/
@@ -200,9 +323,10 @@ int MC_API_GetGreenLaserPower(SharedMemory_handle sm){
  *  Returns MC_API_ERROR if error.
  */
 int MC_API_SetCurrentFrame(SharedMemory_handle sm, int frame){
-	int ret=ip_WriteValue(sm,"int_currFrame",(void *) &frame, sizeof(int));
-	if (ret!=MC_API_OK) return MC_API_ERROR;
-	return MC_API_OK;
+	MC_API_ServerState server;
+	if (MC_API_GetServerState(sm,&server)!=MC_API_OK) return MC_API_ERROR;
+	server.frame=frame;
+	return PublishServerState(sm,&server);
 }
 
 
@@ -212,10 +336,9 @@ int MC_API_SetCurrentFrame(SharedMemory_handle sm, int frame){
  *  Returns MC_API_ERROR if error.
  */
 int MC_API_GetCurrentFrame(SharedMemory_handle sm){
-	int val=0;
-	int ret=ip_ReadValue(sm,"int_currFrame",(void *) &val);
-	if (ret!=MC_API_OK) return MC_API_ERROR;
-	return val;
+	MC_API_ServerState server;
+	if (MC_API_GetServerState(sm,&server)!=MC_API_OK) return MC_API_ERROR;
+	return server.frame;
 
 }
 
@@ -227,9 +350,10 @@ int MC_API_GetCurrentFrame(SharedMemory_handle sm){
  *  Returns MC_API_ERROR if error.
  */
 int MC_API_SetDLPOnOff(SharedMemory_handle sm, int isOn){
-	int ret=ip_WriteValue(sm,"int_DLPisOn",(void *) &isOn, sizeof(int));
-	if (ret!=MC_API_OK) return MC_API_ERROR;
-	return MC_API_OK;
+	MC_API_ServerState server;
+	if (MC_API_GetServerState(sm,&server)!=MC_API_OK) return MC_API_ERROR;
+	server.DLPisOn=isOn;
+	return PublishServerState(sm,&server);
 }
 
 
@@ -240,11 +364,198 @@ int MC_API_SetDLPOnOff(SharedMemory_handle sm, int isOn){
  *  Returns MC_API_ERROR if error.
  */
 int MC_API_GetDLPOnOff(SharedMemory_handle sm){
-	int val=0;
-	int ret=ip_ReadValue(sm,"int_DLPisOn",(void *) &val);
-	if (ret!=MC_API_OK) return MC_API_ERROR;
-	if (ret!=MC_API_TRUE && ret!=MC_API_FALSE) return MC_API_ERROR;
-	return val;
+	MC_API_ServerState server;
+	if (MC_API_GetServerState(sm,&server)!=MC_API_OK) return MC_API_ERROR;
+	if (server.DLPisOn!=MC_API_TRUE && server.DLPisOn!=MC_API_FALSE) return MC_API_ERROR;
+	return server.DLPisOn;
+}
+
+/************* Batched Exchange ****************/
+
+/*
+ * Once per frame: publish the server state and read the client state.
+ */
+int MC_API_ExchangeServer(SharedMemory_handle sm, MC_API_ServerState* out, MC_API_ClientState* in){
+	if (out==NULL || in==NULL) return MC_API_ERROR;
+	if (PublishServerState(sm,out)!=MC_API_OK) return MC_API_ERROR;
+	return GetClientState(sm,in);
+}
+
+/*
+ * Read everything the server publishes.
+ */
+int MC_API_GetServerState(SharedMemory_handle sm, MC_API_ServerState* state){
+	if (state==NULL) return MC_API_ERROR;
+	if (ip_Fetch(sm,MC_ServerStateField,(void *) state)!=IP_SUCCESS) return MC_API_ERROR;
+	return MC_API_OK;
+}
+
+/*
+ * Write everything the client tells the server.
+ */
+int MC_API_SetClientState(SharedMemory_handle sm, MC_API_ClientState* state){
+	if (state==NULL) return MC_API_ERROR;
+	if (ip_Publish(sm,MC_ClientStateField,(void *) state)!=IP_SUCCESS) return MC_API_ERROR;
+	return MC_API_OK;
+}
+
+/*
+ * Block until the server publishes a new frame or DLP state.
+ */
+int MC_API_WaitForUpdate(SharedMemory_handle sm, int timeout_ms, MC_API_ServerState* state){
+	if (sm==NULL) return MC_API_ERROR;
+
+	/* Claim a place to wait the first time */
+	if (MC_Updates==NULL) MC_Updates=ip_CreateNotifierClient(MC_UPDATE_NOTIFIER);
+	if (MC_Updates==NULL) return MC_API_ERROR;
+
+	int ret=ip_Wait(MC_Updates,timeout_ms);
+	if (ret==IP_BUSY) return MC_API_TIMEOUT;
+	if (ret!=IP_SUCCESS) return MC_API_ERROR;
+	if (state!=NULL) return MC_API_GetServerState(sm,state);
+	return MC_API_OK;
+}
+
+/************* Worm State Stream ****************/
+
+/*
+ * Publish the state of the current frame.
+ *  Returns MC_API_OK
+ *  Returns MC_API_ERROR if error.
+ */
+int MC_API_PublishWormState(SharedMemory_handle sm, MC_API_WormState* ws){
+	if (sm==NULL || ws==NULL) return MC_API_ERROR;
+	if (ip_RingPush(MC_WormStateRing,(void *) ws)!=IP_SUCCESS) return MC_API_ERROR;
+	return MC_API_OK;
+}
+
+/*
+ * Get the most recent worm state.
+ */
+int MC_API_GetLatestWormState(SharedMemory_handle sm, MC_API_WormState* ws){
+	if (sm==NULL || ws==NULL) return MC_API_ERROR;
+	int ret=ip_RingReadLatest(MC_WormStateRing,(void *) ws,NULL);
+	if (ret==IP_SUCCESS) return MC_API_OK;
+	if (ret==IP_DOES_NOT_EXIST) return MC_API_NOTHING_NEW;
+	return MC_API_ERROR;
+}
+
+/*
+ * Read the record at *cursor and move the cursor on.
+ * Returns the number of records skipped, MC_API_NOTHING_NEW or MC_API_ERROR
+ */
+int MC_API_GetNextWormState(SharedMemory_handle sm, int* cursor, MC_API_WormState* ws){
+	if (sm==NULL || cursor==NULL || ws==NULL || *cursor<0) return MC_API_ERROR;
+	int skipped=0;
+	int k=0;
+	for (k = 0; k < 2; ++k) {
+		int ret=ip_RingRead(MC_WormStateRing,*cursor,(void *) ws);
+		if (ret==IP_SUCCESS){
+			(*cursor)++;
+			return skipped;
+		}
+		if (ret==IP_DOES_NOT_EXIST || ret==IP_BUSY) return MC_API_NOTHING_NEW;
+		if (ret!=IP_OVERWRITTEN) return MC_API_ERROR;
+
+		/* Fell behind: jump to the oldest record the server won't overwrite right away */
+		int oldest=ip_GetRingHead(MC_WormStateRing) - MC_API_WORM_STATE_LENGTH/2;
+		if (oldest<=*cursor) oldest=*cursor+1;
+		skipped+=oldest-*cursor;
+		*cursor=oldest;
+	}
+	return MC_API_ERROR;
+}
+
+/*
+ * Number of records published so far.
+ */
+int MC_API_GetWormStateHead(SharedMemory_handle sm){
+	if (sm==NULL) return MC_API_ERROR;
+	int head=ip_GetRingHead(MC_WormStateRing);
+	if (head<0) return MC_API_ERROR;
+	return head;
+}
+
+/************* Image Streams ****************/
+
+/*
+ * Create the stream for one kind of image.
+ */
+int MC_API_StartImageStream(SharedMemory_handle sm, int kind, int width, int height){
+	if (sm==NULL || kind<0 || kind>=MC_API_NUM_IMAGE_KINDS || width<1 || height<1) return MC_API_ERROR;
+	if (MC_ImageRings[kind]!=NULL) return MC_API_ERROR;
+
+	/* Rows start on 4 byte boundaries, as in an IplImage */
+	int widthStep=(width+3) & ~3;
+	MC_ImageRings[kind]=ip_CreateRingHost(MC_ImageRingNames[kind],sizeof(MC_API_Image)+widthStep*height,MC_API_IMAGE_STREAM_LENGTH);
+	if (MC_ImageRings[kind]==NULL) return MC_API_ERROR;
+
+	MC_ImageSizes[kind].width=width;
+	MC_ImageSizes[kind].height=height;
+	MC_ImageSizes[kind].widthStep=widthStep;
+	return MC_API_OK;
+}
+
+/*
+ * Start publishing an image in place.
+ */
+MC_API_Image* MC_API_BeginImage(SharedMemory_handle sm, int kind){
+	if (sm==NULL) return NULL;
+	MC_API_Image* img=(MC_API_Image*) ip_RingBeginPush(ImageRing(kind));
+	if (img==NULL) return NULL;
+	memset(img,0,sizeof(MC_API_Image));
+	img->kind=kind;
+	img->width=MC_ImageSizes[kind].width;
+	img->height=MC_ImageSizes[kind].height;
+	img->widthStep=MC_ImageSizes[kind].widthStep;
+	return img;
+}
+
+/*
+ * Finish publishing an image.
+ */
+int MC_API_EndImage(SharedMemory_handle sm, int kind){
+	if (sm==NULL) return MC_API_ERROR;
+	if (ip_RingEndPush(ImageRing(kind))!=IP_SUCCESS) return MC_API_ERROR;
+	return MC_API_OK;
+}
+
+int MC_API_isImageStreamPresent(SharedMemory_handle sm, int kind){
+	if (sm==NULL || ImageRing(kind)==NULL) return MC_API_FALSE;
+	return MC_API_TRUE;
+}
+
+/*
+ * Look at the newest image in place.
+ */
+const MC_API_Image* MC_API_PeekLatestImage(SharedMemory_handle sm, int kind, int* index){
+	if (sm==NULL || index==NULL) return NULL;
+	int latest=ip_GetRingHead(ImageRing(kind))-1;
+	if (latest<0) return NULL;
+	const MC_API_Image* img=(const MC_API_Image*) ip_RingPeek(ImageRing(kind),latest);
+	if (img!=NULL) *index=latest;
+	return img;
+}
+
+/*
+ * Look at image number index in place.
+ */
+const MC_API_Image* MC_API_PeekImage(SharedMemory_handle sm, int kind, int index){
+	if (sm==NULL) return NULL;
+	return (const MC_API_Image*) ip_RingPeek(ImageRing(kind),index);
+}
+
+int MC_API_ImageIsIntact(SharedMemory_handle sm, int kind, int index){
+	if (sm==NULL) return MC_API_FALSE;
+	if (ip_RingCheck(ImageRing(kind),index)!=IP_SUCCESS) return MC_API_FALSE;
+	return MC_API_TRUE;
+}
+
+int MC_API_GetImageHead(SharedMemory_handle sm, int kind){
+	if (sm==NULL) return MC_API_ERROR;
+	int head=ip_GetRingHead(ImageRing(kind));
+	if (head<0) return MC_API_ERROR;
+	return head;
 }
 
 /*
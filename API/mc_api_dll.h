@@ -30,6 +30,43 @@ extern "C" {
 #define MC_API_TRUE 1
 #define MC_API_FALSE 0
 
+/** No record newer than the one asked for has been published yet **/
+#define MC_API_NOTHING_NEW -2
+
+/** Nothing happened before the time was up **/
+#define MC_API_TIMEOUT -3
+
+/** Records in the worm state stream. At 100 fps this is about 10 s **/
+#define MC_API_WORM_STATE_LENGTH 1024
+
+/** Kinds of image MindControl can broadcast **/
+#define MC_API_IMAGE_ORIGINAL 0
+#define MC_API_IMAGE_THRESHOLD 1
+#define MC_API_IMAGE_HUD 2
+#define MC_API_NUM_IMAGE_KINDS 3
+
+/** Images kept in each image stream **/
+#define MC_API_IMAGE_STREAM_LENGTH 8
+
+/*
+ * Everything MindControl tells clients every frame, in one piece.
+ */
+typedef struct MC_API_ServerStateStruct {
+	int frame; /* -1 before the first frame */
+	int DLPisOn;
+	int reserved[2];
+} MC_API_ServerState;
+
+/*
+ * Everything clients tell MindControl, in one piece.
+ */
+typedef struct MC_API_ClientStateStruct {
+	int laserControllerPresent;
+	int greenLaserPower; /* 1 to 100, or MC_API_ERROR if never set */
+	int blueLaserPower;
+	int reserved;
+} MC_API_ClientState;
+
 /*
  * This is the SharedMemory object from interprocess.h
 
@@ -48,18 +85,10 @@ int MC_API_PingServer(SharedMemory_handle sm);
  *
  * To Be Used Only by MindControl
  *
- * The server has some unique properties. It does not wait to acquire a mutex.
- * If it tries to access shared memory, and the memory is busy, it will simply return
- * that the memory is busy.
- *
- * The server also has no refractory period. It can read or write in sequence
- * as often as it wants. If the server reads repeatedly in a loop it oculd theoretically
- * lock out other processes from accessing the shared memory, but thats ok, because its the server.
- *
- * By default the client has a 7ms refractory period.
- * When the client reads from shared memory, the process
- * sleeps for 7ms. This ensures that a client cannot lock up the shared memory
- * A client will also wait up to 4ms to acquire a mutex lock.
+ * The server creates the shared memory and registers the fields. All of
+ * the MC_API get and set calls use InterProcess fast fields: they never
+ * wait on a mutex and never sleep, so server and clients can call them
+ * as often as they like.
  *
  *
  * Returns handle to shared memory object
@@ -83,10 +112,9 @@ int MC_API_StopServer(SharedMemory_handle sm);
  * Returns pointer to Shared Memory handle
  * Returns NULL otherwise.
  *
- * By default the client has a 7ms refractory period.
- * When the client reads from shared memory, the process
- * sleeps for 7ms. This ensures that a client cannot lock up the shared memory
- * A client will also wait up to 4ms to acquire a mutex lock.
+ * The client looks up the fields once here; after that reads and writes
+ * neither wait nor sleep. The server must be built with the same
+ * InterProcess library.
  *
  */
 SharedMemory_handle MC_API_StartClient();
@@ -171,6 +199,209 @@ int MC_API_SetDLPOnOff(SharedMemory_handle sm, int isOn);
 int MC_API_GetDLPOnOff(SharedMemory_handle sm);
 
 
+/*************  Batched Exchange ****************/
+
+/*
+ * Once per frame, publish everything MindControl tells clients and read
+ * everything they tell it: one lock free write and one lock free read.
+ * Wakes clients in MC_API_WaitForUpdate() if the frame or the DLP state
+ * changed.
+ * To Be Used Only by MindControl
+ *  Returns MC_API_OK
+ *  Returns MC_API_ERROR if error.
+ */
+int MC_API_ExchangeServer(SharedMemory_handle sm, MC_API_ServerState* out, MC_API_ClientState* in);
+
+/*
+ * Read everything MindControl publishes at once.
+ *  Returns MC_API_OK
+ *  Returns MC_API_ERROR if error.
+ */
+int MC_API_GetServerState(SharedMemory_handle sm, MC_API_ServerState* state);
+
+/*
+ * Write everything a client tells MindControl at once.
+ *
+ * This replaces all of it, including values other clients set. The single
+ * value setters above only change their own value, and never lose what
+ * another client sets at the same time.
+ *  Returns MC_API_OK
+ *  Returns MC_API_ERROR if error.
+ */
+int MC_API_SetClientState(SharedMemory_handle sm, MC_API_ClientState* state);
+
+/*
+ * Block until MindControl publishes a new frame or a new DLP state,
+ * instead of polling, and then read the server state into state (which
+ * may be NULL). timeout_ms may be INFINITE.
+ *
+ * Up to 8 clients can wait at the same time. A client may wake now and
+ * then with nothing new; compare the frame with the last one seen.
+ *  Returns MC_API_OK
+ *  Returns MC_API_TIMEOUT if nothing changed in time
+ *  Returns MC_API_ERROR if error.
+ */
+int MC_API_WaitForUpdate(SharedMemory_handle sm, int timeout_ms, MC_API_ServerState* state);
+
+
+/*************  Worm State Stream ****************/
+
+/*
+ * One record per frame, published by MindControl after the frame has
+ * been segmented and its illumination sent.
+ *
+ * The layout is fixed (little endian, doubles first, no padding) so that
+ * programs that do not use this header, like bin/annotate.py, can read it.
+ * Times are in ms on MindControl's QueryPerformanceCounter clock.
+ * Positions are in camera pixels; -1 if unknown.
+ */
+typedef struct MC_API_WormStateStruct {
+	double captureTime; /* when the camera captured the frame */
+	double publishTime; /* when this record was published */
+	double velocityX; /* worm velocity in pixels per ms, from the pose predictor */
+	double velocityY;
+	int frame;
+	int isPresent; /* 1 if the worm was found in this frame */
+	int centroidX;
+	int centroidY;
+	int headX;
+	int headY;
+	int tailX;
+	int tailY;
+	int stageKnown; /* 1 if stageX/stageY were measured for this frame */
+	int stageX; /* stage units */
+	int stageY;
+	int stageVelX; /* velocity last commanded to the stage, stage units */
+	int stageVelY;
+	int DLPisOn;
+	int protocolStep; /* -1 if no protocol is in use */
+	int reserved;
+} MC_API_WormState;
+
+/*
+ * Publish the state of the current frame.
+ * To Be Used Only by MindControl
+ *  Returns MC_API_OK
+ *  Returns MC_API_ERROR if error.
+ */
+int MC_API_PublishWormState(SharedMemory_handle sm, MC_API_WormState* ws);
+
+/*
+ * Get the most recent worm state.
+ *  Returns MC_API_OK
+ *  Returns MC_API_NOTHING_NEW if nothing has been published yet
+ *  Returns MC_API_ERROR if error.
+ */
+int MC_API_GetLatestWormState(SharedMemory_handle sm, MC_API_WormState* ws);
+
+/*
+ * Follow the worm state stream frame by frame.
+ *
+ * cursor is the number of the next record to read; start it at 0 to get
+ * everything still in the stream, or at MC_API_GetWormStateHead() to get
+ * only what comes next. On success the record is copied into ws and the
+ * cursor moves on by one.
+ *
+ * A reader that falls more than MC_API_WORM_STATE_LENGTH records behind
+ * loses the oldest ones; the cursor then skips ahead, to half a stream
+ * behind the newest record, so the reader has a chance to catch up.
+ *
+ *  Returns the number of records skipped (normally 0)
+ *  Returns MC_API_NOTHING_NEW if there is no new record yet
+ *  Returns MC_API_ERROR if error.
+ */
+int MC_API_GetNextWormState(SharedMemory_handle sm, int* cursor, MC_API_WormState* ws);
+
+/*
+ * Number of records published so far, or MC_API_ERROR.
+ */
+int MC_API_GetWormStateHead(SharedMemory_handle sm);
+
+
+/*************  Image Streams ****************/
+
+/*
+ * MindControl can broadcast the camera image, the thresholded image and
+ * the heads up display, each in its own stream of the last
+ * MC_API_IMAGE_STREAM_LENGTH frames. The streams are optional; see the -b
+ * switch. Images are 8 bit grayscale, rows widthStep bytes apart, and
+ * the pixels follow the MC_API_Image header directly.
+ *
+ * Clients look at images where they lie in shared memory, read-only,
+ * without copying them, and MindControl never waits for a client. So a
+ * client must check that the image it looked at was not overwritten
+ * while it was looking:
+ *
+ *	int index;
+ *	const MC_API_Image* img=MC_API_PeekLatestImage(sm,MC_API_IMAGE_ORIGINAL,&index);
+ *	if (img!=NULL) {
+ *		... analyze MC_API_ImagePixels(img) ...
+ *		if (MC_API_ImageIsIntact(sm,MC_API_IMAGE_ORIGINAL,index)) ... keep the result ...
+ *	}
+ */
+typedef struct MC_API_ImageStruct {
+	double captureTime; /* ms, when the camera captured the frame */
+	double publishTime; /* ms, when the image was published */
+	int frame;
+	int kind; /* MC_API_IMAGE_ORIGINAL etc. */
+	int width;
+	int height;
+	int widthStep; /* bytes from one row to the next */
+	int reserved[3];
+} MC_API_Image;
+
+/** The pixels of an image **/
+#define MC_API_ImagePixels(img) ((unsigned char*) ((img) + 1))
+
+/*
+ * Create the stream for one kind of image.
+ * To Be Used Only by MindControl
+ *  Returns MC_API_OK
+ *  Returns MC_API_ERROR if error.
+ */
+int MC_API_StartImageStream(SharedMemory_handle sm, int kind, int width, int height);
+
+/*
+ * Publish an image without copying it twice.
+ * To Be Used Only by MindControl
+ *
+ * MC_API_BeginImage() returns the next slot of the stream, with kind,
+ * width, height and widthStep filled in, or NULL if the stream was not
+ * started. Fill in the rest and the pixels, then MC_API_EndImage().
+ */
+MC_API_Image* MC_API_BeginImage(SharedMemory_handle sm, int kind);
+int MC_API_EndImage(SharedMemory_handle sm, int kind);
+
+/*
+ * Is MindControl broadcasting this kind of image?
+ * Returns MC_API_TRUE or MC_API_FALSE
+ */
+int MC_API_isImageStreamPresent(SharedMemory_handle sm, int kind);
+
+/*
+ * Look at the newest image in place. Its number goes in index.
+ * Returns NULL if there is none.
+ */
+const MC_API_Image* MC_API_PeekLatestImage(SharedMemory_handle sm, int kind, int* index);
+
+/*
+ * Look at image number index in place.
+ * Returns NULL if it has not been published yet or is already overwritten.
+ */
+const MC_API_Image* MC_API_PeekImage(SharedMemory_handle sm, int kind, int index);
+
+/*
+ * After looking at an image: was it left alone the whole time?
+ * Returns MC_API_TRUE or MC_API_FALSE
+ */
+int MC_API_ImageIsIntact(SharedMemory_handle sm, int kind, int index);
+
+/*
+ * Number of images of this kind published so far, or MC_API_ERROR.
+ */
+int MC_API_GetImageHead(SharedMemory_handle sm, int kind);
+
+
 
 
 
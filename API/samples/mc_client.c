@@ -41,6 +41,25 @@ int main(){
 		int dlp=MC_API_GetDLPOnOff(sm);
 		printf("DLP is %d\n",dlp);
 	}
+
+	/** Follow the next few frames without polling **/
+	printf("Waiting for the next %d frames..\n",max);
+	MC_API_ServerState state;
+	int last=-1;
+	k=0;
+	while (k<max) {
+		int ret=MC_API_WaitForUpdate(sm,1000,&state);
+		if (ret==MC_API_TIMEOUT) {
+			printf("No new frame in 1s. Is MindControl running?\n");
+			break;
+		}
+		if (ret!=MC_API_OK) break;
+		if (state.frame==last) continue;
+		last=state.frame;
+		printf("Frame %d, DLP is %d\n",state.frame,state.DLPisOn);
+		k++;
+	}
+
 	MC_API_UnRegisterLaserController(sm);
 	printf("Stopping client.. %d\n",MC_API_StopClient(sm));
 	printf("Goodbye!");
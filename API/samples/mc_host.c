@@ -7,6 +7,7 @@
 
 #include <conio.h>
 #include <stdio.h>
+#include <windows.h>
 
 #include "../mc_api_dll.h"
 
@@ -37,6 +38,23 @@ int main(){
 
 	}
 
+	/** Now run like MindControl does: one exchange per frame **/
+	printf("Hit enter to publish %d frames in a row\n",max);
+	getch();
+	MC_API_ServerState out;
+	MC_API_ClientState in;
+	out.reserved[0]=out.reserved[1]=0;
+	for (k = 0; k < max; ++k) {
+		out.frame=max+k;
+		out.DLPisOn=k%2;
+		if (MC_API_ExchangeServer(sm,&out,&in)==MC_API_OK && in.laserControllerPresent==MC_API_TRUE){
+			printf("Frame %d. Power is Green %d, Blue %d\n",out.frame,in.greenLaserPower,in.blueLaserPower);
+		} else {
+			printf("Frame %d.\n",out.frame);
+		}
+		Sleep(100);
+	}
+
 	printf("Stopping server.. %d\n",MC_API_StopServer(sm));
 	printf("Goodbye!");
 
@@ -44,6 +44,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include "AndysOpenCVLib.h"
+#include "PackedPattern.h"
 #include <limits.h>
 
 #include "opencv2/imgproc/imgproc_c.h"
@@ -1172,8 +1173,9 @@ CvPoint FindNearestPt(CvPoint CenterLinePt,CvSeq* Boundary){
 	CvSeqReader reader;
 	cvStartReadSeq(Boundary, &reader, 0);
 	CvPoint* CurrPoint; //The current point we are considering
-	CvPoint* ClosestPoint=(CvPoint*) reader.ptr; //The previous closest point (which we initalize here)
-	int shortestDist =sqDist(CenterLinePt,*ClosestPoint); //The Previous shortest distance (which we initalize herE)
+	/** Keep a local copy. Writing through a pointer into the sequence would overwrite the first boundary point **/
+	CvPoint ClosestPoint=*((CvPoint*) reader.ptr); //The previous closest point (which we initalize here)
+	int shortestDist =sqDist(CenterLinePt,ClosestPoint); //The Previous shortest distance (which we initalize herE)
 	int currDist;
 	for (int i=0;i<Boundary->total;i++){
 		CurrPoint =(CvPoint*) reader.ptr;
@@ -1182,13 +1184,13 @@ CvPoint FindNearestPt(CvPoint CenterLinePt,CvSeq* Boundary){
 			//Update the shortest distance
 			shortestDist=currDist;
 			//Copy the contents from CurrPoint to Closest Point;
-			*ClosestPoint = *CurrPoint;
+			ClosestPoint = *CurrPoint;
 
 		}
 		//Move up a point along the boundary
 		CV_NEXT_SEQ_ELEM(sizeof(CvPoint),reader);
 	}
-	return *ClosestPoint;
+	return ClosestPoint;
 }
 
 
@@ -1197,7 +1199,7 @@ CvPoint FindNearestPt(CvPoint CenterLinePt,CvSeq* Boundary){
  * to the specified point.
  */
 CvPoint FindNormalPt(CvPoint* Centerline, CvPoint* CenterVec, CvSeq* Contour){
-	CvPoint* VecToTarget;
+	CvPoint VecToTarget;
 	CvPoint* Target;
 	CvPoint BestTarget;
 	int DotProd;
@@ -1207,14 +1209,15 @@ CvPoint FindNormalPt(CvPoint* Centerline, CvPoint* CenterVec, CvSeq* Contour){
 
 	//Make one iteration before the Loop
 	Target=(CvPoint*) reader.ptr;
-	*VecToTarget=cvPoint(Target->x-Centerline->x,Target->y-Centerline->y );
-	LowestDotProd=PointDot(CenterVec,VecToTarget);
+	VecToTarget=cvPoint(Target->x-Centerline->x,Target->y-Centerline->y );
+	LowestDotProd=PointDot(CenterVec,&VecToTarget);
+	BestTarget=*Target;
 
 
 	for (int i=0;i<Contour->total;i++){
 		Target=(CvPoint*) reader.ptr;
-		*VecToTarget=cvPoint(Target->x-Centerline->x,Target->y-Centerline->y );
-		DotProd=PointDot(CenterVec,VecToTarget);
+		VecToTarget=cvPoint(Target->x-Centerline->x,Target->y-Centerline->y );
+		DotProd=PointDot(CenterVec,&VecToTarget);
 		if (DotProd<=LowestDotProd){
 			//Update the Lowest Dot product
 			LowestDotProd=DotProd;
@@ -1232,13 +1235,533 @@ CvPoint FindNormalPt(CvPoint* Centerline, CvPoint* CenterVec, CvSeq* Contour){
 
 
 
+/***************************************************************
+ * Boundary Grid
+ ***************************************************************
+ */
+
+/*
+ * Integer division that rounds toward negative infinity,
+ * so that points left of or above the grid origin land in negative cells.
+ */
+static int BGridFloorDiv(int a, int b){
+	if (a>=0) return a/b;
+	return -((-a+b-1)/b);
+}
+
+/*
+ * Allocate an empty boundary grid with cells of CellSize x CellSize pixels.
+ * Returns NULL on error.
+ * Don't forget to call DestroyBoundaryGrid()
+ */
+BoundaryGrid* CreateBoundaryGrid(int CellSize){
+	if (CellSize<1){
+		printf("Error! CellSize must be at least one pixel in CreateBoundaryGrid()\n");
+		return NULL;
+	}
+	BoundaryGrid* Grid=(BoundaryGrid*) malloc(sizeof(BoundaryGrid));
+	if (Grid==NULL) return NULL;
+	Grid->CellSize=CellSize;
+	Grid->Origin=cvPoint(0,0);
+	Grid->NumCols=0;
+	Grid->NumRows=0;
+	Grid->CellStart=NULL;
+	Grid->Pts=NULL;
+	Grid->Ind=NULL;
+	Grid->OrigPts=NULL;
+	Grid->MaxStep=0;
+	Grid->NumPts=0;
+	Grid->PtCapacity=0;
+	Grid->CellCapacity=0;
+	return Grid;
+}
+
+/*
+ * Deallocate a boundary grid and set the pointer to NULL.
+ */
+void DestroyBoundaryGrid(BoundaryGrid** Grid){
+	if (Grid==NULL || *Grid==NULL) return;
+	free((*Grid)->CellStart);
+	free((*Grid)->Pts);
+	free((*Grid)->Ind);
+	free((*Grid)->OrigPts);
+	free(*Grid);
+	*Grid=NULL;
+}
+
+/*
+ * Bucket the points of Boundary (a CvSeq of CvPoint) into the grid.
+ * Any previous contents of the grid are discarded. Memory is only
+ * reallocated when the boundary or its bounding box outgrow the grid.
+ *
+ * The sequence is read once; the bucketing itself is a counting sort
+ * over the local copy of the points.
+ *
+ * Returns A_OK or A_ERROR.
+ */
+int LoadBoundaryGrid(BoundaryGrid* Grid, const CvSeq* Boundary){
+	if (Grid==NULL) return A_ERROR;
+	Grid->NumPts=0;
+	Grid->NumCols=0;
+	Grid->NumRows=0;
+	Grid->MaxStep=0;
+	if (Boundary==NULL || Boundary->total<1){
+		printf("Error! No boundary passed to LoadBoundaryGrid()\n");
+		return A_ERROR;
+	}
+
+	int N=Boundary->total;
+
+	/** Grow the point buffers if necessary **/
+	if (N > Grid->PtCapacity){
+		free(Grid->Pts);
+		free(Grid->Ind);
+		free(Grid->OrigPts);
+		Grid->Pts=(CvPoint*) malloc(N*sizeof(CvPoint));
+		Grid->Ind=(int*) malloc(N*sizeof(int));
+		Grid->OrigPts=(CvPoint*) malloc(N*sizeof(CvPoint));
+		if (Grid->Pts==NULL || Grid->Ind==NULL || Grid->OrigPts==NULL){
+			printf("Error! Out of memory in LoadBoundaryGrid()\n");
+			Grid->PtCapacity=0;
+			return A_ERROR;
+		}
+		Grid->PtCapacity=N;
+	}
+
+	/** Single pass over the sequence: copy out the points and find the bounding box **/
+	CvSeqReader reader;
+	cvStartReadSeq(Boundary, &reader, 0);
+	CvPoint* CurrPt=(CvPoint*) reader.ptr;
+	int minx=CurrPt->x, maxx=CurrPt->x, miny=CurrPt->y, maxy=CurrPt->y;
+	int maxStep2=0, step2;
+	for (int i=0; i<N; i++){
+		CurrPt=(CvPoint*) reader.ptr;
+		Grid->OrigPts[i]=*CurrPt;
+		if (i>0){
+			step2=sqDist(Grid->OrigPts[i-1],*CurrPt);
+			if (step2>maxStep2) maxStep2=step2;
+		}
+		if (CurrPt->x < minx) minx=CurrPt->x;
+		if (CurrPt->x > maxx) maxx=CurrPt->x;
+		if (CurrPt->y < miny) miny=CurrPt->y;
+		if (CurrPt->y > maxy) maxy=CurrPt->y;
+		CV_NEXT_SEQ_ELEM(sizeof(CvPoint),reader);
+	}
+	Grid->MaxStep=sqrt((double) maxStep2);
+
+	int cs=Grid->CellSize;
+	Grid->Origin=cvPoint(minx,miny);
+	Grid->NumCols=(maxx-minx)/cs+1;
+	Grid->NumRows=(maxy-miny)/cs+1;
+	int NumCells=Grid->NumCols*Grid->NumRows;
+
+	/** Grow the cell table if necessary **/
+	if (NumCells+1 > Grid->CellCapacity){
+		free(Grid->CellStart);
+		Grid->CellStart=(int*) malloc((NumCells+1)*sizeof(int));
+		if (Grid->CellStart==NULL){
+			printf("Error! Out of memory in LoadBoundaryGrid()\n");
+			Grid->CellCapacity=0;
+			Grid->NumCols=0;
+			Grid->NumRows=0;
+			return A_ERROR;
+		}
+		Grid->CellCapacity=NumCells+1;
+	}
+	memset(Grid->CellStart,0,(NumCells+1)*sizeof(int));
+
+	/** Count the points in each cell (stored one cell over) **/
+	int c;
+	for (int i=0; i<N; i++){
+		c=((Grid->OrigPts[i].y-miny)/cs)*Grid->NumCols+(Grid->OrigPts[i].x-minx)/cs;
+		Grid->CellStart[c+1]++;
+	}
+
+	/** Cumulative sum gives the first slot of each cell **/
+	for (c=0; c<NumCells; c++) Grid->CellStart[c+1]+=Grid->CellStart[c];
+
+	/** Scatter the points into their cells, using CellStart[] as the write cursor **/
+	int slot;
+	for (int i=0; i<N; i++){
+		c=((Grid->OrigPts[i].y-miny)/cs)*Grid->NumCols+(Grid->OrigPts[i].x-minx)/cs;
+		slot=Grid->CellStart[c]++;
+		Grid->Pts[slot]=Grid->OrigPts[i];
+		Grid->Ind[slot]=i;
+	}
+
+	/** The cursors now point at the start of the next cell, so shift them back by one **/
+	for (c=NumCells; c>0; c--) Grid->CellStart[c]=Grid->CellStart[c-1];
+	Grid->CellStart[0]=0;
+
+	Grid->NumPts=N;
+	return A_OK;
+}
+
+/*
+ * Returns the index along the boundary of the boundary point closest to pt.
+ * Cells are searched in rings of increasing radius around pt until no
+ * unsearched cell could hold a closer point.
+ *
+ * Like FindNearestPt(), ties go to the point furthest along the boundary.
+ *
+ * Returns -1 if the grid is empty.
+ */
+int FindNearestPtIndGrid(const BoundaryGrid* Grid, CvPoint pt){
+	if (Grid==NULL || Grid->NumPts<1) return -1;
+
+	int cs=Grid->CellSize;
+	int cx=BGridFloorDiv(pt.x-Grid->Origin.x,cs);
+	int cy=BGridFloorDiv(pt.y-Grid->Origin.y,cs);
+
+	/** The ring beyond which there are no more cells **/
+	int maxRing=0;
+	if (cx > maxRing) maxRing=cx;
+	if (Grid->NumCols-1-cx > maxRing) maxRing=Grid->NumCols-1-cx;
+	if (cy > maxRing) maxRing=cy;
+	if (Grid->NumRows-1-cy > maxRing) maxRing=Grid->NumRows-1-cy;
+
+	int bestDist=INT_MAX;
+	int bestInd=-1;
+	int d, k, x, y, xstep, reach;
+
+	for (int r=0; r<=maxRing; r++){
+		/** Every point in ring r is at least (r-1)*cs away from pt **/
+		reach=(r-1)*cs;
+		if (reach>0 && bestInd>=0 && reach*reach > bestDist) break;
+
+		for (y=cy-r; y<=cy+r; y++){
+			if (y<0 || y>=Grid->NumRows) continue;
+			/** On the top and bottom edge of the ring visit every cell, otherwise only the two sides **/
+			xstep= (y==cy-r || y==cy+r || r==0) ? 1 : 2*r;
+			for (x=cx-r; x<=cx+r; x+=xstep){
+				if (x<0 || x>=Grid->NumCols) continue;
+				int cell=y*Grid->NumCols+x;
+				for (k=Grid->CellStart[cell]; k<Grid->CellStart[cell+1]; k++){
+					d=sqDist(pt,Grid->Pts[k]);
+					/** Break ties on the boundary index, as FindNearestPt() does, so that the result does not depend on bucket order **/
+					if (d<bestDist || (d==bestDist && Grid->Ind[k]>bestInd)){
+						bestDist=d;
+						bestInd=Grid->Ind[k];
+					}
+				}
+			}
+		}
+	}
+	return bestInd;
+}
+
+/*
+ * Grid equivalent of FindNearestPt().
+ * Returns the coordinates of the point on the boundary closest to pt.
+ */
+CvPoint FindNearestPtGrid(const BoundaryGrid* Grid, CvPoint pt){
+	int ind=FindNearestPtIndGrid(Grid,pt);
+	if (ind<0) return pt;
+	return Grid->OrigPts[ind];
+}
+
+/*
+ * Grid equivalent of FindPerpPoint().
+ *
+ * Finds the index k in [startInd, endInd) of the boundary point that minimizes
+ * abs(dot(a(k)-x, t)), i.e. the point closest to the line through x perpendicular to t.
+ * Only points within SearchRadius pixels of x are considered. Cells that straddle
+ * the perpendicular line are visited first, and every other cell is skipped as soon as
+ * it cannot beat the best point found so far. Like FindPerpPoint(), ties go to the
+ * lowest index, so if every point of [startInd, endInd) lies within SearchRadius of x
+ * the answer is exactly that of FindPerpPoint().
+ *
+ * Returns -1 if no boundary point in [startInd, endInd) lies within SearchRadius of x.
+ */
+int FindPerpPointGrid(CvPoint x, CvPoint t, const BoundaryGrid* Grid, int startInd, int endInd, int SearchRadius){
+	if (Grid==NULL || Grid->NumPts<1) return -1;
+	if (startInd<0) startInd=0;
+	if (endInd>Grid->NumPts) endInd=Grid->NumPts;
+	if (SearchRadius<0) SearchRadius=0;
+
+	int cs=Grid->CellSize;
+	int R2=SearchRadius*SearchRadius;
+
+	/** Cells that overlap the bounding box of the search circle **/
+	int x0=BGridFloorDiv(x.x-SearchRadius-Grid->Origin.x,cs);
+	int x1=BGridFloorDiv(x.x+SearchRadius-Grid->Origin.x,cs);
+	int y0=BGridFloorDiv(x.y-SearchRadius-Grid->Origin.y,cs);
+	int y1=BGridFloorDiv(x.y+SearchRadius-Grid->Origin.y,cs);
+	if (x0<0) x0=0;
+	if (y0<0) y0=0;
+	if (x1>Grid->NumCols-1) x1=Grid->NumCols-1;
+	if (y1>Grid->NumRows-1) y1=Grid->NumRows-1;
+
+	/** Half the diagonal of a cell, scaled by |t|, bounds how much closer to the line a point can be than its cell center **/
+	double tnorm=sqrt((double) t.x*t.x + (double) t.y*t.y);
+	double slack=0.5*sqrt(2.0)*cs*tnorm;
+
+	int bestadp=INT_MAX;
+	int bestInd=-1;
+	int trialadp, d, k;
+
+	/** Pass 0 visits cells straddling the perpendicular line, pass 1 visits the rest **/
+	for (int pass=0; pass<2; pass++){
+		for (int cy=y0; cy<=y1; cy++){
+			for (int cx=x0; cx<=x1; cx++){
+				double centx=Grid->Origin.x+cx*cs+0.5*(cs-1)-x.x;
+				double centy=Grid->Origin.y+cy*cs+0.5*(cs-1)-x.y;
+				double centadp=fabs(centx*t.x+centy*t.y);
+				int straddles=(centadp<=slack);
+				if (straddles != (pass==0)) continue;
+				if (pass==1 && centadp-slack > (double) bestadp) continue;
+
+				int cell=cy*Grid->NumCols+cx;
+				for (k=Grid->CellStart[cell]; k<Grid->CellStart[cell+1]; k++){
+					if (Grid->Ind[k]<startInd || Grid->Ind[k]>=endInd) continue;
+					d=sqDist(x,Grid->Pts[k]);
+					if (d>R2) continue;
+					trialadp=(Grid->Pts[k].x-x.x)*t.x+(Grid->Pts[k].y-x.y)*t.y;
+					trialadp= trialadp < 0 ? -trialadp : trialadp;
+					if (trialadp<bestadp || (trialadp==bestadp && Grid->Ind[k]<bestInd)){
+						bestadp=trialadp;
+						bestInd=Grid->Ind[k];
+					}
+				}
+			}
+		}
+	}
+	return bestInd;
+}
+
+/*
+ * Given a point on the centerline and the centerline's tangent vector there,
+ * returns the boundary point within SearchRadius that lies closest to the
+ * normal of the centerline at that point.
+ *
+ * Note this is not a drop in replacement for FindNormalPt(), which returns
+ * the point with the lowest signed dot product rather than the one closest
+ * to the normal.
+ *
+ * If no such point is found, the nearest boundary point is returned.
+ */
+CvPoint FindNormalPtGrid(CvPoint* Centerline, CvPoint* CenterVec, const BoundaryGrid* Grid, int SearchRadius){
+	int ind=FindPerpPointGrid(*Centerline,*CenterVec,Grid,0,Grid->NumPts,SearchRadius);
+	if (ind<0) return FindNearestPtGrid(Grid,*Centerline);
+	return Grid->OrigPts[ind];
+}
+
+/*
+ * Returns a search radius around x large enough that FindPerpPointGrid() sees
+ * every boundary point whose index lies within HalfWidth of ind, i.e. the
+ * window FindPerpPoint(x,t,a,ind-HalfWidth,ind+HalfWidth) would scan.
+ *
+ * Every point in the window is at most HalfWidth steps of at most MaxStep
+ * from OrigPts[ind], so the triangle inequality gives the bound.
+ */
+int PerpSearchRadiusGrid(const BoundaryGrid* Grid, CvPoint x, int ind, int HalfWidth){
+	if (Grid==NULL || Grid->NumPts<1) return 0;
+	if (ind<0) ind=0;
+	if (ind>Grid->NumPts-1) ind=Grid->NumPts-1;
+	double r=sqrt((double) sqDist(x,Grid->OrigPts[ind])) + HalfWidth*Grid->MaxStep;
+	return (int) ceil(r)+1;
+}
+
+
+
+/***************************************************************
+ * Scanline Polygon Filling
+ ***************************************************************
+ */
+
+/*
+ * Allocate scratch space for the scanline filler.
+ * Don't forget to call DestroyScanlineFiller()
+ */
+ScanlineFiller* CreateScanlineFiller(){
+	ScanlineFiller* sf=(ScanlineFiller*) malloc(sizeof(ScanlineFiller));
+	if (sf==NULL) return NULL;
+	sf->Edges=NULL;
+	sf->Active=NULL;
+	sf->Crossings=NULL;
+	sf->Capacity=0;
+	return sf;
+}
+
+void DestroyScanlineFiller(ScanlineFiller** sf){
+	if (sf==NULL || *sf==NULL) return;
+	free((*sf)->Edges);
+	free((*sf)->Active);
+	free((*sf)->Crossings);
+	free(*sf);
+	*sf=NULL;
+}
+
+/*
+ * qsort() comparison that orders edges by their first scanline
+ */
+static int ComparePolyEdges(const void* a, const void* b){
+	return ((const PolyEdge*) a)->ymin - ((const PolyEdge*) b)->ymin;
+}
+
+/*
+ * Called for every span that FillPolySweep() finds inside the polygon.
+ * xs <= xe are already clipped to the row.
+ */
+typedef void (*PolySpanFunc)(void* dst, int width, int y, int xs, int xe, int value);
+
+static void FillByteSpan(void* dst, int width, int y, int xs, int xe, int value){
+	memset((unsigned char*) dst + y*width + xs,value,xe-xs+1);
+}
+
+static void FillPackedSpan(void* dst, int width, int y, int xs, int xe, int value){
+	SetPackedSpan((PackedPattern*) dst,y,xs,xe,value);
+}
+
+/*
+ * Hand every pixel of the 8-connected line from a to b to Span, clipped to
+ * the array. Pixels are chosen the same way cvLine() chooses them: the line
+ * is walked left to right along its major axis, stepping the minor axis
+ * whenever the error term goes negative.
+ */
+static void FillPolyOutline(int width, int height, CvPoint a, CvPoint b, PolySpanFunc Span, void* dst, int value){
+	if (a.x > b.x){ CvPoint tmp=a; a=b; b=tmp; }
+	int dx=b.x-a.x;
+	int dy=b.y-a.y;
+	int sy= dy < 0 ? -1 : 1;
+	if (dy < 0) dy=-dy;
+
+	int steep= dy > dx;
+	int major= steep ? dy : dx;
+	int minor= steep ? dx : dy;
+	int err=major-2*minor;
+	int x=a.x, y=a.y;
+	for (int i = 0; i <= major; ++i) {
+		if (x >= 0 && x < width && y >= 0 && y < height) Span(dst,width,y,x,x,value);
+		int stepMinor= err < 0;
+		err+= -2*minor + (stepMinor ? 2*major : 0);
+		if (steep){
+			y+=sy;
+			if (stepMinor) x++;
+		} else {
+			x++;
+			if (stepMinor) y+=sy;
+		}
+	}
+}
+
+/*
+ * The scanline sweep behind FillPolyEvenOdd() and FillPolyEvenOddPacked().
+ * Hands each span inside the polygon to Span, then each pixel of the outline.
+ */
+static int FillPolySweep(ScanlineFiller* sf, int width, int height, const CvPoint* pts, int npts, PolySpanFunc Span, void* dst, int value){
+	if (npts < 3) return A_OK;
+
+	/** Grow the scratch space if necessary **/
+	if (npts > sf->Capacity){
+		free(sf->Edges);
+		free(sf->Active);
+		free(sf->Crossings);
+		sf->Edges=(PolyEdge*) malloc(npts*sizeof(PolyEdge));
+		sf->Active=(int*) malloc(npts*sizeof(int));
+		sf->Crossings=(float*) malloc(npts*sizeof(float));
+		if (sf->Edges==NULL || sf->Active==NULL || sf->Crossings==NULL){
+			printf("Error! Out of memory in FillPolyEvenOdd()\n");
+			sf->Capacity=0;
+			return A_ERROR;
+		}
+		sf->Capacity=npts;
+	}
+
+	/** Build the edge table, skipping horizontal edges **/
+	int numEdges=0;
+	int ytop=INT_MAX, ybot=INT_MIN;
+	int k;
+	for (k = 0; k < npts; ++k) {
+		CvPoint a=pts[k];
+		CvPoint b=pts[(k+1)%npts];
+		if (a.y==b.y) continue;
+		if (a.y > b.y){ CvPoint tmp=a; a=b; b=tmp; }
+		PolyEdge* e=&(sf->Edges[numEdges++]);
+		e->ymin=a.y;
+		e->ymax=b.y;
+		e->dxdy=(float) (b.x-a.x) / (float) (b.y-a.y);
+		e->x=(float) a.x;
+		if (a.y < ytop) ytop=a.y;
+		if (b.y > ybot) ybot=b.y;
+	}
+	/** A flat polygon has no edges to sweep, but its outline is still drawn below **/
+	qsort(sf->Edges,numEdges,sizeof(PolyEdge),ComparePolyEdges);
+
+	/** Clip to the array **/
+	int ystart= ytop > 0 ? ytop : 0;
+	int yend= ybot < height ? ybot : height;
+
+	/** Sweep the scanlines, keeping a list of the edges that cross the current one **/
+	int nextEdge=0;
+	int numActive=0;
+	int y, j, m;
+	for (y = ystart; y < yend; ++y) {
+		/** Activate edges that start on or above this scanline **/
+		while (nextEdge < numEdges && sf->Edges[nextEdge].ymin <= y){
+			sf->Active[numActive++]=nextEdge++;
+		}
+
+		/** Retire finished edges and find where the rest cross this scanline **/
+		int numCross=0;
+		for (j = 0; j < numActive; ) {
+			PolyEdge* e=&(sf->Edges[sf->Active[j]]);
+			if (e->ymax <= y){
+				sf->Active[j]=sf->Active[--numActive];
+				continue;
+			}
+			float x=e->x + (float) (y - e->ymin) * e->dxdy;
+
+			/** Insertion sort, there are only ever a handful of crossings **/
+			for (m = numCross; m > 0 && sf->Crossings[m-1] > x; --m) sf->Crossings[m]=sf->Crossings[m-1];
+			sf->Crossings[m]=x;
+			numCross++;
+			j++;
+		}
+
+		/** Fill between pairs of crossings **/
+		for (j = 0; j+1 < numCross; j+=2) {
+			int xs=(int) ceil(sf->Crossings[j]);
+			int xe=(int) floor(sf->Crossings[j+1]);
+			if (xs < 0) xs=0;
+			if (xe > width-1) xe=width-1;
+			if (xe >= xs) Span(dst,width,y,xs,xe,value);
+		}
+	}
+
+	/** The sweep only fills pixel centers strictly inside. Like cvFillPoly() the outline itself belongs to the polygon too **/
+	for (k = 0; k < npts; ++k) FillPolyOutline(width,height,pts[k],pts[(k+1)%npts],Span,dst,value);
+	return A_OK;
+}
+
+/*
+ * Fill a polygon into arr, a width x height 8 bit character array, using the
+ * even-odd rule. A pixel is set to value when its center lies inside the polygon
+ * or when it lies on the 8-connected outline of the polygon, which matches
+ * cvFillPoly(...,8). Any part of the polygon that falls outside of the array is clipped.
+ *
+ * Returns A_OK or A_ERROR.
+ */
+int FillPolyEvenOdd(ScanlineFiller* sf, unsigned char* arr, int width, int height, const CvPoint* pts, int npts, unsigned char value){
+	if (sf==NULL || arr==NULL || pts==NULL) return A_ERROR;
+	return FillPolySweep(sf,width,height,pts,npts,FillByteSpan,arr,value);
+}
+
+int FillPolyEvenOddPacked(ScanlineFiller* sf, PackedPattern* pat, const CvPoint* pts, int npts, int on){
+	if (sf==NULL || pat==NULL || pts==NULL) return A_ERROR;
+	return FillPolySweep(sf,pat->width,pat->height,pts,npts,FillPackedSpan,pat,on);
+}
+
+
+
 /*********************************************************************
  *
  * Marc's Functions
  ***********************************************************************
  */
 
-/*void SegmentSides (const CvSeq *contourA, const CvSeq *contourB, const CvSeq *centerline, CvSeq *segmentedA, CvSeq *segmentedB) {
+/*void SegmentSides (const CvSeq *contourA, const CvSeq *contourB, const CvSeq *centerline, CvSeq *segmentedA, CvSeq *segmentedB,
+ *		BoundaryGrid* GridA, BoundaryGrid* GridB) {
  * all sequences are allocated sequences of CvPoint
  * const sequences are input
  * non const sequences are output and should be empty
@@ -1256,10 +1779,16 @@ CvPoint FindNormalPt(CvPoint* Centerline, CvPoint* CenterVec, CvSeq* Contour){
  * finally, we enforce the rule that points in the segmented contour must have the same order as the original;
  * i.e. if index k > j, then segmentedA(k) comes later in contourA than segmentedA(j)
  *
+ * The perpendicular searches are answered from GridA and GridB, which are loaded
+ * with contourA and contourB. Create the grids once and pass the same ones every
+ * frame. The grids see the same index windows FindPerpPoint() would, so the result
+ * is unchanged. If either grid is NULL, FindPerpPoint() searches the contours directly.
+ *
  * MHG 9/16/09
  */
-void SegmentSides (const CvSeq *contourA, const CvSeq *contourB, const CvSeq *centerline, CvSeq *segmentedA, CvSeq *segmentedB) {
-	int j,lastA, lastB;
+void SegmentSides (const CvSeq *contourA, const CvSeq *contourB, const CvSeq *centerline, CvSeq *segmentedA, CvSeq *segmentedB,
+		BoundaryGrid* GridA, BoundaryGrid* GridB) {
+	int j,lastA, lastB, ind;
 	int ptincrement;
 	int noduplicates = 0;
 	CvPoint current, forward, backward, tangent;
@@ -1269,6 +1798,11 @@ void SegmentSides (const CvSeq *contourA, const CvSeq *contourB, const CvSeq *ce
 	/** This defines the search area with which we will look for a point on the boundary **/
 	ptincrement = 3*((contourA->total > contourB->total ? contourA->total : contourB->total) / centerline->total + 1);
 
+	/** Bucket both sides so that each perpendicular search only visits nearby points.
+	 *  The grids keep their memory from one frame to the next. **/
+	int useGrid= (GridA!=NULL && GridB!=NULL);
+	if (useGrid) useGrid= (LoadBoundaryGrid(GridA,contourA)==A_OK && LoadBoundaryGrid(GridB,contourB)==A_OK);
+
 
 
 	lastA=0;
@@ -1301,12 +1835,20 @@ void SegmentSides (const CvSeq *contourA, const CvSeq *contourB, const CvSeq *ce
 			tangent.y = forward.y - backward.y;
 
 			/** Find the index along the boundary for the perpendicular pointer and store it **/
-			lastA = FindPerpPoint (current, tangent, contourA, lastA - ptincrement, lastA + ptincrement);
-			lastB = FindPerpPoint (current, tangent, contourB, lastB - ptincrement, lastB + ptincrement);
+			if (useGrid){
+				ind = FindPerpPointGrid (current, tangent, GridA, lastA - ptincrement, lastA + ptincrement,
+						PerpSearchRadiusGrid(GridA, current, lastA, ptincrement));
+				lastA = (ind >= 0) ? ind : FindPerpPoint (current, tangent, contourA, lastA - ptincrement, lastA + ptincrement);
+				ind = FindPerpPointGrid (current, tangent, GridB, lastB - ptincrement, lastB + ptincrement,
+						PerpSearchRadiusGrid(GridB, current, lastB, ptincrement));
+				lastB = (ind >= 0) ? ind : FindPerpPoint (current, tangent, contourB, lastB - ptincrement, lastB + ptincrement);
+			} else {
+				lastA = FindPerpPoint (current, tangent, contourA, lastA - ptincrement, lastA + ptincrement);
+				lastB = FindPerpPoint (current, tangent, contourB, lastB - ptincrement, lastB + ptincrement);
+			}
 			cvSeqPush (segmentedA, cvGetSeqElem(contourA, lastA));
 			cvSeqPush (segmentedB, cvGetSeqElem(contourB, lastB));
 		}
-
 }
 
 
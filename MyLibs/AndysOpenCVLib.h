@@ -303,6 +303,180 @@ CvPoint FindNormalPt(CvPoint* Centerline, CvPoint* CenterVec, CvSeq* Contour);
 
 
 
+/***************************************************************
+ * Boundary Grid
+ *
+ * A uniform grid of buckets over the points of a boundary.
+ * FindNearestPt(), FindNormalPt() and FindPerpPoint() scan the
+ * entire boundary for every query. The grid is built once per frame
+ * and then answers the same queries by looking only at the handful
+ * of cells near the query point.
+ *
+ * The brute force functions above remain the reference implementation.
+ ***************************************************************
+ */
+
+/** Default edge length of a grid cell in pixels **/
+#define BGRID_DEFAULT_CELL_SIZE 8
+
+typedef struct BoundaryGridStruct{
+	int CellSize; /** edge length of a cell in pixels **/
+	CvPoint Origin; /** upper left corner of the grid in image coordinates **/
+	int NumCols;
+	int NumRows;
+
+	/** Bucketed points. The points in cell c are
+	 *  Pts[CellStart[c]] ... Pts[CellStart[c+1]-1]
+	 *  and Ind[] holds their index along the original boundary **/
+	int* CellStart;
+	CvPoint* Pts;
+	int* Ind;
+	int NumPts;
+
+	/** The same points in their original order along the boundary **/
+	CvPoint* OrigPts;
+
+	/** Longest distance between two consecutive boundary points, so that
+	 *  k steps along the boundary never take you further than k*MaxStep **/
+	double MaxStep;
+
+	/** Allocated sizes, so that the grid can be reloaded each frame without reallocating **/
+	int PtCapacity;
+	int CellCapacity;
+} BoundaryGrid;
+
+/*
+ * Allocate an empty boundary grid with cells of CellSize x CellSize pixels.
+ * Returns NULL on error.
+ * Don't forget to call DestroyBoundaryGrid()
+ */
+BoundaryGrid* CreateBoundaryGrid(int CellSize);
+
+/*
+ * Deallocate a boundary grid and set the pointer to NULL.
+ */
+void DestroyBoundaryGrid(BoundaryGrid** Grid);
+
+/*
+ * Bucket the points of Boundary (a CvSeq of CvPoint) into the grid.
+ * Any previous contents of the grid are discarded. Memory is only
+ * reallocated when the boundary or its bounding box outgrow the grid.
+ *
+ * Returns A_OK or A_ERROR.
+ */
+int LoadBoundaryGrid(BoundaryGrid* Grid, const CvSeq* Boundary);
+
+/*
+ * Returns the index along the boundary of the boundary point closest to pt.
+ * Cells are searched in rings of increasing radius around pt until no
+ * unsearched cell could hold a closer point.
+ *
+ * Like FindNearestPt(), ties go to the point furthest along the boundary.
+ *
+ * Returns -1 if the grid is empty.
+ */
+int FindNearestPtIndGrid(const BoundaryGrid* Grid, CvPoint pt);
+
+/*
+ * Grid equivalent of FindNearestPt().
+ * Returns the coordinates of the point on the boundary closest to pt.
+ */
+CvPoint FindNearestPtGrid(const BoundaryGrid* Grid, CvPoint pt);
+
+/*
+ * Grid equivalent of FindPerpPoint().
+ *
+ * Finds the index k in [startInd, endInd) of the boundary point that minimizes
+ * abs(dot(a(k)-x, t)), i.e. the point closest to the line through x perpendicular to t.
+ * Only points within SearchRadius pixels of x are considered. Cells that straddle
+ * the perpendicular line are visited first, and every other cell is skipped as soon as
+ * it cannot beat the best point found so far. Like FindPerpPoint(), ties go to the
+ * lowest index, so if every point of [startInd, endInd) lies within SearchRadius of x
+ * the answer is exactly that of FindPerpPoint().
+ *
+ * Pass startInd=0 and endInd=Grid->NumPts to search the whole boundary.
+ *
+ * Returns -1 if no boundary point in [startInd, endInd) lies within SearchRadius of x.
+ */
+int FindPerpPointGrid(CvPoint x, CvPoint t, const BoundaryGrid* Grid, int startInd, int endInd, int SearchRadius);
+
+/*
+ * Given a point on the centerline and the centerline's tangent vector there,
+ * returns the boundary point within SearchRadius that lies closest to the
+ * normal of the centerline at that point.
+ *
+ * Note this is not a drop in replacement for FindNormalPt(), which returns
+ * the point with the lowest signed dot product rather than the one closest
+ * to the normal.
+ *
+ * If no such point is found, the nearest boundary point is returned.
+ */
+CvPoint FindNormalPtGrid(CvPoint* Centerline, CvPoint* CenterVec, const BoundaryGrid* Grid, int SearchRadius);
+
+/*
+ * Returns a search radius around x large enough that FindPerpPointGrid() sees
+ * every boundary point whose index lies within HalfWidth of ind, i.e. the
+ * window FindPerpPoint(x,t,a,ind-HalfWidth,ind+HalfWidth) would scan.
+ */
+int PerpSearchRadiusGrid(const BoundaryGrid* Grid, CvPoint x, int ind, int HalfWidth);
+
+
+
+/***************************************************************
+ * Scanline Polygon Filling
+ *
+ * Fills polygons directly into an 8 bit character array
+ * (e.g. Frame->binary) without going through an IplImage.
+ ***************************************************************
+ */
+
+typedef struct PolyEdgeStruct{
+	int ymin; /** first scanline crossed by the edge **/
+	int ymax; /** one past the last scanline crossed by the edge **/
+	float x; /** x value at ymin **/
+	float dxdy;
+} PolyEdge;
+
+/*
+ * Scratch space for FillPolyEvenOdd().
+ * The buffers grow as needed and are reused from call to call.
+ */
+typedef struct ScanlineFillerStruct{
+	PolyEdge* Edges;
+	int* Active;
+	float* Crossings;
+	int Capacity;
+} ScanlineFiller;
+
+/*
+ * Allocate scratch space for the scanline filler.
+ * Don't forget to call DestroyScanlineFiller()
+ */
+ScanlineFiller* CreateScanlineFiller();
+
+void DestroyScanlineFiller(ScanlineFiller** sf);
+
+/*
+ * Fill a polygon into arr, a width x height 8 bit character array, using the
+ * even-odd rule. A pixel is set to value when its center lies inside the polygon
+ * or when it lies on the 8-connected outline of the polygon, which matches
+ * cvFillPoly(...,8). Any part of the polygon that falls outside of the array is clipped.
+ *
+ * Returns A_OK or A_ERROR.
+ */
+int FillPolyEvenOdd(ScanlineFiller* sf, unsigned char* arr, int width, int height, const CvPoint* pts, int npts, unsigned char value);
+
+/*
+ * Same as FillPolyEvenOdd() but fills straight into a one bit per mirror
+ * pattern (see PackedPattern.h), turning the mirrors inside the polygon on (on!=0) or off.
+ *
+ * Returns A_OK or A_ERROR.
+ */
+struct PackedPatternStruct;
+int FillPolyEvenOddPacked(ScanlineFiller* sf, struct PackedPatternStruct* pat, const CvPoint* pts, int npts, int on);
+
+
+
 
 /*
  *
@@ -310,7 +484,8 @@ CvPoint FindNormalPt(CvPoint* Centerline, CvPoint* CenterVec, CvSeq* Contour);
  *
  */
 
-/*void SegmentSides (const CvSeq *contourA, const CvSeq *contourB, const CvSeq *centerline, CvSeq *segmentedA, CvSeq *segmentedB) {
+/*void SegmentSides (const CvSeq *contourA, const CvSeq *contourB, const CvSeq *centerline, CvSeq *segmentedA, CvSeq *segmentedB,
+ *		BoundaryGrid* GridA, BoundaryGrid* GridB) {
  * all sequences are allocated sequences of CvPoint
  * const sequences are input
  * non const sequences are output and should be empty
@@ -328,9 +503,15 @@ CvPoint FindNormalPt(CvPoint* Centerline, CvPoint* CenterVec, CvSeq* Contour);
  * finally, we enforce the rule that points in the segmented contour must have the same order as the original;
  * i.e. if index k > j, then segmentedA(k) comes later in contourA than segmentedA(j)
  *
+ * The perpendicular searches are answered from GridA and GridB, which are loaded
+ * with contourA and contourB. Create the grids once and pass the same ones every
+ * frame. The grids see the same index windows FindPerpPoint() would, so the result
+ * is unchanged. If either grid is NULL, FindPerpPoint() searches the contours directly.
+ *
  * MHG 9/16/09
  */
-void SegmentSides (const CvSeq *contourA, const CvSeq *contourB, const CvSeq *centerline, CvSeq *segmentedA, CvSeq *segmentedB);
+void SegmentSides (const CvSeq *contourA, const CvSeq *contourB, const CvSeq *centerline, CvSeq *segmentedA, CvSeq *segmentedB,
+		BoundaryGrid* GridA, BoundaryGrid* GridB);
 
 
 
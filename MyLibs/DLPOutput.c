@@ -0,0 +1,351 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * DLPOutput.c
+ *
+ * A dedicated thread that uploads illumination patterns to the DLP.
+ * See DLPOutput.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "DLPOutput.h"
+
+
+/*
+ * Milliseconds since an arbitrary point, from the high resolution performance counter.
+ * Unlike clock() this is monotonic and has sub millisecond resolution.
+ */
+double DLPOut_Now(){
+	return LT_Now();
+}
+
+
+/*
+ * Body of the output thread.
+ *
+ * Sleeps until there is a submission or a request to stop, takes the newest
+ * pending pattern, uploads it and logs the times.
+ */
+DWORD WINAPI DLPOutputThread(LPVOID lpParam){
+	DLPOutput* dlp=(DLPOutput*) lpParam;
+	HANDLE wake[2]={dlp->NewPattern,dlp->Stop};
+	int ind, stop;
+
+	while (1) {
+		WaitForMultipleObjects(2,wake,FALSE,INFINITE);
+
+		/** Claim the newest pending pattern **/
+		EnterCriticalSection(&(dlp->lock));
+		ind=dlp->Pending;
+		dlp->Pending=-1;
+		dlp->Uploading=ind;
+		stop=dlp->StopRequested;
+		LeaveCriticalSection(&(dlp->lock));
+
+		if (ind<0) {
+			/** Only quit once there is nothing left to upload. The stop event stays set, so this never blocks again **/
+			if (stop) break;
+			continue;
+		}
+
+		/** Upload it **/
+		DLPUploadRecord rec;
+		rec.seq=dlp->Seq[ind];
+		rec.frame=dlp->Frame[ind];
+		rec.submitted=dlp->SubmitTime[ind];
+		rec.started=DLPOut_Now();
+		UnpackPatternToBinary(dlp->Buffers[ind],dlp->Staging);
+		rec.ret=dlp->Sink(dlp->Staging,dlp->alpid);
+		rec.completed=DLPOut_Now();
+
+		/** Release the buffer and log the times **/
+		EnterCriticalSection(&(dlp->lock));
+		dlp->Uploading=-1;
+		dlp->NumUploaded++;
+		if (rec.ret<0) dlp->NumErrors++;
+		dlp->Log[dlp->LogCount % DLPOUT_LOG_SIZE]=rec;
+		dlp->LogCount++;
+		LatencyTrace* trace=dlp->Trace;
+		LeaveCriticalSection(&(dlp->lock));
+
+		if (rec.ret>=0) LT_MarkAt(trace,rec.frame,LT_UPLOADED,rec.completed);
+	}
+	return 0;
+}
+
+
+/*
+ * Free the pattern buffers and the staging buffer
+ */
+static void FreeDLPOutputBuffers(DLPOutput* dlp){
+	for (int k = 0; k < DLPOUT_NUM_BUFFERS; ++k) DestroyPackedPattern(&(dlp->Buffers[k]));
+	free(dlp->Staging);
+	dlp->Staging=NULL;
+}
+
+
+/*
+ * Allocate the pattern buffers and start the output thread.
+ *
+ * width x height is the size of a pattern in mirrors (e.g. NSIZEX x NSIZEY).
+ * Sink is called from the output thread for every pattern that is uploaded,
+ * with the pattern expanded to one byte per mirror.
+ *
+ * Returns NULL on error.
+ * Don't forget to call StopDLPOutput()
+ */
+DLPOutput* StartDLPOutput(long alpid, int width, int height, DLPSinkFunc Sink){
+	if (Sink==NULL || width<1 || height<1){
+		printf("Error! StartDLPOutput() needs a sink and a pattern size.\n");
+		return NULL;
+	}
+
+	DLPOutput* dlp=(DLPOutput*) malloc(sizeof(DLPOutput));
+	if (dlp==NULL) return NULL;
+	memset(dlp,0,sizeof(DLPOutput));
+
+	dlp->Sink=Sink;
+	dlp->alpid=alpid;
+	dlp->width=width;
+	dlp->height=height;
+	dlp->Pending=-1;
+	dlp->Uploading=-1;
+
+	/** Preallocate all of the pattern buffers **/
+	int ok=1;
+	for (int k = 0; k < DLPOUT_NUM_BUFFERS; ++k) {
+		dlp->Buffers[k]=CreatePackedPattern(width,height);
+		if (dlp->Buffers[k]==NULL) ok=0;
+		dlp->Seq[k]=-1;
+		dlp->Frame[k]=-1;
+	}
+	dlp->Staging=(unsigned char*) calloc(width*height,sizeof(unsigned char));
+	if (dlp->Staging==NULL) ok=0;
+	if (!ok){
+		printf("Error! Unable to allocate DLP pattern buffers.\n");
+		FreeDLPOutputBuffers(dlp);
+		free(dlp);
+		return NULL;
+	}
+
+	InitializeCriticalSection(&(dlp->lock));
+	dlp->NewPattern=CreateEvent(NULL,FALSE,FALSE,NULL);
+	dlp->Stop=CreateEvent(NULL,TRUE,FALSE,NULL);
+
+	/** Start the output thread **/
+	DWORD dwThreadId;
+	dlp->Thread=CreateThread(NULL,0,DLPOutputThread,(void*) dlp,0,&dwThreadId);
+	if (dlp->Thread==NULL){
+		printf("Error! Cannot create DLP output thread.\n");
+		CloseHandle(dlp->NewPattern);
+		CloseHandle(dlp->Stop);
+		DeleteCriticalSection(&(dlp->lock));
+		FreeDLPOutputBuffers(dlp);
+		free(dlp);
+		return NULL;
+	}
+
+	/** Uploads are on the latency critical path **/
+	SetThreadPriority(dlp->Thread,THREAD_PRIORITY_ABOVE_NORMAL);
+	return dlp;
+}
+
+
+/*
+ * Find a buffer that is neither pending nor being uploaded. With three buffers there always is one.
+ * Only the submitting thread writes to a free buffer, so it can be filled outside of the lock.
+ */
+static int DLPOut_FindFreeBuffer(DLPOutput* dlp){
+	EnterCriticalSection(&(dlp->lock));
+	int free_ind=-1;
+	for (int k = 0; k < DLPOUT_NUM_BUFFERS; ++k) {
+		if (k!=dlp->Pending && k!=dlp->Uploading){
+			free_ind=k;
+			break;
+		}
+	}
+	LeaveCriticalSection(&(dlp->lock));
+	return free_ind;
+}
+
+/*
+ * Publish a filled buffer, replacing any pattern that is still waiting.
+ * Returns the sequence number of the pattern.
+ */
+static int DLPOut_Publish(DLPOutput* dlp, int free_ind, int frame){
+	EnterCriticalSection(&(dlp->lock));
+	int seq=dlp->NumSubmitted++;
+	dlp->Seq[free_ind]=seq;
+	dlp->Frame[free_ind]=frame;
+	dlp->SubmitTime[free_ind]=DLPOut_Now();
+	if (dlp->Pending>=0) dlp->NumSkipped++;
+	dlp->Pending=free_ind;
+	LeaveCriticalSection(&(dlp->lock));
+
+	SetEvent(dlp->NewPattern);
+	return seq;
+}
+
+
+/*
+ * Hand a finished pattern to the output thread.
+ * The pattern is copied, so the caller is free to reuse it right away.
+ * Never blocks on the upload.
+ *
+ * Returns the sequence number of the pattern, or DLPOUT_ERROR.
+ */
+int DLPOut_SubmitPacked(DLPOutput* dlp, const PackedPattern* pat, int frame){
+	if (dlp==NULL || pat==NULL) return DLPOUT_ERROR;
+	int free_ind=DLPOut_FindFreeBuffer(dlp);
+	if (free_ind<0) return DLPOUT_ERROR;
+	if (CopyPackedPattern(pat,dlp->Buffers[free_ind])!=0){
+		printf("Error! Pattern handed to DLPOut_SubmitPacked() is the wrong size.\n");
+		return DLPOUT_ERROR;
+	}
+	return DLPOut_Publish(dlp,free_ind,frame);
+}
+
+/*
+ * Same as DLPOut_SubmitPacked() for a byte per mirror image.
+ */
+int DLPOut_Submit(DLPOutput* dlp, const unsigned char* image, int frame){
+	if (dlp==NULL || image==NULL) return DLPOUT_ERROR;
+	int free_ind=DLPOut_FindFreeBuffer(dlp);
+	if (free_ind<0) return DLPOUT_ERROR;
+	PackBinaryToPattern(image,dlp->Buffers[free_ind]);
+	return DLPOut_Publish(dlp,free_ind,frame);
+}
+
+
+/*
+ * Stamp LT_UPLOADED in lt for every pattern uploaded from now on.
+ */
+void DLPOut_SetLatencyTrace(DLPOutput* dlp, LatencyTrace* lt){
+	if (dlp==NULL) return;
+	EnterCriticalSection(&(dlp->lock));
+	dlp->Trace=lt;
+	LeaveCriticalSection(&(dlp->lock));
+}
+
+
+/*
+ * Copy the most recent upload record into rec.
+ * Returns DLPOUT_OK, or DLPOUT_ERROR if nothing has been uploaded yet.
+ */
+int DLPOut_GetLastUpload(DLPOutput* dlp, DLPUploadRecord* rec){
+	if (dlp==NULL || rec==NULL) return DLPOUT_ERROR;
+	int ret=DLPOUT_ERROR;
+	EnterCriticalSection(&(dlp->lock));
+	if (dlp->LogCount>0){
+		*rec=dlp->Log[(dlp->LogCount-1) % DLPOUT_LOG_SIZE];
+		ret=DLPOUT_OK;
+	}
+	LeaveCriticalSection(&(dlp->lock));
+	return ret;
+}
+
+
+/*
+ * Find the first upload of a pattern submitted as sequence number seq or later.
+ */
+int DLPOut_FindUpload(DLPOutput* dlp, int seq, DLPUploadRecord* rec){
+	if (dlp==NULL || rec==NULL) return DLPOUT_ERROR;
+	int ret=DLPOUT_ERROR;
+	EnterCriticalSection(&(dlp->lock));
+	int n= dlp->LogCount < DLPOUT_LOG_SIZE ? dlp->LogCount : DLPOUT_LOG_SIZE;
+	for (int k = 0; k < n; ++k) {
+		const DLPUploadRecord* r=&(dlp->Log[k]);
+		if (r->seq>=seq && (ret==DLPOUT_ERROR || r->seq<rec->seq)){
+			*rec=*r;
+			ret=DLPOUT_OK;
+		}
+	}
+	LeaveCriticalSection(&(dlp->lock));
+	return ret;
+}
+
+
+/*
+ * Print the number of submitted, uploaded and skipped patterns along with
+ * the mean and max submit-to-complete latency over the timing log.
+ */
+void DLPOut_PrintReport(DLPOutput* dlp){
+	if (dlp==NULL) return;
+	EnterCriticalSection(&(dlp->lock));
+	int n= dlp->LogCount < DLPOUT_LOG_SIZE ? dlp->LogCount : DLPOUT_LOG_SIZE;
+	double sumLatency=0, maxLatency=0, sumUpload=0, maxUpload=0;
+	for (int k = 0; k < n; ++k) {
+		double latency=dlp->Log[k].completed - dlp->Log[k].submitted;
+		double upload=dlp->Log[k].completed - dlp->Log[k].started;
+		sumLatency+=latency;
+		sumUpload+=upload;
+		if (latency>maxLatency) maxLatency=latency;
+		if (upload>maxUpload) maxUpload=upload;
+	}
+	printf("\nDLP output: %d patterns submitted, %d uploaded, %d skipped as stale, %d upload errors.\n",
+			dlp->NumSubmitted,dlp->NumUploaded,dlp->NumSkipped,dlp->NumErrors);
+	if (n>0){
+		printf("DLP output over the last %d uploads: submit-to-complete mean %.2f ms, max %.2f ms; upload mean %.2f ms, max %.2f ms\n",
+				n,sumLatency/n,maxLatency,sumUpload/n,maxUpload);
+	}
+	LeaveCriticalSection(&(dlp->lock));
+}
+
+
+/*
+ * Upload whatever is still pending, stop the output thread, print a report
+ * and free everything. Sets the pointer to NULL.
+ */
+void StopDLPOutput(DLPOutput** dlp){
+	if (dlp==NULL || *dlp==NULL) return;
+	DLPOutput* d=*dlp;
+
+	EnterCriticalSection(&(d->lock));
+	d->StopRequested=1;
+	LeaveCriticalSection(&(d->lock));
+	SetEvent(d->Stop);
+	WaitForSingleObject(d->Thread,INFINITE);
+	CloseHandle(d->Thread);
+
+	DLPOut_PrintReport(d);
+
+	CloseHandle(d->NewPattern);
+	CloseHandle(d->Stop);
+	DeleteCriticalSection(&(d->lock));
+	FreeDLPOutputBuffers(d);
+	free(d);
+	*dlp=NULL;
+}
@@ -0,0 +1,204 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * DLPOutput.h
+ *
+ * A dedicated thread that uploads illumination patterns to the DLP.
+ *
+ * Uploading a pattern to the ALP board takes a few milliseconds. Rather than
+ * having the analysis thread call T2DLP_SendFrame() and wait, the analysis
+ * thread submits a finished pattern to a DLPOutput object and moves on.
+ * The output thread always uploads the most recently submitted pattern.
+ * If a newer pattern arrives before an older one has been uploaded, the
+ * older one is stale and is skipped (latest wins).
+ *
+ * Three preallocated buffers are used: one being uploaded, one holding the
+ * newest pending pattern and one free for the next submission, so the
+ * analysis thread never waits on the upload.
+ *
+ * Patterns are held one bit per mirror (see PackedPattern.h). They are only
+ * expanded to the byte per mirror the driver expects by the output thread,
+ * right before the upload.
+ *
+ * Every upload is logged with its submit, start and complete time. If a
+ * LatencyTrace is attached, the completed upload is also stamped on the
+ * frame the pattern was computed from.
+ *
+ * Depends on windows.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef DLPOUTPUT_H_
+#define DLPOUTPUT_H_
+
+#include <windows.h>
+#include "PackedPattern.h"
+#include "LatencyTrace.h"
+
+#define DLPOUT_NUM_BUFFERS 3
+
+/** Number of uploads remembered in the timing log **/
+#define DLPOUT_LOG_SIZE 512
+
+/** Return Values **/
+#define DLPOUT_OK 0
+#define DLPOUT_ERROR -1
+
+/*
+ * Function that actually uploads a pattern, e.g. T2DLP_SendFrame()
+ */
+typedef int (*DLPSinkFunc)(unsigned char* image, long alpid);
+
+/*
+ * Timing of one upload. All times are in ms from the monotonic DLPOut_Now() clock.
+ */
+typedef struct DLPUploadRecordStruct{
+	int seq; /** sequence number of the submitted pattern **/
+	int frame; /** camera frame the pattern was computed from, -1 if unknown **/
+	double submitted; /** analysis thread handed over the pattern **/
+	double started; /** output thread began the upload **/
+	double completed; /** upload returned **/
+	int ret; /** return value of the sink **/
+} DLPUploadRecord;
+
+typedef struct DLPOutputStruct{
+	/** Where the patterns go **/
+	DLPSinkFunc Sink;
+	long alpid;
+
+	/** Preallocated pattern buffers, one bit per mirror **/
+	PackedPattern* Buffers[DLPOUT_NUM_BUFFERS];
+	int width;
+	int height;
+
+	/** Byte per mirror copy of the pattern being uploaded. Only touched by the output thread. **/
+	unsigned char* Staging;
+	int Seq[DLPOUT_NUM_BUFFERS];
+	int Frame[DLPOUT_NUM_BUFFERS];
+	double SubmitTime[DLPOUT_NUM_BUFFERS];
+
+	/** Buffer indices (-1 means none) **/
+	int Pending; /** newest submitted pattern that has not yet been picked up **/
+	int Uploading; /** pattern the output thread is working on **/
+
+	/** Synchronization **/
+	CRITICAL_SECTION lock;
+	HANDLE NewPattern; /** auto-reset event, set on every submission **/
+	HANDLE Stop; /** manual-reset event, set once by StopDLPOutput() **/
+	HANDLE Thread;
+	int StopRequested; /** guarded by lock **/
+
+	/** Statistics **/
+	int NumSubmitted;
+	int NumUploaded;
+	int NumSkipped; /** patterns that were replaced before they could be uploaded **/
+	int NumErrors;
+
+	/** Optional per-frame latency trace, stamped with LT_UPLOADED **/
+	LatencyTrace* Trace;
+
+	/** Ring buffer of recent uploads **/
+	DLPUploadRecord Log[DLPOUT_LOG_SIZE];
+	int LogCount; /** total number of records ever written **/
+
+} DLPOutput;
+
+
+/*
+ * Milliseconds since an arbitrary point, from the high resolution performance counter.
+ * Unlike clock() this is monotonic and has sub millisecond resolution.
+ * This is the same clock as LT_Now().
+ */
+double DLPOut_Now();
+
+/*
+ * Allocate the pattern buffers and start the output thread.
+ *
+ * width x height is the size of a pattern in mirrors (e.g. NSIZEX x NSIZEY).
+ * Sink is called from the output thread for every pattern that is uploaded,
+ * with the pattern expanded to one byte per mirror.
+ *
+ * Returns NULL on error.
+ * Don't forget to call StopDLPOutput()
+ */
+DLPOutput* StartDLPOutput(long alpid, int width, int height, DLPSinkFunc Sink);
+
+/*
+ * Hand a finished pattern to the output thread.
+ * The pattern is copied, so the caller is free to reuse it right away.
+ * Never blocks on the upload.
+ *
+ * frame is the camera frame the pattern was computed from (or -1). It is
+ * only used to log the upload.
+ *
+ * Returns the sequence number of the pattern, or DLPOUT_ERROR.
+ */
+int DLPOut_SubmitPacked(DLPOutput* dlp, const PackedPattern* pat, int frame);
+
+/*
+ * Same as DLPOut_SubmitPacked() for a byte per mirror image (e.g. Frame->binary).
+ * The image is packed on the calling thread; any nonzero pixel turns its mirror on.
+ */
+int DLPOut_Submit(DLPOutput* dlp, const unsigned char* image, int frame);
+
+/*
+ * Stamp LT_UPLOADED in lt for every pattern uploaded from now on.
+ * Pass NULL to stop. The trace must outlive the output thread or be detached first.
+ */
+void DLPOut_SetLatencyTrace(DLPOutput* dlp, LatencyTrace* lt);
+
+/*
+ * Copy the most recent upload record into rec.
+ * Returns DLPOUT_OK, or DLPOUT_ERROR if nothing has been uploaded yet.
+ */
+int DLPOut_GetLastUpload(DLPOutput* dlp, DLPUploadRecord* rec);
+
+/*
+ * Find the first upload of a pattern submitted as sequence number seq or
+ * later, i.e. the upload that put pattern seq (or whatever replaced it) on
+ * the mirrors. Only the last DLPOUT_LOG_SIZE uploads can be found.
+ * Returns DLPOUT_OK, or DLPOUT_ERROR if there is no such upload yet.
+ */
+int DLPOut_FindUpload(DLPOutput* dlp, int seq, DLPUploadRecord* rec);
+
+/*
+ * Print the number of submitted, uploaded and skipped patterns along with
+ * the mean and max submit-to-complete latency over the timing log.
+ */
+void DLPOut_PrintReport(DLPOutput* dlp);
+
+/*
+ * Upload whatever is still pending, stop the output thread, print a report
+ * and free everything. Sets the pointer to NULL.
+ */
+void StopDLPOutput(DLPOutput** dlp);
+
+#endif /* DLPOUTPUT_H_ */
@@ -34,6 +34,7 @@
  */
 #include <assert.h>
 #include <stdio.h>
+#include <windows.h>
 #include <Talk2DLP.h>
 
 /**
@@ -52,6 +53,20 @@
  * which basically redefines all of the hardware specific functions.
  */
 
+/**
+ * Optionally, the functions here can also pretend to be a DMD.
+ * See T2DLP_SimulateDMD(). This is useful for testing the timing of the
+ * DLP output thread on a machine without a DMD.
+ */
+
+/** Simulated DMD State **/
+static int SimDMDOn=0;
+static int SimDMDUploadDelay=0;
+static long SimDMDFramesReceived=0;
+
+/** Arbitrary ID handed out for the simulated DMD **/
+#define SIM_DMD_ID 1
+
 
 
 
@@ -63,7 +78,21 @@ void T2DLP_errormsg(){
 }
 
 
+/*
+ * Simulate a DMD. Each call to T2DLP_SendFrame() will take uploadDelay ms.
+ */
+int T2DLP_SimulateDMD(int uploadDelay){
+	if (uploadDelay<0) uploadDelay=0;
+	SimDMDOn=1;
+	SimDMDUploadDelay=uploadDelay;
+	SimDMDFramesReceived=0;
+	printf("Simulating a DMD with an upload time of %d ms.\n",uploadDelay);
+	return T2DLP_HAPPY;
+}
+
+
 long T2DLP_on(){
+	if (SimDMDOn) return SIM_DMD_ID;
 	T2DLP_errormsg();
 	assert(0);
 
@@ -71,12 +100,23 @@ long T2DLP_on(){
 }
 int T2DLP_off(long alpid)
 {
+	if (SimDMDOn) {
+		printf("Simulated DMD received %ld frames.\n",SimDMDFramesReceived);
+		return T2DLP_HAPPY;
+	}
 	T2DLP_errormsg();
 	assert(0);
 	return 0;
 }//takes an ID of the DMD
 
 int T2DLP_SendFrame(unsigned char *image, long alpid){
+	if (SimDMDOn) {
+		/** Pretend to load the rows and reset the mirrors **/
+		if (image==NULL || alpid!=SIM_DMD_ID) return T2DLP_SAD;
+		Sleep(SimDMDUploadDelay);
+		SimDMDFramesReceived++;
+		return T2DLP_HAPPY;
+	}
 	T2DLP_errormsg();
 	assert(0);
 	return 0;
@@ -93,6 +133,7 @@ unsigned char *SampleImages( unsigned long nSizeX, unsigned long nSizeY ){
  * Clear the DLP mirrors
  */
 int T2DLP_clear(long myDLP){
+	if (SimDMDOn) return T2DLP_HAPPY;
 	T2DLP_errormsg();
 	assert(0);
 	return 0;
@@ -0,0 +1,392 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * GrayCode.c
+ *
+ * Structured light calibration of the DLP against the camera.
+ * See GrayCode.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "GrayCode.h"
+
+
+/*
+ * Smallest number of bits that can count to n-1
+ */
+static int BitsNeeded(int n){
+	int b=0;
+	while ((1<<b) < n) b++;
+	return b;
+}
+
+/*
+ * Convert a Gray code to an ordinary binary number
+ */
+static unsigned int GrayToBinary(unsigned int g){
+	g ^= g >> 1;
+	g ^= g >> 2;
+	g ^= g >> 4;
+	g ^= g >> 8;
+	return g;
+}
+
+/*
+ * Which axis and which bit pattern k encodes.
+ * Returns 0 for x and 1 for y.
+ */
+static int PatternBit(const GrayCodeCalib* gc, int k, int* bit, int* inverse){
+	int plane=k/2;
+	int planesX=gc->NumBitsX - gc->SkipBits;
+	*inverse= k & 1;
+	if (plane < planesX){
+		*bit= gc->NumBitsX - 1 - plane;
+		return 0;
+	}
+	*bit= gc->NumBitsY - 1 - (plane-planesX);
+	return 1;
+}
+
+
+GrayCodeCalib* CreateGrayCodeCalib(int DLPwidth, int DLPheight, int CamWidth, int CamHeight, int SkipBits, int MinContrast){
+	if (DLPwidth<2 || DLPheight<2 || CamWidth<1 || CamHeight<1 || DLPwidth>65536 || DLPheight>65536){
+		printf("ERROR! CreateGrayCodeCalib() was given invalid dimensions.\n");
+		return NULL;
+	}
+	GrayCodeCalib* gc=(GrayCodeCalib*) malloc(sizeof(GrayCodeCalib));
+	gc->DLPwidth=DLPwidth;
+	gc->DLPheight=DLPheight;
+	gc->CamWidth=CamWidth;
+	gc->CamHeight=CamHeight;
+	gc->NumBitsX=BitsNeeded(DLPwidth);
+	gc->NumBitsY=BitsNeeded(DLPheight);
+
+	/** Always project at least the most significant bit of each axis **/
+	int maxSkip= (gc->NumBitsX < gc->NumBitsY ? gc->NumBitsX : gc->NumBitsY) - 1;
+	if (SkipBits < 0) SkipBits=0;
+	if (SkipBits > maxSkip) SkipBits=maxSkip;
+	gc->SkipBits=SkipBits;
+	gc->MinContrast=MinContrast;
+
+	int N=CamWidth*CamHeight;
+	gc->CodeX=(unsigned short*) calloc(N,sizeof(unsigned short));
+	gc->CodeY=(unsigned short*) calloc(N,sizeof(unsigned short));
+	gc->Contrast=(unsigned char*) malloc(N*sizeof(unsigned char));
+	memset(gc->Contrast,255,N*sizeof(unsigned char));
+	gc->PosCapture=(unsigned char*) malloc(N*sizeof(unsigned char));
+	gc->NumCaptured=0;
+
+	gc->DecodedX=(int*) malloc(N*sizeof(int));
+	gc->DecodedY=(int*) malloc(N*sizeof(int));
+	gc->Mask=(unsigned char*) calloc(N,sizeof(unsigned char));
+	gc->NumValid=0;
+	return gc;
+}
+
+void DestroyGrayCodeCalib(GrayCodeCalib** gc){
+	if (gc==NULL || *gc==NULL) return;
+	free((*gc)->CodeX);
+	free((*gc)->CodeY);
+	free((*gc)->Contrast);
+	free((*gc)->PosCapture);
+	free((*gc)->DecodedX);
+	free((*gc)->DecodedY);
+	free((*gc)->Mask);
+	free(*gc);
+	*gc=NULL;
+}
+
+int GrayCodeNumPatterns(const GrayCodeCalib* gc){
+	return 2*((gc->NumBitsX - gc->SkipBits) + (gc->NumBitsY - gc->SkipBits));
+}
+
+
+int GrayCodeRenderPattern(const GrayCodeCalib* gc, int k, unsigned char* dlpImage){
+	if (gc==NULL || dlpImage==NULL || k<0 || k>=GrayCodeNumPatterns(gc)) return GC_ERROR;
+	int bit, inverse;
+	int axis=PatternBit(gc,k,&bit,&inverse);
+	const int W=gc->DLPwidth;
+	int x,y;
+	if (axis==0){
+		/** Vertical stripes: draw one row and copy it down **/
+		for (x = 0; x < W; x++) {
+			unsigned int on= (((unsigned int) (x ^ (x>>1)) >> bit) & 1) ^ inverse;
+			dlpImage[x]= on ? 255 : 0;
+		}
+		for (y = 1; y < gc->DLPheight; y++) {
+			memcpy(dlpImage + y*W, dlpImage, W);
+		}
+	} else {
+		/** Horizontal stripes: each row is uniform **/
+		for (y = 0; y < gc->DLPheight; y++) {
+			unsigned int on= (((unsigned int) (y ^ (y>>1)) >> bit) & 1) ^ inverse;
+			memset(dlpImage + y*W, on ? 255 : 0, W);
+		}
+	}
+	return GC_OK;
+}
+
+
+int GrayCodeAddCapture(GrayCodeCalib* gc, int k, const unsigned char* camImage){
+	if (gc==NULL || camImage==NULL) return GC_ERROR;
+	if (k!=gc->NumCaptured || k>=GrayCodeNumPatterns(gc)){
+		printf("ERROR! GrayCodeAddCapture() expected pattern %d but got %d.\n",gc->NumCaptured,k);
+		return GC_ERROR;
+	}
+	const int N=gc->CamWidth*gc->CamHeight;
+	if ((k & 1)==0){
+		/** Bitplane: hold on to it until its inverse arrives **/
+		memcpy(gc->PosCapture,camImage,N);
+		gc->NumCaptured++;
+		return GC_OK;
+	}
+
+	/** Inverse: every pixel decides its bit and updates its contrast **/
+	int bit, inverse;
+	int axis=PatternBit(gc,k,&bit,&inverse);
+	unsigned short* code= (axis==0) ? gc->CodeX : gc->CodeY;
+	const unsigned char* pos=gc->PosCapture;
+	unsigned char* contrast=gc->Contrast;
+
+	/** The finest projected bits only count towards the confidence if they are all there is **/
+	int NumBits= (axis==0) ? gc->NumBitsX : gc->NumBitsY;
+	int trusted= (bit >= gc->SkipBits + GC_UNTRUSTED_BITS) || (bit == NumBits-1);
+	int i;
+	for (i = 0; i < N; i++) {
+		int d= (int) pos[i] - (int) camImage[i];
+		int ad= d < 0 ? -d : d;
+		code[i]= (unsigned short) ((code[i] << 1) | (d > 0));
+		if (trusted && ad < contrast[i]) contrast[i]=(unsigned char) ad;
+	}
+	gc->NumCaptured++;
+	return GC_OK;
+}
+
+
+int GrayCodeDecode(GrayCodeCalib* gc){
+	if (gc==NULL) return GC_ERROR;
+	if (gc->NumCaptured!=GrayCodeNumPatterns(gc)){
+		printf("ERROR! GrayCodeDecode() has %d of %d patterns.\n",gc->NumCaptured,GrayCodeNumPatterns(gc));
+		return GC_ERROR;
+	}
+	const int N=gc->CamWidth*gc->CamHeight;
+	const int skip=gc->SkipBits;
+	const int center= skip > 0 ? (1 << skip)/2 : 0;
+	int valid=0;
+	int i;
+	for (i = 0; i < N; i++) {
+		/** The top bits of the Gray code of x are the Gray code of x >> skip **/
+		int x= (int) (GrayToBinary(gc->CodeX[i]) << skip) + center;
+		int y= (int) (GrayToBinary(gc->CodeY[i]) << skip) + center;
+		if (gc->Contrast[i] >= gc->MinContrast && x < gc->DLPwidth && y < gc->DLPheight){
+			gc->DecodedX[i]=x;
+			gc->DecodedY[i]=y;
+			gc->Mask[i]=255;
+			valid++;
+		} else {
+			gc->DecodedX[i]=-1;
+			gc->DecodedY[i]=-1;
+			gc->Mask[i]=0;
+		}
+	}
+	gc->NumValid=valid;
+	printf("Gray code decoded %d of %d camera pixels (%.1f%%).\n",valid,N,100.0*valid/N);
+	return valid;
+}
+
+
+int GrayCodeToLookUp(const GrayCodeCalib* gc, int* CCD2DLPLookUp){
+	if (gc==NULL || CCD2DLPLookUp==NULL) return GC_ERROR;
+	if (gc->CamWidth!=gc->DLPwidth || gc->CamHeight!=gc->DLPheight){
+		printf("ERROR! GrayCodeToLookUp() requires the camera and DLP to be the same size.\n");
+		return GC_ERROR;
+	}
+	/** DLP.x = LookUp[x*nsizey+y], DLP.y = LookUp[nsizex*nsizey + x*nsizey+y] **/
+	const int W=gc->CamWidth;
+	const int H=gc->CamHeight;
+	int* lutX=CCD2DLPLookUp;
+	int* lutY=CCD2DLPLookUp + W*H;
+	int x,y;
+	for (y = 0; y < H; y++) {
+		for (x = 0; x < W; x++) {
+			lutX[x*H+y]=gc->DecodedX[y*W+x];
+			lutY[x*H+y]=gc->DecodedY[y*W+x];
+		}
+	}
+	return GC_OK;
+}
+
+
+
+/**********************************************
+ *
+ * Simulated projector - camera pair
+ *
+ */
+
+#define SIM_PI 3.14159265358979
+
+/*
+ * Uniform random number in (0,1). A private generator so that a
+ * simulation is reproducible and doesn't disturb rand().
+ */
+static double SimUniform(unsigned int* state){
+	*state= *state * 1664525u + 1013904223u;
+	return ((*state >> 8) + 0.5) / 16777216.0;
+}
+
+static double SimGaussian(unsigned int* state){
+	double u1=SimUniform(state);
+	double u2=SimUniform(state);
+	return sqrt(-2*log(u1)) * cos(2*SIM_PI*u2);
+}
+
+/*
+ * Box blur of radius r along rows (dx=1) or columns (dx=width), clamped at the edges.
+ */
+static void SimBoxBlur(const float* src, float* dst, int width, int height, int r, int alongRows){
+	int x,y,j;
+	int len= alongRows ? width : height;
+	int stride= alongRows ? 1 : width;
+	int lines= alongRows ? height : width;
+	int lineStride= alongRows ? width : 1;
+	for (y = 0; y < lines; y++) {
+		const float* s=src + y*lineStride;
+		float* d=dst + y*lineStride;
+		for (x = 0; x < len; x++) {
+			float sum=0;
+			for (j = -r; j <= r; j++) {
+				int t=x+j;
+				if (t < 0) t=0;
+				if (t >= len) t=len-1;
+				sum+=s[t*stride];
+			}
+			d[x*stride]=sum/(2*r+1);
+		}
+	}
+}
+
+
+void SimProjCamTruth(const SimProjCam* sim, double x, double y, double* u, double* v){
+	const double* H=sim->H;
+	double w= H[6]*x + H[7]*y + H[8];
+	*u= (H[0]*x + H[1]*y + H[2]) / w + sim->WarpAmp * sin(2*SIM_PI*x/sim->CamWidth);
+	*v= (H[3]*x + H[4]*y + H[5]) / w + sim->WarpAmp * sin(2*SIM_PI*y/sim->CamHeight);
+}
+
+
+SimProjCam* CreateSimProjCam(int DLPwidth, int DLPheight, int CamWidth, int CamHeight, int BlurRadius, double NoiseSigma){
+	if (DLPwidth<1 || DLPheight<1 || CamWidth<1 || CamHeight<1) return NULL;
+	SimProjCam* sim=(SimProjCam*) malloc(sizeof(SimProjCam));
+	sim->DLPwidth=DLPwidth;
+	sim->DLPheight=DLPheight;
+	sim->CamWidth=CamWidth;
+	sim->CamHeight=CamHeight;
+	sim->BlurRadius= BlurRadius < 0 ? 0 : BlurRadius;
+	sim->NoiseSigma=NoiseSigma;
+	sim->Ambient=20;
+	sim->Bright=200;
+	sim->Seed=1;
+	sim->WarpAmp=2.0;
+
+	/** Camera center maps near the DLP center, rotated by 1.5 degrees and scaled by 0.97, with a hint of perspective **/
+	double th=1.5*SIM_PI/180;
+	double s=0.97;
+	double cx=CamWidth/2.0, cy=CamHeight/2.0;
+	double dx=DLPwidth/2.0 + 6, dy=DLPheight/2.0 - 4;
+	sim->H[0]= s*cos(th); sim->H[1]=-s*sin(th); sim->H[2]= dx - sim->H[0]*cx - sim->H[1]*cy;
+	sim->H[3]= s*sin(th); sim->H[4]= s*cos(th); sim->H[5]= dy - sim->H[3]*cx - sim->H[4]*cy;
+	sim->H[6]= 0; sim->H[7]= 0; sim->H[8]= 1;
+
+	int N=CamWidth*CamHeight;
+	sim->SourceIndex=(int*) malloc(N*sizeof(int));
+	sim->Scratch=(float*) malloc(N*sizeof(float));
+	sim->Scratch2=(float*) malloc(N*sizeof(float));
+	int x,y;
+	double u,v;
+	for (y = 0; y < CamHeight; y++) {
+		for (x = 0; x < CamWidth; x++) {
+			SimProjCamTruth(sim,x,y,&u,&v);
+			int mx=(int) floor(u+0.5);
+			int my=(int) floor(v+0.5);
+			sim->SourceIndex[y*CamWidth+x]= (mx>=0 && my>=0 && mx<DLPwidth && my<DLPheight) ? my*DLPwidth+mx : -1;
+		}
+	}
+	return sim;
+}
+
+void DestroySimProjCam(SimProjCam** sim){
+	if (sim==NULL || *sim==NULL) return;
+	free((*sim)->SourceIndex);
+	free((*sim)->Scratch);
+	free((*sim)->Scratch2);
+	free(*sim);
+	*sim=NULL;
+}
+
+
+int SimProjCamCapture(SimProjCam* sim, const unsigned char* dlpImage, unsigned char* camImage){
+	if (sim==NULL || dlpImage==NULL || camImage==NULL) return GC_ERROR;
+	const int W=sim->CamWidth;
+	const int H=sim->CamHeight;
+	const int N=W*H;
+	float* img=sim->Scratch;
+	int i,pass;
+
+	/** Project **/
+	for (i = 0; i < N; i++) {
+		int src=sim->SourceIndex[i];
+		img[i]= (src>=0 && dlpImage[src]) ? sim->Bright : sim->Ambient;
+	}
+
+	/** Defocus: two passes of a separable box blur are close to a gaussian **/
+	if (sim->BlurRadius > 0){
+		for (pass = 0; pass < 2; pass++) {
+			SimBoxBlur(img,sim->Scratch2,W,H,sim->BlurRadius,1);
+			SimBoxBlur(sim->Scratch2,img,W,H,sim->BlurRadius,0);
+		}
+	}
+
+	/** Sensor noise and quantization **/
+	for (i = 0; i < N; i++) {
+		double val=img[i];
+		if (sim->NoiseSigma > 0) val+= sim->NoiseSigma * SimGaussian(&(sim->Seed));
+		if (val < 0) val=0;
+		if (val > 255) val=255;
+		camImage[i]=(unsigned char) (val+0.5 > 255 ? 255 : val+0.5);
+	}
+	return GC_OK;
+}
@@ -0,0 +1,191 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * GrayCode.h
+ *
+ * Structured light calibration of the DLP against the camera.
+ *
+ * Instead of scanning one spot at a time, the DLP projects a Gray code
+ * bitplane for each bit of the mirror x coordinate and each bit of the
+ * mirror y coordinate, each followed by its inverse. Every camera pixel
+ * compares how bright it is in a bitplane and in its inverse, which gives
+ * that bit of the mirror coordinate it is looking at. So after
+ * 2*(ceil(log2(W)) + ceil(log2(H))) frames every camera pixel has a mirror
+ * coordinate.
+ *
+ * The smallest |bitplane - inverse| difference is kept as the confidence of
+ * a pixel. Pixels below the contrast threshold (outside of the DLP field, or
+ * where the stripes are blurred out) are masked. The finest projected bit is
+ * decoded but left out of the confidence: defocus wipes out its contrast
+ * first, and since neighbouring Gray codes differ in one bit, getting it
+ * wrong only moves the coordinate by one stripe.
+ *
+ * The finest bits can be skipped altogether with SkipBits, in which case
+ * each decoded coordinate is the center of a stripe 2^SkipBits mirrors wide.
+ *
+ * Also contains a simulated projector-camera pair with a known warp, blur
+ * and noise, so the decoder can be exercised without any hardware.
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef GRAYCODE_H_
+#define GRAYCODE_H_
+
+/** Return Values **/
+#define GC_OK 0
+#define GC_ERROR -1
+
+/** Default minimum |bitplane - inverse| intensity difference for a bit to be trusted **/
+#define GC_DEFAULT_MIN_CONTRAST 10
+
+/** Number of finest projected bits that are decoded but left out of the confidence **/
+#define GC_UNTRUSTED_BITS 1
+
+typedef struct GrayCodeCalibStruct{
+	/** Geometry **/
+	int DLPwidth;
+	int DLPheight;
+	int CamWidth;
+	int CamHeight;
+	int NumBitsX; /** ceil(log2(DLPwidth)) **/
+	int NumBitsY; /** ceil(log2(DLPheight)) **/
+	int SkipBits; /** number of finest bits that are not projected **/
+	int MinContrast;
+
+	/** Decoding state, one entry per camera pixel, row-major **/
+	unsigned short* CodeX; /** Gray code bits of the mirror x coordinate received so far **/
+	unsigned short* CodeY;
+	unsigned char* Contrast; /** min |bitplane - inverse| over the trusted bits so far **/
+	unsigned char* PosCapture; /** camera image of the last bitplane, waiting for its inverse **/
+	int NumCaptured;
+
+	/** Results of GrayCodeDecode() **/
+	int* DecodedX; /** mirror coordinate seen by each camera pixel, -1 if masked **/
+	int* DecodedY;
+	unsigned char* Mask; /** 255 where DecodedX/DecodedY are valid, 0 otherwise **/
+	int NumValid;
+} GrayCodeCalib;
+
+
+/*
+ * Allocate a Gray code calibration for a DLP of DLPwidth x DLPheight mirrors
+ * observed by a camera of CamWidth x CamHeight pixels.
+ *
+ * Returns NULL on error.
+ * Don't forget to call DestroyGrayCodeCalib()
+ */
+GrayCodeCalib* CreateGrayCodeCalib(int DLPwidth, int DLPheight, int CamWidth, int CamHeight, int SkipBits, int MinContrast);
+
+void DestroyGrayCodeCalib(GrayCodeCalib** gc);
+
+/*
+ * Total number of patterns to project (bitplanes and their inverses)
+ */
+int GrayCodeNumPatterns(const GrayCodeCalib* gc);
+
+/*
+ * Draw pattern k (0 <= k < GrayCodeNumPatterns()) into the row-major
+ * DLPwidth x DLPheight image dlpImage as 0 and 255.
+ * Even k are bitplanes, odd k are the inverse of the preceding bitplane.
+ * The x bits come first, most significant bit first, then the y bits.
+ */
+int GrayCodeRenderPattern(const GrayCodeCalib* gc, int k, unsigned char* dlpImage);
+
+/*
+ * Hand the camera image that was captured while pattern k was projected
+ * to the decoder. Patterns must be added in order, starting at 0.
+ */
+int GrayCodeAddCapture(GrayCodeCalib* gc, int k, const unsigned char* camImage);
+
+/*
+ * After all of the patterns have been captured, convert the Gray codes of
+ * every camera pixel to mirror coordinates and build the confidence mask.
+ * Returns the number of valid camera pixels, or GC_ERROR.
+ */
+int GrayCodeDecode(GrayCodeCalib* gc);
+
+/*
+ * Write the dense correspondences as a lookup table in the layout of
+ * CalibData->CCD2DLPLookUp (see TransformLib.h). Masked pixels get -1.
+ * The camera and DLP must be the same size, as for the lookup table.
+ */
+int GrayCodeToLookUp(const GrayCodeCalib* gc, int* CCD2DLPLookUp);
+
+
+/**********************************************
+ *
+ * Simulated projector - camera pair
+ *
+ */
+
+typedef struct SimProjCamStruct{
+	int DLPwidth;
+	int DLPheight;
+	int CamWidth;
+	int CamHeight;
+
+	/** Known warp: homography camera -> DLP plus a smooth sinusoidal distortion **/
+	double H[9];
+	double WarpAmp; /** amplitude of the distortion in mirrors **/
+
+	/** Optics and sensor **/
+	int BlurRadius; /** box blur radius in camera pixels, applied twice **/
+	double NoiseSigma; /** gaussian read noise in intensity units **/
+	int Ambient; /** intensity with the mirrors off **/
+	int Bright; /** intensity with the mirrors on **/
+	unsigned int Seed;
+
+	/** Precomputed, per camera pixel: index of the mirror it sees, -1 if none **/
+	int* SourceIndex;
+	float* Scratch;
+	float* Scratch2;
+} SimProjCam;
+
+/*
+ * Create a simulated projector-camera pair with a fixed, slightly rotated,
+ * scaled and distorted warp. BlurRadius and NoiseSigma set how bad the optics are.
+ * Returns NULL on error.
+ */
+SimProjCam* CreateSimProjCam(int DLPwidth, int DLPheight, int CamWidth, int CamHeight, int BlurRadius, double NoiseSigma);
+
+void DestroySimProjCam(SimProjCam** sim);
+
+/*
+ * The camera image you would get while the DLP shows dlpImage.
+ */
+int SimProjCamCapture(SimProjCam* sim, const unsigned char* dlpImage, unsigned char* camImage);
+
+/*
+ * The true mirror coordinate (*u,*v) seen by camera pixel (x,y)
+ */
+void SimProjCamTruth(const SimProjCam* sim, double x, double y, double* u, double* v);
+
+#endif /* GRAYCODE_H_ */
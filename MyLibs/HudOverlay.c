@@ -0,0 +1,299 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * HudOverlay.c
+ *
+ * Heads up display snapshots and their rendering.
+ * See HudOverlay.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include <cxcore.h>
+#include <cv.h>
+#include "opencv2/imgproc/imgproc_c.h"
+
+#include "HudOverlay.h"
+
+/** Set in HudOverlay.Ready when the ready slot has not been taken yet **/
+#define HUD_FRESH 4
+
+#define HUD_WHITE cvScalar(255,255,255)
+
+static const char* HudLabelText[HUD_NUM_LABELS]={
+		"DLP ON",
+		"Floodlight",
+		"Step ",
+		"Recording",
+		"Did you forget to record?",
+		"Tracking",
+		"NOT Tracking!!"};
+
+
+/*
+ * Render text once into its own image.
+ */
+static int RenderGlyph(HudGlyph* g, const char* text, CvFont* font){
+	CvSize size;
+	int baseline;
+	cvGetTextSize(text,font,&size,&baseline);
+
+	/** Leave room for the thick, antialiased strokes **/
+	int m=font->thickness+1;
+	g->img=cvCreateImage(cvSize(size.width+2*m,size.height+baseline+2*m),IPL_DEPTH_8U,1);
+	if (g->img==NULL){
+		printf("Error! Unable to allocate the HUD glyph for \"%s\".\n",text);
+		return HUD_ERROR;
+	}
+	cvZero(g->img);
+	g->margin=m;
+	g->ascent=m+size.height;
+	g->advance=size.width-font->thickness;
+	cvPutText(g->img,text,cvPoint(m,g->ascent),font,HUD_WHITE);
+	return HUD_OK;
+}
+
+/*
+ * Stamp a glyph onto dest with its text origin at org, as cvPutText() would.
+ * The glyph is white on black, so taking the max draws white text.
+ * Only headers are made for the sub images, so the glyph is never modified.
+ */
+static void StampGlyph(IplImage* dest, const HudGlyph* g, CvPoint org){
+	int x=org.x-g->margin;
+	int y=org.y-g->ascent;
+	int x0= x<0 ? 0 : x;
+	int y0= y<0 ? 0 : y;
+	int x1= x+g->img->width > dest->width ? dest->width : x+g->img->width;
+	int y1= y+g->img->height > dest->height ? dest->height : y+g->img->height;
+	if (x1<=x0 || y1<=y0) return;
+
+	CvMat dsub, gsub;
+	cvGetSubRect(dest,&dsub,cvRect(x0,y0,x1-x0,y1-y0));
+	cvGetSubRect(g->img,&gsub,cvRect(x0-x,y0-y,x1-x0,y1-y0));
+	cvMax(&dsub,&gsub,&dsub);
+}
+
+/*
+ * Stamp a non-negative number one prerendered digit at a time.
+ */
+static void StampNumber(IplImage* dest, HudOverlay* hud, int n, CvPoint org){
+	char digits[16];
+	sprintf(digits,"%d",n<0 ? 0 : n);
+	for (int k = 0; digits[k]!='\0'; ++k) {
+		const HudGlyph* g=&(hud->Digit[digits[k]-'0']);
+		StampGlyph(dest,g,org);
+		org.x+=g->advance;
+	}
+}
+
+
+/*
+ * Allocates the snapshots and renders the glyphs.
+ */
+HudOverlay* CreateHudOverlay(CvSize size){
+	HudOverlay* hud=(HudOverlay*) calloc(1,sizeof(HudOverlay));
+	if (hud==NULL){
+		printf("Error! Unable to allocate the HUD overlay.\n");
+		return NULL;
+	}
+	hud->Back=0;
+	hud->Ready=1;
+	hud->Front=2;
+
+	/** Same font the heads up display always used **/
+	cvInitFont(&(hud->font),CV_FONT_HERSHEY_TRIPLEX ,1.0,1.0,0,2,CV_AA);
+
+	int ret=HUD_OK;
+	for (int k = 0; k < 3; ++k) {
+		hud->Slot[k].Img=cvCreateImage(size,IPL_DEPTH_8U,1);
+		if (hud->Slot[k].Img==NULL){
+			printf("Error! Unable to allocate the HUD frame buffers.\n");
+			ret=HUD_ERROR;
+		} else {
+			cvZero(hud->Slot[k].Img);
+		}
+	}
+	for (int k = 0; k < HUD_NUM_LABELS; ++k) {
+		if (RenderGlyph(&(hud->Label[k]),HudLabelText[k],&(hud->font))!=HUD_OK) ret=HUD_ERROR;
+	}
+	char digit[2]={'0','\0'};
+	for (int k = 0; k < 10; ++k) {
+		digit[0]='0'+k;
+		if (RenderGlyph(&(hud->Digit[k]),digit,&(hud->font))!=HUD_OK) ret=HUD_ERROR;
+	}
+	if (ret!=HUD_OK) DestroyHudOverlay(&hud);
+	return hud;
+}
+
+void DestroyHudOverlay(HudOverlay** hud){
+	if (hud==NULL || *hud==NULL) return;
+	for (int k = 0; k < 3; ++k) {
+		if ((*hud)->Slot[k].Img!=NULL) cvReleaseImage(&((*hud)->Slot[k].Img));
+	}
+	for (int k = 0; k < HUD_NUM_LABELS; ++k) {
+		if ((*hud)->Label[k].img!=NULL) cvReleaseImage(&((*hud)->Label[k].img));
+	}
+	for (int k = 0; k < 10; ++k) {
+		if ((*hud)->Digit[k].img!=NULL) cvReleaseImage(&((*hud)->Digit[k].img));
+	}
+	free(*hud);
+	*hud=NULL;
+}
+
+
+/*
+ * The snapshot the producer should fill in for this frame.
+ */
+HudSnapshot* HUD_BackSnapshot(HudOverlay* hud){
+	if (hud==NULL) return NULL;
+	return &(hud->Slot[hud->Back]);
+}
+
+/*
+ * Copy a boundary into a snapshot, decimating it if it is too long.
+ */
+void HUD_SetBoundary(HudSnapshot* snap, CvSeq* Boundary){
+	if (snap==NULL) return;
+	snap->NumBoundPts=0;
+	if (Boundary==NULL || Boundary->total<=0) return;
+
+	int step=(Boundary->total + HUD_MAX_BOUND_PTS-1) / HUD_MAX_BOUND_PTS;
+	if (step==1){
+		cvCvtSeqToArray(Boundary,snap->Boundary,CV_WHOLE_SEQ);
+		snap->NumBoundPts=Boundary->total;
+		return;
+	}
+	for (int k = 0; k < Boundary->total; k+=step) {
+		snap->Boundary[snap->NumBoundPts++]=*CV_GET_SEQ_ELEM(CvPoint,Boundary,k);
+	}
+}
+
+/*
+ * Make the back snapshot the latest one.
+ */
+void HUD_Publish(HudOverlay* hud){
+	if (hud==NULL) return;
+	/** Whatever was in the ready slot becomes our new back slot **/
+	hud->Back=InterlockedExchange(&(hud->Ready),hud->Back | HUD_FRESH) & ~HUD_FRESH;
+}
+
+/*
+ * The latest published snapshot, or NULL if there is nothing new.
+ */
+const HudSnapshot* HUD_TakeLatest(HudOverlay* hud){
+	if (hud==NULL || !(hud->Ready & HUD_FRESH)) return NULL;
+	/** Hand back the slot we were showing and take the fresh one **/
+	hud->Front=InterlockedExchange(&(hud->Ready),hud->Front) & ~HUD_FRESH;
+	return &(hud->Slot[hud->Front]);
+}
+
+
+/*
+ * Draw the heads up display of snap over its camera image into dest.
+ */
+int HUD_Render(HudOverlay* hud, const HudSnapshot* snap, IplImage* illum, IplImage* dest){
+	if (hud==NULL || snap==NULL || snap->Img==NULL || dest==NULL) return HUD_ERROR;
+	IplImage* orig=snap->Img;
+	int CircleDiameterSize=10;
+
+	if (snap->Raw){
+		cvCopy(orig,dest);
+		return HUD_OK;
+	}
+
+	if (!(snap->FluorMode)){
+		/** Overlay a translucent image of the illumination pattern **/
+		if (illum!=NULL){
+			double weighting=0.20; //Alpha blend weighting
+			if (snap->DLPOn) weighting=0.45; // if DLP is on make the illumination pattern more opaque
+			cvAddWeighted(orig,1,illum,weighting,0,dest);
+		} else {
+			cvCopy(orig,dest);
+		}
+		for (int k = 0; k < snap->NumBoundPts; ++k) cvCircle(dest,snap->Boundary[k],1,HUD_WHITE,1);
+		if (snap->HeadTailKnown){
+			cvCircle(dest,snap->tail,CircleDiameterSize,HUD_WHITE,1,CV_AA,0);
+			cvCircle(dest,snap->head,CircleDiameterSize/2,HUD_WHITE,1,CV_AA,0);
+		}
+
+	} else {
+		cvCopy(orig,dest);
+		/** Draw A Circle on the centroid of the fluorescent blob **/
+		if (snap->isPresent){
+			cvCircle(dest,snap->centroid,CircleDiameterSize*2,HUD_WHITE,1,CV_AA,0);
+			for (int k = 0; k < snap->NumBoundPts; ++k) cvCircle(dest,snap->Boundary[k],1,HUD_WHITE,1);
+
+			/** Show where the worm is predicted to be when the pattern lands **/
+			if (snap->PredApplied){
+				cvLine(dest,snap->centroid,snap->predicted,HUD_WHITE,1,CV_AA,0);
+				cvCircle(dest,snap->predicted,CircleDiameterSize/2,HUD_WHITE,1,CV_AA,0);
+			}
+		}
+	}
+
+	/** Display DLP On Off **/
+	if (snap->DLPOn) StampGlyph(dest,&(hud->Label[HUD_DLP_ON]),cvPoint(20,70));
+
+	/*** Let the user know if the illumination flood light is on ***/
+	if (snap->FloodLight) StampGlyph(dest,&(hud->Label[HUD_FLOOD]),cvPoint(20,130));
+
+	/** If we are using protocols, display the protocol number **/
+	if (snap->ProtocolUse){
+		StampGlyph(dest,&(hud->Label[HUD_STEP]),cvPoint(20,160));
+		StampNumber(dest,hud,snap->ProtocolStep,cvPoint(20+hud->Label[HUD_STEP].advance,160));
+	}
+
+	/** Display Recording if we are recording **/
+	if (snap->Record){
+		StampGlyph(dest,&(hud->Label[HUD_RECORDING]),cvPoint(20,100));
+	} else if (snap->DLPOn){
+		StampGlyph(dest,&(hud->Label[HUD_FORGOT_TO_RECORD]),cvPoint(20,100));
+	}
+
+	StampNumber(dest,hud,snap->frameNum,cvPoint(dest->width-200,dest->height-10));
+
+	/** Display the Field of View Circle indicator **/
+	if (snap->ApertureOn) cvCircle(dest,snap->Aperture,snap->ApertureR,HUD_WHITE,1,CV_AA,0);
+
+	/** Target for stage recentering, and the tracker status **/
+	cvRectangle(dest,cvPoint(snap->stageTarget.x+5,snap->stageTarget.y+5),
+			cvPoint(snap->stageTarget.x-5,snap->stageTarget.y-5),HUD_WHITE,2);
+	if (snap->stageTrackingOn){
+		StampGlyph(dest,&(hud->Label[HUD_TRACKING]),cvPoint(20,130));
+	} else {
+		StampGlyph(dest,&(hud->Label[HUD_NOT_TRACKING]),cvPoint(150,300));
+	}
+	return HUD_OK;
+}
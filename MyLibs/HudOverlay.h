@@ -0,0 +1,182 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * HudOverlay.h
+ *
+ * The heads up display, split into what the analysis thread knows and the
+ * pixels that show it.
+ *
+ * Every frame the analysis thread fills in a HudSnapshot: a copy of the
+ * camera image, the boundary, centroid, head and tail, the stage target
+ * and the on/off flags and numbers that are printed on the screen. A plain
+ * copy is much cheaper than a full frame blend and half a dozen
+ * cvPutText() calls.
+ *
+ * Snapshots are handed over through a lock-free triple buffer: the
+ * producer fills its back slot and swaps it with the ready slot with one
+ * InterlockedExchange(), and a consumer swaps its front slot with the
+ * ready slot only if something new was published. Neither side ever
+ * waits, and since each slot has its own image the consumer always gets a
+ * complete frame that the producer is no longer writing to. There is one consumer (the display thread); the recording writer
+ * runs on the analysis thread and renders the back slot before it is
+ * published.
+ *
+ * HUD_Render() rasterizes a snapshot over a camera image. Text is stamped
+ * from glyphs that were rendered once in CreateHudOverlay(), so drawing
+ * the labels is a handful of small cvMax() calls. The glyphs are only
+ * read, so several threads may render at the same time.
+ *
+ * Depends on windows.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef HUDOVERLAY_H_
+#define HUDOVERLAY_H_
+
+#include <windows.h>
+#include <cxcore.h>
+
+/** Longer boundaries are decimated to fit **/
+#define HUD_MAX_BOUND_PTS 2048
+
+/** Labels that are prerendered **/
+#define HUD_DLP_ON 0
+#define HUD_FLOOD 1
+#define HUD_STEP 2
+#define HUD_RECORDING 3
+#define HUD_FORGOT_TO_RECORD 4
+#define HUD_TRACKING 5
+#define HUD_NOT_TRACKING 6
+#define HUD_NUM_LABELS 7
+
+/** Return Values **/
+#define HUD_OK 0
+#define HUD_ERROR -1
+
+/** Everything that goes on the heads up display for one frame **/
+typedef struct HudSnapshotStruct{
+	int frameNum;
+	IplImage* Img; /** the camera image, owned by the slot **/
+	int Raw; /** only show Img, without any overlay **/
+
+	/** Worm **/
+	int FluorMode;
+	int isPresent;
+	CvPoint centroid;
+	int PredApplied; /** draw the predicted centroid too **/
+	CvPoint predicted;
+	int HeadTailKnown; /** head and tail are only drawn if this is set **/
+	CvPoint head;
+	CvPoint tail;
+	int NumBoundPts;
+	CvPoint Boundary[HUD_MAX_BOUND_PTS];
+
+	/** Stage **/
+	CvPoint stageTarget;
+	int stageTrackingOn;
+
+	/** Flags and numbers **/
+	int DLPOn;
+	int FloodLight;
+	int ProtocolUse;
+	int ProtocolStep;
+	int Record;
+	int ApertureOn;
+	CvPoint Aperture;
+	int ApertureR;
+} HudSnapshot;
+
+/** A line of text rendered once, white on black **/
+typedef struct HudGlyphStruct{
+	IplImage* img;
+	int ascent; /** rows from the top of img to the baseline **/
+	int margin; /** columns from the left of img to the text origin **/
+	int advance; /** how far the text origin moves on **/
+} HudGlyph;
+
+typedef struct HudOverlayStruct{
+	/** Triple buffer **/
+	HudSnapshot Slot[3];
+	int Back; /** owned by the producer **/
+	volatile LONG Ready; /** slot index, | HUD_FRESH if not yet taken **/
+	int Front; /** owned by the consumer **/
+
+	/** Prerendered text **/
+	CvFont font;
+	HudGlyph Label[HUD_NUM_LABELS];
+	HudGlyph Digit[10];
+} HudOverlay;
+
+
+/*
+ * Allocates the snapshots, each with an 8 bit image of size, and renders
+ * the glyphs.
+ * Returns NULL on error.
+ */
+HudOverlay* CreateHudOverlay(CvSize size);
+
+void DestroyHudOverlay(HudOverlay** hud);
+
+/*
+ * The snapshot the producer should fill in for this frame.
+ * Producer thread only.
+ */
+HudSnapshot* HUD_BackSnapshot(HudOverlay* hud);
+
+/*
+ * Copy a boundary into a snapshot, decimating it if it has more than
+ * HUD_MAX_BOUND_PTS points. Boundary may be NULL.
+ */
+void HUD_SetBoundary(HudSnapshot* snap, CvSeq* Boundary);
+
+/*
+ * Make the back snapshot the latest one. Never blocks.
+ * Producer thread only.
+ */
+void HUD_Publish(HudOverlay* hud);
+
+/*
+ * The latest published snapshot, or NULL if nothing was published since the
+ * last call. The snapshot stays valid until the next call.
+ * Consumer thread only.
+ */
+const HudSnapshot* HUD_TakeLatest(HudOverlay* hud);
+
+/*
+ * Draw the heads up display of snap over its camera image into dest.
+ * In worm (non fluorescence) mode illum, if not NULL, is blended in
+ * translucently, more opaque when the DLP is on.
+ * All images are 8 bit single channel and the same size.
+ * Returns HUD_OK or HUD_ERROR.
+ */
+int HUD_Render(HudOverlay* hud, const HudSnapshot* snap, IplImage* illum, IplImage* dest);
+
+#endif /* HUDOVERLAY_H_ */
@@ -0,0 +1,441 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * IllumScheduler.c
+ *
+ * Switches the illumination on and off at precise times.
+ * See IllumScheduler.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <windows.h>
+#include <mmsystem.h>
+
+#include "PackedPattern.h"
+#include "LatencyTrace.h"
+#include "DLPOutput.h"
+#include "IllumScheduler.h"
+
+/** With nothing scheduled, how often the thread checks whether it should quit (ms) **/
+#define IS_POLL_TIME 50
+
+
+/*
+ * Should the illumination be on at time t? Also returns the next time
+ * that could change the answer in next, or -1 if there is none.
+ * Call with the lock held.
+ */
+static int IS_WantOn(IllumScheduler* is, double t, double* next){
+	int on;
+	*next=-1;
+
+	if (is->CycleOn){
+		double period=is->CycleOnTime + is->CycleOffTime;
+		double k=floor((t - is->CycleStart)/period);
+		double periodStart=is->CycleStart + k*period;
+		if (t - periodStart < is->CycleOnTime){
+			on=1;
+			*next=periodStart + is->CycleOnTime;
+		} else {
+			on=0;
+			*next=periodStart + period;
+		}
+	} else {
+		on=is->SteadyOn;
+	}
+
+	if (is->PulseActive){
+		if (t < is->PulseEnd){
+			on=1;
+			if (*next<0 || is->PulseEnd<*next) *next=is->PulseEnd;
+		} else {
+			is->PulseActive=0;
+		}
+	}
+	return on;
+}
+
+
+/*
+ * Put the latest pattern (on) or the dark pattern (off) on the mirrors and
+ * log the edge. Call with the lock held.
+ */
+static void IS_Switch(IllumScheduler* is, int on, double due){
+	int seq;
+	if (on){
+		seq=DLPOut_SubmitPacked(is->dlp,is->Latest,is->LatestFrame);
+	} else {
+		seq=DLPOut_SubmitPacked(is->dlp,is->Dark,-1);
+	}
+	is->IsOn=on;
+
+	IllumEdge* edge=&(is->Log[is->LogCount % IS_LOG_SIZE]);
+	edge->on=on;
+	edge->due=due;
+	edge->issued=LT_Now();
+	edge->switched=0;
+	edge->seq=seq;
+	is->LogCount++;
+	if (is->LogCount - is->NumResolved > IS_LOG_SIZE) is->NumResolved=is->LogCount - IS_LOG_SIZE;
+}
+
+
+/*
+ * Fill in when the mirrors actually switched for edges whose upload has finished.
+ * Call with the lock held.
+ */
+static void IS_ResolveEdges(IllumScheduler* is){
+	DLPUploadRecord rec;
+	while (is->NumResolved < is->LogCount){
+		IllumEdge* edge=&(is->Log[is->NumResolved % IS_LOG_SIZE]);
+		if (edge->seq<0){
+			edge->switched=-1;
+		} else if (DLPOut_FindUpload(is->dlp,edge->seq,&rec)==DLPOUT_OK){
+			edge->switched=rec.completed;
+		} else {
+			break;
+		}
+		is->NumResolved++;
+	}
+}
+
+
+/*
+ * Wait until deadline, or until a request comes in.
+ * Sleeps until IS_SPIN_MS before the deadline and spins the rest of the way,
+ * because Sleep() and friends are only good to a millisecond or so.
+ */
+static void IS_WaitUntil(IllumScheduler* is, double deadline){
+	if (deadline<0){
+		WaitForSingleObject(is->Changed,IS_POLL_TIME);
+		return;
+	}
+	double left=deadline - LT_Now();
+	if (left > IS_SPIN_MS){
+		DWORD ms=(DWORD) (left - IS_SPIN_MS);
+		if (ms > IS_POLL_TIME) ms=IS_POLL_TIME;
+		if (WaitForSingleObject(is->Changed,ms)==WAIT_OBJECT_0) return;
+		if (deadline - LT_Now() > IS_SPIN_MS) return;
+	}
+	while (LT_Now() < deadline && !is->StopRequested) Sleep(0);
+}
+
+
+/*
+ * Body of the scheduler thread.
+ */
+DWORD WINAPI IllumSchedulerThread(LPVOID lpParam){
+	IllumScheduler* is=(IllumScheduler*) lpParam;
+	double deadline=-1;
+
+	while (!is->StopRequested){
+		EnterCriticalSection(&(is->lock));
+		double now=LT_Now();
+		double next;
+		int on=IS_WantOn(is,now,&next);
+		if (on!=is->IsOn){
+			/** A deadline that has passed is what caused the edge, otherwise a request did **/
+			double due= (deadline>=0 && deadline<=now) ? deadline : is->RequestTime;
+			IS_Switch(is,on,due);
+		}
+		IS_ResolveEdges(is);
+		deadline=next;
+		LeaveCriticalSection(&(is->lock));
+
+		IS_WaitUntil(is,deadline);
+	}
+	return 0;
+}
+
+
+/*
+ * Start the scheduler thread.
+ */
+IllumScheduler* StartIllumScheduler(DLPOutput* dlp, int width, int height){
+	if (dlp==NULL){
+		printf("Error! StartIllumScheduler() needs a DLP output.\n");
+		return NULL;
+	}
+	IllumScheduler* is=(IllumScheduler*) malloc(sizeof(IllumScheduler));
+	if (is==NULL) return NULL;
+	memset(is,0,sizeof(IllumScheduler));
+
+	is->dlp=dlp;
+	is->LatestFrame=-1;
+	is->Latest=CreatePackedPattern(width,height);
+	is->Dark=CreatePackedPattern(width,height);
+	if (is->Latest==NULL || is->Dark==NULL){
+		printf("Error! Unable to allocate illumination scheduler patterns.\n");
+		DestroyPackedPattern(&(is->Latest));
+		DestroyPackedPattern(&(is->Dark));
+		free(is);
+		return NULL;
+	}
+
+	InitializeCriticalSection(&(is->lock));
+	is->Changed=CreateEvent(NULL,FALSE,FALSE,NULL);
+
+	/** Ask Windows for 1 ms timer resolution so that the thread wakes up close to its deadlines **/
+	timeBeginPeriod(1);
+
+	DWORD dwThreadId;
+	is->Thread=CreateThread(NULL,0,IllumSchedulerThread,(void*) is,0,&dwThreadId);
+	if (is->Thread==NULL){
+		printf("Error! Cannot create illumination scheduler thread.\n");
+		timeEndPeriod(1);
+		CloseHandle(is->Changed);
+		DeleteCriticalSection(&(is->lock));
+		DestroyPackedPattern(&(is->Latest));
+		DestroyPackedPattern(&(is->Dark));
+		free(is);
+		return NULL;
+	}
+	SetThreadPriority(is->Thread,THREAD_PRIORITY_TIME_CRITICAL);
+	return is;
+}
+
+
+/*
+ * Hand the scheduler the newest pattern.
+ */
+int IllumSched_SetPattern(IllumScheduler* is, const PackedPattern* pat, int frame){
+	if (is==NULL || pat==NULL) return IS_ERROR;
+	int ret=IS_OK;
+	EnterCriticalSection(&(is->lock));
+	if (CopyPackedPattern(pat,is->Latest)!=0){
+		printf("Error! Pattern handed to IllumSched_SetPattern() is the wrong size.\n");
+		ret=IS_ERROR;
+	} else {
+		is->LatestFrame=frame;
+		if (is->IsOn) DLPOut_SubmitPacked(is->dlp,is->Latest,frame);
+	}
+	LeaveCriticalSection(&(is->lock));
+	return ret;
+}
+
+
+/*
+ * Illumination on or off whenever no pulse or cycle is running.
+ */
+void IllumSched_SetSteady(IllumScheduler* is, int on){
+	if (is==NULL) return;
+	EnterCriticalSection(&(is->lock));
+	int changed= (is->SteadyOn!=(on!=0));
+	if (changed){
+		is->SteadyOn=(on!=0);
+		is->RequestTime=LT_Now();
+	}
+	LeaveCriticalSection(&(is->lock));
+	if (changed) SetEvent(is->Changed);
+}
+
+
+/*
+ * Turn the illumination on now for duration ms.
+ */
+int IllumSched_Pulse(IllumScheduler* is, double duration){
+	if (is==NULL || duration<=0) return IS_ERROR;
+	EnterCriticalSection(&(is->lock));
+	is->RequestTime=LT_Now();
+	is->PulseActive=1;
+	is->PulseEnd=is->RequestTime + duration;
+	LeaveCriticalSection(&(is->lock));
+	SetEvent(is->Changed);
+	return IS_OK;
+}
+
+
+/*
+ * Cycle the illumination on for onTime ms, then off for offTime ms.
+ */
+int IllumSched_SetCycle(IllumScheduler* is, int on, double onTime, double offTime){
+	if (is==NULL) return IS_ERROR;
+	if (on && (onTime<=0 || offTime<0)) return IS_ERROR;
+	EnterCriticalSection(&(is->lock));
+	int changed;
+	if (on){
+		changed= !is->CycleOn || is->CycleOnTime!=onTime || is->CycleOffTime!=offTime;
+		if (changed){
+			is->RequestTime=LT_Now();
+			is->CycleStart=is->RequestTime;
+			is->CycleOnTime=onTime;
+			is->CycleOffTime=offTime;
+			is->CycleOn=1;
+		}
+	} else {
+		changed=is->CycleOn;
+		if (changed){
+			is->RequestTime=LT_Now();
+			is->CycleOn=0;
+		}
+	}
+	LeaveCriticalSection(&(is->lock));
+	if (changed) SetEvent(is->Changed);
+	return IS_OK;
+}
+
+
+int IllumSched_PulseActive(IllumScheduler* is){
+	if (is==NULL) return 0;
+	EnterCriticalSection(&(is->lock));
+	int active=is->PulseActive;
+	LeaveCriticalSection(&(is->lock));
+	return active;
+}
+
+int IllumSched_IsOn(IllumScheduler* is){
+	if (is==NULL) return 0;
+	EnterCriticalSection(&(is->lock));
+	int on=is->IsOn;
+	LeaveCriticalSection(&(is->lock));
+	return on;
+}
+
+
+/*
+ * Copy the edge log, oldest first. Returns the number of edges or -1.
+ * The copy must be freed by the caller.
+ */
+static int IS_Snapshot(IllumScheduler* is, IllumEdge** copy){
+	*copy=(IllumEdge*) malloc(IS_LOG_SIZE*sizeof(IllumEdge));
+	if (*copy==NULL) return -1;
+	EnterCriticalSection(&(is->lock));
+	IS_ResolveEdges(is);
+	int n= is->LogCount < IS_LOG_SIZE ? is->LogCount : IS_LOG_SIZE;
+	int first=is->LogCount - n;
+	for (int k = 0; k < n; ++k) (*copy)[k]=is->Log[(first+k) % IS_LOG_SIZE];
+	LeaveCriticalSection(&(is->lock));
+	return n;
+}
+
+
+/*
+ * Print how late the edges were and how long the pulses lasted.
+ */
+void IllumSched_PrintReport(IllumScheduler* is, FILE* out){
+	if (is==NULL || out==NULL) return;
+	IllumEdge* edges;
+	int n=IS_Snapshot(is,&edges);
+	if (n<0) return;
+
+	int nIssued=0, nSwitched=0, nPulses=0;
+	double sumIssue=0, maxIssue=0, sumSwitch=0, maxSwitch=0, sumWidthErr=0, maxWidthErr=0;
+	for (int k = 0; k < n; ++k) {
+		double issue=edges[k].issued - edges[k].due;
+		sumIssue+=issue;
+		if (issue>maxIssue) maxIssue=issue;
+		nIssued++;
+		if (edges[k].switched>0){
+			double sw=edges[k].switched - edges[k].due;
+			sumSwitch+=sw;
+			if (sw>maxSwitch) maxSwitch=sw;
+			nSwitched++;
+		}
+		/** A pulse is a rising edge followed by a falling edge **/
+		if (k>0 && edges[k-1].on && !edges[k].on && edges[k-1].switched>0 && edges[k].switched>0){
+			double asked=edges[k].due - edges[k-1].due;
+			double got=edges[k].switched - edges[k-1].switched;
+			double err=fabs(got-asked);
+			sumWidthErr+=err;
+			if (err>maxWidthErr) maxWidthErr=err;
+			nPulses++;
+		}
+	}
+
+	fprintf(out,"\nIllumination scheduler: %d edges.\n",n);
+	if (nIssued>0) fprintf(out,"  due -> handed to DLP: mean %.3f ms, max %.3f ms\n",sumIssue/nIssued,maxIssue);
+	if (nSwitched>0) fprintf(out,"  due -> mirrors switched: mean %.3f ms, max %.3f ms\n",sumSwitch/nSwitched,maxSwitch);
+	if (nPulses>0) fprintf(out,"  on time error over %d pulses: mean %.3f ms, max %.3f ms\n",nPulses,sumWidthErr/nPulses,maxWidthErr);
+	fflush(out);
+	free(edges);
+}
+
+
+/*
+ * Write every logged edge as one tab separated line.
+ */
+int IllumSched_WriteEdges(IllumScheduler* is, const char* filename){
+	if (is==NULL || filename==NULL) return IS_ERROR;
+	IllumEdge* edges;
+	int n=IS_Snapshot(is,&edges);
+	if (n<0) return IS_ERROR;
+
+	FILE* fp=fopen(filename,"w");
+	if (fp==NULL){
+		printf("Error! Unable to open %s to write the illumination edges.\n",filename);
+		free(edges);
+		return IS_ERROR;
+	}
+	fprintf(fp,"%% Times in ms on the same clock as the latency trace. switched: 0 = unknown, -1 = never uploaded\n");
+	fprintf(fp,"on\tdue\tissued\tswitched\tseq\n");
+	for (int k = 0; k < n; ++k) {
+		fprintf(fp,"%d\t%.3f\t%.3f\t%.3f\t%d\n",edges[k].on,edges[k].due,edges[k].issued,edges[k].switched,edges[k].seq);
+	}
+	fclose(fp);
+	free(edges);
+	return IS_OK;
+}
+
+
+/*
+ * Turn the illumination off, stop the thread, print a report and free everything.
+ */
+void StopIllumScheduler(IllumScheduler** is){
+	if (is==NULL || *is==NULL) return;
+	IllumScheduler* s=*is;
+
+	/** Leave the mirrors dark **/
+	EnterCriticalSection(&(s->lock));
+	s->SteadyOn=0;
+	s->PulseActive=0;
+	s->CycleOn=0;
+	if (s->IsOn) IS_Switch(s,0,LT_Now());
+	LeaveCriticalSection(&(s->lock));
+
+	InterlockedExchange(&(s->StopRequested),1);
+	SetEvent(s->Changed);
+	WaitForSingleObject(s->Thread,INFINITE);
+	CloseHandle(s->Thread);
+	timeEndPeriod(1);
+
+	IllumSched_PrintReport(s,stdout);
+
+	CloseHandle(s->Changed);
+	DeleteCriticalSection(&(s->lock));
+	DestroyPackedPattern(&(s->Latest));
+	DestroyPackedPattern(&(s->Dark));
+	free(s);
+	*is=NULL;
+}
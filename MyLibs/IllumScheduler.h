@@ -0,0 +1,183 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * IllumScheduler.h
+ *
+ * A thread that switches the illumination on and off at precise times.
+ *
+ * The analysis thread keeps handing the scheduler its latest pattern with
+ * IllumSched_SetPattern(). The scheduler decides whether that pattern or a
+ * dark one belongs on the mirrors right now:
+ *
+ *   steady  on or off, following the user's DLP switch
+ *   pulse   on for a fixed time starting now (the timed flash)
+ *   cycle   on for OnTime, off for OffTime, repeated (stay on and refract)
+ *
+ * Pulse and cycle edges are deadlines on the LT_Now() clock. The thread
+ * sleeps until just before each deadline and spins for the last
+ * IS_SPIN_MS, so an edge goes to the DLP output thread within
+ * microseconds of when it was due, independent of the camera frame rate.
+ * Cycle edges are computed from the start of the cycle so they never drift.
+ *
+ * Every edge is logged with the time it was due, the time it was handed to
+ * the DLP output thread and, once uploaded, the time the mirrors switched.
+ *
+ * Depends on windows.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef ILLUMSCHEDULER_H_
+#define ILLUMSCHEDULER_H_
+
+#include <stdio.h>
+#include <windows.h>
+#include "PackedPattern.h"
+#include "DLPOutput.h"
+
+/** Wake up this long before a deadline and spin the rest of the way (ms) **/
+#define IS_SPIN_MS 2.0
+
+/** Number of edges remembered in the log **/
+#define IS_LOG_SIZE 1024
+
+/** Return Values **/
+#define IS_OK 0
+#define IS_ERROR -1
+
+/*
+ * One switch of the illumination. Times are in ms on the LT_Now() clock.
+ */
+typedef struct IllumEdgeStruct{
+	int on; /** 1 for a rising edge, 0 for a falling edge **/
+	double due; /** when the edge was scheduled **/
+	double issued; /** when the pattern was handed to the DLP output thread **/
+	double switched; /** when the upload that switched the mirrors completed, 0 if not known yet **/
+	int seq; /** DLP output sequence number, to look up the upload **/
+} IllumEdge;
+
+typedef struct IllumSchedulerStruct{
+	DLPOutput* dlp;
+
+	/** Latest pattern from the analysis thread and an all dark pattern **/
+	PackedPattern* Latest;
+	PackedPattern* Dark;
+	int LatestFrame;
+
+	/** What was asked for **/
+	int SteadyOn;
+	int PulseActive;
+	double PulseEnd;
+	int CycleOn;
+	double CycleStart;
+	double CycleOnTime;
+	double CycleOffTime;
+
+	/** What is on the mirrors right now **/
+	int IsOn;
+
+	/** Edge log **/
+	IllumEdge Log[IS_LOG_SIZE];
+	int LogCount; /** total number of edges ever logged **/
+	int NumResolved; /** edges before this one have their switched time filled in **/
+	double RequestTime; /** when the last request came in **/
+
+	/** Synchronization **/
+	CRITICAL_SECTION lock;
+	HANDLE Changed; /** auto-reset event, set whenever a request changes **/
+	HANDLE Thread;
+	volatile LONG StopRequested;
+} IllumScheduler;
+
+
+/*
+ * Start the scheduler thread. Patterns go out through dlp, which must
+ * outlive the scheduler. Patterns are width x height mirrors.
+ * The illumination starts off.
+ *
+ * Returns NULL on error.
+ * Don't forget to call StopIllumScheduler()
+ */
+IllumScheduler* StartIllumScheduler(DLPOutput* dlp, int width, int height);
+
+/*
+ * Hand the scheduler the newest pattern, computed from camera frame frame.
+ * It is copied. If the illumination is on it goes straight to the DLP,
+ * otherwise it is kept for the next rising edge.
+ */
+int IllumSched_SetPattern(IllumScheduler* is, const PackedPattern* pat, int frame);
+
+/*
+ * Illumination on or off whenever no pulse or cycle is running.
+ */
+void IllumSched_SetSteady(IllumScheduler* is, int on);
+
+/*
+ * Turn the illumination on now for duration ms.
+ * A new pulse replaces one that is still running.
+ */
+int IllumSched_Pulse(IllumScheduler* is, double duration);
+
+/*
+ * Cycle the illumination: on for onTime ms, then off for offTime ms, starting
+ * now. Pass on=0 to stop cycling. Calling it again with the same times does not
+ * restart the cycle.
+ */
+int IllumSched_SetCycle(IllumScheduler* is, int on, double onTime, double offTime);
+
+/*
+ * Is a pulse still running?
+ */
+int IllumSched_PulseActive(IllumScheduler* is);
+
+/*
+ * Is the illumination on right now?
+ */
+int IllumSched_IsOn(IllumScheduler* is);
+
+/*
+ * Print how many edges there were, how late they were handed to the DLP,
+ * how late the mirrors actually switched, and how long the pulses lasted.
+ */
+void IllumSched_PrintReport(IllumScheduler* is, FILE* out);
+
+/*
+ * Write every logged edge as one tab separated line.
+ * Returns IS_OK or IS_ERROR.
+ */
+int IllumSched_WriteEdges(IllumScheduler* is, const char* filename);
+
+/*
+ * Turn the illumination off, stop the thread, print a report and free
+ * everything. Sets the pointer to NULL. Call before StopDLPOutput().
+ */
+void StopIllumScheduler(IllumScheduler** is);
+
+#endif /* ILLUMSCHEDULER_H_ */
@@ -58,6 +58,7 @@
 #include "AndysOpenCVLib.h"
 #include "WormAnalysis.h"
 #include "IllumWormProtocol.h"
+#include "PackedPattern.h"
 #include "version.h"
 #include "AndysComputations.h"
 
@@ -85,6 +86,10 @@ Protocol* CreateProtocolObject(){
 	MyProto->Description=NULL;
 	MyProto->Steps=NULL;
 	MyProto->memory=cvCreateMemStorage();
+	MyProto->Compiled=NULL;
+	MyProto->NumCompiled=0;
+	MyProto->Xform=NULL;
+	MyProto->Filler=NULL;
 	return MyProto;
 
 }
@@ -239,6 +244,18 @@ void DestroyProtocolObject(Protocol** MyProto){
 		(*MyProto)->Description=NULL;
 	}
 
+	/** Free the compiled steps **/
+	if ((*MyProto)->Compiled!=NULL){
+		for (int step=0; step < (*MyProto)->NumCompiled; ++step){
+			DestroyCompiledStep(&((*MyProto)->Compiled[step]));
+		}
+		free((*MyProto)->Compiled);
+		(*MyProto)->Compiled=NULL;
+		(*MyProto)->NumCompiled=0;
+	}
+	DestroyWormSpaceXform(&((*MyProto)->Xform));
+	DestroyScanlineFiller(&((*MyProto)->Filler));
+
 	cvReleaseMemStorage(&(*MyProto)->memory);
 	free(MyProto);
 	*MyProto=NULL;
@@ -652,36 +669,22 @@ void OffsetPtArray(CvPoint** Pts,int numPts,int offset,int XorY){
  * Illuminate a rectangle worm (worm space)
  */
 void IllumRectWorm(IplImage* rectWorm,Protocol* p,int step,int FlipLR){
-	CvSeq* polyMontage= GetMontageFromProtocol(p,step);
-	CvSeq* montage=CreateIlluminationMontage(p->memory);
-	CvtPolyMontage2ContourMontage(polyMontage,montage);
+	CompiledStep* cs=GetCompiledStep(p,step);
+	if (cs==NULL) return;
 
-	int numOfPolys=montage->total;
-	int numPtsInCurrPoly;
-	CvPoint* currPolyPts=NULL;
 	int poly;
-	for (poly = 0; poly < numOfPolys; ++poly) {
-		//printf("==poly=%d==\n",poly);
-		numPtsInCurrPoly=CreatePointArrFromMontage(&currPolyPts,montage,poly);
-		//DisplayPtArr(currPolyPts,numPtsInCurrPoly);
-
-		if (FlipLR==1) {
-				int k=0;
-				for (k = 0; k < numPtsInCurrPoly; ++k) {
-						currPolyPts[k].x=currPolyPts[k].x *-1;
-				}
-			}
-
-
-
-		OffsetPtArray(&currPolyPts,numPtsInCurrPoly, (int) (p->GridSize.width / 2) ,0);
-
-		cvFillConvexPoly(rectWorm,currPolyPts,numPtsInCurrPoly,cvScalar(255,255,255),CV_AA);
+	int k;
+	for (poly = 0; poly < cs->NumPolys; ++poly) {
+		CvPoint* currPolyPts=cs->ImgPts+cs->PolyStart[poly];
+		CvPoint* wormPts=cs->Pts[FlipLR==1]+cs->PolyStart[poly];
 
+		/** Shift the worm-space x values so that the centerline runs down the middle of the image **/
+		for (k = 0; k < cs->PolyNumPts[poly]; ++k) {
+			currPolyPts[k]=cvPoint(wormPts[k].x + (int) (p->GridSize.width / 2), wormPts[k].y);
+		}
 
-		free(currPolyPts);
+		cvFillConvexPoly(rectWorm,currPolyPts,cs->PolyNumPts[poly],cvScalar(255,255,255),CV_AA);
 	}
-	cvClearSeq(montage);
 
 }
 
@@ -833,6 +836,344 @@ void IllumWorm(SegmentedWorm* segworm, CvSeq* IllumMontage, IplImage* img,CvSize
 
 
 
+/*******************************************/
+/*
+ * Compiled Protocol Steps
+ */
+/*******************************************/
+
+/*
+ * Compile a single step of a protocol into a flat array of worm-space
+ * vertices with both the regular and the left/right flipped versions.
+ *
+ * The polygons are interpolated into contours exactly as
+ * GetMontageFromProtocolInterp() would, but into a private memory storage
+ * that is released before returning.
+ *
+ * Returns NULL on error.
+ * Don't forget to call DestroyCompiledStep()
+ */
+CompiledStep* CompileProtocolStep(Protocol* p, int step){
+	if (p==NULL || p->Steps==NULL) {
+		printf("Error! No protocol steps in CompileProtocolStep()\n");
+		return NULL;
+	}
+	if (step < 0 || step >= p->Steps->total){
+		printf("Error! CompileProtocolStep() was asked for step %d, but the protocol only has %d steps\n",step,p->Steps->total);
+		return NULL;
+	}
+
+	/** Interpolate the sparse polygons into contours in scratch memory **/
+	CvMemStorage* scratch=cvCreateMemStorage();
+	CvSeq* montage=CreateIlluminationMontage(scratch);
+	CvtPolyMontage2ContourMontage(GetMontageFromProtocol(p,step),montage);
+
+	CompiledStep* cs=(CompiledStep*) malloc(sizeof(CompiledStep));
+	cs->NumPolys=montage->total;
+	cs->NumPts=0;
+	cs->PolyStart=(int*) malloc(sizeof(int)*(cs->NumPolys+1));
+	cs->PolyNumPts=(int*) malloc(sizeof(int)*(cs->NumPolys+1));
+	cs->PolyPtrs=(CvPoint**) malloc(sizeof(CvPoint*)*(cs->NumPolys+1));
+
+	/** Count up the vertices **/
+	int poly;
+	for (poly = 0; poly < cs->NumPolys; ++poly) {
+		WormPolygon* polygon=*( (WormPolygon**) cvGetSeqElem(montage,poly) );
+		cs->PolyStart[poly]=cs->NumPts;
+		cs->PolyNumPts[poly]=polygon->Points->total;
+		cs->NumPts+=polygon->Points->total;
+	}
+	cs->PolyStart[cs->NumPolys]=cs->NumPts;
+
+	/** Pack the vertices end to end (allocate at least one point so that the buffers are never NULL) **/
+	int numalloc= cs->NumPts > 0 ? cs->NumPts : 1;
+	cs->Pts[0]=(CvPoint*) malloc(sizeof(CvPoint)*numalloc);
+	cs->Pts[1]=(CvPoint*) malloc(sizeof(CvPoint)*numalloc);
+	cs->ImgPts=(CvPoint*) malloc(sizeof(CvPoint)*numalloc);
+	for (poly = 0; poly < cs->NumPolys; ++poly) {
+		WormPolygon* polygon=*( (WormPolygon**) cvGetSeqElem(montage,poly) );
+		cvCvtSeqToArray(polygon->Points,cs->Pts[0]+cs->PolyStart[poly],CV_WHOLE_SEQ);
+		free(polygon); /** the wrapper was malloc'd by CvtPolyMontage2ContourMontage() **/
+	}
+
+	/** Precompute the left/right flipped version **/
+	int k;
+	for (k = 0; k < cs->NumPts; ++k) {
+		cs->Pts[1][k]=cvPoint(-cs->Pts[0][k].x,cs->Pts[0][k].y);
+	}
+
+	cvReleaseMemStorage(&scratch);
+	return cs;
+}
+
+/*
+ * Deallocate a compiled step and set the pointer to NULL
+ */
+void DestroyCompiledStep(CompiledStep** cs){
+	if (cs==NULL || *cs==NULL) return;
+	free((*cs)->PolyStart);
+	free((*cs)->PolyNumPts);
+	free((*cs)->PolyPtrs);
+	free((*cs)->Pts[0]);
+	free((*cs)->Pts[1]);
+	free((*cs)->ImgPts);
+	free(*cs);
+	*cs=NULL;
+}
+
+/*
+ * Returns the compiled version of a protocol step.
+ * The step is compiled the first time it is requested and is then kept
+ * with the protocol until DestroyProtocolObject() is called.
+ *
+ * Returns NULL if the step does not exist.
+ */
+CompiledStep* GetCompiledStep(Protocol* p, int step){
+	if (p==NULL || p->Steps==NULL) return NULL;
+	if (step < 0 || step >= p->Steps->total){
+		printf("Error! GetCompiledStep() was asked for step %d, but the protocol only has %d steps\n",step,p->Steps->total);
+		return NULL;
+	}
+
+	/** Allocate the cache the first time around **/
+	if (p->Compiled==NULL){
+		p->NumCompiled=p->Steps->total;
+		p->Compiled=(CompiledStep**) malloc(sizeof(CompiledStep*)*p->NumCompiled);
+		for (int k = 0; k < p->NumCompiled; ++k) p->Compiled[k]=NULL;
+	}
+
+	if (p->Compiled[step]==NULL) p->Compiled[step]=CompileProtocolStep(p,step);
+	return p->Compiled[step];
+}
+
+/*
+ * Compiled equivalent of IllumWorm().
+ *
+ * Transforms the packed vertices of a compiled step into image space
+ * and fills each polygon into img. Nothing is allocated.
+ *
+ * When FlipLR is set to 1, the illumination pattern is reflected across the worm's centerline.
+ */
+void IllumWormCompiled(SegmentedWorm* segworm, CompiledStep* cs, IplImage* img,CvSize gridSize, int FlipLR){
+	if (cs==NULL) return;
+
+	/** The flipped vertices are already reflected, so transform them without flipping again **/
+	CvPoint* wormPts=cs->Pts[FlipLR==1];
+	int j;
+	for (j = 0; j < cs->NumPts; ++j) {
+		cs->ImgPts[j]=CvtPtWormSpaceToImageSpace(wormPts[j],segworm,gridSize,0);
+	}
+
+	int warnflag=0;
+	for (j = 0; j < cs->NumPts; j++) {
+		if (cs->ImgPts[j].x > img->width || cs->ImgPts[j].x < 0) warnflag=1;
+		if (cs->ImgPts[j].y > img->height || cs->ImgPts[j].y < 0) warnflag=1;
+	}
+	if (warnflag) {
+		printf("Trying to draw a polygon that falls out of bounds.\n");
+		printf("This could mean your illumination pattern is out of bounds of the DMD\n.");
+	}
+
+	/** Actually draw the polygons, one at a time as IllumWorm() does **/
+	int poly;
+	for (poly = 0; poly < cs->NumPolys; ++poly) {
+		cs->PolyPtrs[poly]=cs->ImgPts+cs->PolyStart[poly];
+		cvFillPoly(img,&(cs->PolyPtrs[poly]),&(cs->PolyNumPts[poly]),1,cvScalar(255,255,255),8);
+	}
+}
+
+
+
+/*******************************************/
+/*
+ * Batched Worm Space to Image Space Transform
+ */
+/*******************************************/
+
+/*
+ * Allocate an empty worm space transform.
+ * Don't forget to call DestroyWormSpaceXform()
+ */
+WormSpaceXform* CreateWormSpaceXform(){
+	WormSpaceXform* xf=(WormSpaceXform*) malloc(sizeof(WormSpaceXform));
+	xf->NumRows=0;
+	xf->Capacity=0;
+	xf->Cx=NULL;
+	xf->Cy=NULL;
+	xf->Rx=NULL;
+	xf->Ry=NULL;
+	xf->Lx=NULL;
+	xf->Ly=NULL;
+	return xf;
+}
+
+void DestroyWormSpaceXform(WormSpaceXform** xf){
+	if (xf==NULL || *xf==NULL) return;
+	free((*xf)->Cx);
+	free((*xf)->Cy);
+	free((*xf)->Rx);
+	free((*xf)->Ry);
+	free((*xf)->Lx);
+	free((*xf)->Ly);
+	free(*xf);
+	*xf=NULL;
+}
+
+/*
+ * Load the transform with the centerline and boundaries of a segmented worm.
+ * Call this once per frame (and per coordinate system, e.g. camera and DLP).
+ *
+ * Returns A_OK or A_ERROR.
+ */
+int LoadWormSpaceXform(WormSpaceXform* xf, SegmentedWorm* worm){
+	if (xf==NULL || worm==NULL) return A_ERROR;
+	xf->NumRows=0;
+	if (worm->Centerline==NULL || worm->LeftBound==NULL || worm->RightBound==NULL){
+		printf("Error! The segmented worm has NULL children in LoadWormSpaceXform()\n");
+		return A_ERROR;
+	}
+
+	/** All three sequences should have one point per row, but be safe **/
+	int rows=worm->Centerline->total;
+	if (worm->LeftBound->total < rows) rows=worm->LeftBound->total;
+	if (worm->RightBound->total < rows) rows=worm->RightBound->total;
+	if (rows < 1) return A_ERROR;
+
+	if (rows > xf->Capacity){
+		free(xf->Cx); free(xf->Cy);
+		free(xf->Rx); free(xf->Ry);
+		free(xf->Lx); free(xf->Ly);
+		xf->Cx=(int*) malloc(rows*sizeof(int));
+		xf->Cy=(int*) malloc(rows*sizeof(int));
+		xf->Rx=(int*) malloc(rows*sizeof(int));
+		xf->Ry=(int*) malloc(rows*sizeof(int));
+		xf->Lx=(int*) malloc(rows*sizeof(int));
+		xf->Ly=(int*) malloc(rows*sizeof(int));
+		xf->Capacity=rows;
+	}
+
+	/** Walk the three sequences in lock step **/
+	CvSeqReader CReader, RReader, LReader;
+	cvStartReadSeq(worm->Centerline,&CReader,0);
+	cvStartReadSeq(worm->RightBound,&RReader,0);
+	cvStartReadSeq(worm->LeftBound,&LReader,0);
+	int y;
+	for (y = 0; y < rows; ++y) {
+		CvPoint* c=(CvPoint*) CReader.ptr;
+		CvPoint* r=(CvPoint*) RReader.ptr;
+		CvPoint* l=(CvPoint*) LReader.ptr;
+		xf->Cx[y]=c->x;
+		xf->Cy[y]=c->y;
+		xf->Rx[y]=r->x - c->x;
+		xf->Ry[y]=r->y - c->y;
+		xf->Lx[y]=l->x - c->x;
+		xf->Ly[y]=l->y - c->y;
+		CV_NEXT_SEQ_ELEM(sizeof(CvPoint),CReader);
+		CV_NEXT_SEQ_ELEM(sizeof(CvPoint),RReader);
+		CV_NEXT_SEQ_ELEM(sizeof(CvPoint),LReader);
+	}
+	xf->NumRows=rows;
+	return A_OK;
+}
+
+/*
+ * Batched equivalent of CvtPtWormSpaceToImageSpace() (without FlipLR; use the
+ * pre-flipped vertices of a CompiledStep instead).
+ *
+ * The arithmetic, including the rounding, is the same as in
+ * CvtPtWormSpaceToImageSpace(), but the loop body is free of function
+ * calls and branches so that the compiler can vectorize it.
+ *
+ * Rows outside of the worm grid are clamped to the head or tail.
+ */
+void CvtPtsWormSpaceToImageSpace(const CvPoint* WormPts, CvPoint* ImgPts, int numPts, const WormSpaceXform* xf, CvSize gridSize){
+	float ScaleRadius = (float) (gridSize.width-1)/2;
+	int lastRow=xf->NumRows-1;
+	int j;
+	for (j = 0; j < numPts; ++j) {
+		int y=WormPts[j].y;
+		y= y < 0 ? 0 : y;
+		y= y > lastRow ? lastRow : y;
+		int x=WormPts[j].x;
+
+		/** Right boundary for positive x, left boundary for negative x **/
+		int right= x > 0;
+		int vx= right ? xf->Rx[y] : xf->Lx[y];
+		int vy= right ? xf->Ry[y] : xf->Ly[y];
+		float half= right ? 0.5f : -0.5f;
+		float fracx= (float) (x < 0 ? -x : x) / ScaleRadius;
+
+		int outx=(int) ( (float) xf->Cx[y] + fracx * (float) vx + half);
+		int outy=(int) ( (float) xf->Cy[y] + fracx * (float) vy + half);
+
+		/** Points with x of zero sit exactly on the centerline **/
+		ImgPts[j].x= x==0 ? xf->Cx[y] : outx;
+		ImgPts[j].y= x==0 ? xf->Cy[y] : outy;
+	}
+}
+
+/*
+ * Transform every vertex of every polygon of a compiled step into cs->ImgPts
+ * in one go, and warn if any of them are out of bounds of an image of dimension size.
+ */
+static void TransformCompiledStep(const WormSpaceXform* xf, CompiledStep* cs, CvSize size, CvSize gridSize, int FlipLR){
+	CvtPtsWormSpaceToImageSpace(cs->Pts[FlipLR==1],cs->ImgPts,cs->NumPts,xf,gridSize);
+
+	int warnflag=0;
+	int j;
+	for (j = 0; j < cs->NumPts; j++) {
+		if (cs->ImgPts[j].x > size.width || cs->ImgPts[j].x < 0) warnflag=1;
+		if (cs->ImgPts[j].y > size.height || cs->ImgPts[j].y < 0) warnflag=1;
+	}
+	if (warnflag) {
+		printf("Trying to draw a polygon that falls out of bounds.\n");
+		printf("This could mean your illumination pattern is out of bounds of the DMD\n.");
+	}
+}
+
+/*
+ * Illuminate a compiled protocol step straight into an 8 bit character array
+ * (e.g. Frame->binary) of dimension size.
+ *
+ * xf must already be loaded with the segmented worm. The array is not cleared first.
+ * Polygons are filled with FillPolyEvenOdd().
+ *
+ * Returns A_OK or A_ERROR.
+ */
+int IllumWormCompiledToBin(const WormSpaceXform* xf, ScanlineFiller* sf, CompiledStep* cs, unsigned char* binary, CvSize size, CvSize gridSize, int FlipLR){
+	if (xf==NULL || sf==NULL || cs==NULL || binary==NULL) return A_ERROR;
+	if (xf->NumRows < 1) return A_ERROR;
+
+	TransformCompiledStep(xf,cs,size,gridSize,FlipLR);
+
+	int ret=A_OK;
+	int poly;
+	for (poly = 0; poly < cs->NumPolys; ++poly) {
+		if (FillPolyEvenOdd(sf,binary,size.width,size.height,cs->ImgPts+cs->PolyStart[poly],cs->PolyNumPts[poly],255)!=A_OK) ret=A_ERROR;
+	}
+	return ret;
+}
+
+/*
+ * Illuminate a compiled protocol step straight into a one bit per mirror pattern.
+ * See IllumWormProtocol.h
+ */
+int IllumWormCompiledToPacked(const WormSpaceXform* xf, ScanlineFiller* sf, CompiledStep* cs, PackedPattern* pat, CvSize gridSize, int FlipLR){
+	if (xf==NULL || sf==NULL || cs==NULL || pat==NULL) return A_ERROR;
+	if (xf->NumRows < 1) return A_ERROR;
+
+	TransformCompiledStep(xf,cs,cvSize(pat->width,pat->height),gridSize,FlipLR);
+
+	int ret=A_OK;
+	int poly;
+	for (poly = 0; poly < cs->NumPolys; ++poly) {
+		if (FillPolyEvenOddPacked(sf,pat,cs->ImgPts+cs->PolyStart[poly],cs->PolyNumPts[poly],1)!=A_OK) ret=A_ERROR;
+	}
+	return ret;
+}
+
+
+
 
 /************************************************
  *
@@ -864,30 +1205,47 @@ int IlluminateFromProtocol(SegmentedWorm* SegWorm,Frame* dest, Protocol* p,WormA
 		return -1;
 	}
 
-	/** Create a Temp Image **/
-	IplImage* TempImage=cvCreateImage(cvGetSize(dest->iplimg), IPL_DEPTH_8U, 1);
-	cvSetZero(TempImage); // It turns out that this is critically imporant. 
-						  // Ommitting this command causes image to be initialized with extra crap
-						  // Worse, its not even random crap. On the contrary, it seems to randomly copy
-						  // over the contents of another image
-						  // So for who-knows how long, the DMD was sending the illumination pattern 
-						  // superimposed on top of the illumination pattern that was being shown to the user 
-						  // In other words. It was illuminating extra rectangles and crap.
-						  // Seriously lame. Now it is fixed.j
-						 
+	/** Grab the compiled montage for the selected step **/
+	//printf("Params->ProtocolStep=%d\n",Params->ProtocolStep);
+	CompiledStep* cs=GetCompiledStep(p,Params->ProtocolStep);
+	if (cs==NULL) return -1;
 
-	
+	if (p->Xform==NULL) p->Xform=CreateWormSpaceXform();
+	if (p->Filler==NULL) p->Filler=CreateScanlineFiller();
+	if (LoadWormSpaceXform(p->Xform,SegWorm)!=A_OK) return -1;
 
-	/** Grab a montage for the selected step **/
-	//printf("Params->ProtocolStep=%d\n",Params->ProtocolStep);
-	CvSeq* montage=GetMontageFromProtocolInterp(p,Params->ProtocolStep);
+	/** Rasterize straight into the binary image, which must start out black **/
+	memset(dest->binary,0,dest->size.width*dest->size.height*sizeof(unsigned char));
+	IllumWormCompiledToBin(p->Xform,p->Filler,cs,dest->binary,dest->size,p->GridSize,Params->IllumFlipLR);
 
-	IllumWorm(SegWorm,montage,TempImage,p->GridSize,Params->IllumFlipLR);
-	LoadFrameWithImage(TempImage,dest);
+	/** Keep the IplImage representation of the frame in sync **/
+	CopyCharArrayToIplImage(dest->binary,dest->iplimg,dest->size.width,dest->size.height);
+	return 0;
+}
 
-	cvClearSeq(montage);
-	
-	cvReleaseImage(&TempImage);
+/*
+ * Same as IlluminateFromProtocol() but rasterizes straight into a
+ * one bit per mirror pattern for the DLP.
+ */
+int IlluminateFromProtocolPacked(SegmentedWorm* SegWorm, PackedPattern* dest, Protocol* p,WormAnalysisParam* Params){
+	if (SegWorm->Centerline==NULL || SegWorm->LeftBound==NULL || SegWorm->RightBound ==NULL ){
+		printf("Error! The Worm->Segmented had NULL children. in IlluminateFromProtocolPacked()\n");
+		return -1;
+	}
+	if (SegWorm->Centerline->total==0 || SegWorm->LeftBound->total==0 || SegWorm->RightBound->total ==0 ){
+		printf("Error! At least one of the following: Centerline or Right and Left Boundaries in Worm->Segmented has zero points in IlluminateFromProtocolPacked()\n");
+		return -1;
+	}
+
+	CompiledStep* cs=GetCompiledStep(p,Params->ProtocolStep);
+	if (cs==NULL) return -1;
+
+	if (p->Xform==NULL) p->Xform=CreateWormSpaceXform();
+	if (p->Filler==NULL) p->Filler=CreateScanlineFiller();
+	if (LoadWormSpaceXform(p->Xform,SegWorm)!=A_OK) return -1;
+
+	ClearPackedPattern(dest);
+	IllumWormCompiledToPacked(p->Xform,p->Filler,cs,dest,p->GridSize,Params->IllumFlipLR);
 	return 0;
 }
 
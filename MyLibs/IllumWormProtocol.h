@@ -45,6 +45,51 @@
 #endif
 
 
+/*
+ * A protocol step that has been compiled for fast illumination.
+ *
+ * All of the polygons of the step's montage are interpolated into contours
+ * (one vertex per grid point, as in GetMontageFromProtocolInterp()) and packed
+ * end to end in one flat array of worm-space vertices. The vertices of polygon i
+ * are Pts[FlipLR][PolyStart[i]] ... Pts[FlipLR][PolyStart[i]+PolyNumPts[i]-1].
+ *
+ * Pts[0] holds the vertices as written in the protocol and Pts[1] holds the
+ * same vertices reflected across the centerline (for Params->IllumFlipLR).
+ *
+ * ImgPts and PolyPtrs are scratch space for the image-space vertices so that
+ * illuminating a compiled step does not allocate anything.
+ */
+typedef struct CompiledStepStruct{
+	int NumPolys;
+	int NumPts;
+	int* PolyStart;
+	int* PolyNumPts;
+	CvPoint* Pts[2];
+
+	/** Scratch **/
+	CvPoint* ImgPts;
+	CvPoint** PolyPtrs;
+}CompiledStep;
+
+/*
+ * Per-frame lookup table for converting points from worm space to image space.
+ *
+ * For every row y of the worm grid it holds the point on the centerline and the
+ * vectors from that point to the right and left boundaries, so that a whole
+ * montage can be transformed without any cvGetSeqElem() calls.
+ * See LoadWormSpaceXform() and CvtPtsWormSpaceToImageSpace().
+ */
+typedef struct WormSpaceXformStruct{
+	int NumRows;
+	int Capacity;
+	int* Cx;
+	int* Cy;
+	int* Rx;
+	int* Ry;
+	int* Lx;
+	int* Ly;
+}WormSpaceXform;
+
 typedef struct ProtocolStruct{
 	CvSize GridSize;//height is length of worm
 					//width is width of worm
@@ -53,6 +98,14 @@ typedef struct ProtocolStruct{
 	CvSeq* Steps;
 	CvMemStorage* memory;
 
+	/** Cache of compiled steps, one pointer per step. Filled on first use by GetCompiledStep() **/
+	CompiledStep** Compiled;
+	int NumCompiled;
+
+	/** Scratch space used by IlluminateFromProtocol(), allocated on first use **/
+	WormSpaceXform* Xform;
+	ScanlineFiller* Filler;
+
 }Protocol;
 
 typedef struct WormPolygonStruct{
@@ -223,6 +276,98 @@ int GenerateSimpleIllumMontage(CvSeq* montage, CvPoint origin, CvSize radius, Cv
  */
 void IllumRectWorm(IplImage* rectWorm,Protocol* p,int step,int FlipLR);
 
+
+/*******************************************/
+/*
+ * Compiled Protocol Steps
+ */
+/*******************************************/
+
+/*
+ * Compile a single step of a protocol into a flat array of worm-space
+ * vertices with both the regular and the left/right flipped versions.
+ *
+ * Returns NULL on error.
+ * Don't forget to call DestroyCompiledStep()
+ */
+CompiledStep* CompileProtocolStep(Protocol* p, int step);
+
+/*
+ * Deallocate a compiled step and set the pointer to NULL
+ */
+void DestroyCompiledStep(CompiledStep** cs);
+
+/*
+ * Returns the compiled version of a protocol step.
+ * The step is compiled the first time it is requested and is then kept
+ * with the protocol until DestroyProtocolObject() is called.
+ *
+ * Returns NULL if the step does not exist.
+ */
+CompiledStep* GetCompiledStep(Protocol* p, int step);
+
+/*
+ * Compiled equivalent of IllumWorm().
+ *
+ * Transforms the packed vertices of a compiled step into image space
+ * and fills each polygon into img.
+ *
+ * When FlipLR is set to 1, the illumination pattern is reflected across the worm's centerline.
+ */
+void IllumWormCompiled(SegmentedWorm* segworm, CompiledStep* cs, IplImage* img,CvSize gridSize, int FlipLR);
+
+
+/*******************************************/
+/*
+ * Batched Worm Space to Image Space Transform
+ */
+/*******************************************/
+
+/*
+ * Allocate an empty worm space transform.
+ * Don't forget to call DestroyWormSpaceXform()
+ */
+WormSpaceXform* CreateWormSpaceXform();
+
+void DestroyWormSpaceXform(WormSpaceXform** xf);
+
+/*
+ * Load the transform with the centerline and boundaries of a segmented worm.
+ * Call this once per frame (and per coordinate system, e.g. camera and DLP).
+ *
+ * Returns A_OK or A_ERROR.
+ */
+int LoadWormSpaceXform(WormSpaceXform* xf, SegmentedWorm* worm);
+
+/*
+ * Batched equivalent of CvtPtWormSpaceToImageSpace() (without FlipLR; use the
+ * pre-flipped vertices of a CompiledStep instead).
+ *
+ * Converts numPts worm-space points into image space and writes them to ImgPts.
+ * Rows outside of the worm grid are clamped to the head or tail.
+ */
+void CvtPtsWormSpaceToImageSpace(const CvPoint* WormPts, CvPoint* ImgPts, int numPts, const WormSpaceXform* xf, CvSize gridSize);
+
+/*
+ * Illuminate a compiled protocol step straight into an 8 bit character array
+ * (e.g. Frame->binary) of dimension size.
+ *
+ * xf must already be loaded with the segmented worm. The array is not cleared first.
+ * Polygons are filled with FillPolyEvenOdd().
+ *
+ * Returns A_OK or A_ERROR.
+ */
+int IllumWormCompiledToBin(const WormSpaceXform* xf, ScanlineFiller* sf, CompiledStep* cs, unsigned char* binary, CvSize size, CvSize gridSize, int FlipLR);
+
+/*
+ * Same as IllumWormCompiledToBin() but fills a one bit per mirror pattern
+ * (see PackedPattern.h) with FillPolyEvenOddPacked(). The pattern is not cleared first.
+ *
+ * Returns A_OK or A_ERROR.
+ */
+struct PackedPatternStruct;
+int IllumWormCompiledToPacked(const WormSpaceXform* xf, ScanlineFiller* sf, CompiledStep* cs, struct PackedPatternStruct* pat, CvSize gridSize, int FlipLR);
+
 /*
  * Creates an illumination image in image space
  * according to an illumination montage.
@@ -250,6 +395,12 @@ void IllumWorm(SegmentedWorm* segworm, CvSeq* IllumMontage, IplImage* img,CvSize
  */
 int IlluminateFromProtocol(SegmentedWorm* SegWorm,Frame* dest, Protocol* p,WormAnalysisParam* Params);
 
+/*
+ * Same as IlluminateFromProtocol() but rasterizes straight into a
+ * one bit per mirror pattern for the DLP, without the byte per pixel frame.
+ */
+int IlluminateFromProtocolPacked(SegmentedWorm* SegWorm, struct PackedPatternStruct* dest, Protocol* p,WormAnalysisParam* Params);
+
 /*
  * Switch to a different protocol step for a specified amount of time and then switch back
  *
@@ -0,0 +1,324 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * LatencyTrace.c
+ *
+ * Per-frame camera-to-mirror latency trace.
+ * See LatencyTrace.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "LatencyTrace.h"
+
+/** Width of the longest bar in the printed histograms **/
+#define LT_HIST_BAR_WIDTH 50
+
+/** Intervals that are reported, as pairs of stages **/
+#define LT_NUM_INTERVALS 5
+static const int LTIntervalFrom[LT_NUM_INTERVALS]={LT_CAPTURE,LT_GRABBED,LT_SEGMENTED,LT_PATTERN_READY,LT_CAPTURE};
+static const int LTIntervalTo[LT_NUM_INTERVALS]={LT_GRABBED,LT_SEGMENTED,LT_PATTERN_READY,LT_UPLOADED,LT_UPLOADED};
+static const char* LTIntervalName[LT_NUM_INTERVALS]={
+		"capture -> grabbed",
+		"grabbed -> segmented",
+		"segmented -> pattern ready",
+		"pattern ready -> uploaded",
+		"capture -> mirrors (total)"};
+
+
+/*
+ * Milliseconds since an arbitrary point, from the high resolution performance counter.
+ */
+double LT_Now(){
+	static LARGE_INTEGER freq={0};
+	LARGE_INTEGER now;
+	if (freq.QuadPart==0) QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return 1000.0 * (double) now.QuadPart / (double) freq.QuadPart;
+}
+
+
+/*
+ * Allocate a trace that remembers the last size frames.
+ */
+LatencyTrace* CreateLatencyTrace(int size){
+	if (size<1){
+		printf("Error! CreateLatencyTrace() needs room for at least one frame.\n");
+		return NULL;
+	}
+	LatencyTrace* lt=(LatencyTrace*) malloc(sizeof(LatencyTrace));
+	if (lt==NULL) return NULL;
+	lt->Ring=(LatencyRecord*) calloc(size,sizeof(LatencyRecord));
+	if (lt->Ring==NULL){
+		printf("Error! Unable to allocate the latency trace.\n");
+		free(lt);
+		return NULL;
+	}
+	for (int k = 0; k < size; ++k) lt->Ring[k].frame=-1;
+	lt->size=size;
+	lt->NumFrames=0;
+	lt->NumDropped=0;
+	InitializeCriticalSection(&(lt->lock));
+	return lt;
+}
+
+void DestroyLatencyTrace(LatencyTrace** lt){
+	if (lt==NULL || *lt==NULL) return;
+	DeleteCriticalSection(&((*lt)->lock));
+	free((*lt)->Ring);
+	free(*lt);
+	*lt=NULL;
+}
+
+
+/*
+ * Start the record for frame, whose image was captured at captureTime.
+ */
+void LT_BeginFrame(LatencyTrace* lt, int frame, double captureTime){
+	if (lt==NULL || frame<0) return;
+	EnterCriticalSection(&(lt->lock));
+	LatencyRecord* rec=&(lt->Ring[frame % lt->size]);
+	rec->frame=frame;
+	for (int k = 0; k < LT_NUM_STAGES; ++k) rec->t[k]=0;
+	rec->t[LT_CAPTURE]=captureTime;
+	lt->NumFrames++;
+	LeaveCriticalSection(&(lt->lock));
+}
+
+
+/*
+ * Same as LT_Mark() but with a time that was taken earlier.
+ */
+void LT_MarkAt(LatencyTrace* lt, int frame, int stage, double t){
+	if (lt==NULL || frame<0 || stage<0 || stage>=LT_NUM_STAGES) return;
+	EnterCriticalSection(&(lt->lock));
+	LatencyRecord* rec=&(lt->Ring[frame % lt->size]);
+	if (rec->frame==frame){
+		rec->t[stage]=t;
+	} else {
+		lt->NumDropped++;
+	}
+	LeaveCriticalSection(&(lt->lock));
+}
+
+/*
+ * Stamp stage of frame with the current time.
+ */
+void LT_Mark(LatencyTrace* lt, int frame, int stage){
+	LT_MarkAt(lt,frame,stage,LT_Now());
+}
+
+
+/*
+ * Get the time stage of frame was stamped at.
+ */
+int LT_GetStamp(LatencyTrace* lt, int frame, int stage, double* t){
+	if (lt==NULL || t==NULL || frame<0 || stage<0 || stage>=LT_NUM_STAGES) return LT_ERROR;
+	int ret=LT_ERROR;
+	EnterCriticalSection(&(lt->lock));
+	LatencyRecord* rec=&(lt->Ring[frame % lt->size]);
+	if (rec->frame==frame && rec->t[stage]>0){
+		*t=rec->t[stage];
+		ret=LT_OK;
+	}
+	LeaveCriticalSection(&(lt->lock));
+	return ret;
+}
+
+
+static int CompareDoubles(const void* a, const void* b);
+
+/*
+ * Median time between two stages over the most recent frames before beforeFrame.
+ */
+int LT_RecentLatency(LatencyTrace* lt, int from, int to, int beforeFrame, int n, double* latency){
+	if (lt==NULL || latency==NULL || from<0 || from>=LT_NUM_STAGES || to<0 || to>=LT_NUM_STAGES) return LT_ERROR;
+	if (n>LT_RECENT_MAX) n=LT_RECENT_MAX;
+
+	double vals[LT_RECENT_MAX];
+	int m=0;
+	EnterCriticalSection(&(lt->lock));
+	/** Walk back through the ring, newest frame first **/
+	for (int f = beforeFrame-1; f >= 0 && f >= beforeFrame-lt->size && m < n; --f) {
+		LatencyRecord* rec=&(lt->Ring[f % lt->size]);
+		if (rec->frame!=f || rec->t[from]<=0 || rec->t[to]<=0) continue;
+		vals[m++]=rec->t[to]-rec->t[from];
+	}
+	LeaveCriticalSection(&(lt->lock));
+
+	if (m==0) return LT_ERROR;
+	qsort(vals,m,sizeof(double),CompareDoubles);
+	*latency=vals[m/2];
+	return LT_OK;
+}
+
+
+static int CompareRecordFrames(const void* a, const void* b){
+	return ((const LatencyRecord*) a)->frame - ((const LatencyRecord*) b)->frame;
+}
+
+/*
+ * Copy the ring, oldest frame first. Returns the number of records copied
+ * or -1 on error. The copy must be freed by the caller.
+ */
+static int LT_Snapshot(LatencyTrace* lt, LatencyRecord** copy, int* NumFrames, int* NumDropped){
+	*copy=(LatencyRecord*) malloc(lt->size*sizeof(LatencyRecord));
+	if (*copy==NULL) return -1;
+
+	int n=0;
+	EnterCriticalSection(&(lt->lock));
+	for (int k = 0; k < lt->size; ++k) {
+		if (lt->Ring[k].frame>=0) (*copy)[n++]=lt->Ring[k];
+	}
+	*NumFrames=lt->NumFrames;
+	*NumDropped=lt->NumDropped;
+	LeaveCriticalSection(&(lt->lock));
+
+	/** Frames may have been skipped, so the slots are not necessarily in order **/
+	qsort(*copy,n,sizeof(LatencyRecord),CompareRecordFrames);
+	return n;
+}
+
+static int CompareDoubles(const void* a, const void* b){
+	double da=*(const double*) a;
+	double db=*(const double*) b;
+	return (da>db) - (da<db);
+}
+
+/*
+ * Print the summary and histogram of one interval. vals must be sorted.
+ */
+static void LT_PrintInterval(FILE* out, const char* name, const double* vals, int n){
+	fprintf(out,"\n  %s: ",name);
+	if (n==0){
+		fprintf(out,"no frames\n");
+		return;
+	}
+	fprintf(out,"%d frames, min %.2f  median %.2f  95%% %.2f  99%% %.2f  max %.2f ms\n",
+			n,vals[0],vals[n/2],vals[(int) (0.95*(n-1))],vals[(int) (0.99*(n-1))],vals[n-1]);
+
+	int hist[LT_HIST_NUM_BINS]={0};
+	for (int k = 0; k < n; ++k) {
+		int bin=(int) (vals[k]/LT_HIST_BIN_MS);
+		if (bin<0) bin=0;
+		if (bin>=LT_HIST_NUM_BINS) bin=LT_HIST_NUM_BINS-1;
+		hist[bin]++;
+	}
+
+	/** Only print from the first to the last bin that has something in it **/
+	int lo=0, hi=LT_HIST_NUM_BINS-1, most=0;
+	while (hist[lo]==0) lo++;
+	while (hist[hi]==0) hi--;
+	for (int b = lo; b <= hi; ++b) if (hist[b]>most) most=hist[b];
+
+	for (int b = lo; b <= hi; ++b) {
+		if (b==LT_HIST_NUM_BINS-1){
+			fprintf(out,"    %3d+     ms %6d ",b*LT_HIST_BIN_MS,hist[b]);
+		} else {
+			fprintf(out,"    %3d-%-3d  ms %6d ",b*LT_HIST_BIN_MS,(b+1)*LT_HIST_BIN_MS,hist[b]);
+		}
+		int bar=(hist[b]*LT_HIST_BAR_WIDTH + most-1)/most;
+		for (int k = 0; k < bar; ++k) fputc('#',out);
+		fputc('\n',out);
+	}
+}
+
+
+/*
+ * Print the latency statistics and histograms of every step of the pipeline.
+ */
+void LT_PrintReport(LatencyTrace* lt, FILE* out){
+	if (lt==NULL || out==NULL) return;
+
+	LatencyRecord* recs;
+	int NumFrames, NumDropped;
+	int n=LT_Snapshot(lt,&recs,&NumFrames,&NumDropped);
+	if (n<0){
+		printf("Error! Not enough memory for the latency report.\n");
+		return;
+	}
+	double* vals=(double*) malloc((n>0 ? n : 1)*sizeof(double));
+	if (vals==NULL){
+		free(recs);
+		printf("Error! Not enough memory for the latency report.\n");
+		return;
+	}
+
+	fprintf(out,"\nLatency over the last %d of %d frames (%d late stamps dropped):\n",n,NumFrames,NumDropped);
+	for (int i = 0; i < LT_NUM_INTERVALS; ++i) {
+		int m=0;
+		for (int k = 0; k < n; ++k) {
+			double from=recs[k].t[LTIntervalFrom[i]];
+			double to=recs[k].t[LTIntervalTo[i]];
+			if (from>0 && to>0) vals[m++]=to-from;
+		}
+		qsort(vals,m,sizeof(double),CompareDoubles);
+		LT_PrintInterval(out,LTIntervalName[i],vals,m);
+	}
+	fflush(out);
+
+	free(vals);
+	free(recs);
+}
+
+
+/*
+ * Write every frame in the ring as one line of tab separated stamps.
+ */
+int LT_WriteRecords(LatencyTrace* lt, const char* filename){
+	if (lt==NULL || filename==NULL) return LT_ERROR;
+
+	LatencyRecord* recs;
+	int NumFrames, NumDropped;
+	int n=LT_Snapshot(lt,&recs,&NumFrames,&NumDropped);
+	if (n<0) return LT_ERROR;
+
+	FILE* fp=fopen(filename,"w");
+	if (fp==NULL){
+		printf("Error! Unable to open %s to write the latency trace.\n",filename);
+		free(recs);
+		return LT_ERROR;
+	}
+	fprintf(fp,"%% Times in ms from an arbitrary origin, 0 = stage not reached\n");
+	fprintf(fp,"frame\tcapture\tgrabbed\tsegmented\tpatternReady\tuploaded\n");
+	for (int k = 0; k < n; ++k) {
+		fprintf(fp,"%d",recs[k].frame);
+		for (int s = 0; s < LT_NUM_STAGES; ++s) fprintf(fp,"\t%.3f",recs[k].t[s]);
+		fprintf(fp,"\n");
+	}
+	fclose(fp);
+	free(recs);
+	return LT_OK;
+}
@@ -0,0 +1,166 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * LatencyTrace.h
+ *
+ * Per-frame record of how long it takes to get from a photon hitting the
+ * camera to the corresponding pattern sitting on the mirrors.
+ *
+ * For every frame we stamp five moments on one monotonic clock:
+ *
+ *   LT_CAPTURE        the camera callback fired, or the frame grabber was
+ *                     told to snap, or the frame was read from video
+ *   LT_GRABBED        the frame has been copied into exp->fromCCD
+ *   LT_SEGMENTED      segmentation is finished
+ *   LT_PATTERN_READY  the illumination pattern was handed to the DLP
+ *   LT_UPLOADED       the DLP driver returned from the upload
+ *
+ * Stamps live in a ring that is allocated once. Frame f goes in slot
+ * f % size, so only the most recent size frames are kept. Stages may be
+ * stamped from different threads (the upload is stamped by the DLP output
+ * thread); a stamp for a frame that has already been pushed out of the
+ * ring is dropped.
+ *
+ * A stage that was never reached (e.g. a frame whose pattern was replaced
+ * before it could be uploaded) stays at 0 and is left out of the
+ * statistics for every interval that involves it.
+ *
+ * Depends on windows.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef LATENCYTRACE_H_
+#define LATENCYTRACE_H_
+
+#include <stdio.h>
+#include <windows.h>
+
+/** Stages of the pipeline **/
+#define LT_CAPTURE 0
+#define LT_GRABBED 1
+#define LT_SEGMENTED 2
+#define LT_PATTERN_READY 3
+#define LT_UPLOADED 4
+#define LT_NUM_STAGES 5
+
+/** Number of frames kept by default. At 50 fps this is about 80 s **/
+#define LT_DEFAULT_SIZE 4096
+
+/** Histogram bins are LT_HIST_BIN_MS wide. The last bin catches everything longer **/
+#define LT_HIST_BIN_MS 2
+#define LT_HIST_NUM_BINS 25
+
+/** Most frames LT_RecentLatency() will look at **/
+#define LT_RECENT_MAX 64
+
+/** Return Values **/
+#define LT_OK 0
+#define LT_ERROR -1
+
+typedef struct LatencyRecordStruct{
+	int frame; /** frame number, -1 if the slot is empty **/
+	double t[LT_NUM_STAGES]; /** ms on the LT_Now() clock, 0 if the stage was not reached **/
+} LatencyRecord;
+
+typedef struct LatencyTraceStruct{
+	LatencyRecord* Ring;
+	int size;
+	int NumFrames; /** total number of frames ever begun **/
+	int NumDropped; /** stamps that arrived after their frame had left the ring **/
+	CRITICAL_SECTION lock;
+} LatencyTrace;
+
+
+/*
+ * Milliseconds since an arbitrary point, from the high resolution performance counter.
+ * Unlike clock() this is monotonic and has sub millisecond resolution.
+ */
+double LT_Now();
+
+/*
+ * Allocate a trace that remembers the last size frames.
+ * Returns NULL on error.
+ * Don't forget to call DestroyLatencyTrace()
+ */
+LatencyTrace* CreateLatencyTrace(int size);
+
+void DestroyLatencyTrace(LatencyTrace** lt);
+
+/*
+ * Start the record for frame, whose image was captured at captureTime
+ * (on the LT_Now() clock). Any older frame in the same slot is forgotten.
+ * Does nothing if lt is NULL.
+ */
+void LT_BeginFrame(LatencyTrace* lt, int frame, double captureTime);
+
+/*
+ * Stamp stage of frame with the current time.
+ * Safe to call from any thread. Does nothing if lt is NULL.
+ */
+void LT_Mark(LatencyTrace* lt, int frame, int stage);
+
+/*
+ * Same as LT_Mark() but with a time that was taken earlier.
+ */
+void LT_MarkAt(LatencyTrace* lt, int frame, int stage, double t);
+
+/*
+ * Get the time stage of frame was stamped at.
+ * Returns LT_OK, or LT_ERROR if the frame has left the ring or the stage
+ * was not reached.
+ */
+int LT_GetStamp(LatencyTrace* lt, int frame, int stage, double* t);
+
+/*
+ * Median time from stage from to stage to, over the n (at most
+ * LT_RECENT_MAX) most recent frames before beforeFrame that reached both.
+ * Frames still in the pipeline are simply skipped.
+ * Returns LT_OK, or LT_ERROR if no frame qualifies.
+ */
+int LT_RecentLatency(LatencyTrace* lt, int from, int to, int beforeFrame, int n, double* latency);
+
+/*
+ * Print, for each step of the pipeline and for the whole capture-to-mirror
+ * interval, the number of frames, min, median, 95th and 99th percentile
+ * and max in ms, followed by a histogram.
+ *
+ * Can be called at any time; the ring is copied under the lock first.
+ */
+void LT_PrintReport(LatencyTrace* lt, FILE* out);
+
+/*
+ * Write every frame in the ring as one line of tab separated stamps,
+ * oldest first, so that the latency can be analyzed offline.
+ * Returns LT_OK or LT_ERROR.
+ */
+int LT_WriteRecords(LatencyTrace* lt, const char* filename);
+
+#endif /* LATENCYTRACE_H_ */
@@ -0,0 +1,192 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * PackedPattern.c
+ *
+ * Illumination patterns packed one bit per mirror.
+ * See PackedPattern.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PackedPattern.h"
+
+
+PackedPattern* CreatePackedPattern(int width, int height){
+	if (width < 1 || height < 1){
+		printf("Error! CreatePackedPattern() was given invalid dimensions.\n");
+		return NULL;
+	}
+	PackedPattern* pat=(PackedPattern*) malloc(sizeof(PackedPattern));
+	pat->width=width;
+	pat->height=height;
+	pat->WordsPerRow=(width + PACKED_WORD_BITS - 1) / PACKED_WORD_BITS;
+	int rem=width % PACKED_WORD_BITS;
+	pat->LastWordMask= rem==0 ? ~((PackedWord) 0) : (((PackedWord) 1) << rem) - 1;
+	pat->words=(PackedWord*) calloc(pat->WordsPerRow*height,sizeof(PackedWord));
+	if (pat->words==NULL){
+		printf("Error! Out of memory in CreatePackedPattern()\n");
+		free(pat);
+		return NULL;
+	}
+	return pat;
+}
+
+void DestroyPackedPattern(PackedPattern** pat){
+	if (pat==NULL || *pat==NULL) return;
+	free((*pat)->words);
+	free(*pat);
+	*pat=NULL;
+}
+
+int PackedPatternBytes(const PackedPattern* pat){
+	return pat->WordsPerRow * pat->height * (int) sizeof(PackedWord);
+}
+
+void ClearPackedPattern(PackedPattern* pat){
+	memset(pat->words,0,PackedPatternBytes(pat));
+}
+
+/*
+ * Zero the bits past the end of each row
+ */
+static void MaskRowEnds(PackedPattern* pat){
+	if (pat->LastWordMask==~((PackedWord) 0)) return;
+	PackedWord* last=pat->words + pat->WordsPerRow - 1;
+	int y;
+	for (y = 0; y < pat->height; y++) {
+		*last &= pat->LastWordMask;
+		last+=pat->WordsPerRow;
+	}
+}
+
+void FloodPackedPattern(PackedPattern* pat){
+	memset(pat->words,0xFF,PackedPatternBytes(pat));
+	MaskRowEnds(pat);
+}
+
+void InvertPackedPattern(PackedPattern* pat){
+	int n=pat->WordsPerRow * pat->height;
+	PackedWord* w=pat->words;
+	int i;
+	for (i = 0; i < n; i++) {
+		w[i]=~w[i];
+	}
+	MaskRowEnds(pat);
+}
+
+void SetPackedSpan(PackedPattern* pat, int y, int xs, int xe, int on){
+	if (y < 0 || y >= pat->height) return;
+	if (xs < 0) xs=0;
+	if (xe > pat->width-1) xe=pat->width-1;
+	if (xe < xs) return;
+
+	PackedWord* row=pat->words + y*pat->WordsPerRow;
+	int ws=xs / PACKED_WORD_BITS;
+	int we=xe / PACKED_WORD_BITS;
+	PackedWord first= ~((PackedWord) 0) << (xs % PACKED_WORD_BITS);
+	PackedWord last= ~((PackedWord) 0) >> (PACKED_WORD_BITS - 1 - xe % PACKED_WORD_BITS);
+
+	if (ws==we){
+		if (on) row[ws] |= first & last;
+		else row[ws] &= ~(first & last);
+		return;
+	}
+	if (on){
+		row[ws] |= first;
+		if (we-ws > 1) memset(row+ws+1,0xFF,(we-ws-1)*sizeof(PackedWord));
+		row[we] |= last;
+	} else {
+		row[ws] &= ~first;
+		if (we-ws > 1) memset(row+ws+1,0,(we-ws-1)*sizeof(PackedWord));
+		row[we] &= ~last;
+	}
+}
+
+int GetPackedMirror(const PackedPattern* pat, int x, int y){
+	if (x < 0 || y < 0 || x >= pat->width || y >= pat->height) return 0;
+	return (pat->words[y*pat->WordsPerRow + x/PACKED_WORD_BITS] >> (x % PACKED_WORD_BITS)) & 1;
+}
+
+int CopyPackedPattern(const PackedPattern* src, PackedPattern* dst){
+	if (src==NULL || dst==NULL || src->width!=dst->width || src->height!=dst->height) return -1;
+	memcpy(dst->words,src->words,PackedPatternBytes(src));
+	return 0;
+}
+
+int PackBinaryToPattern(const unsigned char* binary, PackedPattern* pat){
+	if (binary==NULL || pat==NULL) return -1;
+	int y,wi,b;
+	for (y = 0; y < pat->height; y++) {
+		const unsigned char* in=binary + y*pat->width;
+		PackedWord* row=pat->words + y*pat->WordsPerRow;
+		for (wi = 0; wi < pat->WordsPerRow; wi++) {
+			int n= pat->width - wi*PACKED_WORD_BITS;
+			if (n > PACKED_WORD_BITS) n=PACKED_WORD_BITS;
+			PackedWord w=0;
+			for (b = 0; b < n; b++) {
+				w |= ((PackedWord) (in[b]!=0)) << b;
+			}
+			row[wi]=w;
+			in+=PACKED_WORD_BITS;
+		}
+	}
+	return 0;
+}
+
+int UnpackPatternToBinary(const PackedPattern* pat, unsigned char* binary){
+	if (binary==NULL || pat==NULL) return -1;
+	int y,wi,b;
+	for (y = 0; y < pat->height; y++) {
+		unsigned char* out=binary + y*pat->width;
+		const PackedWord* row=pat->words + y*pat->WordsPerRow;
+		for (wi = 0; wi < pat->WordsPerRow; wi++) {
+			int n= pat->width - wi*PACKED_WORD_BITS;
+			if (n > PACKED_WORD_BITS) n=PACKED_WORD_BITS;
+			PackedWord w=row[wi];
+			/** Whole words of off or on mirrors are common **/
+			if (w==0){
+				memset(out,0,n);
+			} else if (n==PACKED_WORD_BITS && w==~((PackedWord) 0)){
+				memset(out,255,n);
+			} else {
+				for (b = 0; b < n; b++) {
+					out[b]= (unsigned char) (0 - ((w >> b) & 1));
+				}
+			}
+			out+=PACKED_WORD_BITS;
+		}
+	}
+	return 0;
+}
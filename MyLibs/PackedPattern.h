@@ -0,0 +1,127 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * PackedPattern.h
+ *
+ * Illumination patterns packed one bit per mirror.
+ *
+ * The DMD is binary, so a pattern only needs one bit per mirror rather than
+ * the byte per pixel of Frame->binary. Packed patterns are 8x smaller, and
+ * clearing, flooding and inverting them are whole word operations.
+ *
+ * Each row starts on a new word. Within a word, bit b (counting from the
+ * least significant bit) is mirror x = 32*word + b. Bits past the end of a
+ * row are always kept at zero.
+ *
+ * Patterns are only expanded back to one byte per mirror at the very end,
+ * when the driver needs bytes (see DLPOutput.h).
+ *
+ * Polygons can be rasterized straight into a packed pattern with
+ * FillPolyEvenOddPacked() in AndysOpenCVLib.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef PACKEDPATTERN_H_
+#define PACKEDPATTERN_H_
+
+typedef unsigned int PackedWord;
+
+#define PACKED_WORD_BITS 32
+
+typedef struct PackedPatternStruct{
+	int width; /** in mirrors **/
+	int height;
+	int WordsPerRow;
+	PackedWord LastWordMask; /** valid bits of the last word of each row **/
+	PackedWord* words; /** row-major, height * WordsPerRow words **/
+} PackedPattern;
+
+
+/*
+ * Allocate a cleared width x height packed pattern.
+ * Returns NULL on error.
+ * Don't forget to call DestroyPackedPattern()
+ */
+PackedPattern* CreatePackedPattern(int width, int height);
+
+void DestroyPackedPattern(PackedPattern** pat);
+
+/*
+ * Number of bytes of pattern data, e.g. to copy it
+ */
+int PackedPatternBytes(const PackedPattern* pat);
+
+/*
+ * Turn every mirror off
+ */
+void ClearPackedPattern(PackedPattern* pat);
+
+/*
+ * Turn every mirror on
+ */
+void FloodPackedPattern(PackedPattern* pat);
+
+/*
+ * Turn every mirror that is on off and vice versa
+ */
+void InvertPackedPattern(PackedPattern* pat);
+
+/*
+ * Set mirrors xs through xe (inclusive) of row y to on (on!=0) or off.
+ * The span is clipped to the pattern.
+ */
+void SetPackedSpan(PackedPattern* pat, int y, int xs, int xe, int on);
+
+/*
+ * Returns 1 if mirror (x,y) is on, 0 otherwise
+ */
+int GetPackedMirror(const PackedPattern* pat, int x, int y);
+
+/*
+ * Copy src into dst. They must be the same size.
+ * Returns 0 on success, -1 on error.
+ */
+int CopyPackedPattern(const PackedPattern* src, PackedPattern* dst);
+
+/*
+ * Pack a width x height 8 bit character array (e.g. Frame->binary) into pat.
+ * Any nonzero pixel turns its mirror on.
+ * Returns 0 on success, -1 on error.
+ */
+int PackBinaryToPattern(const unsigned char* binary, PackedPattern* pat);
+
+/*
+ * Expand pat into a width x height 8 bit character array, 255 for on and 0 for off.
+ * Returns 0 on success, -1 on error.
+ */
+int UnpackPatternToBinary(const PackedPattern* pat, unsigned char* binary);
+
+#endif /* PACKEDPATTERN_H_ */
@@ -0,0 +1,278 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * ProtocolTimeline.c
+ *
+ * Steps through a protocol on a schedule read from a timeline file.
+ * See ProtocolTimeline.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ProtocolTimeline.h"
+
+/** Longest line we expect in a timeline file **/
+#define TL_MAX_LINE 512
+
+
+static int CompareEvents(const void* a, const void* b){
+	const TimelineEvent* ea=(const TimelineEvent*) a;
+	const TimelineEvent* eb=(const TimelineEvent*) b;
+	if (ea->start < eb->start) return -1;
+	if (ea->start > eb->start) return 1;
+	return ea->line - eb->line;
+}
+
+/*
+ * Add one event, growing the array as needed.
+ */
+static int TL_AddEvent(ProtocolTimeline* tl, int* capacity, int step, double start, double end, int line){
+	if (tl->NumEvents == *capacity){
+		int newCapacity= *capacity ? 2 * *capacity : 64;
+		TimelineEvent* grown=(TimelineEvent*) realloc(tl->Events,newCapacity*sizeof(TimelineEvent));
+		if (grown==NULL) return TL_ERROR;
+		tl->Events=grown;
+		*capacity=newCapacity;
+	}
+	TimelineEvent* ev=&(tl->Events[tl->NumEvents++]);
+	ev->step=step;
+	ev->start=start;
+	ev->end=end;
+	ev->line=line;
+	if (step > tl->MaxStep) tl->MaxStep=step;
+	return TL_OK;
+}
+
+
+/*
+ * Read and compile a timeline file.
+ */
+ProtocolTimeline* LoadProtocolTimeline(const char* filename){
+	if (filename==NULL) return NULL;
+	FILE* fp=fopen(filename,"r");
+	if (fp==NULL){
+		printf("Error! Unable to open timeline file %s\n",filename);
+		return NULL;
+	}
+
+	ProtocolTimeline* tl=(ProtocolTimeline*) malloc(sizeof(ProtocolTimeline));
+	if (tl==NULL){
+		fclose(fp);
+		return NULL;
+	}
+	memset(tl,0,sizeof(ProtocolTimeline));
+	tl->MaxStep=-1;
+	tl->CurrentStep=-1;
+
+	/** Read every entry and expand its repeats into separate events **/
+	char buf[TL_MAX_LINE];
+	int capacity=0, line=0, ok=1;
+	while (ok && fgets(buf,TL_MAX_LINE,fp)!=NULL){
+		line++;
+		char* comment=strpbrk(buf,"#%");
+		if (comment!=NULL) *comment='\0';
+
+		int step, repeat;
+		double start, duration, period;
+		int n=sscanf(buf,"%d %lf %lf %d %lf",&step,&start,&duration,&repeat,&period);
+		if (n<=0) continue; /** blank line **/
+		if (n<4){
+			printf("Error! Line %d of %s should read: step start duration repeat [period]\n",line,filename);
+			ok=0;
+			break;
+		}
+		if (n==4) period=duration;
+		if (step<0 || start<0 || duration<=0 || repeat<1 || period<duration){
+			printf("Error! Line %d of %s: need step>=0, start>=0, duration>0, repeat>=1 and period>=duration.\n",line,filename);
+			ok=0;
+			break;
+		}
+		for (int k = 0; k < repeat; ++k) {
+			double t0=1000.0*(start + k*period);
+			if (TL_AddEvent(tl,&capacity,step,t0,t0 + 1000.0*duration,line)!=TL_OK){
+				printf("Error! Out of memory reading timeline %s\n",filename);
+				ok=0;
+				break;
+			}
+		}
+	}
+	fclose(fp);
+
+	if (ok && tl->NumEvents==0){
+		printf("Error! Timeline %s has no entries.\n",filename);
+		ok=0;
+	}
+
+	/** Sort by start time and make sure no two events overlap **/
+	if (ok){
+		qsort(tl->Events,tl->NumEvents,sizeof(TimelineEvent),CompareEvents);
+		for (int k = 1; k < tl->NumEvents; ++k) {
+			if (tl->Events[k].start < tl->Events[k-1].end){
+				printf("Error! In %s the step on line %d starting at %.3f s overlaps the step on line %d.\n",
+						filename,tl->Events[k].line,tl->Events[k].start/1000.0,tl->Events[k-1].line);
+				ok=0;
+				break;
+			}
+		}
+	}
+
+	/** Every event can cause at most two changes: into it and out to the rest step **/
+	if (ok){
+		tl->LogSize=2*tl->NumEvents + 1;
+		tl->Log=(TimelineChange*) malloc(tl->LogSize*sizeof(TimelineChange));
+		tl->Filename=(char*) malloc(strlen(filename)+1);
+		if (tl->Log==NULL || tl->Filename==NULL) ok=0;
+		else strcpy(tl->Filename,filename);
+	}
+
+	if (!ok){
+		DestroyProtocolTimeline(&tl);
+		return NULL;
+	}
+	printf("Loaded timeline %s: %d events over %.1f s\n",filename,tl->NumEvents,TL_Length(tl)/1000.0);
+	return tl;
+}
+
+void DestroyProtocolTimeline(ProtocolTimeline** tl){
+	if (tl==NULL || *tl==NULL) return;
+	free((*tl)->Events);
+	free((*tl)->Log);
+	free((*tl)->Filename);
+	free(*tl);
+	*tl=NULL;
+}
+
+
+/*
+ * Start the timeline now.
+ */
+void TL_Start(ProtocolTimeline* tl, double now, int restStep){
+	if (tl==NULL) return;
+	tl->Running=1;
+	tl->StartTime=now;
+	tl->Cursor=0;
+	tl->CursorSeen=0;
+	tl->RestStep=restStep;
+	tl->CurrentStep=restStep;
+	tl->NumMissed=0;
+	tl->LogCount=0;
+}
+
+/*
+ * Stop the timeline and return the rest step.
+ */
+int TL_Stop(ProtocolTimeline* tl){
+	if (tl==NULL) return TL_NO_CHANGE;
+	tl->Running=0;
+	tl->CurrentStep=tl->RestStep;
+	return tl->RestStep;
+}
+
+
+/*
+ * Call every frame. Returns the step to select if it has changed, or TL_NO_CHANGE.
+ */
+int TL_Update(ProtocolTimeline* tl, double now, int frame){
+	if (tl==NULL || !(tl->Running)) return TL_NO_CHANGE;
+	double t=now - tl->StartTime;
+
+	/** Move past every event that is already over **/
+	while (tl->Cursor < tl->NumEvents && tl->Events[tl->Cursor].end <= t){
+		if (!(tl->CursorSeen)) tl->NumMissed++;
+		tl->Cursor++;
+		tl->CursorSeen=0;
+	}
+
+	/** Which step belongs to time t, and since when **/
+	int step;
+	double due;
+	if (tl->Cursor == tl->NumEvents){
+		step=tl->RestStep;
+		due=tl->Events[tl->NumEvents-1].end;
+		tl->Running=0;
+	} else if (tl->Events[tl->Cursor].start <= t){
+		step=tl->Events[tl->Cursor].step;
+		due=tl->Events[tl->Cursor].start;
+		tl->CursorSeen=1;
+	} else {
+		step=tl->RestStep;
+		due= tl->Cursor>0 ? tl->Events[tl->Cursor-1].end : 0;
+	}
+
+	if (step == tl->CurrentStep) return TL_NO_CHANGE;
+	tl->CurrentStep=step;
+
+	if (tl->LogCount < tl->LogSize){
+		TimelineChange* c=&(tl->Log[tl->LogCount++]);
+		c->step=step;
+		c->due=tl->StartTime + due;
+		c->applied=now;
+		c->frame=frame;
+	}
+	return step;
+}
+
+
+/*
+ * Length of the timeline in ms
+ */
+double TL_Length(ProtocolTimeline* tl){
+	if (tl==NULL || tl->NumEvents==0) return 0;
+	double length=0;
+	for (int k = 0; k < tl->NumEvents; ++k) {
+		if (tl->Events[k].end > length) length=tl->Events[k].end;
+	}
+	return length;
+}
+
+
+/*
+ * Write the step changes of the last run as tab separated lines.
+ */
+int TL_WriteLog(ProtocolTimeline* tl, const char* filename){
+	if (tl==NULL || filename==NULL) return TL_ERROR;
+	FILE* fp=fopen(filename,"w");
+	if (fp==NULL){
+		printf("Error! Unable to open %s to write the timeline log.\n",filename);
+		return TL_ERROR;
+	}
+	fprintf(fp,"%% Protocol step changes from timeline %s\n",tl->Filename);
+	fprintf(fp,"%% Times in ms on the same clock as the latency trace. %d events were too short to be seen by any frame.\n",tl->NumMissed);
+	fprintf(fp,"step\tdue\tapplied\tframe\n");
+	for (int k = 0; k < tl->LogCount; ++k) {
+		fprintf(fp,"%d\t%.3f\t%.3f\t%d\n",tl->Log[k].step,tl->Log[k].due,tl->Log[k].applied,tl->Log[k].frame);
+	}
+	fclose(fp);
+	return TL_OK;
+}
@@ -0,0 +1,160 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * ProtocolTimeline.h
+ *
+ * Steps through a protocol automatically, on a schedule read from a
+ * timeline file.
+ *
+ * A timeline file is plain text with one entry per line:
+ *
+ *     step  start  duration  repeat  [period]
+ *
+ * step is a protocol step (counting from 0). start, duration and period are
+ * in seconds from the moment the timeline is started. The step is selected
+ * at start for duration seconds, repeat times in all, every period seconds
+ * (period defaults to duration, i.e. back to back). Anything after a # or %
+ * is a comment.
+ *
+ * For example, to hold each of the first three steps for 2 s and then
+ * flash step 7 for half a second every 5 s, ten times:
+ *
+ *     0   0  2    1
+ *     1   2  2    1
+ *     2   4  2    1
+ *     7  10  0.5  10  5
+ *
+ * At load, every repeat is expanded into its own event and the events are
+ * sorted by start time. Events may not overlap. Between events the step
+ * that was selected when the timeline started is restored.
+ *
+ * While running, TL_Update() is called every frame. Time only moves forward,
+ * so it just advances a cursor through the sorted events: O(1) per frame.
+ * Every step change is logged with the time it was due, the time it was
+ * applied and the frame it was applied on.
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef PROTOCOLTIMELINE_H_
+#define PROTOCOLTIMELINE_H_
+
+#include <stdio.h>
+
+/** Returned by TL_Update() when the step should stay as it is **/
+#define TL_NO_CHANGE -2
+
+/** Return Values **/
+#define TL_OK 0
+#define TL_ERROR -1
+
+/*
+ * One occurrence of a step. Times are in ms from the start of the timeline.
+ */
+typedef struct TimelineEventStruct{
+	int step;
+	double start;
+	double end;
+	int line; /** line of the timeline file it came from **/
+} TimelineEvent;
+
+/*
+ * One change of the protocol step. Times are in ms on the clock passed to TL_Update().
+ */
+typedef struct TimelineChangeStruct{
+	int step;
+	double due;
+	double applied;
+	int frame;
+} TimelineChange;
+
+typedef struct ProtocolTimelineStruct{
+	char* Filename;
+
+	/** Events sorted by start time **/
+	TimelineEvent* Events;
+	int NumEvents;
+	int MaxStep; /** largest step used, to check against the protocol **/
+
+	/** State while running **/
+	int Running;
+	double StartTime;
+	int Cursor; /** first event that has not ended yet **/
+	int CursorSeen; /** a frame has come along during the cursor event **/
+	int CurrentStep;
+	int RestStep; /** step selected between events and after the end **/
+	int NumMissed; /** events that were over before a frame came along to apply them **/
+
+	/** Log of step changes. Room for every change of one run. **/
+	TimelineChange* Log;
+	int LogSize;
+	int LogCount;
+} ProtocolTimeline;
+
+
+/*
+ * Read and compile a timeline file.
+ * Returns NULL (and prints the offending line) on error.
+ * Don't forget to call DestroyProtocolTimeline()
+ */
+ProtocolTimeline* LoadProtocolTimeline(const char* filename);
+
+void DestroyProtocolTimeline(ProtocolTimeline** tl);
+
+/*
+ * Start the timeline now. restStep is restored between events and at the end.
+ * The log is cleared.
+ */
+void TL_Start(ProtocolTimeline* tl, double now, int restStep);
+
+/*
+ * Stop the timeline. Returns the rest step, which the caller should select again.
+ */
+int TL_Stop(ProtocolTimeline* tl);
+
+/*
+ * Call every frame with the current time (ms) and frame number.
+ * Returns the step to select if it has changed, or TL_NO_CHANGE.
+ * When the last event ends, the rest step is returned and the timeline stops.
+ */
+int TL_Update(ProtocolTimeline* tl, double now, int frame);
+
+/*
+ * Length of the timeline in ms
+ */
+double TL_Length(ProtocolTimeline* tl);
+
+/*
+ * Write the step changes of the last run as tab separated lines.
+ * Returns TL_OK or TL_ERROR.
+ */
+int TL_WriteLog(ProtocolTimeline* tl, const char* filename);
+
+#endif /* PROTOCOLTIMELINE_H_ */
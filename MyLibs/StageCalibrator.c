@@ -0,0 +1,286 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * StageCalibrator.c
+ *
+ * Automatic pixel to stage calibration.
+ * See StageCalibrator.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <windows.h>
+
+#include "LatencyTrace.h"
+#include "StageIO.h"
+#include "StageControl.h"
+#include "StageCalibrator.h"
+
+/** Positions visited, in steps from where the stage started **/
+static const int SCAL_Pattern[SCAL_NUM_POINTS][2]={
+		{0,0},{1,0},{0,0},{0,1},{0,0},{-1,0},{0,0},{0,-1},{0,0}};
+
+
+StageCalibrator* CreateStageCalibrator(StageIO* io){
+	if (io==NULL){
+		printf("Error! CreateStageCalibrator() needs the stage I/O thread.\n");
+		return NULL;
+	}
+	StageCalibrator* cal=(StageCalibrator*) malloc(sizeof(StageCalibrator));
+	if (cal==NULL) return NULL;
+	memset(cal,0,sizeof(StageCalibrator));
+	cal->io=io;
+	cal->State=SCAL_IDLE;
+	SC_DefaultCalibration(&(cal->Result));
+	return cal;
+}
+
+void DestroyStageCalibrator(StageCalibrator** cal){
+	if (cal==NULL || *cal==NULL) return;
+	SCAL_Abort(*cal);
+	free(*cal);
+	*cal=NULL;
+}
+
+
+int SCAL_Start(StageCalibrator* cal, int step){
+	if (cal==NULL) return SCAL_ERROR;
+	if (cal->State==SCAL_SETTLING || cal->State==SCAL_COLLECTING){
+		printf("Stage calibration is already running.\n");
+		return SCAL_ERROR;
+	}
+	if (step<=0) step=SCAL_DEFAULT_STEP;
+	cal->Step=step;
+	cal->Point=0;
+	cal->HaveStart=0;
+	cal->MoveTime=LT_Now();
+	cal->StillSince=0;
+	cal->State=SCAL_SETTLING;
+	printf("Stage calibration: moving the stage %d units along each axis. Keep one bright object in view.\n",step);
+	return SCAL_OK;
+}
+
+void SCAL_Abort(StageCalibrator* cal){
+	if (cal==NULL) return;
+	if (cal->State==SCAL_SETTLING || cal->State==SCAL_COLLECTING){
+		StageIO_Halt(cal->io);
+		printf("Stage calibration stopped.\n");
+	}
+	cal->State=SCAL_IDLE;
+}
+
+static int SCAL_Fail(StageCalibrator* cal, const char* why){
+	printf("Stage calibration failed: %s.\n",why);
+	StageIO_Halt(cal->io);
+	cal->State=SCAL_FAILED;
+	return cal->State;
+}
+
+
+/*
+ * Least squares fit of dImage = A dStage over all the points.
+ */
+static int SCAL_Fit(StageCalibrator* cal){
+	int n=SCAL_NUM_POINTS;
+	double ms[2]={0,0}, mi[2]={0,0};
+	for (int k = 0; k < n; ++k) {
+		ms[0]+=cal->StageX[k]/n;
+		ms[1]+=cal->StageY[k]/n;
+		mi[0]+=cal->ImgX[k]/n;
+		mi[1]+=cal->ImgY[k]/n;
+	}
+
+	double Sss[2][2]={{0,0},{0,0}};
+	double Sis[2][2]={{0,0},{0,0}};
+	double maxMove=0;
+	for (int k = 0; k < n; ++k) {
+		double ds[2]={cal->StageX[k]-ms[0],cal->StageY[k]-ms[1]};
+		double di[2]={cal->ImgX[k]-mi[0],cal->ImgY[k]-mi[1]};
+		for (int a = 0; a < 2; ++a) {
+			for (int b = 0; b < 2; ++b) {
+				Sss[a][b]+=ds[a]*ds[b];
+				Sis[a][b]+=di[a]*ds[b];
+			}
+		}
+		maxMove=fmax(maxMove,hypot(cal->ImgX[k]-cal->ImgX[0],cal->ImgY[k]-cal->ImgY[0]));
+	}
+	if (maxMove<SCAL_MIN_DISPLACEMENT) return SCAL_Fail(cal,"the object hardly moved. Try a bigger step");
+
+	double det=Sss[0][0]*Sss[1][1] - Sss[0][1]*Sss[1][0];
+	if (fabs(det)<1e-9) return SCAL_Fail(cal,"the stage did not move along both axes");
+	double inv[2][2]={{Sss[1][1]/det,-Sss[0][1]/det},{-Sss[1][0]/det,Sss[0][0]/det}};
+
+	double A[2][2];
+	for (int a = 0; a < 2; ++a) {
+		for (int b = 0; b < 2; ++b) {
+			A[a][b]=Sis[a][0]*inv[0][b] + Sis[a][1]*inv[1][b];
+		}
+	}
+
+	double sumSq=0;
+	for (int k = 0; k < n; ++k) {
+		double ds[2]={cal->StageX[k]-ms[0],cal->StageY[k]-ms[1]};
+		double ex=cal->ImgX[k]-mi[0] - (A[0][0]*ds[0] + A[0][1]*ds[1]);
+		double ey=cal->ImgY[k]-mi[1] - (A[1][0]*ds[0] + A[1][1]*ds[1]);
+		sumSq+=ex*ex + ey*ey;
+	}
+	cal->Residual=sqrt(sumSq/n);
+
+	printf("Stage calibration: A = [%.5f %.5f; %.5f %.5f] pixels per stage unit, residual %.2f pixels.\n",
+			A[0][0],A[0][1],A[1][0],A[1][1],cal->Residual);
+	double detA=A[0][0]*A[1][1] - A[0][1]*A[1][0];
+	if (fabs(detA)>0) printf("  about %.1f stage units per pixel\n",1/sqrt(fabs(detA)));
+
+	if (cal->Residual>SCAL_MAX_RESIDUAL) return SCAL_Fail(cal,"the object did not move like a rigid shift. Did it move by itself?");
+
+	memcpy(cal->Result.A,A,sizeof(A));
+	cal->Result.SpinScale=SC_DEFAULT_SPIN_SCALE;
+	cal->State=SCAL_DONE;
+	return cal->State;
+}
+
+
+/*
+ * Once per frame. Never waits.
+ */
+int SCAL_Update(StageCalibrator* cal, double x, double y, double t, int present){
+	if (cal==NULL) return SCAL_IDLE;
+	if (cal->State==SCAL_DONE || cal->State==SCAL_FAILED) cal->State=SCAL_IDLE;
+	if (cal->State==SCAL_IDLE) return SCAL_IDLE;
+
+	double now=LT_Now();
+	StagePosition pos;
+	int havePos= StageIO_GetPosition(cal->io,&pos)==STAGEIO_OK;
+
+	if (cal->State==SCAL_SETTLING){
+		if (now - cal->MoveTime > SCAL_MOVE_TIMEOUT_MS) return SCAL_Fail(cal,"the stage did not get where it was sent");
+
+		/** Only positions asked for after the move count **/
+		if (!havePos || pos.t < cal->MoveTime) return cal->State;
+		if (cal->StillSince==0 || pos.x!=cal->LastX || pos.y!=cal->LastY){
+			cal->LastX=pos.x;
+			cal->LastY=pos.y;
+			cal->StillSince=pos.t;
+			return cal->State;
+		}
+		if (pos.t - cal->StillSince < SCAL_SETTLE_MS) return cal->State;
+
+		if (!(cal->HaveStart)){
+			cal->StartX=pos.x;
+			cal->StartY=pos.y;
+			cal->HaveStart=1;
+		}
+		long tx=cal->StartX + SCAL_Pattern[cal->Point][0]*cal->Step;
+		long ty=cal->StartY + SCAL_Pattern[cal->Point][1]*cal->Step;
+		if (labs(pos.x-tx)>SCAL_TOLERANCE || labs(pos.y-ty)>SCAL_TOLERANCE) return cal->State;
+
+		/** Stopped where it should be. Average the frames captured from now on **/
+		cal->SettledTime=now;
+		cal->NumFrames=0;
+		cal->SumX=0;
+		cal->SumY=0;
+		cal->State=SCAL_COLLECTING;
+		return cal->State;
+	}
+
+	/** SCAL_COLLECTING **/
+	if (t <= cal->SettledTime) return cal->State;
+	if (!present) return SCAL_Fail(cal,"lost the object");
+	cal->SumX+=x;
+	cal->SumY+=y;
+	cal->NumFrames++;
+	if (cal->NumFrames<SCAL_FRAMES) return cal->State;
+
+	int k=cal->Point;
+	cal->ImgX[k]=cal->SumX/cal->NumFrames;
+	cal->ImgY[k]=cal->SumY/cal->NumFrames;
+	cal->StageX[k]= havePos ? pos.x : cal->LastX;
+	cal->StageY[k]= havePos ? pos.y : cal->LastY;
+	cal->Point++;
+	if (cal->Point==SCAL_NUM_POINTS) return SCAL_Fit(cal);
+
+	/** On to the next point **/
+	int dx=(SCAL_Pattern[cal->Point][0] - SCAL_Pattern[k][0])*cal->Step;
+	int dy=(SCAL_Pattern[cal->Point][1] - SCAL_Pattern[k][1])*cal->Step;
+	if (StageIO_MoveRel(cal->io,dx,dy)!=STAGEIO_OK) return SCAL_Fail(cal,"unable to move the stage");
+	cal->MoveTime=now;
+	cal->StillSince=0;
+	cal->State=SCAL_SETTLING;
+	return cal->State;
+}
+
+
+int SCAL_WriteFile(const StageCalibration* calib, double residual, const char* filename){
+	if (calib==NULL || filename==NULL) return SCAL_ERROR;
+	FILE* fp=fopen(filename,"w");
+	if (fp==NULL){
+		printf("Error! Unable to open %s to write the stage calibration.\n",filename);
+		return SCAL_ERROR;
+	}
+	fprintf(fp,"# Stage calibration written by MindControl. dImage (pixels) = A dStage (stage units)\n");
+	fprintf(fp,"A00 %.9g\nA01 %.9g\nA10 %.9g\nA11 %.9g\n",calib->A[0][0],calib->A[0][1],calib->A[1][0],calib->A[1][1]);
+	fprintf(fp,"SpinScale %.9g\n",calib->SpinScale);
+	fprintf(fp,"Residual %.3f\n",residual);
+	fclose(fp);
+	return SCAL_OK;
+}
+
+int SCAL_ReadFile(StageCalibration* calib, const char* filename){
+	if (calib==NULL || filename==NULL) return SCAL_ERROR;
+	FILE* fp=fopen(filename,"r");
+	if (fp==NULL) return SCAL_ERROR;
+
+	StageCalibration c;
+	SC_DefaultCalibration(&c);
+	int found=0;
+	char line[256];
+	char key[32];
+	double val;
+	while (fgets(line,sizeof(line),fp)!=NULL){
+		if (line[0]=='#' || sscanf(line,"%31s %lf",key,&val)!=2) continue;
+		if (strcmp(key,"A00")==0) { c.A[0][0]=val; found|=1; }
+		else if (strcmp(key,"A01")==0) { c.A[0][1]=val; found|=2; }
+		else if (strcmp(key,"A10")==0) { c.A[1][0]=val; found|=4; }
+		else if (strcmp(key,"A11")==0) { c.A[1][1]=val; found|=8; }
+		else if (strcmp(key,"SpinScale")==0 && val>0) c.SpinScale=val;
+	}
+	fclose(fp);
+
+	if (found!=15){
+		printf("Error! %s does not have all four entries of the stage calibration.\n",filename);
+		return SCAL_ERROR;
+	}
+	*calib=c;
+	return SCAL_OK;
+}
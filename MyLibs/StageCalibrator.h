@@ -0,0 +1,172 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * StageCalibrator.h
+ *
+ * Measures how the stage moves the image: the 2x2 matrix A (pixels per
+ * stage unit) with dImage = A dStage, including rotation, axis swap and
+ * sign. The stage feedback loop uses it (see StageCalibration in
+ * StageControl.h).
+ *
+ * Put one bright object in view and keep it still. The calibrator moves the
+ * stage through a small pattern of relative moves, step stage units along
+ * each axis and back:
+ *
+ *   (0,0) (+1,0) (0,0) (0,+1) (0,0) (-1,0) (0,0) (0,-1) (0,0)
+ *
+ * At each position it waits for the stage to stop, then averages the
+ * object's centroid over SCAL_FRAMES frames captured after that, and notes
+ * the stage position reported by StageIO. A is the least squares fit of the
+ * image displacements to the stage displacements.
+ *
+ * Nothing waits. SCAL_Update() is called once per frame from the analysis
+ * thread with that frame's centroid and looks at where things stand.
+ *
+ * The result goes in a small text file that InvokeStage() reads at start up.
+ *
+ * Depends on windows.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef STAGECALIBRATOR_H_
+#define STAGECALIBRATOR_H_
+
+#include <windows.h>
+#include "StageIO.h"
+#include "StageControl.h"
+
+/** Default size of each move (stage units) **/
+#define SCAL_DEFAULT_STEP 500
+
+/** Points in the pattern **/
+#define SCAL_NUM_POINTS 9
+
+/** The stage has stopped once its position is unchanged for this long (ms) **/
+#define SCAL_SETTLE_MS 150
+
+/** ...and within this many stage units of where it was sent **/
+#define SCAL_TOLERANCE 2
+
+/** Give up if the stage takes longer than this to get somewhere (ms) **/
+#define SCAL_MOVE_TIMEOUT_MS 5000
+
+/** Frames averaged at each position **/
+#define SCAL_FRAMES 5
+
+/** Reject a fit with a larger RMS residual (pixels) **/
+#define SCAL_MAX_RESIDUAL 2.0
+
+/** Reject a pattern that moves the object by less than this (pixels) **/
+#define SCAL_MIN_DISPLACEMENT 5.0
+
+/** Where the calibration is kept, in the working directory **/
+#define SCAL_DEFAULT_FILE "StageCalibration.txt"
+
+/** States **/
+#define SCAL_IDLE 0
+#define SCAL_SETTLING 1
+#define SCAL_COLLECTING 2
+#define SCAL_DONE 3
+#define SCAL_FAILED 4
+
+/** Return Values **/
+#define SCAL_OK 0
+#define SCAL_ERROR -1
+
+typedef struct StageCalibratorStruct{
+	StageIO* io;
+	int State;
+	int Step;
+
+	/** Where we are in the pattern **/
+	int Point;
+	int HaveStart; /** StartX,StartY are known **/
+	long StartX;
+	long StartY;
+	double MoveTime; /** when the last move was sent **/
+	long LastX;
+	long LastY;
+	double StillSince;
+	double SettledTime;
+
+	/** Centroid averaging at the current point **/
+	int NumFrames;
+	double SumX;
+	double SumY;
+
+	/** What was measured at each point **/
+	double ImgX[SCAL_NUM_POINTS];
+	double ImgY[SCAL_NUM_POINTS];
+	double StageX[SCAL_NUM_POINTS];
+	double StageY[SCAL_NUM_POINTS];
+
+	/** Result **/
+	StageCalibration Result;
+	double Residual; /** RMS, pixels **/
+} StageCalibrator;
+
+
+/*
+ * Returns NULL on error.
+ */
+StageCalibrator* CreateStageCalibrator(StageIO* io);
+
+void DestroyStageCalibrator(StageCalibrator** cal);
+
+/*
+ * Start the pattern with moves of step stage units. Tracking must be off.
+ * Returns SCAL_ERROR if a calibration is already running.
+ */
+int SCAL_Start(StageCalibrator* cal, int step);
+
+/*
+ * Stop where we are and halt the stage.
+ */
+void SCAL_Abort(StageCalibrator* cal);
+
+/*
+ * Call once per frame with the object's centroid (pixels), the time the
+ * frame was captured (LT_Now() clock) and whether there was an object.
+ * Never waits. Returns the state: SCAL_SETTLING or SCAL_COLLECTING while
+ * running, then SCAL_DONE (see Result) or SCAL_FAILED once, then SCAL_IDLE.
+ */
+int SCAL_Update(StageCalibrator* cal, double x, double y, double t, int present);
+
+/*
+ * Write or read a calibration file.
+ * SCAL_ReadFile() leaves calib alone and returns SCAL_ERROR if the file is
+ * missing or incomplete.
+ */
+int SCAL_WriteFile(const StageCalibration* calib, double residual, const char* filename);
+
+int SCAL_ReadFile(StageCalibration* calib, const char* filename);
+
+#endif /* STAGECALIBRATOR_H_ */
@@ -0,0 +1,474 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * StageControl.c
+ *
+ * Fixed rate stage feedback loop.
+ * See StageControl.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <windows.h>
+#include <mmsystem.h>
+
+#include "LatencyTrace.h"
+#include "StageIO.h"
+#include "StageControl.h"
+
+
+static int SC_Crop(int lo, int hi, int val){
+	if (val<lo) return lo;
+	if (val>hi) return hi;
+	return val;
+}
+
+static double SC_CropD(double lo, double hi, double val){
+	if (val<lo) return lo;
+	if (val>hi) return hi;
+	return val;
+}
+
+static int SC_Round(double val){
+	return (int) floor(val+0.5);
+}
+
+/*
+ * SC_ALG_PROPORTIONAL
+ * The velocity is linear with the object's distance from the target up
+ * until activeZone pixels, and flat beyond that.
+ */
+static void SC_Proportional(const StageCtlSettings* s, const StageMeasurement* m, int* sx, int* sy){
+	int dx=SC_Round(s->targetX - m->x);
+	int dy=SC_Round(s->targetY - m->y);
+	int vx=SC_Crop(-s->activeZone,s->activeZone,dx)*s->gain;
+	int vy=SC_Crop(-s->activeZone,s->activeZone,dy)*s->gain;
+	/** spinStage() swapped and negated the axes to accomodate the camera angle relative to the stage **/
+	*sx=-vx;
+	*sy=-vy;
+}
+
+/*
+ * Forget the integral and the worm's velocity.
+ */
+static void SC_ResetPI(StageControl* sc){
+	sc->IntX=sc->IntY=0;
+	sc->WormVx=sc->WormVy=0;
+	sc->HavePrev=0;
+	sc->Saturated=0;
+}
+
+/*
+ * SC_ALG_PI_FF, once per new frame: update the worm's velocity over the
+ * ground and the integral of the error, using the time between frames.
+ */
+static void SC_NewFrame(StageControl* sc, const StageCtlSettings* s, const StageCalibration* c,
+		const StageMeasurement* m, const StagePosition* pos){
+	if (sc->HavePrev){
+		double dt=(m->t - sc->PrevMeas.t)/1000;
+		if (dt>0 && dt<=SC_MAX_DT_MS/1000.0){
+			/** How fast the stage went in the meantime; measured if we can, else what we asked for **/
+			double svx=sc->StageVx;
+			double svy=sc->StageVy;
+			if (m->stage.valid && sc->PrevMeas.stage.valid){
+				svx=(m->stage.x - sc->PrevMeas.stage.x)/dt;
+				svy=(m->stage.y - sc->PrevMeas.stage.y)/dt;
+			} else if (pos->valid && sc->PrevPos.valid && pos->t > sc->PrevPos.t){
+				double dts=(pos->t - sc->PrevPos.t)/1000;
+				svx=(pos->x - sc->PrevPos.x)/dts;
+				svy=(pos->y - sc->PrevPos.y)/dts;
+			}
+
+			/** The object moved in the image; whatever the stage does not account for, the worm did **/
+			double wx=(m->x - sc->PrevMeas.x)/dt - (c->A[0][0]*svx + c->A[0][1]*svy);
+			double wy=(m->y - sc->PrevMeas.y)/dt - (c->A[1][0]*svx + c->A[1][1]*svy);
+			sc->WormVx+=SC_FF_SMOOTHING*(wx - sc->WormVx);
+			sc->WormVy+=SC_FF_SMOOTHING*(wy - sc->WormVy);
+
+			/** Anti-windup: hold the integral while the stage is at its top speed **/
+			if (!sc->Saturated){
+				sc->IntX+=SC_CropD(-s->activeZone,s->activeZone,s->targetX - m->x)*dt;
+				sc->IntY+=SC_CropD(-s->activeZone,s->activeZone,s->targetY - m->y)*dt;
+			}
+			/** ...and never let it ask for more than the proportional term can **/
+			if (s->ki>0){
+				double maxInt=s->kp*s->activeZone/s->ki;
+				sc->IntX=SC_CropD(-maxInt,maxInt,sc->IntX);
+				sc->IntY=SC_CropD(-maxInt,maxInt,sc->IntY);
+			}
+		}
+	}
+	sc->PrevMeas=*m;
+	sc->PrevPos=*pos;
+	sc->HavePrev=1;
+}
+
+/*
+ * SC_ALG_PI_FF
+ * v_stage = A^-1 ( kp*e + ki*Integral(e dt) - kff*v_worm ), capped.
+ */
+static void SC_PIFF(StageControl* sc, const StageCtlSettings* s, const StageCalibration* c, double Ainv[2][2],
+		const StageMeasurement* m, double age, int* sx, int* sy){
+	/** Carry the object forward from when the frame was captured to now **/
+	double a=age/1000;
+	double px=m->x + (sc->WormVx + c->A[0][0]*sc->StageVx + c->A[0][1]*sc->StageVy)*a;
+	double py=m->y + (sc->WormVy + c->A[1][0]*sc->StageVx + c->A[1][1]*sc->StageVy)*a;
+	double ex=SC_CropD(-s->activeZone,s->activeZone,s->targetX - px);
+	double ey=SC_CropD(-s->activeZone,s->activeZone,s->targetY - py);
+
+	/** How we want the stage to move the object in the image (pixels/s) **/
+	double ux=s->kp*ex + s->ki*sc->IntX - s->kff*sc->WormVx;
+	double uy=s->kp*ey + s->ki*sc->IntY - s->kff*sc->WormVy;
+
+	/** In stage units/s, then SPIN units **/
+	double spinX=(Ainv[0][0]*ux + Ainv[0][1]*uy)*c->SpinScale;
+	double spinY=(Ainv[1][0]*ux + Ainv[1][1]*uy)*c->SpinScale;
+
+	/** Cap at the proportional law's top speed, keeping the direction **/
+	double vmax=(double) s->activeZone*s->gain;
+	double biggest=fmax(fabs(spinX),fabs(spinY));
+	sc->Saturated= biggest>vmax;
+	if (sc->Saturated){
+		double f= (biggest>0) ? vmax/biggest : 0;
+		spinX*=f;
+		spinY*=f;
+		sc->NumSaturated++;
+	}
+	*sx=SC_Round(spinX);
+	*sy=SC_Round(spinY);
+}
+
+static int SC_Invert(const double A[2][2], double Ainv[2][2]){
+	double det=A[0][0]*A[1][1] - A[0][1]*A[1][0];
+	if (fabs(det)<1e-12) return SC_ERROR;
+	Ainv[0][0]=A[1][1]/det;
+	Ainv[0][1]=-A[0][1]/det;
+	Ainv[1][0]=-A[1][0]/det;
+	Ainv[1][1]=A[0][0]/det;
+	return SC_OK;
+}
+
+/*
+ * Sleep until SC_SPIN_MS before deadline and spin the rest of the way.
+ */
+static void SC_WaitUntil(StageControl* sc, double deadline){
+	double left=deadline - LT_Now();
+	if (left > SC_SPIN_MS) Sleep((DWORD) (left - SC_SPIN_MS));
+	while (LT_Now() < deadline && !sc->StopRequested) Sleep(0);
+}
+
+static void SC_NoteTick(StageControl* sc, double due, double woke, double lastWoke){
+	double late=woke - due;
+	sc->NumTicks++;
+	sc->SumLate+=late;
+	if (late>sc->MaxLate) sc->MaxLate=late;
+	if (lastWoke>0){
+		double period=woke - lastWoke;
+		sc->SumPeriod+=period;
+		sc->SumPeriodSq+=period*period;
+		if (sc->MinPeriod==0 || period<sc->MinPeriod) sc->MinPeriod=period;
+		if (period>sc->MaxPeriod) sc->MaxPeriod=period;
+	}
+}
+
+static void SC_NoteAge(StageControl* sc, double age){
+	sc->NumAged++;
+	sc->SumAge+=age;
+	if (age>sc->MaxAge) sc->MaxAge=age;
+	int bin=(int) (age/SC_HIST_BIN_MS);
+	if (bin<0) bin=0;
+	if (bin>=SC_HIST_NUM_BINS) bin=SC_HIST_NUM_BINS-1;
+	sc->AgeHist[bin]++;
+}
+
+
+/*
+ * Body of the control thread.
+ */
+DWORD WINAPI StageControlThread(LPVOID lpParam){
+	StageControl* sc=(StageControl*) lpParam;
+	StageCtlSettings settings;
+	StageMeasurement meas;
+	StagePosition pos;
+	StageCalibration calib;
+	double Ainv[2][2];
+	double start=LT_Now();
+	double lastWoke=0;
+	long tick=1;
+	int wasOn=0;
+	int sentX=0, sentY=0;
+	int lastAlg=-1;
+
+	while (!sc->StopRequested){
+		double due=start + tick*sc->Period;
+		SC_WaitUntil(sc,due);
+		if (sc->StopRequested) break;
+		double now=LT_Now();
+
+		/** If we fell a whole period behind, skip ahead rather than rush to catch up **/
+		long behind=(long) ((now - due)/sc->Period);
+		if (behind>0){
+			sc->NumMissed+=behind;
+			tick+=behind;
+			due+=behind*sc->Period;
+		}
+		tick++;
+		SC_NoteTick(sc,due,now,lastWoke);
+		lastWoke=now;
+
+		EnterCriticalSection(&(sc->lock));
+		settings=sc->Settings;
+		meas=sc->Meas;
+		calib=sc->Calib;
+		memcpy(Ainv,sc->Ainv,sizeof(Ainv));
+		LeaveCriticalSection(&(sc->lock));
+
+		if (!settings.on){
+			if (wasOn){
+				StageIO_Halt(sc->io);
+				sentX=sentY=0;
+				sc->StageVx=sc->StageVy=0;
+				EnterCriticalSection(&(sc->lock));
+				sc->VelX=sc->VelY=0;
+				sc->ImgVx=sc->ImgVy=0;
+				LeaveCriticalSection(&(sc->lock));
+			}
+			wasOn=0;
+			continue;
+		}
+
+		/** Keep the object at the target, or stand still if we no longer know where it is **/
+		int sx=0, sy=0;
+		double age=now - meas.t;
+		int fresh= meas.present && meas.t>0 && age <= SC_STALE_MS;
+		if (StageIO_GetPosition(sc->io,&pos)!=STAGEIO_OK) pos.valid=0;
+		if (!wasOn || !fresh || settings.algID!=lastAlg) SC_ResetPI(sc);
+		lastAlg=settings.algID;
+
+		if (!fresh){
+			sc->NumStale++;
+		} else if (settings.algID==SC_ALG_PI_FF){
+			if (!sc->HavePrev || meas.frame!=sc->PrevMeas.frame) SC_NewFrame(sc,&settings,&calib,&meas,&pos);
+			SC_PIFF(sc,&settings,&calib,Ainv,&meas,age,&sx,&sy);
+		} else {
+			SC_Proportional(&settings,&meas,&sx,&sy);
+		}
+
+		if (!wasOn || sx!=sentX || sy!=sentY){
+			/** How old is what this command is based on? **/
+			if (fresh) SC_NoteAge(sc,age);
+			if (pos.valid){
+				double stageAge=now - pos.t;
+				sc->NumStageAged++;
+				sc->SumStageAge+=stageAge;
+				if (stageAge>sc->MaxStageAge) sc->MaxStageAge=stageAge;
+			}
+			StageIO_SpinAxes(sc->io,sx,sy);
+			sentX=sx;
+			sentY=sy;
+			sc->StageVx=sx/calib.SpinScale;
+			sc->StageVy=sy/calib.SpinScale;
+			sc->NumCommands++;
+			EnterCriticalSection(&(sc->lock));
+			sc->VelX=-sx;
+			sc->VelY=-sy;
+			sc->ImgVx=calib.A[0][0]*sc->StageVx + calib.A[0][1]*sc->StageVy;
+			sc->ImgVy=calib.A[1][0]*sc->StageVx + calib.A[1][1]*sc->StageVy;
+			LeaveCriticalSection(&(sc->lock));
+		}
+		wasOn=1;
+	}
+
+	if (wasOn) StageIO_Halt(sc->io);
+	return 0;
+}
+
+
+/*
+ * Start the control loop at rate Hz.
+ */
+StageControl* StartStageControl(StageIO* io, int rate){
+	if (io==NULL){
+		printf("Error! StartStageControl() needs the stage I/O thread.\n");
+		return NULL;
+	}
+	if (rate<=0 || rate>1000){
+		printf("Error! Stage control rate of %d Hz is out of range (1-1000 Hz).\n",rate);
+		return NULL;
+	}
+	StageControl* sc=(StageControl*) malloc(sizeof(StageControl));
+	if (sc==NULL) return NULL;
+	memset(sc,0,sizeof(StageControl));
+	sc->io=io;
+	sc->Period=1000.0/rate;
+	SC_DefaultCalibration(&(sc->Calib));
+	SC_Invert(sc->Calib.A,sc->Ainv);
+	InitializeCriticalSection(&(sc->lock));
+
+	/** Ask Windows for 1 ms timer resolution so that the thread wakes up close to its ticks **/
+	timeBeginPeriod(1);
+
+	DWORD dwThreadId;
+	sc->Thread=CreateThread(NULL,0,StageControlThread,(void*) sc,0,&dwThreadId);
+	if (sc->Thread==NULL){
+		printf("Error! Cannot create stage control thread.\n");
+		timeEndPeriod(1);
+		DeleteCriticalSection(&(sc->lock));
+		free(sc);
+		return NULL;
+	}
+	SetThreadPriority(sc->Thread,THREAD_PRIORITY_HIGHEST);
+	return sc;
+}
+
+
+/*
+ * Halt the stage, stop the thread, print a report and free everything.
+ */
+void StopStageControl(StageControl** sc){
+	if (sc==NULL || *sc==NULL) return;
+	StageControl* s=*sc;
+
+	InterlockedExchange(&(s->StopRequested),1);
+	WaitForSingleObject(s->Thread,INFINITE);
+	CloseHandle(s->Thread);
+	timeEndPeriod(1);
+
+	SC_PrintReport(s,stdout);
+
+	DeleteCriticalSection(&(s->lock));
+	free(s);
+	*sc=NULL;
+}
+
+
+int SC_SetMeasurement(StageControl* sc, double x, double y, double t, int frame, int present, const StagePosition* stage){
+	if (sc==NULL) return SC_ERROR;
+	EnterCriticalSection(&(sc->lock));
+	sc->Meas.x=x;
+	sc->Meas.y=y;
+	sc->Meas.t=t;
+	sc->Meas.frame=frame;
+	sc->Meas.present=present;
+	if (stage!=NULL) sc->Meas.stage=*stage;
+	else sc->Meas.stage.valid=0;
+	LeaveCriticalSection(&(sc->lock));
+	return SC_OK;
+}
+
+int SC_SetSettings(StageControl* sc, const StageCtlSettings* settings){
+	if (sc==NULL || settings==NULL) return SC_ERROR;
+	EnterCriticalSection(&(sc->lock));
+	sc->Settings=*settings;
+	LeaveCriticalSection(&(sc->lock));
+	return SC_OK;
+}
+
+/*
+ * Until calibrated: image x is stage -X and image y is stage -Y,
+ * SC_DEFAULT_STAGE_PER_PIXEL stage units a pixel.
+ */
+void SC_DefaultCalibration(StageCalibration* calib){
+	if (calib==NULL) return;
+	calib->A[0][0]=-1/SC_DEFAULT_STAGE_PER_PIXEL;
+	calib->A[0][1]=0;
+	calib->A[1][0]=0;
+	calib->A[1][1]=-1/SC_DEFAULT_STAGE_PER_PIXEL;
+	calib->SpinScale=SC_DEFAULT_SPIN_SCALE;
+}
+
+int SC_SetCalibration(StageControl* sc, const StageCalibration* calib){
+	if (sc==NULL || calib==NULL) return SC_ERROR;
+	double Ainv[2][2];
+	if (SC_Invert(calib->A,Ainv)!=SC_OK || calib->SpinScale<=0){
+		printf("Error! Stage calibration cannot be inverted. Keeping the old one.\n");
+		return SC_ERROR;
+	}
+	EnterCriticalSection(&(sc->lock));
+	sc->Calib=*calib;
+	memcpy(sc->Ainv,Ainv,sizeof(Ainv));
+	LeaveCriticalSection(&(sc->lock));
+	return SC_OK;
+}
+
+int SC_GetVelocity(StageControl* sc, int* vx, int* vy){
+	if (sc==NULL || vx==NULL || vy==NULL) return SC_ERROR;
+	EnterCriticalSection(&(sc->lock));
+	*vx=sc->VelX;
+	*vy=sc->VelY;
+	LeaveCriticalSection(&(sc->lock));
+	return SC_OK;
+}
+
+int SC_GetImageVelocity(StageControl* sc, double* vx, double* vy){
+	if (sc==NULL || vx==NULL || vy==NULL) return SC_ERROR;
+	EnterCriticalSection(&(sc->lock));
+	*vx=sc->ImgVx;
+	*vy=sc->ImgVy;
+	LeaveCriticalSection(&(sc->lock));
+	return SC_OK;
+}
+
+
+/*
+ * Print the loop rate, how late the ticks were and how old the measurements were.
+ */
+void SC_PrintReport(StageControl* sc, FILE* out){
+	if (sc==NULL || out==NULL) return;
+	fprintf(out,"\nStage control: %d ticks at %.0f Hz, %d skipped, %d commands (%d at top speed), %d ticks without a fresh measurement.\n",
+			sc->NumTicks,1000/sc->Period,sc->NumMissed,sc->NumCommands,sc->NumSaturated,sc->NumStale);
+	if (sc->NumTicks>1){
+		int n=sc->NumTicks-1;
+		double mean=sc->SumPeriod/n;
+		double var=sc->SumPeriodSq/n - mean*mean;
+		fprintf(out,"  tick period: mean %.3f ms, sd %.3f ms, min %.3f ms, max %.3f ms\n",
+				mean,sqrt(var>0 ? var : 0),sc->MinPeriod,sc->MaxPeriod);
+		fprintf(out,"  woke up late: mean %.3f ms, max %.3f ms\n",sc->SumLate/sc->NumTicks,sc->MaxLate);
+	}
+	if (sc->NumAged>0){
+		fprintf(out,"  measurement age when sent: mean %.1f ms, max %.1f ms\n",sc->SumAge/sc->NumAged,sc->MaxAge);
+		fprintf(out,"  age (ms):");
+		for (int k = 0; k < SC_HIST_NUM_BINS; ++k) {
+			if (sc->AgeHist[k]==0) continue;
+			if (k==SC_HIST_NUM_BINS-1) fprintf(out," >=%d:%d",k*SC_HIST_BIN_MS,sc->AgeHist[k]);
+			else fprintf(out," %d-%d:%d",k*SC_HIST_BIN_MS,(k+1)*SC_HIST_BIN_MS,sc->AgeHist[k]);
+		}
+		fprintf(out,"\n");
+	}
+	if (sc->NumStageAged>0){
+		fprintf(out,"  stage position age when sent: mean %.1f ms, max %.1f ms\n",
+				sc->SumStageAge/sc->NumStageAged,sc->MaxStageAge);
+	}
+	fflush(out);
+}
@@ -0,0 +1,271 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * StageControl.h
+ *
+ * The stage feedback loop, on its own thread, at a fixed rate.
+ *
+ * It used to run inside the display thread between cvShowImage() and
+ * cvWaitKey(), so its rate depended on how long drawing took. Now the
+ * display thread only hands over the user's settings, and the analysis
+ * thread hands over where the object was in each frame and when that frame
+ * was captured:
+ *
+ *   SC_SetMeasurement()  analysis thread, once per frame
+ *   SC_SetSettings()     display thread, whenever it likes
+ *
+ * Every 1000/rate ms the control thread takes the latest measurement and the
+ * latest stage position (from StageIO, which never blocks), works out a
+ * velocity and sends it to the stage. Ticks are deadlines counted from the
+ * start of the loop, so the rate does not drift.
+ *
+ * Two control laws, picked by the AlgID slider:
+ *
+ *   SC_ALG_PROPORTIONAL  velocity = gain * error, with the error cropped to
+ *                        the active zone. What MindControl always did.
+ *   SC_ALG_PI_FF         PI on the position error plus feed-forward of the
+ *                        worm's own velocity, worked out in image pixels and
+ *                        turned into stage velocity with the calibration:
+ *
+ *       v_stage = A^-1 ( kp*e + ki*Integral(e dt) - kff*v_worm )
+ *
+ *     e is the error from the latest frame, carried forward to now with
+ *     the velocities we know about. dt comes from the frame capture times.
+ *     v_worm is the worm's velocity over the ground. It is the object's
+ *     velocity in the image minus what the stage's own motion accounts
+ *     for. The stage's motion comes from the measurement when it carries
+ *     the stage position at capture (see StageOdometry.h), otherwise from
+ *     StageIO positions. The error is cropped to the active
+ *     zone, and the stage speed is capped at activeZone*gain, the top speed
+ *     of the proportional law. While the speed is capped the integral is
+ *     frozen (anti-windup).
+ *
+ * The calibration A maps stage displacement (stage units) to the object's
+ * displacement in the image (pixels), including any rotation, axis swap or
+ * sign flip. Until SC_SetCalibration() is called it is the old hard wired
+ * guess: axes swapped twice and negated by spinStage(), i.e. image x is
+ * stage -X, image y is stage -Y, SC_DEFAULT_STAGE_PER_PIXEL units a pixel.
+ *
+ * For every tick the thread notes how late it woke up, and how old the
+ * measurement and the stage position were when the command went out.
+ * If the measurement is older than SC_STALE_MS, or there is nothing to track,
+ * the stage is told to stand still instead.
+ *
+ * Times are ms on the LT_Now() clock.
+ *
+ * Depends on windows.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef STAGECONTROL_H_
+#define STAGECONTROL_H_
+
+#include <stdio.h>
+#include <windows.h>
+#include "StageIO.h"
+
+/** Default rate of the loop (Hz) **/
+#define SC_DEFAULT_RATE 100
+
+/** Wake up this long before a tick and spin the rest of the way (ms) **/
+#define SC_SPIN_MS 1.0
+
+/** Stand still if the measurement is older than this (ms) **/
+#define SC_STALE_MS 200
+
+/** Histogram of measurement ages: SC_HIST_BIN_MS wide bins, the last one catches the rest **/
+#define SC_HIST_BIN_MS 5
+#define SC_HIST_NUM_BINS 20
+
+/** Control laws (Params->AlgID) **/
+#define SC_ALG_PROPORTIONAL 1
+#define SC_ALG_PI_FF 2
+
+/** Stage units per pixel until calibrated. The old code's placeholder **/
+#define SC_DEFAULT_STAGE_PER_PIXEL 50.0
+
+/** SPIN units per stage unit/s until calibrated **/
+#define SC_DEFAULT_SPIN_SCALE 1.0
+
+/** Only difference frames this close together for the worm's velocity (ms) **/
+#define SC_MAX_DT_MS 200
+
+/** Weight of a new worm velocity sample in the running estimate **/
+#define SC_FF_SMOOTHING 0.3
+
+/** Return Values **/
+#define SC_OK 0
+#define SC_ERROR -1
+
+/*
+ * Where the object to keep centered was, in image pixels.
+ */
+typedef struct StageMeasurementStruct{
+	double x;
+	double y;
+	double t; /** when the frame was captured **/
+	int frame;
+	int present; /** 0 if there was nothing to track **/
+	StagePosition stage; /** where the stage was at capture; stage.valid is 0 if unknown **/
+} StageMeasurement;
+
+/*
+ * What the user asked for.
+ */
+typedef struct StageCtlSettingsStruct{
+	int on; /** tracking on. The stage is halted when this goes to 0 **/
+	int algID; /** SC_ALG_PROPORTIONAL or SC_ALG_PI_FF **/
+	int targetX; /** where the object should sit in the image **/
+	int targetY;
+	int gain; /** SC_ALG_PROPORTIONAL: SPIN units per pixel off target **/
+	int activeZone; /** beyond this many pixels off target, stop speeding up **/
+	double kp; /** SC_ALG_PI_FF: 1/s **/
+	double ki; /** 1/s^2 **/
+	double kff; /** fraction of the worm's velocity to follow **/
+} StageCtlSettings;
+
+/*
+ * How the stage moves the image: dImage = A dStage.
+ */
+typedef struct StageCalibrationStruct{
+	double A[2][2]; /** pixels per stage unit. Row is image x,y; column is stage X,Y **/
+	double SpinScale; /** SPIN units per stage unit/s **/
+} StageCalibration;
+
+typedef struct StageControlStruct{
+	StageIO* io;
+	double Period; /** ms **/
+
+	/** Inputs, protected by lock **/
+	CRITICAL_SECTION lock;
+	StageMeasurement Meas;
+	StageCtlSettings Settings;
+	StageCalibration Calib;
+	double Ainv[2][2];
+
+	/** Last command, protected by lock **/
+	int VelX;
+	int VelY;
+	double ImgVx; /** how fast that command moves the scene through the image, pixels/s **/
+	double ImgVy;
+
+	/** Thread **/
+	HANDLE Thread;
+	volatile LONG StopRequested;
+
+	/** SC_ALG_PI_FF state. Only touched by the thread **/
+	double IntX; /** integral of the error, pixel*s **/
+	double IntY;
+	double WormVx; /** worm velocity over the ground, pixels/s **/
+	double WormVy;
+	int HavePrev;
+	StageMeasurement PrevMeas;
+	StagePosition PrevPos;
+	double StageVx; /** last stage velocity sent, stage units/s **/
+	double StageVy;
+	int Saturated; /** the last command was capped **/
+
+	/** Statistics. Only touched by the thread until it stops **/
+	int NumTicks;
+	int NumMissed; /** ticks skipped because the thread fell a whole period behind **/
+	int NumStale; /** ticks with no fresh measurement **/
+	int NumCommands; /** velocities sent. An unchanged velocity is not sent again **/
+	int NumSaturated; /** commands capped at the top speed **/
+	double SumLate;
+	double MaxLate; /** woke up this much after the tick was due **/
+	double SumPeriod;
+	double SumPeriodSq;
+	double MinPeriod;
+	double MaxPeriod;
+	int NumAged;
+	double SumAge;
+	double MaxAge; /** measurement age when a command went out **/
+	int AgeHist[SC_HIST_NUM_BINS];
+	int NumStageAged;
+	double SumStageAge;
+	double MaxStageAge; /** stage position age when a command went out **/
+} StageControl;
+
+
+/*
+ * Start the control loop at rate Hz. Commands go out through io, which must
+ * outlive the loop. Tracking starts off.
+ *
+ * Returns NULL on error.
+ * Don't forget to call StopStageControl()
+ */
+StageControl* StartStageControl(StageIO* io, int rate);
+
+/*
+ * Halt the stage, stop the thread, print a report and free everything.
+ * Sets the pointer to NULL. Call before StopStageIO().
+ */
+void StopStageControl(StageControl** sc);
+
+/*
+ * Hand over where the object was in frame frame, captured at time t, and
+ * where the stage was at that moment (NULL if unknown).
+ */
+int SC_SetMeasurement(StageControl* sc, double x, double y, double t, int frame, int present, const StagePosition* stage);
+
+int SC_SetSettings(StageControl* sc, const StageCtlSettings* settings);
+
+/*
+ * Use a new calibration from now on.
+ * Returns SC_ERROR, and keeps the old one, if A cannot be inverted.
+ */
+int SC_SetCalibration(StageControl* sc, const StageCalibration* calib);
+
+/*
+ * The calibration used until SC_SetCalibration() is called.
+ */
+void SC_DefaultCalibration(StageCalibration* calib);
+
+/*
+ * The velocity most recently sent to the stage, as SPIN X=-vx Y=-vy.
+ * That is the convention of the proportional law and of the stage velocity
+ * written out with the worm.
+ */
+int SC_GetVelocity(StageControl* sc, int* vx, int* vy);
+
+/*
+ * How fast the velocity most recently sent moves the scene through the
+ * image (pixels/s), according to the calibration. 0 while halted.
+ */
+int SC_GetImageVelocity(StageControl* sc, double* vx, double* vy);
+
+/*
+ * Print the loop rate, how late the ticks were and how old the measurements
+ * were when commands went out.
+ */
+void SC_PrintReport(StageControl* sc, FILE* out);
+
+#endif /* STAGECONTROL_H_ */
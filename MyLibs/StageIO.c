@@ -0,0 +1,411 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * StageIO.c
+ *
+ * Stage I/O thread for the LUDL MAC6000.
+ * See StageIO.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "LatencyTrace.h"
+#include "StageIO.h"
+
+
+/*
+ * Throw away anything the controller said before we started listening.
+ */
+static void StageIO_Drain(StageIO* io){
+	char buf[256];
+	while (io->port.Read(io->port.handle,buf,sizeof(buf),0)>0);
+}
+
+/*
+ * Write one command and remember that a reply is owed.
+ */
+static int StageIO_Send(StageIO* io, const char* cmd, int type){
+	int len=strlen(cmd);
+	if (io->port.Write(io->port.handle,cmd,len)!=len){
+		printf("Error! Unable to write `%s` to the stage.\n",cmd);
+		io->NumErrors++;
+		return STAGEIO_ERROR;
+	}
+	io->InflightType[io->NumInflight]=type;
+	io->InflightSent[io->NumInflight]=LT_Now();
+	io->NumInflight++;
+	if (type==STAGEIO_CMD_WHERE) io->WhereInflight=1;
+	io->NumSent++;
+	return STAGEIO_OK;
+}
+
+/*
+ * Publish a new position. Readers retry if they catch PosSeq odd or changed.
+ */
+static void StageIO_SetPosition(StageIO* io, long x, long y, double sent, double received){
+	InterlockedIncrement(&(io->PosSeq));
+	io->Pos.x=x;
+	io->Pos.y=y;
+	io->Pos.t=0.5*(sent+received);
+	io->Pos.rtt=received-sent;
+	io->Pos.valid=1;
+	InterlockedIncrement(&(io->PosSeq));
+	io->NumPositions++;
+}
+
+/*
+ * What kind of answer a reply line is: STAGEIO_CMD_WHERE for :A x y,
+ * STAGEIO_CMD_SYNC for :A x, STAGEIO_CMD_OTHER for a plain :A, or -1 for
+ * :N and anything else. Numbers are read into num.
+ */
+static int StageIO_ReplyType(const char* line, long* num){
+	if (line[0]!=':' || line[1]!='A') return -1;
+	const char* p=line+2;
+	char* end;
+	int n;
+	for (n = 0; n < 3; ++n) {
+		long v=strtol(p,&end,10);
+		if (end==p) break;
+		if (n<2) num[n]=v;
+		p=end;
+	}
+	if (n==0) return STAGEIO_CMD_OTHER;
+	if (n==1) return STAGEIO_CMD_SYNC;
+	if (n==2) return STAGEIO_CMD_WHERE;
+	return -1;
+}
+
+/*
+ * A complete reply line arrived; find the command in flight it answers.
+ *
+ * Replies come back in order, but one can go missing or turn up late. So a
+ * reply is only matched to a command that expects its kind of answer. A
+ * position (or the one number answer to a resync) can only be meant for a
+ * WHERE (or the resync), so any older commands are skipped and counted as
+ * lost. A plain :A only answers the oldest command, and only if that is not
+ * waiting for numbers. A :N answers the oldest command. Anything else is a
+ * stray and is dropped without touching the commands in flight.
+ */
+static void StageIO_HandleLine(StageIO* io, double now){
+	io->Line[io->LineLen]='\0';
+
+	/** Replies start with a colon; anything else (e.g. an echo) is ignored **/
+	if (io->Line[0]!=':') return;
+	io->NumReplies++;
+
+	long num[2]={0,0};
+	int answer=StageIO_ReplyType(io->Line,num);
+	int isErr=(io->Line[1]=='N');
+
+	int k=io->NumInflight;
+	if (answer==STAGEIO_CMD_WHERE || answer==STAGEIO_CMD_SYNC){
+		for (k = 0; k < io->NumInflight && io->InflightType[k]!=answer; ++k);
+	} else if (io->NumInflight>0 && (isErr || (answer==STAGEIO_CMD_OTHER && io->InflightType[0]==STAGEIO_CMD_OTHER))){
+		k=0;
+	}
+	if (k==io->NumInflight){
+		/** e.g. a late reply to a command we had already given up on **/
+		io->NumStray++;
+		return;
+	}
+
+	int type=io->InflightType[k];
+	double sent=io->InflightSent[k];
+	io->NumLost+=k;
+	int j;
+	for (j = k+1; j < io->NumInflight; ++j) {
+		io->InflightType[j-k-1]=io->InflightType[j];
+		io->InflightSent[j-k-1]=io->InflightSent[j];
+	}
+	io->NumInflight-=k+1;
+	io->WhereInflight=0;
+	for (j = 0; j < io->NumInflight; ++j) {
+		if (io->InflightType[j]==STAGEIO_CMD_WHERE) io->WhereInflight=1;
+	}
+	if (type==STAGEIO_CMD_SYNC) io->Resyncing=0;
+
+	if (isErr){
+		printf("Stage replied with an error: `%s`\n",io->Line);
+		io->NumErrors++;
+		return;
+	}
+
+	if (type==STAGEIO_CMD_WHERE) StageIO_SetPosition(io,num[0],num[1],sent,now);
+}
+
+/*
+ * After a timeout: forget everything in flight and send a command with an
+ * answer nothing else gets (WHERE X). The controller answers in order, so
+ * once that answer is back every late reply to an abandoned command has been
+ * read and dropped. Nothing else is sent until then.
+ */
+static void StageIO_Resync(StageIO* io){
+	io->NumInflight=0;
+	io->WhereInflight=0;
+	io->LineLen=0;
+	StageIO_Drain(io);
+	io->Resyncing=1;
+	StageIO_Send(io,"WHERE X\r",STAGEIO_CMD_SYNC);
+}
+
+
+/*
+ * The stage I/O thread.
+ */
+DWORD WINAPI StageIOThread(LPVOID lpParam){
+	StageIO* io=(StageIO*) lpParam;
+	char cmd[STAGEIO_CMD_LEN];
+	char buf[256];
+	double stopTime=0;
+
+	StageIO_Drain(io);
+
+	while (1){
+		double now=LT_Now();
+
+		/** A reply that never comes would block the line forever; start over **/
+		if (io->NumInflight>0 && now - io->InflightSent[0] > STAGEIO_REPLY_TIMEOUT_MS){
+			io->NumTimeouts++;
+			StageIO_Resync(io);
+			now=LT_Now();
+		} else if (io->Resyncing && io->NumInflight==0){
+			/** The resync could not be sent; try again **/
+			StageIO_Resync(io);
+		}
+
+		/** Send what is waiting, one-shot commands first, as long as there is room in flight.
+		 *  One place is kept for the position poll, so that a stream of spins cannot starve it. **/
+		int room=STAGEIO_MAX_INFLIGHT - ((io->WhereInflight || io->StopRequested) ? 0 : 1);
+		while (!(io->Resyncing) && io->NumInflight < room){
+			int have=0;
+			EnterCriticalSection(&(io->lock));
+			if (io->QueueCount>0){
+				strcpy(cmd,io->Queue[io->QueueHead]);
+				io->QueueHead=(io->QueueHead+1) % STAGEIO_QUEUE_SIZE;
+				io->QueueCount--;
+				have=1;
+			} else if (io->MotionPending){
+				strcpy(cmd,io->Motion);
+				io->MotionPending=0;
+				have=1;
+			}
+			LeaveCriticalSection(&(io->lock));
+			if (!have) break;
+			StageIO_Send(io,cmd,STAGEIO_CMD_OTHER);
+		}
+
+		if (io->StopRequested){
+			/** Leave once everything has been sent and answered, or after a timeout **/
+			if (stopTime==0) stopTime=now;
+			EnterCriticalSection(&(io->lock));
+			int waiting=io->QueueCount + io->MotionPending;
+			LeaveCriticalSection(&(io->lock));
+			if ((waiting==0 && io->NumInflight==0) || now - stopTime > STAGEIO_REPLY_TIMEOUT_MS) break;
+		} else if (!(io->Resyncing) && !(io->WhereInflight) && io->NumInflight < STAGEIO_MAX_INFLIGHT
+				&& now - io->LastWhere >= io->PollMs){
+			/** Poll the position **/
+			if (StageIO_Send(io,"WHERE X Y\r",STAGEIO_CMD_WHERE)==STAGEIO_OK) io->LastWhere=now;
+		}
+
+		/** Read whatever has come back, waiting a little if nothing has **/
+		int n=io->port.Read(io->port.handle,buf,sizeof(buf),STAGEIO_READ_MS);
+		if (n<0){
+			io->NumErrors++;
+			Sleep(STAGEIO_READ_MS);
+			continue;
+		}
+		now=LT_Now();
+		for (int k = 0; k < n; ++k) {
+			if (buf[k]=='\n'){
+				if (io->LineLen>0) StageIO_HandleLine(io,now);
+				io->LineLen=0;
+			} else if (buf[k]!='\r' && io->LineLen < (int) sizeof(io->Line)-1){
+				io->Line[io->LineLen++]=buf[k];
+			}
+		}
+	}
+	return 0;
+}
+
+
+/*
+ * Start the stage I/O thread on port.
+ */
+StageIO* StartStageIO(StagePort port){
+	if (port.Write==NULL || port.Read==NULL){
+		printf("Error! StartStageIO() needs a port to read and write.\n");
+		return NULL;
+	}
+	StageIO* io=(StageIO*) calloc(1,sizeof(StageIO));
+	if (io==NULL){
+		printf("Error! Unable to allocate the stage I/O object.\n");
+		return NULL;
+	}
+	io->port=port;
+	io->LastWhere=-STAGEIO_POLL_MS;
+	io->PollMs=STAGEIO_POLL_MS;
+	InitializeCriticalSection(&(io->lock));
+
+	DWORD dwThreadId;
+	io->Thread=CreateThread(NULL,0,StageIOThread,(void*) io,0,&dwThreadId);
+	if (io->Thread==NULL){
+		printf("Error! Unable to start the stage I/O thread.\n");
+		DeleteCriticalSection(&(io->lock));
+		free(io);
+		return NULL;
+	}
+	SetThreadPriority(io->Thread,THREAD_PRIORITY_ABOVE_NORMAL);
+	return io;
+}
+
+/*
+ * Send anything still waiting, stop the thread and free the object.
+ */
+void StopStageIO(StageIO** io){
+	if (io==NULL || *io==NULL) return;
+	StageIO* s=*io;
+	InterlockedExchange(&(s->StopRequested),1);
+	WaitForSingleObject(s->Thread,INFINITE);
+	CloseHandle(s->Thread);
+	DeleteCriticalSection(&(s->lock));
+	free(s);
+	*io=NULL;
+}
+
+
+/*
+ * Replace whatever motion request has not been sent yet.
+ */
+static int StageIO_SetMotion(StageIO* io, const char* cmd){
+	if (io==NULL) return STAGEIO_ERROR;
+	EnterCriticalSection(&(io->lock));
+	if (io->MotionPending) io->NumCoalesced++;
+	strcpy(io->Motion,cmd);
+	io->MotionPending=1;
+	LeaveCriticalSection(&(io->lock));
+	return STAGEIO_OK;
+}
+
+/*
+ * Line up a one-shot command behind the others.
+ */
+static int StageIO_Enqueue(StageIO* io, const char* cmd){
+	if (io==NULL) return STAGEIO_ERROR;
+	int ret=STAGEIO_OK;
+	EnterCriticalSection(&(io->lock));
+	if (io->QueueCount==STAGEIO_QUEUE_SIZE){
+		ret=STAGEIO_ERROR;
+	} else {
+		strcpy(io->Queue[(io->QueueHead+io->QueueCount) % STAGEIO_QUEUE_SIZE],cmd);
+		io->QueueCount++;
+	}
+	LeaveCriticalSection(&(io->lock));
+	if (ret!=STAGEIO_OK) printf("Error! Too many stage commands waiting. Dropping `%s`\n",cmd);
+	return ret;
+}
+
+/*
+ * Set the velocity of the stage. Same axes and signs as spinStage().
+ */
+int StageIO_Spin(StageIO* io, int xspeed, int yspeed){
+	char cmd[STAGEIO_CMD_LEN];
+	sprintf(cmd,"SPIN X=%d Y=%d\r",-yspeed,-xspeed);
+	return StageIO_SetMotion(io,cmd);
+}
+
+int StageIO_SpinAxes(StageIO* io, int xspeed, int yspeed){
+	char cmd[STAGEIO_CMD_LEN];
+	sprintf(cmd,"SPIN X=%d Y=%d\r",xspeed,yspeed);
+	return StageIO_SetMotion(io,cmd);
+}
+
+int StageIO_Halt(StageIO* io){
+	return StageIO_SetMotion(io,"HALT\r");
+}
+
+int StageIO_MoveRel(StageIO* io, int xpos, int ypos){
+	char cmd[STAGEIO_CMD_LEN];
+	sprintf(cmd,"MOVEI X=%d Y=%d\r",xpos,ypos);
+	return StageIO_Enqueue(io,cmd);
+}
+
+int StageIO_SetHere(StageIO* io, int x, int y){
+	char cmd[STAGEIO_CMD_LEN];
+	sprintf(cmd,"HERE X=%d Y=%d\r",x,y);
+	return StageIO_Enqueue(io,cmd);
+}
+
+int StageIO_Center(StageIO* io, int x, int y){
+	char cmd[STAGEIO_CMD_LEN];
+	sprintf(cmd,"CENTER X=%d Y=%d\r",x,y);
+	return StageIO_Enqueue(io,cmd);
+}
+
+
+/*
+ * Copy the most recent position without taking a lock.
+ */
+int StageIO_SetPollInterval(StageIO* io, int ms){
+	if (io==NULL || ms<=0) return STAGEIO_ERROR;
+	InterlockedExchange(&(io->PollMs),ms);
+	return STAGEIO_OK;
+}
+
+int StageIO_GetPosition(StageIO* io, StagePosition* pos){
+	if (io==NULL || pos==NULL) return STAGEIO_ERROR;
+	LONG seq;
+	do {
+		seq=io->PosSeq;
+		MemoryBarrier();
+		*pos=io->Pos;
+		MemoryBarrier();
+	} while ((seq & 1) || seq!=io->PosSeq);
+	return pos->valid ? STAGEIO_OK : STAGEIO_ERROR;
+}
+
+
+/*
+ * Print how many commands and replies went over the line.
+ */
+void StageIO_PrintReport(StageIO* io, FILE* out){
+	if (io==NULL || out==NULL) return;
+	StagePosition pos;
+	StageIO_GetPosition(io,&pos);
+	fprintf(out,"\nStage I/O: %d commands sent, %d replies, %d positions, %d errors, %d timeouts, %d motion commands replaced before they were sent\n",
+			io->NumSent,io->NumReplies,io->NumPositions,io->NumErrors,io->NumTimeouts,io->NumCoalesced);
+	fprintf(out,"  %d replies matched to no command, %d commands never answered\n",io->NumStray,io->NumLost);
+	if (pos.valid) fprintf(out,"  last position (%ld, %ld), answered in %.1f ms\n",pos.x,pos.y,pos.rtt);
+	fflush(out);
+}
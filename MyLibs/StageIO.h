@@ -0,0 +1,220 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * StageIO.h
+ *
+ * A dedicated thread that owns the serial line to the LUDL MAC6000 stage
+ * controller.
+ *
+ * Nobody else waits on the stage any more. Other threads only leave
+ * requests with the StageIO object and read back the latest position:
+ *
+ *   StageIO_Spin()      set the velocity. Only the newest motion request
+ *                       (spin or halt) is sent; if a newer one arrives
+ *                       before an older one has gone out, the older one is
+ *                       simply replaced.
+ *   StageIO_Halt()      stop. Replaces any pending spin.
+ *   StageIO_MoveRel(), StageIO_SetHere(), StageIO_Center()
+ *                       one-shot commands, sent in order.
+ *   StageIO_GetPosition()
+ *                       the most recent position and when it was
+ *                       measured. Never blocks.
+ *
+ * The thread keeps a few commands in flight at once, asks WHERE X Y every
+ * STAGEIO_POLL_MS and parses replies as they arrive. The controller answers
+ * every command with one line (:A ... or :N ...). Each command in flight
+ * remembers what kind of answer it expects (a position for WHERE, a plain
+ * :A otherwise), and replies are only matched to a command expecting them,
+ * so a lost or stray reply is never credited to the wrong request. After a
+ * timeout the thread sends WHERE X, whose one number answer nothing else
+ * gets, and drops everything until that comes back before sending more.
+ * Because every reply is read as it arrives,
+ * the :A chatter that clearStageBuffer() used to throw away never piles up.
+ *
+ * The serial port is reached through a StagePort, so that the same thread
+ * can talk to a real COM port (see T2S_SerialWrite() and T2S_SerialRead()
+ * in Talk2Stage.h) or to anything else that speaks the protocol.
+ *
+ * Times are ms on the LT_Now() clock.
+ *
+ * Depends on windows.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef STAGEIO_H_
+#define STAGEIO_H_
+
+#include <stdio.h>
+#include <windows.h>
+
+/** Ask for the position this often, unless told otherwise **/
+#define STAGEIO_POLL_MS 10
+
+/** Commands sent but not yet answered, at most **/
+#define STAGEIO_MAX_INFLIGHT 4
+
+/** Give up on a reply after this long and start over **/
+#define STAGEIO_REPLY_TIMEOUT_MS 250
+
+/** Longest the thread waits for input before looking for new requests **/
+#define STAGEIO_READ_MS 2
+
+/** Room for one-shot commands waiting to be sent **/
+#define STAGEIO_QUEUE_SIZE 16
+#define STAGEIO_CMD_LEN 64
+
+/** Return Values **/
+#define STAGEIO_OK 0
+#define STAGEIO_ERROR -1
+
+/*
+ * The serial line.
+ * Write returns the number of bytes written or -1.
+ * Read waits at most timeoutMs for at least one byte and returns the number
+ * of bytes read, 0 if there were none, or -1 on error.
+ */
+typedef struct StagePortStruct{
+	void* handle;
+	int (*Write)(void* handle, const char* buf, int len);
+	int (*Read)(void* handle, char* buf, int len, int timeoutMs);
+} StagePort;
+
+/** Where the stage was, in stage units **/
+typedef struct StagePositionStruct{
+	long x;
+	long y;
+	double t; /** halfway between asking and getting the answer **/
+	double rtt; /** how long the answer took **/
+	int valid; /** 0 until the first reply **/
+} StagePosition;
+
+/** What kind of command is in flight, i.e. what answer it expects **/
+#define STAGEIO_CMD_OTHER 0 /** :A **/
+#define STAGEIO_CMD_WHERE 1 /** :A x y **/
+#define STAGEIO_CMD_SYNC 2 /** :A x, see StageIO_Resync() **/
+
+typedef struct StageIOStruct{
+	StagePort port;
+
+	/** Requests from other threads, protected by lock **/
+	CRITICAL_SECTION lock;
+	int MotionPending; /** a spin or halt is waiting to be sent **/
+	char Motion[STAGEIO_CMD_LEN];
+	char Queue[STAGEIO_QUEUE_SIZE][STAGEIO_CMD_LEN];
+	int QueueHead;
+	int QueueCount;
+
+	/** Commands in flight, oldest first. Only touched by the thread **/
+	int InflightType[STAGEIO_MAX_INFLIGHT];
+	double InflightSent[STAGEIO_MAX_INFLIGHT];
+	int NumInflight;
+	int WhereInflight;
+	int Resyncing; /** waiting for the answer to WHERE X after a timeout **/
+	double LastWhere;
+	volatile LONG PollMs; /** ask for the position this often, see StageIO_SetPollInterval() **/
+
+	/** Reply line being assembled. Only touched by the thread **/
+	char Line[128];
+	int LineLen;
+
+	/** Latest position, written by the thread under a sequence lock **/
+	volatile LONG PosSeq;
+	StagePosition Pos;
+
+	/** Thread **/
+	HANDLE Thread;
+	volatile LONG StopRequested;
+
+	/** Statistics **/
+	int NumSent;
+	int NumReplies;
+	int NumErrors; /** :N replies and failed writes **/
+	int NumTimeouts;
+	int NumStray; /** replies that matched no command in flight **/
+	int NumLost; /** commands skipped over because a later one was answered **/
+	int NumCoalesced; /** motion requests replaced before they were sent **/
+	int NumPositions;
+} StageIO;
+
+
+/*
+ * Start the stage I/O thread on port. The thread has the port to itself
+ * from now on until StopStageIO().
+ * Returns NULL on error.
+ */
+StageIO* StartStageIO(StagePort port);
+
+/*
+ * Send anything still waiting (e.g. a final halt), stop the thread and free
+ * the object. The port is not closed.
+ */
+void StopStageIO(StageIO** io);
+
+/*
+ * Set the velocity of the stage. Same axes and signs as spinStage().
+ */
+int StageIO_Spin(StageIO* io, int xspeed, int yspeed);
+
+/*
+ * Set the velocity of the stage in its own axes and signs: SPIN X=xspeed Y=yspeed.
+ */
+int StageIO_SpinAxes(StageIO* io, int xspeed, int yspeed);
+
+int StageIO_Halt(StageIO* io);
+
+int StageIO_MoveRel(StageIO* io, int xpos, int ypos);
+
+/*
+ * Call the current location (x,y).
+ */
+int StageIO_SetHere(StageIO* io, int x, int y);
+
+int StageIO_Center(StageIO* io, int x, int y);
+
+/*
+ * Ask for the position every ms instead of every STAGEIO_POLL_MS, e.g.
+ * when something else tracks the stage and the serial position is only
+ * a slow check.
+ */
+int StageIO_SetPollInterval(StageIO* io, int ms);
+
+/*
+ * Copy the most recent position. Never blocks.
+ * Returns STAGEIO_OK, or STAGEIO_ERROR if no position has been read yet.
+ */
+int StageIO_GetPosition(StageIO* io, StagePosition* pos);
+
+/*
+ * Print how many commands and replies went over the line.
+ */
+void StageIO_PrintReport(StageIO* io, FILE* out);
+
+#endif /* STAGEIO_H_ */
@@ -0,0 +1,350 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * StageOdometry.c
+ *
+ * Stage position from phase correlation of consecutive frames.
+ * See StageOdometry.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <windows.h>
+
+#include <cxcore.h>
+#include <cv.h>
+#include "opencv2/imgproc/imgproc_c.h"
+
+#include "StageIO.h"
+#include "StageControl.h"
+#include "StageOdometry.h"
+
+/** Width of the soft edge around the blanked out worm (shrunken pixels, odd) **/
+#define SO_MASK_EDGE 9
+
+/** Whitening floor, as a fraction of the mean magnitude of the cross power spectrum **/
+#define SO_WHITEN_FLOOR 1.0
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+
+StageOdometry* CreateStageOdometry(CvSize frameSize, int scale){
+	if (scale<1) scale=SO_DEFAULT_SCALE;
+	CvSize size=cvSize(frameSize.width/scale,frameSize.height/scale);
+	if (size.width<16 || size.height<16){
+		printf("Error! Frames of %dx%d are too small for stage odometry at scale %d.\n",frameSize.width,frameSize.height,scale);
+		return NULL;
+	}
+	StageOdometry* so=(StageOdometry*) calloc(1,sizeof(StageOdometry));
+	if (so==NULL) return NULL;
+	so->Scale=scale;
+	so->Size=size;
+	so->ExcludeRadius=SO_DEFAULT_EXCLUDE_RADIUS;
+
+	so->Small=cvCreateImage(size,IPL_DEPTH_8U,1);
+	so->Prev=cvCreateImage(size,IPL_DEPTH_32F,1);
+	so->Cur=cvCreateImage(size,IPL_DEPTH_32F,1);
+	so->Window=cvCreateImage(size,IPL_DEPTH_32F,1);
+	so->Mask=cvCreateImage(size,IPL_DEPTH_32F,1);
+	so->Work=cvCreateImage(size,IPL_DEPTH_32F,1);
+	so->Re=cvCreateImage(size,IPL_DEPTH_32F,1);
+	so->Im=cvCreateImage(size,IPL_DEPTH_32F,1);
+	so->SpecPrev=cvCreateImage(size,IPL_DEPTH_32F,2);
+	so->SpecCur=cvCreateImage(size,IPL_DEPTH_32F,2);
+
+	/** Hanning window, so the frame's edges don't look like a feature that stays put **/
+	for (int y = 0; y < size.height; ++y) {
+		double wy=0.5 - 0.5*cos(2*M_PI*y/(size.height-1));
+		for (int x = 0; x < size.width; ++x) {
+			double wx=0.5 - 0.5*cos(2*M_PI*x/(size.width-1));
+			CV_IMAGE_ELEM(so->Window,float,y,x)=(float) (wx*wy);
+		}
+	}
+
+	StageCalibration calib;
+	SC_DefaultCalibration(&calib);
+	SO_SetCalibration(so,&calib);
+	return so;
+}
+
+void DestroyStageOdometry(StageOdometry** so){
+	if (so==NULL || *so==NULL) return;
+	StageOdometry* s=*so;
+	cvReleaseImage(&(s->Small));
+	cvReleaseImage(&(s->Prev));
+	cvReleaseImage(&(s->Cur));
+	cvReleaseImage(&(s->Window));
+	cvReleaseImage(&(s->Mask));
+	cvReleaseImage(&(s->Work));
+	cvReleaseImage(&(s->Re));
+	cvReleaseImage(&(s->Im));
+	cvReleaseImage(&(s->SpecPrev));
+	cvReleaseImage(&(s->SpecCur));
+	free(s);
+	*so=NULL;
+}
+
+
+int SO_SetCalibration(StageOdometry* so, const StageCalibration* calib){
+	if (so==NULL || calib==NULL) return SO_ERROR;
+	const double (*A)[2]=calib->A;
+	double det=A[0][0]*A[1][1] - A[0][1]*A[1][0];
+	if (fabs(det)<1e-12){
+		printf("Error! The stage calibration cannot be inverted.\n");
+		return SO_ERROR;
+	}
+	so->Ainv[0][0]=A[1][1]/det;
+	so->Ainv[0][1]=-A[0][1]/det;
+	so->Ainv[1][0]=-A[1][0]/det;
+	so->Ainv[1][1]=A[0][0]/det;
+	return SO_OK;
+}
+
+
+/*
+ * Spectrum of src under the current mask. The mean of the unmasked part
+ * is taken out first, so the mask itself adds nothing.
+ */
+static void SO_Spectrum(StageOdometry* so, const IplImage* src, IplImage* spec){
+	double wsum=cvSum(so->Mask).val[0];
+	cvMul(src,so->Mask,so->Work);
+	double mean= wsum>0 ? cvSum(so->Work).val[0]/wsum : 0;
+	cvSubS(src,cvScalarAll(mean),so->Work);
+	cvMul(so->Work,so->Mask,so->Work);
+	cvDFT(so->Work,spec,CV_DXT_FORWARD);
+}
+
+/*
+ * Vertex of the parabola through three samples, relative to the middle one.
+ */
+static double SO_Parabola(double left, double mid, double right){
+	double den=left - 2*mid + right;
+	if (den>=0) return 0;
+	double v=0.5*(left - right)/den;
+	if (v<-0.5) return -0.5;
+	if (v>0.5) return 0.5;
+	return v;
+}
+
+/*
+ * Peak to a fraction of a pixel, wrapped around the edges, as a signed
+ * shift.
+ */
+static void SO_SubPixel(const IplImage* corr, CvPoint peak, double* dx, double* dy){
+	int w=corr->width, h=corr->height;
+#define SO_AT(i,j) CV_IMAGE_ELEM(corr,float,(peak.y+(j)+h)%h,(peak.x+(i)+w)%w)
+	*dx=peak.x + SO_Parabola(SO_AT(-1,0),SO_AT(0,0),SO_AT(1,0));
+	*dy=peak.y + SO_Parabola(SO_AT(0,-1),SO_AT(0,0),SO_AT(0,1));
+#undef SO_AT
+	if (*dx > w/2) *dx-=w;
+	if (*dy > h/2) *dy-=h;
+}
+
+
+int SO_AddFrame(StageOdometry* so, const IplImage* img, double t, const CvPoint* worm){
+	if (so==NULL || img==NULL) return SO_ERROR;
+	if (img->nChannels!=1 || img->depth!=IPL_DEPTH_8U){
+		printf("Error! Stage odometry needs 8 bit gray frames.\n");
+		return SO_ERROR;
+	}
+	cvResize(img,so->Small,CV_INTER_AREA);
+	cvConvert(so->Small,so->Cur);
+	so->NumFrames++;
+
+	int measured=0;
+	double dt= so->HavePrev ? t - so->PrevT : 0;
+	if (so->HavePrev && dt>0){
+		/** Window, with the worm blanked out wherever it was in either frame **/
+		if (worm!=NULL || so->PrevHasWorm){
+			int r=so->ExcludeRadius/so->Scale;
+			cvSet(so->Work,cvScalarAll(1));
+			if (worm!=NULL) cvCircle(so->Work,cvPoint(worm->x/so->Scale,worm->y/so->Scale),r,cvScalarAll(0),CV_FILLED);
+			if (so->PrevHasWorm) cvCircle(so->Work,cvPoint(so->PrevWorm.x/so->Scale,so->PrevWorm.y/so->Scale),r,cvScalarAll(0),CV_FILLED);
+			cvSmooth(so->Work,so->Work,CV_GAUSSIAN,SO_MASK_EDGE,SO_MASK_EDGE);
+			cvMul(so->Window,so->Work,so->Mask);
+		} else {
+			cvCopy(so->Window,so->Mask);
+		}
+
+		SO_Spectrum(so,so->Prev,so->SpecPrev);
+		SO_Spectrum(so,so->Cur,so->SpecCur);
+
+		/** Normalized cross power spectrum; its inverse peaks at the shift from Prev to Cur **/
+		cvMulSpectrums(so->SpecCur,so->SpecPrev,so->SpecCur,CV_DXT_MUL_CONJ);
+		cvSplit(so->SpecCur,so->Re,so->Im,NULL,NULL);
+		cvCartToPolar(so->Re,so->Im,so->Work,NULL,0);
+		/** Only partly whitened: frequencies that hold nothing but noise stay small.
+		 *  The mask is free by now and holds the denominator **/
+		double area=so->Size.width*so->Size.height;
+		double whiten=SO_WHITEN_FLOOR*cvSum(so->Work).val[0]/area;
+		cvAddS(so->Work,cvScalarAll(whiten + 1e-9),so->Mask);
+		cvDiv(so->Re,so->Mask,so->Re,1);
+		cvDiv(so->Im,so->Mask,so->Im,1);
+		/** A perfect match would peak at the mean weight **/
+		cvDiv(so->Work,so->Mask,so->Work,1);
+		double perfect=cvSum(so->Work).val[0]/area;
+		cvMerge(so->Re,so->Im,NULL,NULL,so->SpecCur);
+		cvDFT(so->SpecCur,so->Work,CV_DXT_INV_SCALE);
+
+		double peak;
+		CvPoint loc;
+		cvMinMaxLoc(so->Work,NULL,&peak,NULL,&loc,NULL);
+		if (perfect>0) peak/=perfect;
+		so->Response=peak;
+		so->SumResponse+=peak;
+
+		if (peak>=SO_MIN_RESPONSE){
+			double dx, dy;
+			SO_SubPixel(so->Work,loc,&dx,&dy);
+			so->ShiftX=dx*so->Scale;
+			so->ShiftY=dy*so->Scale;
+			/** The ground moves through the image as the stage does **/
+			double sx=so->Ainv[0][0]*so->ShiftX + so->Ainv[0][1]*so->ShiftY;
+			double sy=so->Ainv[1][0]*so->ShiftX + so->Ainv[1][1]*so->ShiftY;
+			so->X+=sx;
+			so->Y+=sy;
+			so->Vx=sx/dt;
+			so->Vy=sy/dt;
+			measured=1;
+			so->NumMeasured++;
+		}
+	}
+	if (!measured && so->HavePrev && dt>0){
+		/** Assume the stage kept going **/
+		so->X+=so->Vx*dt;
+		so->Y+=so->Vy*dt;
+		so->NumAssumed++;
+	}
+	so->Measured=measured;
+	so->T=t;
+
+	/** Remember it for SO_Correct() **/
+	so->HistT[so->HistHead]=so->T;
+	so->HistX[so->HistHead]=so->X;
+	so->HistY[so->HistHead]=so->Y;
+	so->HistHead=(so->HistHead+1)%SO_HISTORY;
+	if (so->HistCount<SO_HISTORY) so->HistCount++;
+
+	/** This frame is the next one's reference **/
+	IplImage* tmp=so->Prev;
+	so->Prev=so->Cur;
+	so->Cur=tmp;
+	so->PrevT=t;
+	so->HavePrev=1;
+	so->PrevHasWorm= worm!=NULL;
+	if (worm!=NULL) so->PrevWorm=*worm;
+
+	return measured ? SO_OK : SO_ERROR;
+}
+
+
+/*
+ * Where the odometry puts the stage at time t, between frames or a little
+ * after the last one.
+ */
+static int SO_At(StageOdometry* so, double t, double* x, double* y){
+	int newest=(so->HistHead - 1 + SO_HISTORY)%SO_HISTORY;
+	if (t>=so->HistT[newest]){
+		*x=so->HistX[newest] + so->Vx*(t - so->HistT[newest]);
+		*y=so->HistY[newest] + so->Vy*(t - so->HistT[newest]);
+		return SO_OK;
+	}
+	int later=newest;
+	for (int k = 1; k < so->HistCount; ++k) {
+		int i=(newest - k + SO_HISTORY)%SO_HISTORY;
+		if (so->HistT[i]<=t){
+			double f=(t - so->HistT[i])/(so->HistT[later] - so->HistT[i]);
+			*x=so->HistX[i] + f*(so->HistX[later] - so->HistX[i]);
+			*y=so->HistY[i] + f*(so->HistY[later] - so->HistY[i]);
+			return SO_OK;
+		}
+		later=i;
+	}
+	return SO_ERROR;
+}
+
+int SO_Correct(StageOdometry* so, const StagePosition* serial){
+	if (so==NULL || serial==NULL || !serial->valid) return SO_ERROR;
+	if (serial->t<=so->LastSerialT || so->HistCount==0) return SO_ERROR;
+	so->LastSerialT=serial->t;
+
+	double ex, ey;
+	if (SO_At(so,serial->t,&ex,&ey)!=SO_OK) return SO_ERROR;
+	double errX=serial->x - ex;
+	double errY=serial->y - ey;
+
+	/** The first serial position sets the origin, after that only nudge **/
+	double gain=1.0;
+	if (so->Anchored){
+		gain=SO_DRIFT_GAIN;
+		double err=hypot(errX,errY);
+		so->NumCorrections++;
+		so->SumCorrection+=err;
+		if (err>so->MaxCorrection) so->MaxCorrection=err;
+	}
+	so->X+=gain*errX;
+	so->Y+=gain*errY;
+	for (int k = 0; k < so->HistCount; ++k) {
+		int i=(so->HistHead - 1 - k + SO_HISTORY)%SO_HISTORY;
+		so->HistX[i]+=gain*errX;
+		so->HistY[i]+=gain*errY;
+	}
+	so->Anchored=1;
+	return SO_OK;
+}
+
+
+int SO_GetPosition(StageOdometry* so, StagePosition* pos){
+	if (so==NULL || pos==NULL) return SO_ERROR;
+	pos->x=lround(so->X);
+	pos->y=lround(so->Y);
+	pos->t=so->T;
+	pos->rtt=0;
+	pos->valid= so->Measured && so->Anchored;
+	return pos->valid ? SO_OK : SO_ERROR;
+}
+
+
+void SO_PrintReport(StageOdometry* so, FILE* out){
+	if (so==NULL || out==NULL) return;
+	int compared=so->NumMeasured + so->NumAssumed;
+	fprintf(out,"\nStage odometry: %d frames, %d measured, %d assumed",so->NumFrames,so->NumMeasured,so->NumAssumed);
+	if (compared>0) fprintf(out,", mean correlation peak %.2f",so->SumResponse/compared);
+	fprintf(out,"\n");
+	if (so->NumCorrections>0) fprintf(out,"  %d serial corrections, disagreement mean %.1f max %.1f stage units\n",
+			so->NumCorrections,so->SumCorrection/so->NumCorrections,so->MaxCorrection);
+	fflush(out);
+}
@@ -0,0 +1,189 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * StageOdometry.h
+ *
+ * Tracks the stage from the camera instead of the serial line.
+ *
+ * Every frame is shrunk by Scale and phase correlated with the previous
+ * one: the inverse of the whitened cross power spectrum of the two has a
+ * single sharp peak at the shift between them, found to a fraction of a
+ * pixel with a parabola. The whitening has a floor, so frequencies that
+ * hold nothing but noise do not drown the peak. Everything that is fixed to the ground
+ * (agar, scratches, debris) moves through the image exactly as the stage
+ * moves, so with the pixel to stage calibration (see StageCalibrator.h)
+ * the shift is the stage's displacement between the two frames. The worm
+ * is not fixed to the ground, so a disc around it is blanked out with a
+ * soft edge before the transform.
+ *
+ * Summing the displacements gives the stage position at the moment every
+ * frame was captured, at camera rate and without asking the stage. The
+ * sum drifts, so the serial position (StageIO) is used as a slow
+ * correction: SO_Correct() compares it with the odometry at the time the
+ * stage answered and takes out SO_DRIFT_GAIN of the difference. The first
+ * serial position sets the origin.
+ *
+ * A frame whose correlation peak is weaker than SO_MIN_RESPONSE (a blank
+ * field, a bubble, a focus change) is not measured; the stage is assumed
+ * to have kept its last velocity for that frame.
+ *
+ * Everything runs on the thread that calls SO_AddFrame(). A 1024x768
+ * frame at the default scale costs three 256x192 transforms.
+ *
+ * Times are ms on the LT_Now() clock.
+ *
+ * Depends on windows.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef STAGEODOMETRY_H_
+#define STAGEODOMETRY_H_
+
+#include <stdio.h>
+#include <windows.h>
+#include <cxcore.h>
+#include "StageIO.h"
+#include "StageControl.h"
+
+/** Shrink frames by this much before correlating **/
+#define SO_DEFAULT_SCALE 4
+
+/** Blank out this far around the worm (full size pixels) **/
+#define SO_DEFAULT_EXCLUDE_RADIUS 120
+
+/** Weakest correlation peak taken as a measurement. 1 is a perfect match **/
+#define SO_MIN_RESPONSE 0.3
+
+/** Fraction of the serial position's disagreement taken out at a time **/
+#define SO_DRIFT_GAIN 0.1
+
+/** Ask the stage where it is this often once the odometry runs (ms) **/
+#define SO_SERIAL_POLL_MS 100
+
+/** Frames remembered to compare with late serial positions **/
+#define SO_HISTORY 64
+
+/** Return Values **/
+#define SO_OK 0
+#define SO_ERROR -1
+
+typedef struct StageOdometryStruct{
+	int Scale;
+	CvSize Size; /** shrunken frame **/
+	int ExcludeRadius;
+
+	/** Pixel to stage calibration **/
+	double Ainv[2][2]; /** stage units per pixel **/
+
+	/** Images. All Size **/
+	IplImage* Small; /** 8U **/
+	IplImage* Prev; /** 32F, previous frame **/
+	IplImage* Cur; /** 32F **/
+	IplImage* Window; /** 32F Hanning window **/
+	IplImage* Mask; /** 32F window with the worm blanked out **/
+	IplImage* Work; /** 32F **/
+	IplImage* Re; /** 32F **/
+	IplImage* Im; /** 32F **/
+	IplImage* SpecPrev; /** 32FC2 **/
+	IplImage* SpecCur; /** 32FC2 **/
+	int HavePrev;
+	double PrevT;
+	int PrevHasWorm;
+	CvPoint PrevWorm;
+
+	/** Estimate, stage units **/
+	double X;
+	double Y;
+	double T; /** capture time of the last frame **/
+	double Vx; /** stage units/ms, from the last measured frame **/
+	double Vy;
+	int Measured; /** the last frame was measured, not assumed **/
+	int Anchored; /** a serial position has set the origin **/
+	double ShiftX; /** last shift, full size pixels **/
+	double ShiftY;
+	double Response; /** last correlation peak **/
+
+	/** Recent frames, for SO_Correct() **/
+	double HistT[SO_HISTORY];
+	double HistX[SO_HISTORY];
+	double HistY[SO_HISTORY];
+	int HistHead;
+	int HistCount;
+	double LastSerialT;
+
+	/** Statistics **/
+	int NumFrames;
+	int NumMeasured;
+	int NumAssumed;
+	int NumCorrections;
+	double SumCorrection; /** stage units **/
+	double MaxCorrection;
+	double SumResponse;
+} StageOdometry;
+
+
+/*
+ * For frames of size frameSize, shrunk by scale.
+ * Returns NULL on error.
+ */
+StageOdometry* CreateStageOdometry(CvSize frameSize, int scale);
+
+void DestroyStageOdometry(StageOdometry** so);
+
+/*
+ * Use calib to turn image shifts into stage displacement.
+ */
+int SO_SetCalibration(StageOdometry* so, const StageCalibration* calib);
+
+/*
+ * Add a frame (8 bit, one channel, frameSize) captured at t.
+ * worm is where the worm is in it, or NULL if there is none.
+ * Returns SO_OK if the frame was measured, SO_ERROR if the stage's
+ * displacement had to be assumed (or this is the first frame).
+ */
+int SO_AddFrame(StageOdometry* so, const IplImage* img, double t, const CvPoint* worm);
+
+/*
+ * Slow drift correction from the stage's own idea of where it is.
+ * Positions already seen are ignored, so call it as often as you like.
+ */
+int SO_Correct(StageOdometry* so, const StagePosition* serial);
+
+/*
+ * Where the stage was when the last frame was captured.
+ * pos->valid is 1 only if that frame was measured and a serial position
+ * has set the origin. Positions are in the stage's units and axes.
+ */
+int SO_GetPosition(StageOdometry* so, StagePosition* pos);
+
+void SO_PrintReport(StageOdometry* so, FILE* out);
+
+#endif /* STAGEODOMETRY_H_ */
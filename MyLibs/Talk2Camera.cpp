@@ -41,6 +41,7 @@
  */
 #include "../3rdPartyLibs/tisgrabber.h"
 #include "Talk2Camera.h"
+#include "LatencyTrace.h"
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -72,6 +73,7 @@ void T2Cam_CloseLib() {
 void T2Cam_AllocateCamData(CamData** MyCamera) {
 	printf("inside T2Cam_AllocateCamData\n");
 	*MyCamera = (CamData*) malloc(sizeof(CamData));
+	(*MyCamera)->iFrameTime = 0;
 }
 
 /*
@@ -194,6 +196,7 @@ void _cdecl callback(HGRABBER hGrabber, unsigned char* pData,
 	}
 	//if (!CallBackDataStruct->iProcessing) {
 		//CallBackDataStruct->iProcessing = 1;
+		CallBackDataStruct->iFrameTime = LT_Now(); //For the latency trace
 		CallBackDataStruct->iImageData = pData; //Copy the frame data into the structure.
 		CallBackDataStruct->iFrameNumber = frameNumber;
 		if (PRINT_DEBUG) {
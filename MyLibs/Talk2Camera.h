@@ -60,6 +60,7 @@ struct CamDataStruct {
 	COLORFORMAT iColorFormat;
 	int iProcessing;
 	unsigned long iFrameNumber;
+	double iFrameTime; // LT_Now() when the callback saw this frame
 };
 
 /*
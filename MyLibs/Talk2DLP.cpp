@@ -86,6 +86,14 @@ int T2DLP_clear(long myDLP){
 	return 0;
 }
 
+/*
+ * Only DontTalk2DLP.c can simulate a DMD.
+ */
+int T2DLP_SimulateDMD(int uploadDelay){
+	printf("This build talks to a real DMD. Ignoring request to simulate one.\n");
+	return T2DLP_SAD;
+}
+
 int T2DLP_off(long alpid){
 	printf("Inside T2DLP_off().. Closing the device driver.");
 	AlpbDevReset((ALPB_HDEVICE) alpid, ALPB_RESET_GLOBAL,0);
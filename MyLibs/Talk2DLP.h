@@ -47,6 +47,17 @@ unsigned char *SampleImages( unsigned long nSizeX, unsigned long nSizeY );
  */
 int T2DLP_clear(long myDLP);
 
+/*
+ * Simulate a DMD in software builds that link against DontTalk2DLP.c.
+ *
+ * After calling this, T2DLP_on(), T2DLP_SendFrame(), T2DLP_clear() and T2DLP_off()
+ * pretend to talk to a DMD. Each upload takes uploadDelay milliseconds,
+ * so that the timing of the DLP output path can be exercised without hardware.
+ *
+ * Builds that talk to a real DMD return T2DLP_SAD and ignore the request.
+ */
+int T2DLP_SimulateDMD(int uploadDelay);
+
 #define	T2DLP_HAPPY	 	0
 #define	T2DLP_SAD		-1
 
@@ -342,6 +342,48 @@ int centerStage(HANDLE s){
 
 
 
+/*
+ * Serial port transport for the stage I/O thread (see StageIO.h).
+ * Write the whole command. Returns the number of bytes written or -1.
+ */
+int T2S_SerialWrite(void* s, const char* buf, int len){
+	DWORD nWritten;
+	if (!WriteFile((HANDLE) s, buf, len, &nWritten, NULL)) return -1;
+	return (int) nWritten;
+}
+
+/*
+ * Read whatever the stage has sent, waiting at most timeoutMs for the first
+ * byte. Returns the number of bytes read, 0 if there were none, or -1.
+ */
+int T2S_SerialRead(void* s, char* buf, int len, int timeoutMs){
+	static HANDLE lastPort=NULL;
+	static int lastTimeout=-1;
+
+	/** Changing the timeouts is a driver call; only do it when they change **/
+	if ((HANDLE) s!=lastPort || timeoutMs!=lastTimeout){
+		COMMTIMEOUTS timeouts={0};
+		/** Return as soon as anything is there, or after timeoutMs if nothing is **/
+		timeouts.ReadIntervalTimeout=MAXDWORD;
+		timeouts.ReadTotalTimeoutMultiplier=MAXDWORD;
+		timeouts.ReadTotalTimeoutConstant= (timeoutMs>0) ? timeoutMs : 1;
+		timeouts.WriteTotalTimeoutConstant=50;
+		timeouts.WriteTotalTimeoutMultiplier=10;
+		if(!SetCommTimeouts((HANDLE) s, &timeouts)){
+			printf("Error: unable to set serial port timeouts.\n");
+			return -1;
+		}
+		lastPort=(HANDLE) s;
+		lastTimeout=timeoutMs;
+	}
+
+	DWORD nRead;
+	if (!ReadFile((HANDLE) s, buf, len, &nRead, NULL)) return -1;
+	return (int) nRead;
+}
+
+
+
 
 void steerStageFromNumberPad(HANDLE s, int speed, int input){
 	  switch (input) {
@@ -70,6 +70,14 @@ int zeroStage(HANDLE s);
  */
 int centerStage(HANDLE s);
 
+/*
+ * Serial port transport for the stage I/O thread. See StageIO.h
+ * The handle is the one returned by InitializeUsbStage().
+ */
+int T2S_SerialWrite(void* s, const char* buf, int len);
+
+int T2S_SerialRead(void* s, char* buf, int len, int timeoutMs);
+
 /*
  *
  *  Given a number on the number pad, this steers the stage.
@@ -32,7 +32,11 @@
 #include "opencv2/imgproc/imgproc_c.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <stdbool.h>
+#include <windows.h>
 
 #include "AndysOpenCVLib.h"
 #include "WormAnalysis.h"
@@ -45,6 +49,129 @@
  *
  */
 
+/** Upper limit on the number of threads used for a full frame remap **/
+#define REMAP_MAX_THREADS 8
+
+/*
+ * One worker of the remap pool. Each worker owns a fixed band of DLP rows.
+ */
+typedef struct RemapWorkerStruct{
+	struct RemapPoolStruct* Pool;
+	int RowStart;
+	int RowEnd;
+	HANDLE Go; // auto-reset, set by the caller when there is a frame to remap
+	HANDLE Done; // auto-reset, set by the worker when its band is finished
+	HANDLE Thread;
+} RemapWorker;
+
+typedef struct RemapPoolStruct{
+	CalibData* Calib;
+	const unsigned char* src;
+	unsigned char* dst;
+	int NumWorkers;
+	RemapWorker* Workers;
+	HANDLE* DoneEvents;
+	int MainRowEnd; // the calling thread does rows [0,MainRowEnd)
+	volatile LONG Stop;
+} RemapPool;
+
+
+/*
+ * Gather rows [RowStart,RowEnd) of the DLP image from the camera image.
+ * Invalid entries of the map point at camera pixel 0 and have a mask of 0,
+ * so there is no branch in the loop.
+ */
+static void RemapRows(const CalibData* Calib, const unsigned char* src, unsigned char* dst, int RowStart, int RowEnd){
+	const int width=Calib->SizeOfDLP.width;
+	const int* map=Calib->DLP2CCDMap + RowStart*width;
+	const unsigned char* mask=Calib->DLP2CCDMask + RowStart*width;
+	unsigned char* out=dst + RowStart*width;
+	int n=(RowEnd-RowStart)*width;
+	int i;
+	for (i = 0; i < n; i++) {
+		out[i]= src[map[i]] & mask[i];
+	}
+}
+
+
+DWORD WINAPI RemapWorkerThread(LPVOID lpParam){
+	RemapWorker* w=(RemapWorker*) lpParam;
+	RemapPool* pool=w->Pool;
+	while(1){
+		WaitForSingleObject(w->Go,INFINITE);
+		if (pool->Stop) break;
+		RemapRows(pool->Calib,pool->src,pool->dst,w->RowStart,w->RowEnd);
+		SetEvent(w->Done);
+	}
+	return 0;
+}
+
+
+static void DestroyRemapPool(RemapPool** PoolPtr){
+	if (PoolPtr==NULL || *PoolPtr==NULL) return;
+	RemapPool* pool=*PoolPtr;
+	int k;
+	InterlockedExchange(&(pool->Stop),1);
+	for (k = 0; k < pool->NumWorkers; k++) {
+		if (pool->Workers[k].Thread!=NULL){
+			SetEvent(pool->Workers[k].Go);
+			WaitForSingleObject(pool->Workers[k].Thread,INFINITE);
+			CloseHandle(pool->Workers[k].Thread);
+		}
+		CloseHandle(pool->Workers[k].Go);
+		CloseHandle(pool->Workers[k].Done);
+	}
+	free(pool->Workers);
+	free(pool->DoneEvents);
+	free(pool);
+	*PoolPtr=NULL;
+}
+
+/*
+ * Start the worker threads. The DLP rows are split into equal bands,
+ * one for the calling thread and one for each worker.
+ */
+static RemapPool* CreateRemapPool(CalibData* Calib){
+	SYSTEM_INFO sysinfo;
+	GetSystemInfo(&sysinfo);
+	int numThreads=(int) sysinfo.dwNumberOfProcessors;
+	if (numThreads > REMAP_MAX_THREADS) numThreads=REMAP_MAX_THREADS;
+	if (numThreads > Calib->SizeOfDLP.height) numThreads=Calib->SizeOfDLP.height;
+	if (numThreads < 1) numThreads=1;
+
+	RemapPool* pool=(RemapPool*) malloc(sizeof(RemapPool));
+	pool->Calib=Calib;
+	pool->src=NULL;
+	pool->dst=NULL;
+	pool->Stop=0;
+	pool->NumWorkers=numThreads-1;
+	pool->Workers=(RemapWorker*) calloc(numThreads,sizeof(RemapWorker));
+	pool->DoneEvents=(HANDLE*) calloc(numThreads,sizeof(HANDLE));
+
+	int height=Calib->SizeOfDLP.height;
+	pool->MainRowEnd=height/numThreads;
+	int k;
+	for (k = 0; k < pool->NumWorkers; k++) {
+		RemapWorker* w=&(pool->Workers[k]);
+		w->Pool=pool;
+		w->RowStart=height*(k+1)/numThreads;
+		w->RowEnd=height*(k+2)/numThreads;
+		w->Go=CreateEvent(NULL,FALSE,FALSE,NULL);
+		w->Done=CreateEvent(NULL,FALSE,FALSE,NULL);
+		pool->DoneEvents[k]=w->Done;
+		DWORD dwThreadId;
+		w->Thread=CreateThread(NULL,0,RemapWorkerThread,(void*) w,0,&dwThreadId);
+		if (w->Thread==NULL){
+			printf("ERROR! CreateRemapPool() could not start worker thread %d\n",k);
+			pool->NumWorkers=k+1;
+			DestroyRemapPool(&pool);
+			return NULL;
+		}
+	}
+	printf("Full frame remap will use %d thread(s).\n",numThreads);
+	return pool;
+}
+
 
 
 
@@ -58,9 +185,14 @@ CalibData* CreateCalibData( CvSize SizeOfDLP, CvSize SizeOfCCD){
 
 	printf("Inside CreateCalibData()\nSizeOfDLP.height =%d,SizeOfDLP.width=%d\n",SizeOfDLP.height ,SizeOfDLP.width);
 	CalibData* Calib=(CalibData*) malloc(sizeof(CalibData));
-	Calib->CCD2DLPLookUp = (int *) malloc(2 * SizeOfDLP.height * SizeOfDLP.width* sizeof(int));
+	/** The lookup table is only allocated if one is read from disk or expanded from a model **/
+	Calib->CCD2DLPLookUp = NULL;
+	Calib->Model = NULL;
 	Calib->SizeOfCCD=SizeOfCCD;
 	Calib->SizeOfDLP=SizeOfDLP;
+	Calib->DLP2CCDMap=NULL;
+	Calib->DLP2CCDMask=NULL;
+	Calib->RemapPool=NULL;
 	return Calib;
 }
 
@@ -68,7 +200,11 @@ CalibData* CreateCalibData( CvSize SizeOfDLP, CvSize SizeOfCCD){
  * Deallocate memory for CalibData object
  */
 void DestroyCalibData(CalibData* Calib){
+	DestroyRemapPool(&(Calib->RemapPool));
+	free(Calib->DLP2CCDMap);
+	free(Calib->DLP2CCDMask);
 	free(Calib->CCD2DLPLookUp);
+	DestroyCalibModel(&(Calib->Model));
 	free(Calib);
 
 }
@@ -77,6 +213,38 @@ void DestroyCalibData(CalibData* Calib){
 
 
 
+/*
+ * Read a CalibModel written by WriteCalibModelToFile(). fp points just past the magic.
+ * Returns NULL on error.
+ */
+static CalibModel* ReadCalibModel(FILE* fp){
+	int header[7];
+	if (fread(header,sizeof(int),7,fp)!=7) return NULL;
+	int GridCols=header[5];
+	int GridRows=header[6];
+	if (GridCols<2 || GridRows<2 || GridCols*GridRows > 1000000) return NULL;
+
+	CalibModel* m=(CalibModel*) malloc(sizeof(CalibModel));
+	m->SizeOfDLP=cvSize(header[0],header[1]);
+	m->SizeOfCCD=cvSize(header[2],header[3]);
+	m->GridStep=header[4];
+	m->GridCols=GridCols;
+	m->GridRows=GridRows;
+	m->ResidX=(float*) malloc(GridCols*GridRows*sizeof(float));
+	m->ResidY=(float*) malloc(GridCols*GridRows*sizeof(float));
+
+	int ok=1;
+	if (fread(&(m->NumPts),sizeof(int),1,fp)!=1) ok=0;
+	if (ok && fread(m->H,sizeof(double),9,fp)!=9) ok=0;
+	if (ok && fread(&(m->RMSHomography),sizeof(double),1,fp)!=1) ok=0;
+	if (ok && fread(&(m->RMSModel),sizeof(double),1,fp)!=1) ok=0;
+	if (ok && fread(m->ResidX,sizeof(float),GridCols*GridRows,fp)!=(size_t) (GridCols*GridRows)) ok=0;
+	if (ok && fread(m->ResidY,sizeof(float),GridCols*GridRows,fp)!=(size_t) (GridCols*GridRows)) ok=0;
+	if (!ok) DestroyCalibModel(&m);
+	return m;
+}
+
+
 /*
  * Read In Calibration Frome File
  *
@@ -92,35 +260,394 @@ int LoadCalibFromFile(CalibData* Calib, char * filename){
 
 	if ((fp = fopen(filename, "rb")) == NULL) {
 		printf("Cannot open file.\n");
-		FLAG=1;
+		return 1;
 	}
-	result = 0;
-	if (FLAG==0) result = fread(Calib->CCD2DLPLookUp, sizeof(int) * 2 * Calib->SizeOfDLP.height * Calib->SizeOfDLP.width , 1, fp);
+
+	/** Any inverse map built from the old calibration is now stale **/
+	free(Calib->DLP2CCDMap);
+	free(Calib->DLP2CCDMask);
+	Calib->DLP2CCDMap=NULL;
+	Calib->DLP2CCDMask=NULL;
+	free(Calib->CCD2DLPLookUp);
+	Calib->CCD2DLPLookUp=NULL;
+	DestroyCalibModel(&(Calib->Model));
+
+	/** Is this a compact model or a legacy lookup table? **/
+	char magic[sizeof(CALIBMODEL_MAGIC)-1];
+	if (fread(magic,sizeof(magic),1,fp)==1 && memcmp(magic,CALIBMODEL_MAGIC,sizeof(magic))==0){
+		Calib->Model=ReadCalibModel(fp);
+		if (Calib->Model==NULL){
+			printf("Read error!\n");
+			FLAG=-1;
+		} else if (Calib->Model->SizeOfDLP.width!=Calib->SizeOfDLP.width || Calib->Model->SizeOfDLP.height!=Calib->SizeOfDLP.height
+				|| Calib->Model->SizeOfCCD.width!=Calib->SizeOfCCD.width || Calib->Model->SizeOfCCD.height!=Calib->SizeOfCCD.height){
+			printf("Read error! Calibration model was made for a DLP of %d x %d and a camera of %d x %d.\n",
+					Calib->Model->SizeOfDLP.width,Calib->Model->SizeOfDLP.height,Calib->Model->SizeOfCCD.width,Calib->Model->SizeOfCCD.height);
+			DestroyCalibModel(&(Calib->Model));
+			FLAG=-1;
+		} else {
+			printf("Read was successful. Calibration model from %d points, RMS error %.2f DLP pixels.\n",Calib->Model->NumPts,Calib->Model->RMSModel);
+		}
+		fclose(fp);
+		return FLAG;
+	}
+
+	/** Legacy raw lookup table **/
+	rewind(fp);
+	Calib->CCD2DLPLookUp = (int *) malloc(2 * Calib->SizeOfDLP.height * Calib->SizeOfDLP.width* sizeof(int));
+	result = fread(Calib->CCD2DLPLookUp, sizeof(int) * 2 * Calib->SizeOfDLP.height * Calib->SizeOfDLP.width , 1, fp);
 	if (result != 1) {
 		printf("Read error!\n");
 	} else{
 		printf("Read was successful.\n");
 	}
-	if (FLAG==0) fclose(fp);
+	fclose(fp);
 	if (result ==0) FLAG=-1;
 	return FLAG;
 }
 
 
+/*
+ * Apply the 3x3 homography H to (x,y)
+ */
+static void ApplyHomography(const double* H, double x, double y, double* u, double* v){
+	double w= H[6]*x + H[7]*y + H[8];
+	if (w==0) w=1e-12;
+	*u= (H[0]*x + H[1]*y + H[2]) / w;
+	*v= (H[3]*x + H[4]*y + H[5]) / w;
+}
+
+/*
+ * Bilinearly interpolate the residual grid of a model at camera point (x,y).
+ * Points beyond the grid use the value at the nearest edge.
+ */
+static void InterpCalibResidual(const CalibModel* m, double x, double y, double* rx, double* ry){
+	double gx= x / m->GridStep;
+	double gy= y / m->GridStep;
+	if (gx < 0) gx=0;
+	if (gy < 0) gy=0;
+	if (gx > m->GridCols-1) gx=m->GridCols-1;
+	if (gy > m->GridRows-1) gy=m->GridRows-1;
+	int c=(int) gx;
+	int r=(int) gy;
+	if (c > m->GridCols-2) c=m->GridCols-2;
+	if (r > m->GridRows-2) r=m->GridRows-2;
+	double fx= gx - c;
+	double fy= gy - r;
+	int i= r*m->GridCols + c;
+	int W= m->GridCols;
+	*rx= (1-fy)*((1-fx)*m->ResidX[i] + fx*m->ResidX[i+1]) + fy*((1-fx)*m->ResidX[i+W] + fx*m->ResidX[i+W+1]);
+	*ry= (1-fy)*((1-fx)*m->ResidY[i] + fx*m->ResidY[i+1]) + fy*((1-fx)*m->ResidY[i+W] + fx*m->ResidY[i+W+1]);
+}
+
+/*
+ * Evaluate a CalibModel at the camera point (x,y).
+ */
+void CalibModelCam2DLP(const CalibModel* Model, double x, double y, double* u, double* v){
+	double rx, ry;
+	ApplyHomography(Model->H,x,y,u,v);
+	InterpCalibResidual(Model,x,y,&rx,&ry);
+	*u+=rx;
+	*v+=ry;
+}
+
+
+/*
+ * Similarity transform that moves the centroid of n points to the origin
+ * and scales their mean distance from it to sqrt(2). Row-major 3x3.
+ * This keeps the least squares fit of the homography well conditioned.
+ */
+static void NormalizingTransform(const double* x, const double* y, int n, double* T){
+	double cx=0, cy=0, d=0;
+	int k;
+	for (k = 0; k < n; k++) {
+		cx+=x[k];
+		cy+=y[k];
+	}
+	cx/=n;
+	cy/=n;
+	for (k = 0; k < n; k++) {
+		d+=sqrt((x[k]-cx)*(x[k]-cx) + (y[k]-cy)*(y[k]-cy));
+	}
+	d/=n;
+	double s= (d > 0) ? sqrt(2.0)/d : 1;
+	T[0]=s; T[1]=0; T[2]=-s*cx;
+	T[3]=0; T[4]=s; T[5]=-s*cy;
+	T[6]=0; T[7]=0; T[8]=1;
+}
+
+/*
+ * C = A * B for row-major 3x3 matrices
+ */
+static void MatMul3x3(const double* A, const double* B, double* C){
+	int r,c;
+	for (r = 0; r < 3; r++) {
+		for (c = 0; c < 3; c++) {
+			C[r*3+c]= A[r*3]*B[c] + A[r*3+1]*B[3+c] + A[r*3+2]*B[6+c];
+		}
+	}
+}
+
+/*
+ * Solve the n x n system A x = b in place by Gaussian elimination with partial pivoting.
+ * The solution is left in b. Returns -1 if A is singular.
+ */
+static int SolveLinearSystem(double* A, double* b, int n){
+	int i,j,k;
+	for (k = 0; k < n; k++) {
+		int piv=k;
+		for (i = k+1; i < n; i++) {
+			if (fabs(A[i*n+k]) > fabs(A[piv*n+k])) piv=i;
+		}
+		if (fabs(A[piv*n+k]) < 1e-12) return -1;
+		if (piv!=k){
+			for (j = 0; j < n; j++) {
+				double t=A[k*n+j]; A[k*n+j]=A[piv*n+j]; A[piv*n+j]=t;
+			}
+			double t=b[k]; b[k]=b[piv]; b[piv]=t;
+		}
+		for (i = k+1; i < n; i++) {
+			double f=A[i*n+k]/A[k*n+k];
+			for (j = k; j < n; j++) A[i*n+j]-=f*A[k*n+j];
+			b[i]-=f*b[k];
+		}
+	}
+	for (k = n-1; k >= 0; k--) {
+		for (j = k+1; j < n; j++) b[k]-=A[k*n+j]*b[j];
+		b[k]/=A[k*n+k];
+	}
+	return 0;
+}
+
+/*
+ * Least squares homography taking (x,y) to (u,v), with H[8]==1.
+ * Returns -1 if the points are degenerate.
+ */
+static int FitHomography(const double* x, const double* y, const double* u, const double* v, int n, double* H){
+	double Tc[9], Td[9];
+	NormalizingTransform(x,y,n,Tc);
+	NormalizingTransform(u,v,n,Td);
+
+	/** Accumulate the normal equations of the 2n x 8 linear system **/
+	double AtA[64];
+	double Atb[8];
+	memset(AtA,0,sizeof(AtA));
+	memset(Atb,0,sizeof(Atb));
+	int k,i,j;
+	for (k = 0; k < n; k++) {
+		double xn= Tc[0]*x[k] + Tc[2];
+		double yn= Tc[4]*y[k] + Tc[5];
+		double un= Td[0]*u[k] + Td[2];
+		double vn= Td[4]*v[k] + Td[5];
+		double rowU[8]={xn, yn, 1, 0, 0, 0, -xn*un, -yn*un};
+		double rowV[8]={0, 0, 0, xn, yn, 1, -xn*vn, -yn*vn};
+		for (i = 0; i < 8; i++) {
+			for (j = 0; j < 8; j++) {
+				AtA[i*8+j]+= rowU[i]*rowU[j] + rowV[i]*rowV[j];
+			}
+			Atb[i]+= rowU[i]*un + rowV[i]*vn;
+		}
+	}
+	if (SolveLinearSystem(AtA,Atb,8)!=0) return -1;
+
+	/** Undo the normalization: H = inv(Td) * Hn * Tc **/
+	double Hn[9]={Atb[0],Atb[1],Atb[2],Atb[3],Atb[4],Atb[5],Atb[6],Atb[7],1};
+	double TdInv[9]={1/Td[0], 0, -Td[2]/Td[0],
+					0, 1/Td[4], -Td[5]/Td[4],
+					0, 0, 1};
+	double tmp[9];
+	MatMul3x3(Hn,Tc,tmp);
+	MatMul3x3(TdInv,tmp,H);
+	if (H[8]==0) return -1;
+	for (i = 0; i < 9; i++) H[i]/=H[8];
+	return 0;
+}
+
+
+/*
+ * Fit a CalibModel to a sequence of PairOfPoints.
+ * See TransformLib.h
+ */
+CalibModel* FitCalibModel(CvSeq* CalibSeq, CvSize SizeOfDLP, CvSize SizeOfCCD, int GridStep){
+	if (CalibSeq==NULL || CalibSeq->total < 4 || GridStep < 1){
+		printf("ERROR! FitCalibModel() needs at least 4 pairs of points.\n");
+		return NULL;
+	}
+	int n=CalibSeq->total;
+	double* x=(double*) malloc(4*n*sizeof(double));
+	double* y=x+n;
+	double* u=x+2*n;
+	double* v=x+3*n;
+	int k;
+	for (k = 0; k < n; k++) {
+		PairOfPoints* pair=(PairOfPoints*) cvGetSeqElem(CalibSeq,k);
+		x[k]=pair->beta.x; // camera
+		y[k]=pair->beta.y;
+		u[k]=pair->alpha.x; // DLP
+		v[k]=pair->alpha.y;
+	}
+
+	CalibModel* m=(CalibModel*) malloc(sizeof(CalibModel));
+	m->SizeOfDLP=SizeOfDLP;
+	m->SizeOfCCD=SizeOfCCD;
+	m->GridStep=GridStep;
+	m->GridCols= (SizeOfCCD.width + GridStep - 1) / GridStep + 1;
+	m->GridRows= (SizeOfCCD.height + GridStep - 1) / GridStep + 1;
+	m->ResidX=(float*) calloc(m->GridCols*m->GridRows,sizeof(float));
+	m->ResidY=(float*) calloc(m->GridCols*m->GridRows,sizeof(float));
+	m->NumPts=n;
+
+	if (FitHomography(x,y,u,v,n,m->H)!=0){
+		printf("ERROR! FitCalibModel() could not fit a homography. Are the points collinear?\n");
+		free(x);
+		DestroyCalibModel(&m);
+		return NULL;
+	}
+
+	/** Residuals of the homography at each calibration point **/
+	double* ru=(double*) malloc(2*n*sizeof(double));
+	double* rv=ru+n;
+	double sse=0;
+	for (k = 0; k < n; k++) {
+		double hu,hv;
+		ApplyHomography(m->H,x[k],y[k],&hu,&hv);
+		ru[k]=u[k]-hu;
+		rv[k]=v[k]-hv;
+		sse+=ru[k]*ru[k]+rv[k]*rv[k];
+	}
+	m->RMSHomography=sqrt(sse/n);
+
+	/** Smooth the residuals onto the grid with a gaussian kernel about as wide as the point spacing.
+	 * The extra weight in the denominator pulls nodes far from any point back to the pure homography. **/
+	double sigma= sqrt((double) SizeOfCCD.width * SizeOfCCD.height / n);
+	if (sigma < GridStep) sigma=GridStep;
+	const double twoSigmaSq= 2*sigma*sigma;
+	const double prior= 0.1;
+	int r,c;
+	for (r = 0; r < m->GridRows; r++) {
+		for (c = 0; c < m->GridCols; c++) {
+			double gx=c*GridStep;
+			double gy=r*GridStep;
+			double wsum=prior, sx=0, sy=0;
+			for (k = 0; k < n; k++) {
+				double dsq=(x[k]-gx)*(x[k]-gx) + (y[k]-gy)*(y[k]-gy);
+				double w=exp(-dsq/twoSigmaSq);
+				wsum+=w;
+				sx+=w*ru[k];
+				sy+=w*rv[k];
+			}
+			m->ResidX[r*m->GridCols+c]=(float) (sx/wsum);
+			m->ResidY[r*m->GridCols+c]=(float) (sy/wsum);
+		}
+	}
+
+	sse=0;
+	for (k = 0; k < n; k++) {
+		double mu,mv;
+		CalibModelCam2DLP(m,x[k],y[k],&mu,&mv);
+		sse+=(u[k]-mu)*(u[k]-mu) + (v[k]-mv)*(v[k]-mv);
+	}
+	m->RMSModel=sqrt(sse/n);
+	printf("Fit calibration model to %d points. RMS error: homography %.2f, with residual grid %.2f DLP pixels.\n",n,m->RMSHomography,m->RMSModel);
+
+	free(ru);
+	free(x);
+	return m;
+}
+
+/*
+ * Deallocate a CalibModel and set the pointer to NULL
+ */
+void DestroyCalibModel(CalibModel** Model){
+	if (Model==NULL || *Model==NULL) return;
+	free((*Model)->ResidX);
+	free((*Model)->ResidY);
+	free(*Model);
+	*Model=NULL;
+}
+
+/*
+ * Write a CalibModel to disk so that LoadCalibFromFile() can read it.
+ */
+int WriteCalibModelToFile(const CalibModel* Model, const char* filename){
+	if (Model==NULL) return -1;
+	FILE *fp;
+	if ((fp = fopen(filename, "wb+")) == NULL) {
+		printf("ERROR: Cannot open file to write calibration\n");
+		return -1;
+	}
+	int header[7]={Model->SizeOfDLP.width, Model->SizeOfDLP.height, Model->SizeOfCCD.width, Model->SizeOfCCD.height,
+			Model->GridStep, Model->GridCols, Model->GridRows};
+	int numNodes=Model->GridCols*Model->GridRows;
+	int ok=1;
+	if (fwrite(CALIBMODEL_MAGIC,sizeof(CALIBMODEL_MAGIC)-1,1,fp)!=1) ok=0;
+	if (ok && fwrite(header,sizeof(int),7,fp)!=7) ok=0;
+	if (ok && fwrite(&(Model->NumPts),sizeof(int),1,fp)!=1) ok=0;
+	if (ok && fwrite(Model->H,sizeof(double),9,fp)!=9) ok=0;
+	if (ok && fwrite(&(Model->RMSHomography),sizeof(double),1,fp)!=1) ok=0;
+	if (ok && fwrite(&(Model->RMSModel),sizeof(double),1,fp)!=1) ok=0;
+	if (ok && fwrite(Model->ResidX,sizeof(float),numNodes,fp)!=(size_t) numNodes) ok=0;
+	if (ok && fwrite(Model->ResidY,sizeof(float),numNodes,fp)!=(size_t) numNodes) ok=0;
+	fclose(fp);
+	if (!ok){
+		printf("Write error!\n");
+		return -1;
+	}
+	printf("Write was successful.\n");
+	return 0;
+}
+
+/*
+ * Generate the dense CCD2DLPLookUp table from Calib->Model.
+ */
+int ExpandCalibModelToLookUp(CalibData* Calib){
+	if (Calib==NULL || Calib->Model==NULL){
+		printf("ERROR! ExpandCalibModelToLookUp() has no model to expand.\n");
+		return -1;
+	}
+	/** Same layout as the table from MATLAB: all of the x values column by column, then all of the y values **/
+	const int nsizex=Calib->SizeOfDLP.width;
+	const int nsizey=Calib->SizeOfDLP.height;
+	if (Calib->CCD2DLPLookUp==NULL) Calib->CCD2DLPLookUp=(int*) malloc(2*nsizex*nsizey*sizeof(int));
+	int* lutX=Calib->CCD2DLPLookUp;
+	int* lutY=Calib->CCD2DLPLookUp + nsizex*nsizey;
+	int x,y;
+	double u,v;
+	for (x = 0; x < nsizex; x++) {
+		for (y = 0; y < nsizey; y++) {
+			CalibModelCam2DLP(Calib->Model,x,y,&u,&v);
+			lutX[x*nsizey+y]=(int) floor(u+0.5);
+			lutY[x*nsizey+y]=(int) floor(v+0.5);
+		}
+	}
+	return 0;
+}
+
+
 /*
  * Transform's the binary image from the frame in Cam and transforms it DLP space.
  * Copies it into the DLP frame and also converts it to IlpImage and copies that to the DLP
  * frame also.
- * DEPRECATED!! This is really really slow.
- * If possible transform the outline of the worm using TransformSegWormCam2DLP isntead of the whole frame.
+ *
+ * This uses the inverse map and the threaded gather in RemapCharArrayCam2DLP().
+ * If you only need the worm, transforming its outline with TransformSegWormCam2DLP is still cheaper.
  *
  */
 int TransformFrameCam2DLP(Frame* Cam, Frame* DLP, CalibData* Calib) {
 	int ret = 0;
 
-	ret = ConvertCharArrayImageFromCam2DLP(Calib->CCD2DLPLookUp, Cam->binary,
-			DLP->binary, Cam->size.width, Cam->size.height, DLP->size.width,
-			DLP->size.height, 0);
+	if (Cam->size.width != Calib->SizeOfCCD.width || Cam->size.height != Calib->SizeOfCCD.height
+			|| DLP->size.width != Calib->SizeOfDLP.width || DLP->size.height != Calib->SizeOfDLP.height){
+		printf("ERROR! TransformFrameCam2DLP() frame sizes do not match the calibration.\n");
+		return -1;
+	}
+
+	if (Calib->DLP2CCDMap==NULL || Calib->RemapPool==NULL){
+		ret=BuildInverseCalibMap(Calib);
+		if (ret!=0) return ret;
+	}
+
+	ret = RemapCharArrayCam2DLP(Calib, Cam->binary, DLP->binary);
 //	return 0;
 	if (ret == 0) /** This could be ommitted to save CPU cycles, at the cost of monitoring output **/
 		ret = CopyCharArrayToIplImage(DLP->binary, DLP->iplimg,DLP->size.width,DLP->size.height);
@@ -130,6 +657,128 @@ int TransformFrameCam2DLP(Frame* Cam, Frame* DLP, CalibData* Calib) {
 
 
 
+/*
+ * Builds the inverse map (DLP pixel -> camera pixel) from the forward
+ * lookup table and starts the remap worker threads.
+ * See TransformLib.h
+ */
+int BuildInverseCalibMap(CalibData* Calib){
+	if (Calib==NULL || (Calib->CCD2DLPLookUp==NULL && Calib->Model==NULL)){
+		printf("ERROR! BuildInverseCalibMap() has no calibration to invert.\n");
+		return -1;
+	}
+	/** With a model the dense table is only needed while we build the map **/
+	int expanded=0;
+	if (Calib->CCD2DLPLookUp==NULL){
+		if (ExpandCalibModelToLookUp(Calib)!=0) return -1;
+		expanded=1;
+	}
+	/** The lookup table is indexed by camera pixel but laid out with the DLP dimensions (see cvtPtCam2DLP) **/
+	const int nsizex=Calib->SizeOfDLP.width;
+	const int nsizey=Calib->SizeOfDLP.height;
+	const int ccdsizex=Calib->SizeOfCCD.width;
+	const int ccdsizey=Calib->SizeOfCCD.height;
+	const int N=nsizex*nsizey;
+	const int* lutX=Calib->CCD2DLPLookUp;
+	const int* lutY=Calib->CCD2DLPLookUp + N;
+
+	if (Calib->DLP2CCDMap==NULL) Calib->DLP2CCDMap=(int*) malloc(N*sizeof(int));
+	if (Calib->DLP2CCDMask==NULL) Calib->DLP2CCDMask=(unsigned char*) malloc(N*sizeof(unsigned char));
+	int* map=Calib->DLP2CCDMap;
+	unsigned char* mask=Calib->DLP2CCDMask;
+	memset(map,0,N*sizeof(int));
+	memset(mask,0,N*sizeof(unsigned char));
+
+	/** Scatter every camera pixel onto the DLP, once. Same last-one-wins order as the old forward remap. **/
+	int x,y;
+	for (x = 0; x < nsizex && x < ccdsizex; x++) {
+		const int* colX=lutX + x*nsizey;
+		const int* colY=lutY + x*nsizey;
+		for (y = 0; y < nsizey && y < ccdsizey; y++) {
+			int dx=colX[y];
+			int dy=colY[y];
+			if (dx < 0 || dy < 0 || dx >= nsizex || dy >= nsizey) continue;
+			map[dy*nsizex+dx]=y*ccdsizex+x;
+			mask[dy*nsizex+dx]=0xFF;
+		}
+	}
+
+	/** Fill holes that are enclosed by mapped pixels on opposite sides.
+	 * Filled pixels are marked 0x01 so that they are not used as a source themselves
+	 * and the projected area does not creep outwards. **/
+	int holes=0;
+	int filled=0;
+	for (y = 1; y < nsizey-1; y++) {
+		for (x = 1; x < nsizex-1; x++) {
+			int i=y*nsizex+x;
+			if (mask[i]!=0) continue;
+			holes++;
+			if (mask[i-1]==0xFF && mask[i+1]==0xFF){
+				map[i]=map[i-1];
+				mask[i]=0x01;
+				filled++;
+			} else if (mask[i-nsizex]==0xFF && mask[i+nsizex]==0xFF){
+				map[i]=map[i-nsizex];
+				mask[i]=0x01;
+				filled++;
+			}
+		}
+	}
+	int valid=0;
+	int i;
+	for (i = 0; i < N; i++) {
+		if (mask[i]!=0){
+			mask[i]=0xFF;
+			valid++;
+		}
+	}
+	printf("Built inverse calibration map: %d of %d DLP pixels are mapped (%d holes filled).\n",valid,N,filled);
+
+	if (expanded){
+		free(Calib->CCD2DLPLookUp);
+		Calib->CCD2DLPLookUp=NULL;
+	}
+
+	if (Calib->RemapPool==NULL){
+		Calib->RemapPool=CreateRemapPool(Calib);
+		if (Calib->RemapPool==NULL) return -1;
+	}
+	return 0;
+}
+
+
+/*
+ * Full frame camera -> DLP remap using the inverse map.
+ * See TransformLib.h
+ */
+int RemapCharArrayCam2DLP(CalibData* Calib, const unsigned char* fromCCD, unsigned char* forDLP){
+	if (Calib==NULL || fromCCD==NULL || forDLP==NULL){
+		printf("ERROR! RemapCharArrayCam2DLP() was passed NULL.\n");
+		return -1;
+	}
+	if (Calib->DLP2CCDMap==NULL || Calib->RemapPool==NULL){
+		printf("ERROR! RemapCharArrayCam2DLP() called before BuildInverseCalibMap().\n");
+		return -1;
+	}
+	RemapPool* pool=Calib->RemapPool;
+	pool->src=fromCCD;
+	pool->dst=forDLP;
+
+	/** Hand the other bands to the workers and do the first band on this thread **/
+	int k;
+	for (k = 0; k < pool->NumWorkers; k++) {
+		SetEvent(pool->Workers[k].Go);
+	}
+	RemapRows(Calib,fromCCD,forDLP,0,pool->MainRowEnd);
+	if (pool->NumWorkers > 0) WaitForMultipleObjects(pool->NumWorkers,pool->DoneEvents,TRUE,INFINITE);
+
+	pool->src=NULL;
+	pool->dst=NULL;
+	return 0;
+}
+
+
+
 /*
  *  This function takes a lookup table generated by the CalibrationTest() function in calibrate.c
  *  It takes pointers to pre-allocated memory for the images fromCCD and forDLP which are
@@ -145,6 +794,7 @@ int TransformFrameCam2DLP(Frame* Cam, Frame* DLP, CalibData* Calib) {
  *
  *	If DEBUG_FLAG !=0, then print debugging information.
  *
+ *  DEPRECATED. This scatters column by column and leaves holes. Use RemapCharArrayCam2DLP() instead.
  *
  */
 int ConvertCharArrayImageFromCam2DLP(int *CCD2DLPLookUp,
@@ -209,11 +859,15 @@ int ConvertCharArrayImageFromCam2DLP(int *CCD2DLPLookUp,
 
 /*
  * Converts a CvPoint (x,y) camera space to DLP space.
- * This uses the lookup table generated by the CalibrationTest() function in calibrate.c
+ * This uses Calib->Model if one is loaded, otherwise the lookup table
+ * generated by the CalibrationTest() function in calibrate.c
  *
  *  Currently ccdsizex and ccdsizey are simply placeholders, they don't do anything.
  *  In other words this assumes that both the camera and DLP are the simesize, namely 1024x768
  *
+ *  Returns 1 on success, -1 on error. With the lookup table, a camPt outside
+ *  the camera is clamped to its edge and 0 is returned.
+ *
  *	If DEBUG_FLAG !=0, then print debugging information.
  *
  *
@@ -230,6 +884,15 @@ int cvtPtCam2DLP(CvPoint camPt, CvPoint* DLPpt,CalibData* Calib) {
 		printf(
 				"ERROR: Ignoring values of ccdsizex & ccdsizey. \nCurrently CCD must be the same size as the DLP.\n This functionality has yet to be coded up.");
 	}
+	/** A compact model is evaluated directly **/
+	if (Calib->Model != NULL) {
+		double u,v;
+		CalibModelCam2DLP(Calib->Model,camPt.x,camPt.y,&u,&v);
+		DLPpt->x=(int) floor(u+0.5);
+		DLPpt->y=(int) floor(v+0.5);
+		return 1;
+	}
+
 	if (Calib->CCD2DLPLookUp == NULL) {
 		printf("ERROR! CCD2DLPLookUp==NULL!\n");
 		return -1;
@@ -250,19 +913,18 @@ int cvtPtCam2DLP(CvPoint camPt, CvPoint* DLPpt,CalibData* Calib) {
 	/* DLP.y = CCD2DLPLookup[nsizey * nsizex +  camPt.x*nsizey+camPt.y]  */
 	
 	
-	if (XOUT * nsizey * nsizex + camPt.x * nsizey + camPt.y >= nsizex* nsizey * 2) {
-		printf(" In accessing lookup table, we are out of bounds!!\n");
-		return 0;
-	}
-
-	if (YOUT * nsizey * nsizex + camPt.x * nsizey + camPt.y >= nsizex* nsizey * 2) {
-		printf(" In accessing lookup table, we are out of bounds!!\n");
-		return 0;
-	}
+	/** A point off the camera (e.g. one shifted by the latency prediction) takes
+	 *  the value at the nearest edge of the table, so the caller still gets a point **/
+	int inBounds=1;
+	if (camPt.x < 0) { camPt.x=0; inBounds=0; }
+	if (camPt.y < 0) { camPt.y=0; inBounds=0; }
+	if (camPt.x >= nsizex) { camPt.x=nsizex-1; inBounds=0; }
+	if (camPt.y >= nsizey) { camPt.y=nsizey-1; inBounds=0; }
 
 	/** Actually convert the camPt to the DLPpt **/
 	DLPpt->x = Calib->CCD2DLPLookUp[XOUT * nsizey * nsizex + camPt.x * nsizey + camPt.y];
 	DLPpt->y = Calib->CCD2DLPLookUp[YOUT * nsizey * nsizex + camPt.x * nsizey + camPt.y];
+	if (!inBounds) return 0;
 
 
 
@@ -50,14 +50,53 @@
 
 
 
+/** Spacing of the residual grid of a CalibModel in camera pixels **/
+#define CALIBMODEL_GRID_STEP 32
+
+/** First bytes of a calibration file that holds a CalibModel rather than a raw lookup table **/
+#define CALIBMODEL_MAGIC "MCCALIB1"
+
+/*
+ * Compact camera -> DLP calibration.
+ *
+ * A homography H takes a camera point to the DLP. What the homography
+ * can't capture (lens distortion etc.) is stored as a coarse grid of
+ * residuals in camera space that is bilinearly interpolated.
+ *
+ * A whole model is a few KB, compared to 2*W*H ints for a lookup table.
+ */
+typedef struct CalibModelStruct{
+	CvSize SizeOfDLP;
+	CvSize SizeOfCCD;
+	double H[9]; // row-major homography, camera -> DLP
+	int GridStep; // spacing of the residual grid in camera pixels
+	int GridCols;
+	int GridRows;
+	float* ResidX; // DLP x residual at each grid node, row-major GridRows x GridCols
+	float* ResidY; // DLP y residual at each grid node
+	int NumPts; // number of point pairs used in the fit
+	double RMSHomography; // RMS error in DLP pixels of the homography alone
+	double RMSModel; // RMS error in DLP pixels of homography + residual grid
+} CalibModel;
+
+
 /*
  * This structure contains information about calibrating the DLP to the CCD
  *
+ * Either CCD2DLPLookUp (the legacy dense table) or Model is loaded from disk.
+ * If only Model is loaded, the dense table is generated from it on demand.
+ *
  */
 typedef struct CalibDataStruct{
 	int* CCD2DLPLookUp;
+	CalibModel* Model;
 	CvSize SizeOfDLP;
 	CvSize SizeOfCCD;
+
+	/** Inverse map used for full frame remaps. Built on demand from CCD2DLPLookUp. **/
+	int* DLP2CCDMap; // for each DLP pixel (row-major) the row-major index of the camera pixel it shows
+	unsigned char* DLP2CCDMask; // 0xFF where DLP2CCDMap is valid, 0 where the DLP pixel has no camera pixel
+	struct RemapPoolStruct* RemapPool; // worker threads that split the remap by DLP rows
 } CalibData;
 
 
@@ -71,6 +110,36 @@ typedef struct CalibDataStruct{
 int TransformFrameCam2DLP(Frame* Cam, Frame* DLP, CalibData* Calib);
 
 
+/*
+ * Builds the inverse map (DLP pixel -> camera pixel) from the forward
+ * lookup table in Calib->CCD2DLPLookUp and starts the remap worker threads.
+ * If only Calib->Model is loaded the table is expanded from it temporarily.
+ *
+ * The forward table scatters camera pixels onto the DLP and leaves holes
+ * wherever the DLP is magnified relative to the camera. Holes that are bounded
+ * on both sides (left/right or above/below) by mapped pixels are filled from
+ * their neighbor. Everything else is marked invalid and is remapped to 0.
+ *
+ * Must be called again whenever CCD2DLPLookUp changes. TransformFrameCam2DLP()
+ * calls it automatically the first time it is needed.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int BuildInverseCalibMap(CalibData* Calib);
+
+/*
+ * Full frame camera -> DLP remap using the inverse map built by BuildInverseCalibMap().
+ * fromCCD is a row-major SizeOfCCD image, forDLP a row-major SizeOfDLP image.
+ *
+ * Every DLP pixel is written (invalid pixels are set to 0). The inner loop is a
+ * branchless gather over contiguous DLP rows and the rows are split across
+ * the remap worker threads.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int RemapCharArrayCam2DLP(CalibData* Calib, const unsigned char* fromCCD, unsigned char* forDLP);
+
+
 
 
 /*
@@ -92,6 +161,10 @@ void DestroyCalibData(CalibData* Calib);
 /*
  * Read In Calibration Frome File
  *
+ * The file is either a CalibModel written by WriteCalibModelToFile()
+ * or the legacy raw lookup table of 2*W*H ints. The format is detected
+ * from the first bytes of the file.
+ *
  * Returns 1 if open failed.
  * Returns -1 if open succesfully but read fails.
  */
@@ -99,6 +172,45 @@ void DestroyCalibData(CalibData* Calib);
 int LoadCalibFromFile(CalibData* Calib, char * filename);
 
 
+/*
+ * Fit a CalibModel to a sequence of PairOfPoints as gathered by calibrateFG.
+ * In each pair alpha is the DLP point and beta the point observed on the camera.
+ *
+ * The homography is fit by linear least squares on normalized coordinates.
+ * The residuals that remain at each point are then smoothed onto a
+ * grid of GridStep camera pixels.
+ *
+ * Needs at least 4 pairs. Returns NULL on error.
+ */
+CalibModel* FitCalibModel(CvSeq* CalibSeq, CvSize SizeOfDLP, CvSize SizeOfCCD, int GridStep);
+
+/*
+ * Deallocate a CalibModel and set the pointer to NULL
+ */
+void DestroyCalibModel(CalibModel** Model);
+
+/*
+ * Evaluate a CalibModel at the camera point (x,y).
+ * Writes the DLP point to (*u,*v) in sub pixel precision.
+ */
+void CalibModelCam2DLP(const CalibModel* Model, double x, double y, double* u, double* v);
+
+/*
+ * Write a CalibModel to disk so that LoadCalibFromFile() can read it.
+ * Returns 0 on success, -1 on error.
+ */
+int WriteCalibModelToFile(const CalibModel* Model, const char* filename);
+
+/*
+ * Generate the dense CCD2DLPLookUp table from Calib->Model.
+ * Only needed by code that reads the table directly; cvtPtCam2DLP() and
+ * BuildInverseCalibMap() take care of this themselves.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int ExpandCalibModelToLookUp(CalibData* Calib);
+
+
 
 
 /*
@@ -116,17 +228,22 @@ int LoadCalibFromFile(CalibData* Calib, char * filename);
  *
  *  If DEBUG_FLAG !=0, then print debugging information.
  *
+ *  DEPRECATED. This scatters column by column and leaves holes. Use RemapCharArrayCam2DLP() instead.
  *
  */
 int ConvertCharArrayImageFromCam2DLP(int *CCD2DLPLookUp,  unsigned char* fromCCD,unsigned char* forDLP, int nsizex, int nsizey, int ccdsizex, int ccdsizey, int DEBUG_FLAG);
 
 /*
  * Converts a CvPoint (x,y) camera space to DLP space.
- * This uses the lookup table generated by the CalibrationTest() function in calibrate.c
+ * This uses Calib->Model if one is loaded, otherwise the lookup table
+ * generated by the CalibrationTest() function in calibrate.c
  *
  *  Currently ccdsizex and ccdsizey are simply placeholders, they don't do anything.
  *  In other words this assumes that both the camera and DLP are the simesize, namely 102
  *
+ *  Returns 1 on success, -1 on error. With the lookup table, a camPt outside
+ *  the camera is clamped to its edge and 0 is returned.
+ *
  *	If DEBUG_FLAG !=0, then print debugging information.
  *
  *
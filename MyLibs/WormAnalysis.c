@@ -28,6 +28,7 @@
 
 #include <stdio.h>
 #include <time.h>
+#include <math.h>
 
 
 //OpenCV Headers
@@ -114,12 +115,16 @@ WormAnalysisData* CreateWormAnalysisDataStruct(){
 
 	/*** Create Segmented Worm Object ***/
 	WormPtr->Segmented= CreateSegmentedWormStruct();
+	WormPtr->SideGridA= CreateBoundaryGrid(BGRID_DEFAULT_CELL_SIZE);
+	WormPtr->SideGridB= CreateBoundaryGrid(BGRID_DEFAULT_CELL_SIZE);
 
 	/** Create Time Evolution Worm Object **/
 	WormPtr->TimeEvolution= CreateWormTimeEvolution();
 
 	/** Position on plate information **/
 	WormPtr->stageVelocity=cvPoint(0,0);
+	WormPtr->stagePosition=cvPoint(0,0);
+	WormPtr->stagePositionKnown=0;
 
 	return WormPtr;
 }
@@ -141,6 +146,8 @@ void DestroyWormAnalysisDataStruct(WormAnalysisData* Worm){
 	free((Worm)->Segmented);
 	free( Worm->FluorFeatures);
 	DestroyWormTimeEvolution(&(Worm->TimeEvolution));
+	DestroyBoundaryGrid(&(Worm->SideGridA));
+	DestroyBoundaryGrid(&(Worm->SideGridB));
 	free(Worm);
 	Worm=NULL;
 }
@@ -295,7 +302,7 @@ WormAnalysisParam* CreateWormAnalysisParam(){
 	ParamPtr->IllumFlipLR=0;
 	ParamPtr->IllumSquareOrig=cvPoint(ParamPtr->DefaultGridSize.width/2,ParamPtr->DefaultGridSize.height/2);
 	ParamPtr->IllumSquareRad=cvSize(ParamPtr->DefaultGridSize.width/4,ParamPtr->DefaultGridSize.height/4);
-	ParamPtr->IllumDuration=15;
+	ParamPtr->IllumDuration=1500; // ms
 	ParamPtr->DLPOnFlash=0;
 
 
@@ -322,7 +329,7 @@ WormAnalysisParam* CreateWormAnalysisParam(){
 
 	/** Timing for Phase & Curvature Based Triggering **/
 	ParamPtr->StayOnAndRefract=0; //Stay On for the time IllumDuration and wait to turn on again a time specified below
-	ParamPtr->IllumRefractoryPeriod= 0; //Amount of time to wait to turn on again in tenths of Seconds
+	ParamPtr->IllumRefractoryPeriod= 0; //Amount of time to wait to turn on again in ms
 
 
 	/** Illum Head-Tail Sweep **/
@@ -348,6 +355,9 @@ WormAnalysisParam* CreateWormAnalysisParam(){
 	ParamPtr->stageSpeedFactor=25;
 	ParamPtr->stageROIRadius=250;
 	ParamPtr->stageTargetSegment=10;
+	ParamPtr->stageKp=40;
+	ParamPtr->stageKi=20;
+	ParamPtr->stageKff=100;
 	
 	/** Software Aperture Field-Of-View **/
 	ParamPtr->ApertureOn=0; // by default, turn off the software aperture
@@ -356,9 +366,12 @@ WormAnalysisParam* CreateWormAnalysisParam(){
 	ParamPtr->ApertureR=768/2; // radius of circle
 	
 
+	/** Latency Compensation **/
+	ParamPtr->PredictOn=0;
+	ParamPtr->PredictMaxShift=30;
+
 	/**Record Parameters **/
 	ParamPtr->Record=0;
-	ParamPtr->CalibXY=0;
 
 	return ParamPtr;
 }
@@ -468,6 +481,34 @@ void ClearSegmentedInfo(SegmentedWorm* SegWorm){
 
 }
 
+/** Translate every point of a sequence of CvPoints **/
+static void ShiftPtSequence(CvSeq* seq, CvPoint shift){
+	if (seq==NULL) return;
+	for (int k = 0; k < seq->total; ++k) {
+		CvPoint* pt=CV_GET_SEQ_ELEM(CvPoint,seq,k);
+		pt->x+=shift.x;
+		pt->y+=shift.y;
+	}
+}
+
+/*
+ * Translates every point of a segmented worm by shift.
+ */
+void ShiftSegmentedWorm(SegmentedWorm* SegWorm, CvPoint shift){
+	if (SegWorm==NULL) return;
+	ShiftPtSequence(SegWorm->Centerline,shift);
+	ShiftPtSequence(SegWorm->LeftBound,shift);
+	ShiftPtSequence(SegWorm->RightBound,shift);
+	if (SegWorm->Head!=NULL){
+		SegWorm->Head->x+=shift.x;
+		SegWorm->Head->y+=shift.y;
+	}
+	if (SegWorm->Tail!=NULL){
+		SegWorm->Tail->x+=shift.x;
+		SegWorm->Tail->y+=shift.y;
+	}
+}
+
 
 /************************************************************/
 /* Creating, Destroying and updating TimeEvolution Structure	*/
@@ -493,11 +534,19 @@ WormTimeEvolution* CreateWormTimeEvolution(){
 	//TimeEv->WormAccBuffer=cvCreateSeq(0,sizeof(CvSeq),sizeof(double),TimeEv->MemTimeEvolutionStorage);
 	TimeEv->RecentAcceleration=cvPoint(0,0);
 
+	/** Pose Prediction **/
+	TimeEv->WormPosBuffer=cvCreateSeq(0,sizeof(CvSeq),sizeof(WormPosSample),TimeEv->MemTimeEvolutionStorage);
+	TimeEv->PredVelocity=cvPoint2D32f(0,0);
+	TimeEv->PredShift=cvPoint2D32f(0,0);
+	TimeEv->PredHorizon=0;
+	TimeEv->PredApplied=0;
+
 	return TimeEv;
 }
 
 int DestroyWormTimeEvolution(WormTimeEvolution** TimeEvolution){
 	(*TimeEvolution)->WormVelBuffer=NULL;
+	(*TimeEvolution)->WormPosBuffer=NULL;
 	//(*TimeEvolution)-WormAccBuffer=NULL;
 	cvReleaseMemStorage(&( (*TimeEvolution)->MemTimeEvolutionStorage ));
 	free(*TimeEvolution);
@@ -521,6 +570,72 @@ int AddWormMotionHistory(WormTimeEvolution* TimeEvolution, CvPoint CurrVelocity,
 	return A_OK;
 }
 
+/*
+ * Remember where the worm was in the frame captured at time t (ms).
+ */
+int AddWormPositionHistory(WormTimeEvolution* TimeEvolution, CvPoint Pos, double t){
+	if (TimeEvolution==NULL) {
+		printf("AddWormPositionHistory Error!");
+		return A_ERROR;
+	}
+	WormPosSample sample;
+	sample.t=t;
+	sample.x=Pos.x;
+	sample.y=Pos.y;
+	return PushToSeqBuffer(TimeEvolution->WormPosBuffer,(void*) &sample,PRED_HISTORY_SIZE);
+}
+
+void ClearWormPositionHistory(WormTimeEvolution* TimeEvolution){
+	if (TimeEvolution==NULL) return;
+	cvClearSeq(TimeEvolution->WormPosBuffer);
+	TimeEvolution->PredVelocity=cvPoint2D32f(0,0);
+}
+
+/*
+ * Fit a velocity to the recent positions and predict how far the worm
+ * moves in the next horizon ms.
+ */
+int PredictWormShift(WormTimeEvolution* TimeEvolution, double horizon, int MaxShift, CvPoint2D32f* shift){
+	if (TimeEvolution==NULL || shift==NULL) return A_ERROR;
+	*shift=cvPoint2D32f(0,0);
+	TimeEvolution->PredShift=*shift;
+	TimeEvolution->PredHorizon=horizon;
+
+	CvSeq* buff=TimeEvolution->WormPosBuffer;
+	if (buff->total<3) return A_ERROR;
+
+	/** Least squares slope of x(t) and y(t), using only positions that are recent enough **/
+	double newest=CV_GET_SEQ_ELEM(WormPosSample,buff,0)->t;
+	double st=0, sx=0, sy=0, stt=0, stx=0, sty=0;
+	int n=0;
+	for (int k = 0; k < buff->total; ++k) {
+		WormPosSample* s=CV_GET_SEQ_ELEM(WormPosSample,buff,k);
+		double t=s->t - newest; // keep the numbers small
+		if (t < -PRED_HISTORY_MS) break;
+		st+=t; sx+=s->x; sy+=s->y;
+		stt+=t*t; stx+=t*s->x; sty+=t*s->y;
+		n++;
+	}
+	double denom=n*stt - st*st;
+	if (n<3 || denom<=0) return A_ERROR;
+
+	double vx=(n*stx - st*sx)/denom;
+	double vy=(n*sty - st*sy)/denom;
+	TimeEvolution->PredVelocity=cvPoint2D32f(vx,vy);
+
+	/** Don't let one bad segmentation throw the illumination across the field **/
+	double dx=vx*horizon;
+	double dy=vy*horizon;
+	double mag=sqrt(dx*dx+dy*dy);
+	if (MaxShift>=0 && mag>MaxShift){
+		dx*=MaxShift/mag;
+		dy*=MaxShift/mag;
+	}
+	*shift=cvPoint2D32f(dx,dy);
+	TimeEvolution->PredShift=*shift;
+	return A_OK;
+}
+
 
 
 
@@ -570,8 +685,11 @@ int DestroyWormFluor(WormFluor* Fluor){
  * The thresholded image is deposited into Worm.ImgThresh
  * The Boundary is placed in Worm.Boundary
  *
+ * The stage carries the whole scene along between frames, so the search
+ * is centered on the previous centroid moved by stageShift.
+ *
  */
-void FindWormBoundary(WormAnalysisData* Worm, WormAnalysisParam* Params, CvPoint* prevpt, CvPoint target){ // prevpt is the previous centroid of the fluorescent feature that remains in Worm->FF->centroid
+void FindWormBoundary(WormAnalysisData* Worm, WormAnalysisParam* Params, CvPoint* prevpt, CvPoint target, CvPoint stageShift){ // prevpt is the previous centroid of the fluorescent feature that remains in Worm->FF->centroid
 	/** This function currently takes around 5-7 ms **/
 	/**
 	 * Before I forget.. plan to make this faster by:
@@ -584,13 +702,14 @@ void FindWormBoundary(WormAnalysisData* Worm, WormAnalysisParam* Params, CvPoint
 	/** Crop the Image based on the user defined aperture **/
 	IplImage* OrigCropped=cvCreateImage(cvGetSize(Worm->ImgOrig),IPL_DEPTH_8U,1);
 	CvPoint Pt = cvPoint((*prevpt).x,(*prevpt).y);
+	CvPoint Search = cvPoint(Pt.x + stageShift.x, Pt.y + stageShift.y);
 	//if (Params->ApertureOn) {
 		
 		/** draw a filled in circle for a mask **/
 		IplImage* CircleROI=cvCreateImage(cvGetSize(Worm->ImgOrig),IPL_DEPTH_8U,1);
 		cvZero(CircleROI);
 		 if (((*prevpt).y) !=0){
-			 cvCircle(CircleROI,*prevpt,25,cvScalar(COLOR_MAX,COLOR_MAX,COLOR_MAX),-1,CV_AA,0);
+			 cvCircle(CircleROI,Search,25,cvScalar(COLOR_MAX,COLOR_MAX,COLOR_MAX),-1,CV_AA,0);
 			 ////printf("Previous centroid is (%d,%d) \n",Pt.x,Pt.y);//(*prevpt).x,(*prevpt).y
 		 } else {
 		cvCircle(CircleROI,cvPoint(target.x,target.y),100,cvScalar(COLOR_MAX,COLOR_MAX,COLOR_MAX),-1,CV_AA,0);		
@@ -1169,7 +1288,8 @@ int SegmentWorm(WormAnalysisData* Worm, WormAnalysisParam* Params){
 	// /*** Use Marc's Perpendicular Segmentation Algorithm
 	 // *   To Segment the Left and Right Boundaries and store them
 	 // */
-	// SegmentSides(OrigBoundA,OrigBoundB,Worm->Segmented->Centerline,Worm->Segmented->LeftBound,Worm->Segmented->RightBound);
+	// SegmentSides(OrigBoundA,OrigBoundB,Worm->Segmented->Centerline,Worm->Segmented->LeftBound,Worm->Segmented->RightBound,
+			// Worm->SideGridA,Worm->SideGridB);
 	// return 0;
 
 }
@@ -1205,6 +1325,13 @@ int CreateWormHUDS(IplImage* TempImage, WormAnalysisData* Worm, WormAnalysisPara
 		/** Draw A Circle on the centroid of the fluorescent blob **/ 
 		if (Worm->FluorFeatures!=NULL && Worm->isPresent==1) {
 				cvCircle(TempImage,*(Worm->FluorFeatures->centroid),CircleDiameterSize*2,cvScalar(COLOR_MAX,COLOR_MAX,COLOR_MAX),1,CV_AA,0);
+				/** Show where the worm is predicted to be when the pattern lands **/
+				if (Params->PredictOn && Worm->TimeEvolution->PredApplied) {
+					CvPoint pred=cvPoint(Worm->FluorFeatures->centroid->x + cvRound(Worm->TimeEvolution->PredShift.x),
+							Worm->FluorFeatures->centroid->y + cvRound(Worm->TimeEvolution->PredShift.y));
+					cvLine(TempImage,*(Worm->FluorFeatures->centroid),pred,cvScalar(COLOR_MAX,COLOR_MAX,COLOR_MAX),1,CV_AA,0);
+					cvCircle(TempImage,pred,CircleDiameterSize/2,cvScalar(COLOR_MAX,COLOR_MAX,COLOR_MAX),1,CV_AA,0);
+				}
 				DrawSequence(&TempImage,Worm->Boundary);
 		} else {
 			//printf("No centroid found to draw!\n");
@@ -58,6 +58,15 @@
 
 #define COLOR_MAX 255
 
+/** Pose Prediction: how many recent positions, and how far back in ms, the velocity is fit to **/
+#define PRED_HISTORY_SIZE 6
+#define PRED_HISTORY_MS 250
+
+/** Timed illumination: longest duration in ms, and the key steps below and above 100 ms **/
+#define ILLUM_MAX_MS 10000
+#define ILLUM_FINE_STEP_MS 10
+#define ILLUM_STEP_MS 100
+
 
 typedef struct WormAnalysisParamStruct{
 	/* WormAnalyisisParam is a structure containing inputs
@@ -116,7 +125,7 @@ typedef struct WormAnalysisParamStruct{
 	int IllumSweepOn;
 
 	/** Timed DLP On **/
-	int IllumDuration; // in tenthsOfSeconds
+	int IllumDuration; // in ms
 	int DLPOnFlash;  // (see also IllumRefractoryPeriod and StayOnAndRefrat)
 
 	/** Use Protocols? **/
@@ -155,13 +164,16 @@ typedef struct WormAnalysisParamStruct{
 
 	/** Timing for Phase & Curvature Based Triggering **/
 	int StayOnAndRefract; //Stay On for the time IllumDuration and wait to turn on again a time specified below
-	int IllumRefractoryPeriod; //Amount of time to wait to turn on again in tenths of Seconds
+	int IllumRefractoryPeriod; //Amount of time to wait to turn on again in ms
 
 	/** Stage Control Parameters **/
 	int stageTrackingOn;
 	int stageSpeedFactor; // gain of feedback loop
 	int stageROIRadius;   // radius of the active zone
 	int stageTargetSegment; //segment along the worms centerline used for targeting
+	int stageKp; // PI + feed-forward controller (AlgID 2): proportional gain in tenths of 1/s
+	int stageKi; // integral gain in tenths of 1/s^2
+	int stageKff; // feed-forward of the worm's velocity in percent
 
 	/** Software Aperture Field-Of-View **/
 	int ApertureOn; // by default, turn off the software aperture
@@ -169,10 +181,13 @@ typedef struct WormAnalysisParamStruct{
 	int ApertureY; // y coordinate of center of circle
 	int ApertureR; // radius of circle
 	
+	/** Latency Compensation **/
+	int PredictOn; // extrapolate the worm forward to when the pattern reaches the mirrors
+	int PredictMaxShift; // never move the illumination further than this many pixels
+
 
 	/** Record Data Parameters **/
 	int Record;
-	int CalibXY;
 
 } WormAnalysisParam;
 
@@ -200,9 +215,24 @@ typedef struct WormTimeEvolutionStruct{
 	/** Phase and Curvature Analysis **/
 	CvSeq* WormVelBuffer;
 	CvPoint RecentAcceleration;
+
+	/** Pose Prediction **/
+	CvSeq* WormPosBuffer; // recent WormPosSample, most recent first
+	CvPoint2D32f PredVelocity; // pixels per ms, fit to WormPosBuffer
+	CvPoint2D32f PredShift; // how far forward the worm was moved this frame
+	double PredHorizon; // ms ahead that was predicted this frame
+	int PredApplied; // was the shift applied this frame?
+
 	CvMemStorage* MemTimeEvolutionStorage;
 }WormTimeEvolution;
 
+/** A position of the worm in camera space and the time its frame was captured **/
+typedef struct WormPosSampleStruct{
+	double t; // ms on the LT_Now() clock
+	double x;
+	double y;
+}WormPosSample;
+
 
 /* 
  * Struct to hold the fluorescence centroid 
@@ -255,11 +285,17 @@ typedef struct WormImageAnalysisStruct{
 	/** Segmented Worm **/
 	SegmentedWorm* Segmented;
 
+	/** Grids over the two sides of the boundary for SegmentSides(), reused every frame **/
+	BoundaryGrid* SideGridA;
+	BoundaryGrid* SideGridB;
+
 	/** Time Evolution Structure **/
 	WormTimeEvolution* TimeEvolution;
 
 	/** Information about location on plate **/
 	CvPoint stageVelocity; //compensating velocity of stage.
+	CvPoint stagePosition; //where the stage was when the frame was captured (stage units)
+	int stagePositionKnown; //stagePosition was measured for this frame
 
 	//WormIlluminationData* Illum;
 }WormAnalysisData;
@@ -418,6 +454,12 @@ void DestroySegmentedWormStruct(SegmentedWorm* SegWorm);
  */
 void ClearSegmentedInfo(SegmentedWorm* SegWorm);
 
+/*
+ * Translates every point of a segmented worm (centerline, bounds, head
+ * and tail) by shift.
+ */
+void ShiftSegmentedWorm(SegmentedWorm* SegWorm, CvPoint shift);
+
 
 
 /************************************************************/
@@ -438,6 +480,29 @@ int DestroyWormTimeEvolution(WormTimeEvolution** TimeEvolution);
 
 int AddWormMotionHistory(WormTimeEvolution* TimeEvolution, CvPoint CurrVelocity, WormAnalysisParam* AnalysisParam);
 
+/*
+ * Remember where the worm was in the frame captured at time t (ms).
+ * Only the most recent PRED_HISTORY_SIZE positions are kept.
+ */
+int AddWormPositionHistory(WormTimeEvolution* TimeEvolution, CvPoint Pos, double t);
+
+/*
+ * Forget the position history, e.g. when the worm is lost, so that a stale
+ * velocity is never used to predict.
+ */
+void ClearWormPositionHistory(WormTimeEvolution* TimeEvolution);
+
+/*
+ * Fit a velocity to the positions of the last PRED_HISTORY_MS and predict
+ * how far the worm will move in the next horizon ms.
+ * The shift is clipped to MaxShift pixels.
+ *
+ * The velocity, shift and horizon are also left in TimeEvolution.
+ * Returns A_OK, or A_ERROR (and a zero shift) if there are fewer than
+ * three recent positions to fit.
+ */
+int PredictWormShift(WormTimeEvolution* TimeEvolution, double horizon, int MaxShift, CvPoint2D32f* shift);
+
 
 
 
@@ -474,8 +539,12 @@ int DestroyWormFluor(WormFluor* Fluor);
  * The thresholded image is deposited into Worm.ImgThresh
  * The Boundary is placed in Worm.Boundary
  *
+ * The search is centered on the previous centroid moved by stageShift,
+ * how far the stage is expected to have carried the scene since the
+ * previous frame.
+ *
  */
-void FindWormBoundary(WormAnalysisData* Worm, WormAnalysisParam* WormParams, CvPoint* prevpt, CvPoint target); //, WormGeom* PrevWorm
+void FindWormBoundary(WormAnalysisData* Worm, WormAnalysisParam* WormParams, CvPoint* prevpt, CvPoint target, CvPoint stageShift); //, WormGeom* PrevWorm
 
 
 
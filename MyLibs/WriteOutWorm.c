@@ -273,6 +273,33 @@ int AppendWormFrameToDisk(WormAnalysisData* Worm, WormAnalysisParam* Params, Wri
 			cvEndWriteStruct(fs);
 		}
 
+		if (Worm->stagePositionKnown){
+			cvStartWriteStruct(fs,"StagePosition",CV_NODE_MAP,NULL);
+				cvWriteInt(fs,"x",Worm->stagePosition.x);
+				cvWriteInt(fs,"y",Worm->stagePosition.y);
+			cvEndWriteStruct(fs);
+		}
+
+		/** Latency compensation applied to the illumination **/
+		if (Params->PredictOn){
+			cvStartWriteStruct(fs,"PredictedShift",CV_NODE_MAP,NULL);
+				cvWriteInt(fs,"applied",Worm->TimeEvolution->PredApplied);
+				cvWriteReal(fs,"x",Worm->TimeEvolution->PredShift.x);
+				cvWriteReal(fs,"y",Worm->TimeEvolution->PredShift.y);
+				cvWriteReal(fs,"ms",Worm->TimeEvolution->PredHorizon);
+			cvEndWriteStruct(fs);
+		}
+
+		/** Timed illumination, in ms **/
+		if (Params->DLPOnFlash || Params->StayOnAndRefract){
+			cvStartWriteStruct(fs,"IllumTiming",CV_NODE_MAP,NULL);
+				cvWriteInt(fs,"Flash",Params->DLPOnFlash);
+				cvWriteInt(fs,"StayOnAndRefract",Params->StayOnAndRefract);
+				cvWriteInt(fs,"DurationMs",Params->IllumDuration);
+				cvWriteInt(fs,"RefractoryPeriodMs",Params->IllumRefractoryPeriod);
+			cvEndWriteStruct(fs);
+		}
+
 		cvStartWriteStruct(fs,"LaserPower",CV_NODE_MAP,NULL);
 			cvWriteInt(fs,"Green",Params->GreenLaser);
 			cvWriteInt(fs,"Blue",Params->BlueLaser);
@@ -42,6 +42,14 @@
 #include "WriteOutWorm.h"
 #include "version.h"
 #include "../API/mc_api_dll.h"
+#include "DLPOutput.h"
+#include "IllumScheduler.h"
+#include "ProtocolTimeline.h"
+#include "HudOverlay.h"
+#include "StageIO.h"
+#include "StageControl.h"
+#include "StageCalibrator.h"
+#include "StageOdometry.h"
 
 #include "experiment.h"
 
@@ -87,6 +95,11 @@ Experiment* CreateExperimentStruct() {
 	exp->p = NULL;
 	exp->pflag = 0;
 
+	/** Protocol Timeline **/
+	exp->timelinefname = NULL;
+	exp->timeline = NULL;
+	exp->timelineOn = 0;
+
 	/** Camera Input**/
 	exp->MyCamera = NULL;
 
@@ -102,6 +115,8 @@ Experiment* CreateExperimentStruct() {
 
 	/** DLP Output **/
 	exp->myDLP = 0;
+	exp->dlpOut = NULL;
+	exp->DLPIsClear = 0;
 
 	/** Calibration Data  Object**/
 	exp->Calib = NULL;
@@ -121,12 +136,16 @@ Experiment* CreateExperimentStruct() {
 	/** internal IplImage **/
 	exp->SubSampled = NULL; // Image used to subsample stuff
 	exp->HUDS = NULL; //Image used to generate the Heads Up Display
+	exp->DispHUDS = NULL;
+	exp->Hud = NULL;
 	exp->CurrentSelectedImg = NULL; //The current image selected for display
 
 	/** Internal Frame data types **/
 	exp->fromCCD = NULL;
 	exp->forDLP = NULL;
 	exp->IlluminationFrame = NULL;
+	exp->DLPPattern = NULL;
+	exp->Latency = NULL;
 
 	/** Write Data To File **/
 	exp->DataWriter = NULL;
@@ -140,8 +159,8 @@ Experiment* CreateExperimentStruct() {
 	exp->last = 0;
 
 	/** Illumination Timing Info **/
-	exp->illumStart = 0;
-	exp->illumFinished = 0;
+	exp->illumSched = NULL;
+	exp->illumFlashStarted = 0;
 
 	/** Illumination Head Tail Timing Info **/
 	exp->illumSweepHTtimer=0;
@@ -154,9 +173,16 @@ Experiment* CreateExperimentStruct() {
 	/** Stage Control **/
 	exp->stageIsPresent=0;
 	exp->stage=NULL;
+	exp->stageIO=NULL;
+	exp->stageCtl=NULL;
+	exp->stageCal=NULL;
+	exp->stageOdom=NULL;
+	exp->stageControlRate=SC_DEFAULT_RATE;
 	exp->stageVel=cvPoint(0,0);
 	exp->stageCenter=cvPoint(0,0);
 	exp->stageLoc=cvPoint(0,0);//(CvPoint*) malloc (sizeof(CvPoint));
+	exp->stageLocTime=0;
+	exp->prevCaptureTime=0;
 	exp->stageFeedbackTarget=cvPoint(NSIZEX/2,NSIZEY/2); // re-center stage to have worm in center of view
 	exp->stageIsTurningOff=0;	
 
@@ -166,6 +192,8 @@ Experiment* CreateExperimentStruct() {
 
 	/** MindControl API **/
 	exp->sm=NULL;
+	int k;
+	for (k=0; k<MC_API_NUM_IMAGE_KINDS; k++) exp->broadcastImages[k]=0;
 
 	exp->scratchMem =cvCreateMemStorage(0);
 
@@ -200,12 +228,19 @@ void displayHelp() {
 			"\t-i  InputVideo.avi\n\t\tNo camera. Use video file source instead.\n\n");
 	printf(
 			"\t-s\n\t\tSimulate the existence of DLP. (No physical DLP required.)\n\n");
+	printf(
+			"\t-u  5\n\t\tSimulate a DMD that takes 5 ms to upload each frame. (Only in builds without DLP hardware.)\n\n");
 	printf("\t-g\n\t\tUse camera attached to FrameGrabber.\n\n");
 	printf("\t-t\n\t\tUse USB stage tracker.\n\n");
 	printf("\t-x\n\tx 512\t Target x position  of worm for stage feedback loop. 0 is left.\n\n");
 	printf("\t-y\n\ty 384\t Target y position of worm for stage feedback loop. 0 is top.\n\n");
+	printf("\t-r\n\tr 100\t Rate of the stage feedback loop in Hz.\n\n");
 	printf(
 			"\t-p  protocol.yml\n\t\tIlluminate according to a YAML protocol file.\n\n");
+	printf(
+			"\t-T  timeline.txt\n\t\tStep through the protocol on a schedule. Press T to start. (Requires -p.)\n\n");
+	printf(
+			"\t-b  oth\n\t\tBroadcast images to other programs over the MindControl API: o original, t thresholded, h heads up display.\n\n");
 	printf("\t-f\n\tOperate in fluorescence mode. Expects fluorescing blobs instead of darkfield image.. Disables worm shape tracking and disables DLP. Tracks centroid of brightest blob.\n\n");
 	printf("\t-?\n\t\tDisplay this help.\n\n");
 	printf("\nSee shortcutkeys.txt for a list of keyboard shortcuts.\n");
@@ -222,7 +257,7 @@ int HandleCommandLineArguments(Experiment* exp) {
 	opterr = 0;
 
 	int c;
-	while ((c = getopt(exp->argc, exp->argv, "si:d:o:p:fgtx:y:?")) != -1) {
+	while ((c = getopt(exp->argc, exp->argv, "si:d:o:p:T:b:fgtx:y:r:u:?")) != -1) {
 		switch (c) {
 		case 'i': /** specify input video file **/
 			exp->VidFromFile = 1;
@@ -257,6 +292,13 @@ int HandleCommandLineArguments(Experiment* exp) {
 			exp->SimDLP = 1;
 			break;
 
+		case 'u': /** Simulate a DMD with a given upload time **/
+			if (optarg != NULL && T2DLP_SimulateDMD(atoi(optarg)) == T2DLP_HAPPY) {
+				/** Drive the full DLP output path, just without hardware **/
+				exp->SimDLP = 0;
+			}
+			break;
+
 		case 'p': /** Load Protocol **/
 			if (optarg != NULL) {
 				exp->protocolfname = optarg;
@@ -267,6 +309,23 @@ int HandleCommandLineArguments(Experiment* exp) {
 			}
 			break;
 
+		case 'T': /** Load Protocol Timeline **/
+			if (optarg != NULL) {
+				exp->timelinefname = optarg;
+			} else {
+				fprintf(stderr,
+						"Detected '-T' switch but no timeline file specified\n");
+			}
+			break;
+
+		case 'b': /** Broadcast images over the MindControl API **/
+			if (optarg != NULL) {
+				exp->broadcastImages[MC_API_IMAGE_ORIGINAL] = (strchr(optarg, 'o') != NULL);
+				exp->broadcastImages[MC_API_IMAGE_THRESHOLD] = (strchr(optarg, 't') != NULL);
+				exp->broadcastImages[MC_API_IMAGE_HUD] = (strchr(optarg, 'h') != NULL);
+			}
+			break;
+
 		case 'g': /** Use frame grabber **/
 			if (exp->VidFromFile) {
 				printf(
@@ -293,6 +352,12 @@ int HandleCommandLineArguments(Experiment* exp) {
 				}
 				printf("Stage feedback target y= %d pixels.\n",exp->stageFeedbackTarget.y );
 		break;
+		case 'r': /** rate of the stage feedback loop **/
+				if (optarg != NULL) {
+					exp->stageControlRate = atoi(optarg);
+				}
+				printf("Stage feedback loop rate= %d Hz.\n",exp->stageControlRate );
+		break;
 		
 		case 'f': /** fluorescence mode... expect fluorescence neurons, not darkfield image **/
 				exp->FluorMode=1;
@@ -475,7 +540,7 @@ void SetupGUI(Experiment* exp) {
 				// (int) NULL);
 
 		// cvCreateTrackbar("IllumDuration", exp->WinCon1,
-				// &(exp->Params->IllumDuration), 70, (int) NULL);
+				// &(exp->Params->IllumDuration), ILLUM_MAX_MS, (int) NULL);
 		// cvCreateTrackbar("DLPFlashOn", exp->WinCon1,
 				// &(exp->Params->DLPOnFlash), 1, (int) NULL);
 
@@ -537,7 +602,7 @@ void SetupGUI(Experiment* exp) {
 						// &(exp->Params->CurvaturePhaseDerivThresholdPositive), 1, (int) NULL);
 
 		// cvCreateTrackbar("IllumRefractPeriod", exp->WinCon2,
-				// &(exp->Params->IllumRefractoryPeriod), 70, (int) NULL);
+				// &(exp->Params->IllumRefractoryPeriod), ILLUM_MAX_MS, (int) NULL);
 
 		////Use the minimum DLP On and Refractory Period?
 		// cvCreateTrackbar("StayOn&Refract", exp->WinCon2,
@@ -600,6 +665,10 @@ void SetupGUI(Experiment* exp) {
 		cvCreateTrackbar("StageSpeed",exp->WinCon1,&(exp->Params->stageSpeedFactor),200, (int) NULL);
 		/* Within the Activezone, the gain on the feedback is linear with distance, outside it is  flat */
 		cvCreateTrackbar("ActiveZone",exp->WinCon1,&(exp->Params->stageROIRadius),200, (int) NULL);
+		/* Gains of the PI + feed-forward controller, used when the tracking algorithm is 2 */
+		cvCreateTrackbar("StageKp",exp->WinCon1,&(exp->Params->stageKp),200, (int) NULL);
+		cvCreateTrackbar("StageKi",exp->WinCon1,&(exp->Params->stageKi),200, (int) NULL);
+		cvCreateTrackbar("StageFF",exp->WinCon1,&(exp->Params->stageKff),150, (int) NULL);
 		
 		if (!(exp->FluorMode)){
 			cvCreateTrackbar("TargetSeg",exp->WinCon1,&(exp->Params->stageTargetSegment),99, (int) NULL);
@@ -745,26 +814,52 @@ void RollVideoInput(Experiment* exp) {
 
 /**** Do Calibration ***/
 /*
- * Perform calibration routine
- * Ni Ji 10112016
- * 
+ * Measure how the stage moves the image and hand the result to the
+ * stage feedback loop. Runs a step every frame and never waits;
+ * see StageCalibrator.h
+ *
+ * Have one bright object in view and turn on DoCalib.
  */
-int HandleCalibrationData(Experiment* exp) {
-// have at least one bright object in view, move stage by 100 stage units (fyi 10um), find out how many pixels the object has moved
-	Toggle(&(exp->Params->CalibXY));
-	if (exp->DoCalib){
-			printf("DoCalib = %d \n",exp->DoCalib);
-		if(exp->Params->CalibXY){
-			moveStageRel(exp->stage, 100, 0);
-		} else {
-			moveStageRel(exp->stage, 0, 100);
+int HandleStageCalibration(Experiment* exp) {
+	if (exp->stageCal==NULL || exp->stageCtl==NULL) {
+		exp->DoCalib=0;
+		return 0;
+	}
+
+	StageCalibrator* cal=exp->stageCal;
+	int running= (cal->State==SCAL_SETTLING || cal->State==SCAL_COLLECTING);
+	if (!(exp->DoCalib)) {
+		/** Turned off part way through **/
+		if (running) SCAL_Abort(cal);
+		return 0;
+	}
+
+	if (!running) {
+		/** The feedback loop must leave the stage alone while we move it **/
+		if (exp->Params->stageTrackingOn) exp->stageIsTurningOff=1;
+		exp->Params->stageTrackingOn=0;
+		if (SCAL_Start(cal,SCAL_DEFAULT_STEP)!=SCAL_OK) {
+			exp->DoCalib=0;
+			return 0;
+		}
+	}
+	exp->Params->stageTrackingOn=0;
+
+	double captureTime;
+	if (LT_GetStamp(exp->Latency,exp->Worm->frameNum,LT_CAPTURE,&captureTime)!=LT_OK) captureTime=LT_Now();
+	CvPoint* Pt=exp->Worm->FluorFeatures->centroid;
+	int state=SCAL_Update(cal,Pt->x,Pt->y,captureTime,exp->Worm->isPresent);
+
+	if (state==SCAL_DONE) {
+		if (SC_SetCalibration(exp->stageCtl,&(cal->Result))==SC_OK) {
+			SO_SetCalibration(exp->stageOdom,&(cal->Result));
+			if (SCAL_WriteFile(&(cal->Result),cal->Residual,SCAL_DEFAULT_FILE)==SCAL_OK)
+				printf("Stage calibration saved to %s\n",SCAL_DEFAULT_FILE);
 		}
-		sleep(3);
-		CvPoint calib1;
-		calib1 = getStageLoc(exp->stage);
-		//*(exp->Worm->stageLoc) = calib1;
-		printf("(%d %d)\n",calib1.x, calib1.y);
-		//printf("frame number %d\n", exp->Worm->frameNum);
+		exp->DoCalib=0;
+	} else if (state==SCAL_FAILED) {
+		printf("Keeping the previous stage calibration.\n");
+		exp->DoCalib=0;
 	}
 	return 0;
 }
@@ -790,6 +885,8 @@ void InitializeExperiment(Experiment* exp) {
 
 	exp->SubSampled = SubSampled;
 	exp->HUDS = HUDS;
+	exp->DispHUDS = cvCreateImage(cvSize(NSIZEX, NSIZEY), IPL_DEPTH_8U, 1);
+	exp->Hud = CreateHudOverlay(cvSize(NSIZEX, NSIZEY));
 
 	/*** Create Frames **/
 	Frame* fromCCD = CreateFrame(cvSize(NSIZEX, NSIZEY));
@@ -800,6 +897,10 @@ void InitializeExperiment(Experiment* exp) {
 	exp->fromCCD = fromCCD;
 	exp->forDLP = forDLP;
 	exp->IlluminationFrame = IlluminationFrame;
+	exp->DLPPattern = CreatePackedPattern(NSIZEX, NSIZEY);
+
+	/** Timestamps of every step from capture to the mirrors **/
+	exp->Latency = CreateLatencyTrace(LT_DEFAULT_SIZE);
 
 	/** Create Worm Data Struct and Worm Parameter Struct **/
 	WormAnalysisData* Worm = CreateWormAnalysisDataStruct();
@@ -807,9 +908,18 @@ void InitializeExperiment(Experiment* exp) {
 	InitializeEmptyWormImages(Worm, cvSize(NSIZEX, NSIZEY));
 	InitializeWormMemStorage(Worm);
 
-	/** Create SegWormDLP object using memory from the worm object **/
+	/** The worm in DLP space, which protocols are drawn onto **/
 	exp->segWormDLP = CreateSegmentedWormStruct();
 
+	/** Camera to DLP calibration, as written by calibrateFG **/
+	char calibfname[] = "calib.dat";
+	exp->Calib = CreateCalibData(cvSize(NSIZEX, NSIZEY), cvSize(NSIZEX, NSIZEY));
+	if (LoadCalibFromFile(exp->Calib, calibfname) != 0) {
+		printf("Could not load calib.dat. Protocols will not be illuminated.\n");
+		DestroyCalibData(exp->Calib);
+		exp->Calib = NULL;
+	}
+
 	exp->Worm = Worm;
 	exp->Params = Params;
 	exp->DoCalib = 0;
@@ -824,6 +934,15 @@ void InitializeExperiment(Experiment* exp) {
 	/** Create MindControl API Shared Memory **/
 	exp->sm=MC_API_StartServer();
 
+	/** Image streams for other programs, if asked for **/
+	int k;
+	for (k=0; k<MC_API_NUM_IMAGE_KINDS; k++) {
+		if (exp->broadcastImages[k] && MC_API_StartImageStream(exp->sm,k,NSIZEX,NSIZEY)!=MC_API_OK) {
+			printf("Could not start image stream %d. Not broadcasting it.\n",k);
+			exp->broadcastImages[k]=0;
+		}
+	}
+
 }
 
 /*
@@ -839,6 +958,8 @@ void ReleaseExperiment(Experiment* exp) {
 		DestroyFrame(&(exp->forDLP));
 	if (exp->IlluminationFrame != NULL)
 		DestroyFrame(&(exp->IlluminationFrame));
+	DestroyPackedPattern(&(exp->DLPPattern));
+	DestroyLatencyTrace(&(exp->Latency));
 
 	/** Stop MindControl API Shared Memory Server **/
 	if (exp->sm!=NULL){
@@ -853,8 +974,10 @@ void ReleaseExperiment(Experiment* exp) {
 	exp->outfname = NULL;
 
 	/** The segmented worm DLP structure **/
-	// Note that the memorystorage for the Cvseq's are in exp->worm->Memorystorage
-	free(exp->segWormDLP);
+	if (exp->segWormDLP != NULL) {
+		DestroySegmentedWormStruct(exp->segWormDLP);
+		exp->segWormDLP = NULL;
+	}
 
 	/** Free up Worm Objects **/
 	if (exp->Worm != NULL) {
@@ -876,6 +999,9 @@ void ReleaseExperiment(Experiment* exp) {
 		cvReleaseImage(&(exp->SubSampled));
 	if (exp->HUDS != NULL)
 		cvReleaseImage(&(exp->HUDS));
+	if (exp->DispHUDS != NULL)
+		cvReleaseImage(&(exp->DispHUDS));
+	DestroyHudOverlay(&(exp->Hud));
 
 	/** Free Up Calib Data **/
 	if (exp->Calib != NULL)
@@ -905,12 +1031,15 @@ void DestroyExperiment(Experiment** exp) {
  *
  */
 int GrabFrame(Experiment* exp) {
+	double captureTime = 0;
 
 	if (!(exp->VidFromFile)) {
 		/** Acquire from Physical Camera **/
 		if (exp->UseFrameGrabber) {
 			/** Use BitFlow SDK to acquire from Frame Grabber **/
 			//printf("Trying to acquire a frame...\n");
+			/** The snap is issued here, so this is as close to the exposure as we can get **/
+			captureTime = LT_Now();
 			if (AcquireFrame(exp->fg)==T2FG_ERROR){
 				return EXP_ERROR;
 			}
@@ -928,6 +1057,7 @@ int GrabFrame(Experiment* exp) {
 			/** Acqure from ImagingSource USB Cam **/
 
 			exp->lastFrameSeenOutside = exp->MyCamera->iFrameNumber;
+			captureTime = exp->MyCamera->iFrameTime;
 			/*** Create a local copy of the image***/
 			LoadFrameWithBin(exp->MyCamera->iImageData, exp->fromCCD);
 
@@ -939,6 +1069,7 @@ int GrabFrame(Experiment* exp) {
 
 		IplImage* tempImg;
 		/** Grab the frame from the video **/
+		captureTime = LT_Now();
 		tempImg = cvQueryFrame(exp->capture);
 
 		/** Stall for a little bit **/
@@ -969,6 +1100,10 @@ int GrabFrame(Experiment* exp) {
 	}
 
 	exp->Worm->frameNum++;
+
+	/** Start this frame's latency record **/
+	LT_BeginFrame(exp->Latency, exp->Worm->frameNum, captureTime);
+	LT_Mark(exp->Latency, exp->Worm->frameNum, LT_GRABBED);
 	return EXP_SUCCESS;
 }
 
@@ -1026,6 +1161,9 @@ int SetupRecording(Experiment* exp) {
 
 		BeginToWriteOutFrames(exp->DataWriter);
 
+		/** Tell the annotation system which experiment is running **/
+		WriteRecentExperimentToFile(exp);
+
 		printf("Initialized data recording\n");
 		DestroyFilename(&DataFileName);
 	}
@@ -1075,6 +1213,37 @@ void FinishRecording(Experiment* exp) {
 
 }
 
+/*
+ * Print histograms of the camera-to-mirror latency.
+ * If data is being recorded, also write the per-frame trace to
+ * <outfname>_latency.txt
+ */
+void ReportLatency(Experiment* exp) {
+	LT_PrintReport(exp->Latency, stdout);
+
+	if (exp->RECORDDATA && exp->dirname != NULL && exp->outfname != NULL) {
+		char* LatencyFileName = CreateFileName(exp->dirname, exp->outfname, "_latency.txt");
+		if (LT_WriteRecords(exp->Latency, LatencyFileName) == LT_OK)
+			printf("Wrote latency trace to %s\n", LatencyFileName);
+		DestroyFilename(&LatencyFileName);
+	}
+}
+
+/*
+ * Turn the illumination off and stop the illumination scheduler.
+ */
+void StopIllumination(Experiment* exp) {
+	if (exp->illumSched == NULL) return;
+
+	if (exp->RECORDDATA && exp->dirname != NULL && exp->outfname != NULL) {
+		char* IllumFileName = CreateFileName(exp->dirname, exp->outfname, "_illum.txt");
+		if (IllumSched_WriteEdges(exp->illumSched, IllumFileName) == IS_OK)
+			printf("Wrote illumination edge times to %s\n", IllumFileName);
+		DestroyFilename(&IllumFileName);
+	}
+	StopIllumScheduler(&(exp->illumSched));
+}
+
 /************************************************/
 /*   Frame Rate Routines
  *
@@ -1130,21 +1299,91 @@ int CalculateAndPrintFrameRateAndInfo(Experiment* exp) {
 
 /*
  * If the DLP is on, don't do anything.
- * If the DLP is off, clear the IlluminationFrame
+ * When the DLP goes off, clear the IlluminationFrame
  * and send that to the DLP so that none of hte DLP mirrors
- * are exposed
+ * are exposed. The mirrors stay dark, so this is only done once per switch off.
  */
 void ClearDLPifNotDisplayingNow(Experiment* exp) {
 	/** If the DLP is not displaying **/
 	if (exp->Params->DLPOn == 0) {
+		/** The mirrors are already dark **/
+		if (exp->DLPIsClear) return;
+
 		/** Clear the DLP **/
 		RefreshFrame(exp->IlluminationFrame);
-		if (!(exp->SimDLP))
-			T2DLP_SendFrame((unsigned char *) exp->IlluminationFrame->binary,
-					exp->myDLP);
+		ClearPackedPattern(exp->DLPPattern);
+		if (!(exp->SimDLP)) SendIlluminationToDLP(exp);
+		exp->DLPIsClear = 1;
+	} else {
+		exp->DLPIsClear = 0;
 	}
 }
 
+/*
+ * Send exp->DLPPattern to the DLP, inverting it first if the selection is
+ * inverted and flooding it if the flood light is on.
+ */
+void SendIlluminationToDLP(Experiment* exp) {
+	/** The scheduler keeps the pattern off the mirrors while the illumination is off **/
+	int lit = exp->Params->DLPOn || exp->illumSched != NULL;
+
+	/** Invert the selection, 32 mirrors at a time **/
+	if (exp->Params->IllumInvert && lit)
+		InvertPackedPattern(exp->DLPPattern);
+
+	if (exp->Params->IllumFloodEverything && lit)
+		FloodPackedPattern(exp->DLPPattern);
+
+	LT_Mark(exp->Latency, exp->Worm->frameNum, LT_PATTERN_READY);
+
+	if (exp->illumSched != NULL) {
+		IllumSched_SetPattern(exp->illumSched, exp->DLPPattern, exp->Worm->frameNum);
+	} else if (exp->dlpOut != NULL) {
+		/** Hand the pattern to the DLP output thread rather than waiting on the upload **/
+		DLPOut_SubmitPacked(exp->dlpOut, exp->DLPPattern, exp->Worm->frameNum);
+	} else {
+		/** No output thread: expand the pattern here and upload it ourselves **/
+		UnpackPatternToBinary(exp->DLPPattern, exp->forDLP->binary);
+		if (T2DLP_SendFrame((unsigned char *) exp->forDLP->binary, exp->myDLP) == T2DLP_HAPPY)
+			LT_Mark(exp->Latency, exp->Worm->frameNum, LT_UPLOADED);
+	}
+}
+
+/*
+ * Handle Transient Illumination Timing
+ *
+ * The scheduler thread does the actual switching, so the edges land when
+ * they are due rather than on the next frame.
+ */
+int HandleIlluminationTiming(Experiment* exp) {
+	if (exp->illumSched == NULL) return 0;
+	WormAnalysisParam* Params = exp->Params;
+
+	/** Timed flash: one pulse of IllumDuration every time it is switched on **/
+	if (!(Params->DLPOnFlash)) {
+		exp->illumFlashStarted = 0;
+	} else if (!(exp->illumFlashStarted)) {
+		if (IllumSched_Pulse(exp->illumSched, Params->IllumDuration) == IS_OK) {
+			exp->illumFlashStarted = 1;
+		} else {
+			Params->DLPOnFlash = 0;
+		}
+	} else if (!IllumSched_PulseActive(exp->illumSched)) {
+		/** The pulse is over **/
+		Params->DLPOnFlash = 0;
+		exp->illumFlashStarted = 0;
+	}
+
+	/** Stay on for IllumDuration, then stay off for IllumRefractoryPeriod, and so on **/
+	int cycle = Params->DLPOn && Params->StayOnAndRefract && Params->IllumDuration > 0;
+	IllumSched_SetCycle(exp->illumSched, cycle, Params->IllumDuration,
+			Params->IllumRefractoryPeriod);
+
+	/** Otherwise the DLP is simply on or off **/
+	IllumSched_SetSteady(exp->illumSched, Params->DLPOn);
+	return 0;
+}
+
 /*
  * Given an image in teh worm object, segment the worm
  *
@@ -1163,13 +1402,54 @@ void DoSegmentation(Experiment* exp) {
 	 */
 		
 	
+	/** Look for the worm where the velocity just sent to the stage will have carried it **/
+	double captureTime;
+	if (LT_GetStamp(exp->Latency,exp->Worm->frameNum,LT_CAPTURE,&captureTime)!=LT_OK) captureTime=LT_Now();
+	CvPoint stageShift=cvPoint(0,0);
+	if (exp->stageCtl!=NULL && exp->prevCaptureTime>0) {
+		double dt=captureTime - exp->prevCaptureTime;
+		double ivx, ivy;
+		if (dt>0 && dt<=SC_MAX_DT_MS && SC_GetImageVelocity(exp->stageCtl,&ivx,&ivy)==SC_OK)
+			stageShift=cvPoint(lround(ivx*dt/1000),lround(ivy*dt/1000));
+	}
+	exp->prevCaptureTime=captureTime;
+
 	TICTOC::timer().tic("_FindWormBoundary",exp->e);
 	if (!(exp->e)) 
-		FindWormBoundary(exp->Worm,exp->Params, exp->Worm->FluorFeatures->centroid,exp->stageFeedbackTarget); // ,exp->PrevWorm modified by Ni: use prevworm information to crop region of interest out of full image
+		FindWormBoundary(exp->Worm,exp->Params, exp->Worm->FluorFeatures->centroid,exp->stageFeedbackTarget,stageShift); // ,exp->PrevWorm modified by Ni: use prevworm information to crop region of interest out of full image
 	TICTOC::timer().toc("_FindWormBoundary",exp->e);
 
 	/** Store worm pos from prev 6 frames**/
 	if (AddWormMotionHistory(exp->Worm->TimeEvolution,exp->Worm->currvelocity,exp->Params)!=A_OK) printf("Error adding mean curvature!!\n");
+
+	/** Store where the worm was when the frame was captured, for latency compensation **/
+	if (exp->Worm->isPresent && LT_GetStamp(exp->Latency,exp->Worm->frameNum,LT_CAPTURE,&captureTime)==LT_OK) {
+		if (exp->Params->FluorMode) {
+			AddWormPositionHistory(exp->Worm->TimeEvolution,*(exp->Worm->FluorFeatures->centroid),captureTime);
+		} else if (cvSeqExists(exp->Worm->Segmented->Centerline)) {
+			AddWormPositionHistory(exp->Worm->TimeEvolution,
+					*CV_GET_SEQ_ELEM(CvPoint,exp->Worm->Segmented->Centerline,exp->Worm->Segmented->Centerline->total/2),captureTime);
+		}
+	} else {
+		/** Never predict from a velocity measured before the worm was lost **/
+		ClearWormPositionHistory(exp->Worm->TimeEvolution);
+	}
+
+	/** Where the stage was when the frame was captured, from the frame itself **/
+	HandleStageOdometry(exp);
+
+	/** Hand the point to keep centered to the stage feedback loop **/
+	if (exp->stageCtl!=NULL) {
+		if (LT_GetStamp(exp->Latency,exp->Worm->frameNum,LT_CAPTURE,&captureTime)!=LT_OK) captureTime=LT_Now();
+		CvPoint* PtOnWorm=exp->Worm->FluorFeatures->centroid;
+		StagePosition stagePos;
+		stagePos.x=exp->Worm->stagePosition.x;
+		stagePos.y=exp->Worm->stagePosition.y;
+		stagePos.t=captureTime;
+		stagePos.rtt=0;
+		stagePos.valid=exp->Worm->stagePositionKnown;
+		SC_SetMeasurement(exp->stageCtl,PtOnWorm->x,PtOnWorm->y,captureTime,exp->Worm->frameNum,exp->Worm->isPresent,&stagePos);
+	}
 	
 
 	/** Display values in buffer **/
@@ -1194,43 +1474,120 @@ void DoSegmentation(Experiment* exp) {
 
 
 /*
- * Add a rectangle to the image to denote the target for stage recentering.
+ * Latency compensation: predict how far the worm moves before this
+ * frame's pattern reaches the mirrors.
  */
-void MarkRecenteringTarget(Experiment* exp){
-	// int A = (int)(exp->stageFeedbackTarget.x);
-	// int B = (int)(exp->stageFeedbackTarget.y);
-	// int C = (int)(exp->Worm->currvelocity.x);
-	int A = (int)(exp->stageFeedbackTarget.x) + (int)(exp->Worm->currvelocity.x);
-	int B = (int)(exp->stageFeedbackTarget.y) + (int)(exp->Worm->currvelocity.y);
-//printf("stageFeedbackTarget: x=%d, y=%d, A=%d, B=%d\n",exp->stageFeedbackTarget.x,exp->stageFeedbackTarget.y, A, B);
-	
-	
-	if (abs(A)<NSIZEX&&abs(B)<NSIZEY){
-	//exp->stageFeedbackTarget.x = A; exp->stageFeedbackTarget.y = B;
-	}
-	
-	CvPoint a=cvPoint( (exp->stageFeedbackTarget.x) +5, (exp->stageFeedbackTarget.y) +5);
-	CvPoint b=cvPoint((exp->stageFeedbackTarget.x) -5, (exp->stageFeedbackTarget.y) -5);
-	cvRectangle(exp->HUDS,a,b, cvScalar(255,255,255),2);
-	//printf("stageFeedbackTarget: x=%d, y=%d, A=%d, B=%d\n",exp->stageFeedbackTarget.x,exp->stageFeedbackTarget.y, A, B);
-	
-	/*Also display tracker status */
-		/** Prepare Text **/
-	CvFont font;
-	cvInitFont(&font,CV_FONT_HERSHEY_TRIPLEX ,1.0,1.0,0,2,CV_AA);
-	
-	//cvDrawContours(exp->Worm->ImgThresh,exp->Worm->Boundary,cvScalar(255,255,255),cvScalar(255,255,255),5,1,CV_AA);
+void PredictWormPose(Experiment* exp) {
+	WormTimeEvolution* TimeEv=exp->Worm->TimeEvolution;
+	TimeEv->PredApplied=0;
+	TimeEv->PredShift=cvPoint2D32f(0,0);
+	TimeEv->PredHorizon=0;
+	if (!(exp->Params->PredictOn) || !(exp->Worm->isPresent)) return;
+
+	/** Frames before this one have (mostly) made it to the mirrors by now **/
+	double horizon;
+	if (LT_RecentLatency(exp->Latency,LT_CAPTURE,LT_UPLOADED,exp->Worm->frameNum,PRED_LATENCY_FRAMES,&horizon)!=LT_OK) return;
+
+	CvPoint2D32f shift;
+	if (PredictWormShift(TimeEv,horizon,exp->Params->PredictMaxShift,&shift)==A_OK) TimeEv->PredApplied=1;
+}
+
+/*
+ * Rasterize the current protocol step onto the (predicted) worm in DLP space.
+ * Needs calib.dat and a segmented centerline; returns 0 without drawing if
+ * either is missing (SegmentWorm() does not build a centerline at the moment).
+ */
+int IlluminateWormFromProtocol(Experiment* exp) {
+	if (!(exp->pflag) || exp->p==NULL || !(exp->Params->ProtocolUse) || exp->Calib==NULL) return 0;
+	SegmentedWorm* SegWorm=exp->Worm->Segmented;
+	if (!(exp->Worm->isPresent) || !cvSeqExists(SegWorm->Centerline)) return 0;
+
+	/** Move the worm to where it will be when the pattern is on the mirrors **/
+	CvPoint shift=cvPoint(0,0);
+	if (exp->Worm->TimeEvolution->PredApplied)
+		shift=cvPoint(cvRound(exp->Worm->TimeEvolution->PredShift.x),cvRound(exp->Worm->TimeEvolution->PredShift.y));
+
+	/** Only shift it for the DLP; the worm itself is still recorded where it was seen **/
+	ShiftSegmentedWorm(SegWorm,shift);
+	int ret=TransformSegWormCam2DLP(SegWorm,exp->segWormDLP,exp->Calib);
+	ShiftSegmentedWorm(SegWorm,cvPoint(-shift.x,-shift.y));
+	if (ret<0) return -1;
+
+	return IlluminateFromProtocolPacked(exp->segWormDLP,exp->DLPPattern,exp->p,exp->Params);
+}
 
-	
-	
-	/*** Let the user know if the illumination flood light is on ***/
-	if (exp->Params->stageTrackingOn){
-		cvPutText(exp->HUDS,"Tracking",cvPoint(20,130),&font,cvScalar(255,255,255));
-	} else {
-		cvPutText(exp->HUDS,"NOT Tracking!!",cvPoint(150,300),&font,cvScalar(255,255,255));
-	}
-	
 
+/*
+ * Publish what goes on the heads up display for this frame.
+ */
+void PublishHUD(Experiment* exp){
+	HudSnapshot* snap=HUD_BackSnapshot(exp->Hud);
+	if (snap==NULL) return;
+	WormAnalysisData* Worm=exp->Worm;
+	WormAnalysisParam* Params=exp->Params;
+
+	/** The display thread gets its own copy of the frame, so it never sees one half written **/
+	snap->frameNum=Worm->frameNum;
+	snap->Raw=0;
+	cvCopy(Worm->ImgOrig,snap->Img);
+
+	/** The worm **/
+	snap->FluorMode=Params->FluorMode;
+	snap->isPresent=Worm->isPresent;
+	snap->centroid=*(Worm->FluorFeatures->centroid);
+	snap->PredApplied=Params->PredictOn && Worm->TimeEvolution->PredApplied;
+	snap->predicted=cvPoint(snap->centroid.x + cvRound(Worm->TimeEvolution->PredShift.x),
+			snap->centroid.y + cvRound(Worm->TimeEvolution->PredShift.y));
+	/** Head and tail are only set by GivenBoundaryFindWormHeadTail(), which may not have run **/
+	snap->HeadTailKnown= Worm->isPresent && Worm->Head!=NULL && Worm->Tail!=NULL;
+	snap->head= snap->HeadTailKnown ? *(Worm->Head) : cvPoint(-1,-1);
+	snap->tail= snap->HeadTailKnown ? *(Worm->Tail) : cvPoint(-1,-1);
+	/** A lost worm's boundary points into memory that has already been cleared **/
+	HUD_SetBoundary(snap, Worm->isPresent ? Worm->Boundary : NULL);
+
+	/** Target for stage recentering **/
+	snap->stageTarget=exp->stageFeedbackTarget;
+	snap->stageTrackingOn=Params->stageTrackingOn;
+
+	/** Status **/
+	snap->DLPOn=Params->DLPOn;
+	snap->FloodLight=Params->IllumFloodEverything;
+	snap->ProtocolUse=Params->ProtocolUse;
+	snap->ProtocolStep=Params->ProtocolStep;
+	snap->Record=Params->Record;
+	snap->ApertureOn=Params->ApertureOn;
+	snap->Aperture=cvPoint(Params->ApertureX,Params->ApertureY);
+	snap->ApertureR=Params->ApertureR;
+
+	/** The HUDS video needs every frame, so draw it here, but only if it is recorded or broadcast **/
+	if ((exp->RECORDVID && Params->Record) || exp->broadcastImages[MC_API_IMAGE_HUD])
+		HUD_Render(exp->Hud,snap,exp->IlluminationFrame->iplimg,exp->HUDS);
+
+	HUD_Publish(exp->Hud);
+}
+
+/*
+ * Publish the camera frame as it is, for when analysis is switched off.
+ */
+void PublishRawFrame(Experiment* exp){
+	HudSnapshot* snap=HUD_BackSnapshot(exp->Hud);
+	if (snap==NULL) return;
+	snap->frameNum=exp->Worm->frameNum;
+	snap->Raw=1;
+	cvCopy(exp->fromCCD->iplimg,snap->Img);
+	HUD_Publish(exp->Hud);
+
+	if (exp->broadcastImages[MC_API_IMAGE_ORIGINAL]) BroadcastImage(exp,MC_API_IMAGE_ORIGINAL,exp->fromCCD->iplimg);
+}
+
+/*
+ * Draw the most recently published heads up display into exp->DispHUDS.
+ */
+int RenderLatestHUD(Experiment* exp){
+	const HudSnapshot* snap=HUD_TakeLatest(exp->Hud);
+	if (snap==NULL) return 0;
+	HUD_Render(exp->Hud,snap,exp->IlluminationFrame->iplimg,exp->DispHUDS);
+	return 1;
 }
 
 
@@ -1356,6 +1713,9 @@ int HandleKeyStroke(int c, Experiment* exp) {
 	case ',':
 		if (exp->pflag) Decrement(&(exp->Params->ProtocolStep),0);
 		break;
+	case 'T': /** Run the protocol timeline **/
+		if (exp->timeline != NULL) Toggle(&(exp->timelineOn));
+		break;
 
 	/** Threshold **/
 	case ']':
@@ -1373,17 +1733,34 @@ int HandleKeyStroke(int c, Experiment* exp) {
 		Decrement(&(exp->Params->GaussSize),0);
 		break;
 
+	/** Latency histograms **/
+	case 'L':
+		LT_PrintReport(exp->Latency, stdout);
+		break;
+
+	/** Latency compensation **/
+	case 'P':
+		Toggle(&(exp->Params->PredictOn));
+		if (exp->Params->PredictOn) printf("Predicting the worm forward to the mirrors.\n");
+		else printf("Latency compensation off.\n");
+		break;
+
 	/** Timed DLP on **/
 	case '/':
 		Toggle(&(exp->Params->DLPOnFlash));
 		break;
 
+	/** Timed duration, in steps of 10 ms up to 100 ms and 100 ms above **/
 	case '<':
-		Decrement(&(exp->Params->IllumDuration),0);
+		exp->Params->IllumDuration-= (exp->Params->IllumDuration>ILLUM_STEP_MS) ? ILLUM_STEP_MS : ILLUM_FINE_STEP_MS;
+		if (exp->Params->IllumDuration<0) exp->Params->IllumDuration=0;
+		printf("Illumination duration %d ms\n",exp->Params->IllumDuration);
 		break;
 
 	case '>':
-		Increment(&(exp->Params->IllumDuration),100);
+		exp->Params->IllumDuration+= (exp->Params->IllumDuration>=ILLUM_STEP_MS) ? ILLUM_STEP_MS : ILLUM_FINE_STEP_MS;
+		if (exp->Params->IllumDuration>ILLUM_MAX_MS) exp->Params->IllumDuration=ILLUM_MAX_MS;
+		printf("Illumination duration %d ms\n",exp->Params->IllumDuration);
 		break;
 
 	/** Timed Secondary Protocol Illumination **/
@@ -1419,11 +1796,11 @@ int HandleKeyStroke(int c, Experiment* exp) {
 			/** If we are turning the stage off, let the rest of the code know **/
 			printf("Turning tracking off!\n");
 			exp->stageIsTurningOff=1;
-			getStageLoc(exp->stage);
 		} else {
 			printf("Turning tracking on!\n");
-			setStartingStageLoc(exp->stage);
-			exp->stageLoc = getStageLoc(exp->stage);
+			StageIO_SetHere(exp->stageIO,0,0);
+			exp->stageLoc = cvPoint(0,0);
+			exp->stageLocTime = LT_Now();
 		}
 		break;
 	case 'X':
@@ -1450,23 +1827,104 @@ int HandleKeyStroke(int c, Experiment* exp) {
 }
 
 
+/*
+ * Publish this frame's record in the MindControl API worm state stream.
+ */
+void PublishWormState(Experiment* exp){
+	if (exp->sm==NULL) return;
+	WormAnalysisData* Worm=exp->Worm;
+	MC_API_WormState ws;
+
+	ws.frame=Worm->frameNum;
+	if (LT_GetStamp(exp->Latency,Worm->frameNum,LT_CAPTURE,&(ws.captureTime))!=LT_OK) ws.captureTime=-1;
+	ws.isPresent=Worm->isPresent;
+
+	/** The same points the heads up display shows **/
+	ws.centroidX=ws.centroidY=-1;
+	if (Worm->isPresent){
+		ws.centroidX=Worm->FluorFeatures->centroid->x;
+		ws.centroidY=Worm->FluorFeatures->centroid->y;
+	}
+	ws.headX=ws.headY=ws.tailX=ws.tailY=-1;
+	if (Worm->isPresent && Worm->Head!=NULL && Worm->Tail!=NULL){
+		ws.headX=Worm->Head->x;
+		ws.headY=Worm->Head->y;
+		ws.tailX=Worm->Tail->x;
+		ws.tailY=Worm->Tail->y;
+	}
+	ws.velocityX=Worm->TimeEvolution->PredVelocity.x;
+	ws.velocityY=Worm->TimeEvolution->PredVelocity.y;
+
+	/** The stage **/
+	ws.stageKnown=Worm->stagePositionKnown;
+	ws.stageX=Worm->stagePosition.x;
+	ws.stageY=Worm->stagePosition.y;
+	ws.stageVelX=ws.stageVelY=0;
+	if (exp->stageCtl!=NULL) SC_GetVelocity(exp->stageCtl,&(ws.stageVelX),&(ws.stageVelY));
+
+	/** Illumination **/
+	ws.DLPisOn=exp->Params->DLPOn;
+	ws.protocolStep= exp->Params->ProtocolUse ? exp->Params->ProtocolStep : -1;
+	ws.reserved=0;
+
+	ws.publishTime=LT_Now();
+	MC_API_PublishWormState(exp->sm,&ws);
+}
+
+/*
+ * Copy one image straight into the next slot of its MindControl API stream.
+ */
+void BroadcastImage(Experiment* exp, int kind, IplImage* img){
+	if (img==NULL || img->nChannels!=1 || img->depth!=IPL_DEPTH_8U) return;
+	if (img->width!=NSIZEX || img->height!=NSIZEY) return;
+	MC_API_Image* slot=MC_API_BeginImage(exp->sm,kind);
+	if (slot==NULL) return;
+
+	slot->frame=exp->Worm->frameNum;
+	if (LT_GetStamp(exp->Latency,exp->Worm->frameNum,LT_CAPTURE,&(slot->captureTime))!=LT_OK) slot->captureTime=-1;
+
+	/** An image header around the slot's pixels, so OpenCV copies into shared memory directly **/
+	IplImage dest;
+	cvInitImageHeader(&dest,cvSize(slot->width,slot->height),IPL_DEPTH_8U,1,IPL_ORIGIN_TL,4);
+	cvSetData(&dest,MC_API_ImagePixels(slot),slot->widthStep);
+	cvCopy(img,&dest);
+
+	slot->publishTime=LT_Now();
+	MC_API_EndImage(exp->sm,kind);
+}
+
+/*
+ * Broadcast the images the user asked for with -b.
+ */
+void BroadcastImages(Experiment* exp){
+	if (exp->sm==NULL) return;
+	if (exp->broadcastImages[MC_API_IMAGE_ORIGINAL]) BroadcastImage(exp,MC_API_IMAGE_ORIGINAL,exp->Worm->ImgOrig);
+	if (exp->broadcastImages[MC_API_IMAGE_THRESHOLD]) BroadcastImage(exp,MC_API_IMAGE_THRESHOLD,exp->Worm->ImgThresh);
+	if (exp->broadcastImages[MC_API_IMAGE_HUD]) BroadcastImage(exp,MC_API_IMAGE_HUD,exp->HUDS);
+}
+
 /*
  * Write out current values to MindControl API and read in
  * values set by external processes.
  *
- * At the moment, MindControl writes out the current frame and the
- * status of the DLP. It reads in the laser power values.
+ * At the moment, MindControl writes out the current frame, the
+ * status of the DLP and the worm state stream. It reads in the laser power values.
  */
 void SyncAPI(Experiment* exp){
 
-	/** Write out to the MindControl API **/
-	MC_API_SetCurrentFrame(exp->sm, exp->Worm->frameNum);
-	MC_API_SetDLPOnOff(exp->sm,exp->Params->DLPOn);
+	/** Write out to and read in from the MindControl API in one exchange **/
+	MC_API_ServerState out;
+	MC_API_ClientState in;
+	out.frame=exp->Worm->frameNum;
+	out.DLPisOn=exp->Params->DLPOn;
+	out.reserved[0]=out.reserved[1]=0;
+	int ret=MC_API_ExchangeServer(exp->sm,&out,&in);
+	PublishWormState(exp);
 
 	/** Load in Info From Laser Controller **/
-	if (MC_API_isLaserControllerPresent(exp->sm)) {
-		exp->Params->GreenLaser=MC_API_GetGreenLaserPower(exp->sm);
-		exp->Params->BlueLaser=MC_API_GetBlueLaserPower(exp->sm);
+	if (ret==MC_API_OK && in.laserControllerPresent==MC_API_TRUE) {
+		exp->Params->GreenLaser=in.greenLaserPower;
+		exp->Params->BlueLaser=in.blueLaserPower;
 	} else {
 		exp->Params->GreenLaser=-1;
 		exp->Params->BlueLaser=-1;
@@ -1538,32 +1996,12 @@ int DoOnTheFlyIllumination(Experiment* exp) {
 	IllumWorm(exp->segWormDLP, montage, exp->forDLP->iplimg,
 			exp->Params->DefaultGridSize,exp->Params->IllumFlipLR);
 	LoadFrameWithImage(exp->forDLP->iplimg, exp->forDLP);
+	PackBinaryToPattern(exp->forDLP->binary, exp->DLPPattern);
 	cvClearSeq(montage);
 	return 0;
 
 }
 
-/**
- * Invert the illumination, so white becomes black and vice-versa.
- */
-void InvertIllumination(Experiment* exp){
-	IplImage* temp= cvCreateImage( cvSize(exp->IlluminationFrame->iplimg->width,exp->IlluminationFrame->iplimg->height),
-			IPL_DEPTH_8U, 1);
-
-	/** Invert Illumination Frame **/
-
-	cvXorS(exp->IlluminationFrame->iplimg,cvScalar(255,255,255),temp);
-	LoadFrameWithImage(temp,exp->IlluminationFrame);
-
-
-
-	/** Invert DLP Frame **/
-	cvXorS(exp->forDLP->iplimg,cvScalar(255,255,255),temp);
-	LoadFrameWithImage(temp,exp->forDLP);
-
-
-}
-
 
 /*********************
  *
@@ -1584,6 +2022,75 @@ void LoadProtocol(Experiment* exp) {
 	exp->Params->ProtocolTotalSteps=exp->p->Steps->total;
 }
 
+/*
+ * Load the timeline given with -T and check it against the protocol.
+ */
+int LoadTimeline(Experiment* exp) {
+	if (exp->timelinefname == NULL) return 0;
+	if (!(exp->pflag)) {
+		printf("Error! A timeline (-T) steps through a protocol, so a protocol (-p) must be loaded too.\n");
+		return -1;
+	}
+	exp->timeline = LoadProtocolTimeline(exp->timelinefname);
+	if (exp->timeline == NULL) return -1;
+
+	if (exp->timeline->MaxStep >= exp->Params->ProtocolTotalSteps) {
+		printf("Error! Timeline %s uses step %d but the protocol only has %d steps.\n",
+				exp->timelinefname, exp->timeline->MaxStep, exp->Params->ProtocolTotalSteps);
+		DestroyProtocolTimeline(&(exp->timeline));
+		return -1;
+	}
+	printf("Press T to start the timeline.\n");
+	return 0;
+}
+
+/*
+ * Start or stop the protocol timeline when the user asks to, and
+ * select whatever protocol step the timeline says belongs to this frame.
+ */
+int HandleProtocolTimeline(Experiment* exp) {
+	ProtocolTimeline* tl = exp->timeline;
+	if (tl == NULL) return 0;
+
+	if (exp->timelineOn && !(tl->Running)) {
+		/** Whatever step is selected now is where we return to between events **/
+		TL_Start(tl, LT_Now(), exp->Params->ProtocolStep);
+		exp->Params->ProtocolUse = 1;
+		printf("Timeline started at frame %d. It lasts %.1f s.\n", exp->Worm->frameNum, TL_Length(tl) / 1000.0);
+	} else if (!(exp->timelineOn) && tl->Running) {
+		exp->Params->ProtocolStep = TL_Stop(tl);
+		printf("Timeline stopped by the user at frame %d.\n", exp->Worm->frameNum);
+		return 0;
+	}
+	if (!(tl->Running)) return 0;
+
+	int step = TL_Update(tl, LT_Now(), exp->Worm->frameNum);
+	if (step != TL_NO_CHANGE) exp->Params->ProtocolStep = step;
+
+	if (!(tl->Running)) {
+		exp->timelineOn = 0;
+		printf("Timeline finished at frame %d. %d events were too short to be seen by any frame.\n",
+				exp->Worm->frameNum, tl->NumMissed);
+	}
+	return 0;
+}
+
+/*
+ * Stop the timeline, write out its step changes and free it.
+ */
+void FinishProtocolTimeline(Experiment* exp) {
+	if (exp->timeline == NULL) return;
+	if (exp->timeline->Running) exp->Params->ProtocolStep = TL_Stop(exp->timeline);
+
+	if (exp->RECORDDATA && exp->dirname != NULL && exp->outfname != NULL && exp->timeline->LogCount > 0) {
+		char* TimelineFileName = CreateFileName(exp->dirname, exp->outfname, "_timeline.txt");
+		if (TL_WriteLog(exp->timeline, TimelineFileName) == TL_OK)
+			printf("Wrote protocol step changes to %s\n", TimelineFileName);
+		DestroyFilename(&TimelineFileName);
+	}
+	DestroyProtocolTimeline(&(exp->timeline));
+}
+
 /*
  *  Releases a protocol from the experiment object.
  */
@@ -1596,14 +2103,17 @@ void ReleaseProtocolFromExperiment(Experiment* exp) {
 
 
 /*
- * Writes a recent frame number to file
+ * Writes the data file name and the software version to recentExperiment.txt
+ * for the annotation system. The frame number and DLP state come from the
+ * worm state stream in the MindControl API.
  */
-int WriteRecentFrameNumberToFile(Experiment* exp){
+int WriteRecentExperimentToFile(Experiment* exp){
 	if (exp->RECORDDATA == 0) return 0;
-	if (exp->Worm->frameNum < 0 || exp->DataWriter->filename == NULL  || build_git_sha == NULL) return -1;
+	if (exp->DataWriter == NULL || exp->DataWriter->filename == NULL  || build_git_sha == NULL) return -1;
 	FILE* pFile;
-	pFile = fopen("recentFrameNum.txt","w");
-	fprintf(pFile,"%d\n%s\n%s\n%u",exp->Worm->frameNum,exp->DataWriter->filename,build_git_sha,exp->Params->DLPOn);
+	pFile = fopen("recentExperiment.txt","w");
+	if (pFile == NULL) return -1;
+	fprintf(pFile,"%s\n%s\n",exp->DataWriter->filename,build_git_sha);
 	fclose(pFile);
 	return 0;
 }
@@ -1636,76 +2146,147 @@ int WriteRecentFrameNumberToFile(Experiment* exp){
  *  When the object is out side the activeZoneRadius, then the velocity is flat.
  *
  *  The user can set both the active zone radius and the gain (speed).
+ *
+ * The feedback loop itself now runs on its own thread at a fixed rate (see StageControl.c).
+ * What is left here starts and stops it and hands it the user's settings.
  */
- /* 7/12/2016: Ni is changing the algorithm for determining stage velocity: the worm's previous velocity and acceleration will be stored
- * and passed on AdjustStageToKeepObjectAtTarget to computer the next velocity command to send to the stage
+
+
+/*
+ * Scan for the USB device.
  */
+int InvokeStage(Experiment* exp){
+	exp->stageCenter=cvPoint(NSIZEX/2 , NSIZEY/2 );
 
+	exp->stage=InitializeUsbStage();
+	if (exp->stage==NULL){
+		printf("ERROR! Invoking the stage failed.\nTurning tracking off.\n");
+		exp->Params->stageTrackingOn=0;
+		return 0;
+	}
 
-CvPoint AdjustStageToKeepObjectAtTarget(HANDLE stage, CvPoint* obj,CvPoint target, int speed,
-int activeZoneRadius, CvPoint stgdisp, int algID, CvPoint wormvel){
-	if (obj==NULL){
-		printf("Error! obj is NULL in AdjustStageToKeepObjectAtTarget()\n");
-		return cvPoint(0,0);
+	/** From here on only the stage I/O thread talks to the serial port **/
+	StagePort port;
+	port.handle=exp->stage;
+	port.Write=T2S_SerialWrite;
+	port.Read=T2S_SerialRead;
+	exp->stageIO=StartStageIO(port);
+	if (exp->stageIO==NULL){
+		printf("ERROR! Starting the stage I/O thread failed.\nTurning tracking off.\n");
+		exp->Params->stageTrackingOn=0;
+		return 0;
 	}
 
-	if (obj==NULL){
-		printf("Error! target is NULL in AdjustStageToKeepObjectAtTarget()\n");
-		return cvPoint(0,0);
+	printf("Telling stage to HALT...\n");
+	StageIO_Halt(exp->stageIO);
+
+	exp->stageCtl=StartStageControl(exp->stageIO,exp->stageControlRate);
+	if (exp->stageCtl==NULL){
+		printf("ERROR! Starting the stage feedback loop failed.\nTurning tracking off.\n");
+		exp->Params->stageTrackingOn=0;
 	}
-//	printf("About to adjust stage.\n");
 
-	CvPoint diff;
-	CvPoint vel;
-		
-	/** (stage-obj)*speed **/
-	// This is where the FUN happens...
-	// Toggle between multiple algorithms
-	//printf("obj= (%d, %d), target =(%d, %d)\n",obj->x, obj->y, target.x, target.y);
-if (algID==1){
-	diff.x=target.x-obj->x;
-	diff.y=target.y-obj->y;
-
-	//printf("About to Multiply!\n");
-	vel.x= CropNumber(-activeZoneRadius,activeZoneRadius, diff.x)*speed;
-	vel.y= CropNumber(-activeZoneRadius,activeZoneRadius, diff.y)*speed;
-}else{
-	
-	int iftime;
-	vel.x = (stgdisp.x+(int)(wormvel.x)*50)/iftime; // 50 is place holder for pixel to stage unit conversion factor
-	vel.y = (stgdisp.y+(int)(wormvel.y)*50)/iftime; // iftime is time interval between the current and previous frames
-}
+	/** Pixel to stage calibration from last time, if there is one **/
+	StageCalibration calib;
+	SC_DefaultCalibration(&calib);
+	if (exp->stageCtl!=NULL){
+		if (SCAL_ReadFile(&calib,SCAL_DEFAULT_FILE)==SCAL_OK && SC_SetCalibration(exp->stageCtl,&calib)==SC_OK){
+			printf("Loaded the stage calibration from %s\n",SCAL_DEFAULT_FILE);
+		} else {
+			printf("No stage calibration in %s. Using the default. Press 'c' to calibrate.\n",SCAL_DEFAULT_FILE);
+			SC_DefaultCalibration(&calib);
+		}
+		exp->stageCal=CreateStageCalibrator(exp->stageIO);
+	}
 
+	/** Follow the stage from the camera; the serial position only corrects drift **/
+	exp->stageOdom=CreateStageOdometry(cvSize(NSIZEX,NSIZEY),SO_DEFAULT_SCALE);
+	if (exp->stageOdom!=NULL){
+		SO_SetCalibration(exp->stageOdom,&calib);
+		StageIO_SetPollInterval(exp->stageIO,SO_SERIAL_POLL_MS);
+	}
 
-	//printf("SpinStage: vel.x=%d, vel.y=%d\n",vel.x,vel.y);
-	spinStage(stage,vel.y,vel.x); //swapped values here to accomodate weird camera angle relative to stage
-	return vel;
+	/** Wait a little for the first position **/
+	StagePosition stgp;
+	for (int k = 0; k < 50; ++k) {
+		if (StageIO_GetPosition(exp->stageIO,&stgp)==STAGEIO_OK){
+			exp->stageLoc=cvPoint(stgp.x,stgp.y);
+			exp->stageLocTime=stgp.t;
+			break;
+		}
+		Sleep(STAGEIO_POLL_MS);
+	}
+	return 1;
 }
 
 
 /*
- * Scan for the USB device.
+ * Emergency stop: halt the stage now and keep the feedback loop from moving
+ * it again. Only sends commands, so the display thread can call it while the
+ * main thread is still using the stage objects.
  */
-int InvokeStage(Experiment* exp){
-	exp->stageCenter=cvPoint(NSIZEX/2 , NSIZEY/2 );
-
-	exp->stage=InitializeUsbStage();
-	if (exp->stage==NULL){
-		printf("ERROR! Invoking the stage failed.\nTurning tracking off.\n");
-		exp->Params->stageTrackingOn=0;
-		return 0;
+int HaltStage(Experiment* exp){
+	if (exp->stage==NULL) return 0;
+	exp->Params->stageTrackingOn=0;
+	if (exp->stageCtl!=NULL){
+		StageCtlSettings settings;
+		memset(&settings,0,sizeof(settings));
+		settings.on=0;
+		SC_SetSettings(exp->stageCtl,&settings);
+	}
+	if (exp->stageIO!=NULL){
+		StageIO_Halt(exp->stageIO);
 	} else {
-		exp->stageLoc = getStageLoc(exp->stage);
-		printf("Telling stage to HALT...\n");
 		haltStage(exp->stage);
 	}
-
+	return 0;
 }
 
-
+/*
+ * Halt the stage, then stop the feedback loop and the stage I/O thread and
+ * free the calibrator and odometry. Only call this once nothing else uses
+ * them, i.e. after the main loop has finished and the display thread has
+ * stopped. Safe to call more than once.
+ */
 int ShutOffStage(Experiment* exp){
-	getStageLoc(exp->stage);
-	haltStage(exp->stage);
+	if (exp->stage==NULL) return 0;
+	SO_PrintReport(exp->stageOdom,stdout);
+	DestroyStageOdometry(&(exp->stageOdom));
+	DestroyStageCalibrator(&(exp->stageCal));
+	/** Halts the stage if it was tracking **/
+	StopStageControl(&(exp->stageCtl));
+	if (exp->stageIO!=NULL){
+		StageIO_Halt(exp->stageIO);
+		StageIO_PrintReport(exp->stageIO,stdout);
+		/** Sends the halt before it returns **/
+		StopStageIO(&(exp->stageIO));
+	} else {
+		haltStage(exp->stage);
+	}
+	return 0;
+}
+
+/*
+ * Follow the stage from the camera (see StageOdometry.h) and note in the
+ * worm object where it was when this frame was captured. The serial
+ * position is only used to correct drift.
+ */
+int HandleStageOdometry(Experiment* exp){
+	exp->Worm->stagePositionKnown=0;
+	if (exp->stageOdom==NULL || exp->e) return 0;
+
+	double captureTime;
+	if (LT_GetStamp(exp->Latency,exp->Worm->frameNum,LT_CAPTURE,&captureTime)!=LT_OK) captureTime=LT_Now();
+	CvPoint* worm= exp->Worm->isPresent ? exp->Worm->FluorFeatures->centroid : NULL;
+	SO_AddFrame(exp->stageOdom,exp->fromCCD->iplimg,captureTime,worm);
+
+	StagePosition stgp;
+	if (exp->stageIO!=NULL && StageIO_GetPosition(exp->stageIO,&stgp)==STAGEIO_OK) SO_Correct(exp->stageOdom,&stgp);
+	if (SO_GetPosition(exp->stageOdom,&stgp)==SO_OK){
+		exp->Worm->stagePosition=cvPoint(stgp.x,stgp.y);
+		exp->Worm->stagePositionKnown=1;
+	}
+	return 0;
 }
 
 /*
@@ -1717,7 +2298,7 @@ int ShutOffStage(Experiment* exp){
  */
 int HandleStageTracker(Experiment* exp){	
 	if (exp->stageIsPresent==1){ /** If the Stage is Present **/
-		if (exp->stage==NULL) return 0;
+		if (exp->stage==NULL || exp->stageIO==NULL || exp->stageCtl==NULL) return 0;
 				/** If we are tracking but there is nothing to track, turn tracking off but only once **/	
 				if 	(exp->Worm->isPresent ==0 && exp->Params->stageTrackingOn==1){
 					exp->stageIsTurningOff=1;
@@ -1725,46 +2306,45 @@ int HandleStageTracker(Experiment* exp){
 					printf("Shutting off tracking because  Worm is not present to track..\n");
 				}
 		
-		 if (exp->Params->stageTrackingOn==1){
-			 if (exp->Params->OnOff==0){ /** if the analysis system is off **/
+		 if (exp->Params->stageTrackingOn==1 && exp->Params->OnOff==0){ /** if the analysis system is off **/
 				 /** Turn the stage off **/
 				 exp->stageIsTurningOff=1;
 				 exp->Params->stageTrackingOn=0;
 				printf("Setting flags to turn stage off in HandleStageTracker()\n");
-			 } else {
-			/** Move the stage to keep the worm centered in the field of view **/
-			
+		}
 
-			
-			/** Find The Point on the Worm To Center **/
-			CvPoint* PtOnWorm;
-					
-					// /** Track based on the centroid of the binary image **/
-					PtOnWorm = (CvPoint*) exp->Worm->FluorFeatures->centroid;	
-					printf("point on worm x=%d, y=%d\n",PtOnWorm->x,PtOnWorm->y);
-
-			CvPoint stgp;
-			CvPoint stgdisp;
-			stgp = getStageLoc(exp->stage);
-			printf("Stage Pos is: %d, %d \n",stgp.x,stgp.y);
-			// calculate stage displacement since last frame,
-			stgdisp = cvPoint(stgp.x-(exp->stageLoc.x),stgp.y-(exp->stageLoc.y));
-			exp->stageLoc = stgp; // update stage position
-
-
-				/** Adjust the stage velocity to keep that point centered in the field of view **/
-			exp->Worm->stageVelocity=AdjustStageToKeepObjectAtTarget(exp->stage,PtOnWorm,exp->stageFeedbackTarget,
-				exp->Params->stageSpeedFactor, exp->Params->stageROIRadius, exp->stageLoc, exp->Params->AlgID, exp->Worm->currvelocity);
-				}
+		/** Tell the feedback loop what the user wants. It moves the stage to keep
+		 * the worm centered in the field of view, and halts it when tracking goes off **/
+		StageCtlSettings settings;
+		settings.on=exp->Params->stageTrackingOn;
+		settings.algID=exp->Params->AlgID;
+		settings.targetX=exp->stageFeedbackTarget.x;
+		settings.targetY=exp->stageFeedbackTarget.y;
+		settings.gain=exp->Params->stageSpeedFactor;
+		settings.activeZone=exp->Params->stageROIRadius;
+		settings.kp=exp->Params->stageKp/10.0;
+		settings.ki=exp->Params->stageKi/10.0;
+		settings.kff=exp->Params->stageKff/100.0;
+		SC_SetSettings(exp->stageCtl,&settings);
+
+		if (exp->Params->stageTrackingOn==1){
+			/** Latest position from the stage I/O thread; does not wait for the stage **/
+			StagePosition stgp;
+			if (StageIO_GetPosition(exp->stageIO,&stgp)==STAGEIO_OK && stgp.t!=exp->stageLocTime){
+				exp->stageLoc = cvPoint(stgp.x,stgp.y); // update stage position
+				exp->stageLocTime = stgp.t;
+			}
+
+			/** Velocity the feedback loop last sent, written out with the worm **/
+			SC_GetVelocity(exp->stageCtl,&(exp->Worm->stageVelocity.x),&(exp->Worm->stageVelocity.y));
 		}
 		if (exp->Params->stageTrackingOn==0){/** Tracking Should be off **/
 			//printf("Tracking is off in HandleStageTracker()\n");
 			/** If we are in the process of turning tacking off **/
 			if (exp->stageIsTurningOff==1){
-				/** Tell the stage to Halt **/
 				printf("Tracking Stopped!");
-				printf("Telling stage to HALT.\n");
-				haltStage(exp->stage);
+				printf("The feedback loop halts the stage.\n");
+				exp->Worm->stageVelocity=cvPoint(0,0);
 				exp->stageIsTurningOff=0;
 			}
 			/** The stage is already halted, so there is nothing to do. **/
@@ -68,6 +68,9 @@
 #ifndef MC_API_DLL_H_
  #error "#include API/mc_api_dll.h" must appear in source files before "#include experiment.h"
 #endif
+#ifndef DLPOUTPUT_H_
+ #error "#include DLPOutput.h" must appear in source files before "#include experiment.h"
+#endif
 
 
 
@@ -75,6 +78,9 @@
 #define EXP_SUCCESS 0
 #define EXP_VIDEO_RAN_OUT 1
 
+/** Number of recent frames whose latency sets how far ahead the worm is predicted **/
+#define PRED_LATENCY_FRAMES 30
+
 typedef struct ExperimentStruct{
 	/** Simulation? True/false **/
 	int SimDLP; //1= simulate the DLP, 0= real DLP
@@ -106,6 +112,11 @@ typedef struct ExperimentStruct{
     Protocol* p;
     int pflag;
 
+	/** Protocol Timeline (see ProtocolTimeline.h) **/
+	char* timelinefname;
+	struct ProtocolTimelineStruct* timeline;
+	int timelineOn; // 1 while the user wants the timeline to run
+
 	/** Camera Input**/
 	CamData* MyCamera;
 
@@ -121,6 +132,8 @@ typedef struct ExperimentStruct{
 
 	/** DLP Output **/
 	long myDLP;
+	DLPOutput* dlpOut; // Thread that uploads patterns to the DLP
+	int DLPIsClear; // 1 once the mirrors have been cleared for the DLP being off
 
 	/** Calibration Data  Object**/
 	CalibData* Calib;
@@ -140,12 +153,20 @@ typedef struct ExperimentStruct{
 	/** internal IplImage **/
 	IplImage* SubSampled; // Image used to subsample stuff
 	IplImage* HUDS;  //Image used to generate the Heads Up Display
+	IplImage* DispHUDS; //Heads Up Display as drawn by the display thread
 	IplImage* CurrentSelectedImg;
 
+	/** What goes on the Heads Up Display, handed from the analysis to the display thread **/
+	struct HudOverlayStruct* Hud;
+
 	/** Internal Frame data types **/
 	Frame* fromCCD;
 	Frame* forDLP;
 	Frame* IlluminationFrame;
+	PackedPattern* DLPPattern; // What actually goes to the DLP, one bit per mirror
+
+	/** Per-frame camera-to-mirror latency **/
+	LatencyTrace* Latency;
 
 	/** Write Data To File **/
 	WriteOut* DataWriter;
@@ -159,8 +180,8 @@ typedef struct ExperimentStruct{
 	clock_t last;
 
 	/** Illumination Timer **/
-	double illumStart; //Time that the illumination began
-	double illumFinished;  //Time that the illumination finished
+	struct IllumSchedulerStruct* illumSched; // Switches the illumination on and off on time (see IllumScheduler.h)
+	int illumFlashStarted; // 1 once the pulse for the current timed flash has been requested
 
 	/** Illum Head-To-Tail Sweep Internal Variables **/
 	double illumSweepHTtimer;
@@ -177,8 +198,15 @@ typedef struct ExperimentStruct{
 	/** Stage Control **/
 	int stageIsPresent;	
 	HANDLE stage; // Handle to USB stage object
+	struct StageIOStruct* stageIO; // Thread that owns the stage's serial line (see StageIO.h)
+	struct StageControlStruct* stageCtl; // Fixed rate stage feedback loop (see StageControl.h)
+	struct StageCalibratorStruct* stageCal; // Pixel to stage calibration (see StageCalibrator.h)
+	struct StageOdometryStruct* stageOdom; // Stage position from the camera (see StageOdometry.h)
+	int stageControlRate; // Hz
 	CvPoint stageVel; //Current velocity of stage
 	CvPoint stageLoc; //Current stage positoin (absolute)
+	double stageLocTime; //When stageLoc was measured (ms, LT_Now() clock)
+	double prevCaptureTime; //When the previous segmented frame was captured (ms, LT_Now() clock)
 	CvPoint stageCenter; // Point indicating center of stage.
 	CvPoint stageFeedbackTarget; //Target of the stage feedback loop as a point in the image
 	int stageIsTurningOff; //1 indicates stage is turning off. 0 indicates stage is on or off.
@@ -186,6 +214,7 @@ typedef struct ExperimentStruct{
 
 	/** MindControl API **/
 	SharedMemory_handle sm;
+	int broadcastImages[MC_API_NUM_IMAGE_KINDS]; // 1 to broadcast that kind of image over the API (see -b)
 
 	/** Scratch CvMemoryStorage **/
 	CvMemStorage* scratchMem;
@@ -236,9 +265,38 @@ int HandleIlluminationSweep(Experiment* exp);
  */
 int HandleCurvaturePhaseAnalysis(Experiment* exp);
 
-/** Handle Transient Illumination Timing **/
+/*
+ * Handle Transient Illumination Timing
+ *
+ * Translates the timed flash (DLPOnFlash, IllumDuration), stay on and
+ * refract (StayOnAndRefract, IllumRefractoryPeriod) and the DLP on/off
+ * switch into requests to the illumination scheduler, which switches the
+ * mirrors at the right moments on its own thread. Durations are in ms.
+ *
+ * Call once per frame. Does nothing without a scheduler.
+ */
 int HandleIlluminationTiming(Experiment* exp);
 
+/*
+ * Load the timeline given with -T and check it against the protocol.
+ * Returns 0, or -1 on error.
+ */
+int LoadTimeline(Experiment* exp);
+
+/*
+ * Start or stop the protocol timeline when the user asks to, and
+ * select whatever protocol step the timeline says belongs to this frame.
+ *
+ * Call once per frame. Does nothing without a timeline.
+ */
+int HandleProtocolTimeline(Experiment* exp);
+
+/*
+ * Stop the timeline. If data is being recorded, write the step changes
+ * to <outfname>_timeline.txt. Then free the timeline.
+ */
+void FinishProtocolTimeline(Experiment* exp);
+
 /*
  * Flips the simulation variable to on.
  */
@@ -285,11 +343,10 @@ void RollVideoInput(Experiment* exp);
 int GrabFrame(Experiment* exp);
 
 /*
- * Create calibration Data structure
- * Load calibration data from file
- * return -1 if the calibration from file doesn't exist.
+ * Step the automatic pixel to stage calibration (see StageCalibrator.h).
+ * Call once per frame after segmentation. Never waits.
  */
-int HandleCalibrationData(Experiment* exp);
+int HandleStageCalibration(Experiment* exp);
 
 
 
@@ -353,6 +410,21 @@ int SetupRecording(Experiment* exp);
  */
 void FinishRecording(Experiment* exp);
 
+/*
+ * Print histograms of the camera-to-mirror latency.
+ * If data is being recorded, also write the per-frame trace to
+ * <outfname>_latency.txt
+ */
+void ReportLatency(Experiment* exp);
+
+/*
+ * Turn the illumination off and stop the illumination scheduler.
+ * If data is being recorded, the times of every on/off edge are written to
+ * <outfname>_illum.txt first.
+ * Call before StopDLPOutput().
+ */
+void StopIllumination(Experiment* exp);
+
 
 /************************************************/
 /*   Frame Rate Routines
@@ -384,12 +456,24 @@ int CalculateAndPrintFrameRateAndInfo(Experiment* exp);
 
 /*
  * If the DLP is on, don't do anything.
- * If the DLP is off, clear the IlluminationFrame
+ * When the DLP goes off, clear the IlluminationFrame and the DLP pattern
  * and send that to the DLP so that none of hte DLP mirrors
- * are exposed
+ * are exposed. The mirrors stay dark, so this is only done once per switch off.
  */
 void ClearDLPifNotDisplayingNow(Experiment* exp);
 
+/*
+ * Send exp->DLPPattern to the DLP. If the selection is inverted
+ * (IllumInvert), every mirror is flipped first; if the flood light is on,
+ * every mirror is turned on.
+ *
+ * With an illumination scheduler the pattern goes to the scheduler, which
+ * only lets it onto the mirrors while the illumination is on.
+ *
+ * The pattern stays packed until the DLP output thread uploads it.
+ */
+void SendIlluminationToDLP(Experiment* exp);
+
 
 /*
  * Given an image in teh worm object, segment the worm
@@ -397,11 +481,51 @@ void ClearDLPifNotDisplayingNow(Experiment* exp);
  */
 void DoSegmentation(Experiment* exp);
 
+/*
+ * Latency compensation.
+ * Predict how far the worm will have moved by the time the pattern for
+ * this frame reaches the mirrors. The horizon is the median
+ * capture-to-mirror latency of the last PRED_LATENCY_FRAMES frames and the
+ * velocity is fit to the worm's recent positions.
+ *
+ * The shift is left in exp->Worm->TimeEvolution, drawn on the HUDS and
+ * written out with the frame. Does nothing unless Params->PredictOn.
+ */
+void PredictWormPose(Experiment* exp);
 
 /*
- * Add a rectangle to the image to denote the target for stage recentering.
+ * Rasterize the current protocol step onto the worm in DLP space, into
+ * exp->DLPPattern. If a predicted shift was made for this frame, the worm
+ * is moved by it before it is transformed into DLP space.
+ *
+ * Needs a protocol, calibration data and a segmented worm; does nothing
+ * otherwise. Returns 0, or -1 on error.
+ */
+int IlluminateWormFromProtocol(Experiment* exp);
+
+
+/*
+ * Publish what goes on the heads up display for this frame (a copy of the
+ * camera image, the worm, the stage recentering target and the status
+ * text) for the display thread to draw at its own pace.
+ *
+ * The HUDS image itself is only drawn here when it is being recorded.
+ */
+void PublishHUD(Experiment* exp);
+
+/*
+ * Publish the camera frame without any overlay, for when analysis is
+ * switched off.
+ */
+void PublishRawFrame(Experiment* exp);
+
+/*
+ * Draw the most recently published heads up display into exp->DispHUDS.
+ * Returns 1 if it was redrawn, 0 if nothing new was published since the
+ * last call.
+ * Display thread only.
  */
-void MarkRecenteringTarget(Experiment* exp);
+int RenderLatestHUD(Experiment* exp);
 
 /*
  * Preparesthe Selected Display
@@ -416,11 +540,6 @@ void PrepareSelectedDisplay(Experiment* exp);
  */
 int DoOnTheFlyIllumination(Experiment* exp);
 
-/**
- * Invert the illumination, so white becomes black and vice-versa.
- */
-void InvertIllumination(Experiment* exp);
-
 
 /*
  *
@@ -431,12 +550,29 @@ void InvertIllumination(Experiment* exp);
  */
 int HandleKeyStroke(int c, Experiment* exp);
 
+/*
+ * Publish this frame's record in the MindControl API worm state stream.
+ */
+void PublishWormState(Experiment* exp);
+
+/*
+ * Copy one 8 bit NSIZEX x NSIZEY image straight into the next slot of its
+ * MindControl API image stream.
+ */
+void BroadcastImage(Experiment* exp, int kind, IplImage* img);
+
+/*
+ * Broadcast the images the user asked for with -b over the MindControl API.
+ * Call after PublishHUD(), which draws the heads up display.
+ */
+void BroadcastImages(Experiment* exp);
+
 /*
  * Write out current values to MindControl API and read in
  * values set by external processes.
  *
- * At the moment, MindControl writes out the current frame and the
- * status of the DLP. It reads in the laser power values.
+ * At the moment, MindControl writes out the current frame, the
+ * status of the DLP and the worm state stream. It reads in the laser power values.
  */
 void SyncAPI(Experiment* exp);
 
@@ -468,9 +604,11 @@ void ReleaseProtocolFromExperiment(Experiment* exp);
 
 
 /*
- * Writes a recent frame number to file
+ * Writes the data file name and the software version to recentExperiment.txt
+ * for the annotation system. The frame number and DLP state come from the
+ * worm state stream in the MindControl API.
  */
-int WriteRecentFrameNumberToFile(Experiment* exp);
+int WriteRecentExperimentToFile(Experiment* exp);
 
 
 /**************************************************
@@ -493,6 +631,13 @@ int WriteRecentFrameNumberToFile(Experiment* exp);
  */
 int InvokeStage(Experiment* exp);
 
+/*
+ * Follow the stage from the camera and note where it was when the current
+ * frame was captured (Worm->stagePosition). Call once per frame after
+ * FindWormBoundary().
+ */
+int HandleStageOdometry(Experiment* exp);
+
 /*
  * Update the Stage Tracker.
  * If the Stage tracker is not initialized, don't do anything.
@@ -502,6 +647,16 @@ int InvokeStage(Experiment* exp);
  */
 int HandleStageTracker(Experiment* exp);
 
+/*
+ * Emergency stop: halt the stage and turn tracking off, without freeing
+ * anything. Safe from any thread.
+ */
+int HaltStage(Experiment* exp);
+
+/*
+ * Halt the stage and free everything that talks to it. Only once no other
+ * thread uses the stage any more.
+ */
 int ShutOffStage(Experiment* exp);
 
 
@@ -0,0 +1,29 @@
+% This writes out a timeline for stepping through a protocol automatically.
+% Run MindControl with -p protocol.yml -T timeline.txt and press T to start.
+%
+% steps, starts, durations and repeats are vectors of equal length, one
+% entry per line of the timeline. Steps count from 0 like the protocol
+% steps on screen. Times are in seconds. periods is optional and defaults
+% to durations (repeats back to back).
+%
+% For example, to hold each step of a raster protocol for 2 s:
+%   n=length(protocol);
+%   writeTimeline('raster_timeline.txt',0:n-1,2*(0:n-1),2*ones(1,n),ones(1,n))
+function [] = writeTimeline(filename,steps,starts,durations,repeats,periods)
+assert(ischar(filename),'Error: filename must be a string')
+if nargin<6
+    periods=durations;
+end
+n=length(steps);
+assert(length(starts)==n && length(durations)==n && length(repeats)==n && length(periods)==n, ...
+    'Error: steps, starts, durations, repeats and periods must all be the same length')
+
+fid = fopen(filename,'w');
+fprintf(fid,'# MindControl protocol timeline generated by writeTimeline.m\n');
+fprintf(fid,'# %s\n',datestr(now));
+fprintf(fid,'# step\tstart\tduration\trepeat\tperiod\n');
+for k=1:n
+    fprintf(fid,'%d\t%g\t%g\t%d\t%g\n',steps(k),starts(k),durations(k),repeats(k),periods(k));
+end
+fclose(fid);
+end
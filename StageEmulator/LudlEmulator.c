@@ -0,0 +1,454 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * LudlEmulator.c
+ *
+ * Pretends to be a LUDL MAC6000 stage controller on a pseudo-terminal, so
+ * that the stage code can be run and timed on a plain Linux box.
+ *
+ * Understands the part of the protocol that MindControl uses:
+ *
+ *   SPIN X=vx Y=vy     spin at a velocity             -> :A
+ *   HALT               decelerate to a stop           -> :A
+ *   WHERE X Y          report the position            -> :A x y
+ *   MOVEI X=dx Y=dy    move by a relative amount      -> :A
+ *   HERE X=x Y=y       call the current position x,y  -> :A
+ *   CENTER X=x Y=y     move to x,y                    -> :A
+ *
+ * Anything else is answered with :N -1. Every reply ends in a line feed.
+ *
+ * The line is modelled byte by byte at the baud rate (8 data bits, no
+ * parity and two stop bits, as InitializeUsbStage() configures it). Each
+ * command takes effect a fixed latency after its last byte arrives, and
+ * replies queue up behind each other on the way back. Velocity changes are
+ * limited by an acceleration and the position is integrated from the
+ * velocity every millisecond.
+ *
+ * The controller can also be made to lock up once too many unread replies
+ * pile up, the way the real one did over the virtual COM port driver before
+ * clearStageBuffer() (see Talk2Stage.c).
+ *
+ * Usage: ludlemu [options], then open the printed device (or the -k link).
+ * Ctrl-C prints statistics and exits.
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+
+#define EMU_CMD_LEN 128
+#define EMU_REPLY_LEN 64
+#define EMU_QUEUE_SIZE 1024
+
+/** Start bit, 8 data bits, 2 stop bits **/
+#define EMU_BITS_PER_BYTE 11
+
+/** Integration step (s) **/
+#define EMU_TICK 0.001
+
+typedef struct EmuOptionsStruct{
+	int baud;
+	double latency; /** s from the end of a command to its effect **/
+	double accel; /** stage units/s^2 **/
+	double maxSpeed; /** stage units/s **/
+	double spinScale; /** stage units/s per SPIN unit **/
+	int lockupBytes; /** lock up when this many reply bytes are unread. 0 never **/
+	const char* link;
+	int verbose;
+} EmuOptions;
+
+#define AXIS_SPIN 0
+#define AXIS_MOVE 1
+
+typedef struct EmuAxisStruct{
+	double pos;
+	double vel;
+	int mode;
+	double spin; /** velocity asked for in AXIS_SPIN **/
+	double target; /** position asked for in AXIS_MOVE **/
+} EmuAxis;
+
+typedef struct EmuEventStruct{
+	double t;
+	char text[EMU_CMD_LEN];
+} EmuEvent;
+
+typedef struct EmuQueueStruct{
+	EmuEvent e[EMU_QUEUE_SIZE];
+	int head;
+	int count;
+} EmuQueue;
+
+typedef struct EmuStatsStruct{
+	long spin, halt, where, movei, here, center, unknown;
+	long replies;
+	long dropped; /** commands that arrived while the queue was full **/
+	int maxUnread;
+	double maxLag; /** longest a reply waited for the line (s) **/
+} EmuStats;
+
+static volatile sig_atomic_t Quit=0;
+
+static void OnSignal(int sig){
+	(void) sig;
+	Quit=1;
+}
+
+static double Now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+static int Push(EmuQueue* q, double t, const char* text){
+	if (q->count==EMU_QUEUE_SIZE) return -1;
+	EmuEvent* e=&(q->e[(q->head+q->count) % EMU_QUEUE_SIZE]);
+	e->t=t;
+	snprintf(e->text,EMU_CMD_LEN,"%s",text);
+	q->count++;
+	return 0;
+}
+
+static EmuEvent* Peek(EmuQueue* q){
+	return (q->count>0) ? &(q->e[q->head]) : NULL;
+}
+
+static void Pop(EmuQueue* q){
+	q->head=(q->head+1) % EMU_QUEUE_SIZE;
+	q->count--;
+}
+
+
+/*
+ * Move one axis along for dt seconds.
+ */
+static void AdvanceAxis(EmuAxis* a, double dt, const EmuOptions* o){
+	double want;
+	if (a->mode==AXIS_MOVE){
+		/** Fastest speed from which we can still stop on the target **/
+		double d=a->target - a->pos;
+		want=copysign(fmin(o->maxSpeed,sqrt(2*o->accel*fabs(d))),d);
+	} else {
+		want=a->spin;
+	}
+
+	double dv=want - a->vel;
+	double maxdv=o->accel*dt;
+	if (dv>maxdv) dv=maxdv;
+	if (dv<-maxdv) dv=-maxdv;
+	a->vel+=dv;
+	a->pos+=a->vel*dt;
+
+	if (a->mode==AXIS_MOVE && fabs(a->target - a->pos)<0.5 && fabs(a->vel)<=maxdv){
+		a->pos=a->target;
+		a->vel=0;
+		a->mode=AXIS_SPIN;
+		a->spin=0;
+	}
+}
+
+static void Advance(EmuAxis* ax, double* tNow, double until, const EmuOptions* o){
+	while (*tNow < until){
+		double dt=fmin(EMU_TICK,until - *tNow);
+		AdvanceAxis(&ax[0],dt,o);
+		AdvanceAxis(&ax[1],dt,o);
+		*tNow+=dt;
+	}
+}
+
+
+/*
+ * Find X=<n> and Y=<n> in the arguments of a command.
+ * Returns a bit mask of the axes found: 1 for X, 2 for Y.
+ */
+static int ParseAxes(const char* args, long* v){
+	int found=0;
+	for (const char* p=args; *p; p++){
+		int axis=(*p=='X') ? 0 : (*p=='Y') ? 1 : -1;
+		if (axis<0 || p[1]!='=') continue;
+		char* end;
+		long n=strtol(p+2,&end,10);
+		if (end==p+2) continue;
+		v[axis]=n;
+		found|=1<<axis;
+		p=end-1;
+	}
+	return found;
+}
+
+static int StartsWith(const char* s, const char* word){
+	int n=strlen(word);
+	return strncmp(s,word,n)==0 && (s[n]=='\0' || s[n]==' ');
+}
+
+
+/*
+ * Act on one command and write its reply into reply.
+ */
+static void ApplyCommand(const char* cmd, EmuAxis* ax, const EmuOptions* o, EmuStats* st, char* reply){
+	long v[2]={0,0};
+	int found;
+	strcpy(reply,":A\n");
+
+	if (StartsWith(cmd,"SPIN")){
+		st->spin++;
+		found=ParseAxes(cmd+4,v);
+		for (int k = 0; k < 2; ++k) {
+			if (!(found & (1<<k))) continue;
+			ax[k].mode=AXIS_SPIN;
+			ax[k].spin=fmax(-o->maxSpeed,fmin(o->maxSpeed,v[k]*o->spinScale));
+		}
+	} else if (StartsWith(cmd,"HALT")){
+		st->halt++;
+		for (int k = 0; k < 2; ++k) {
+			ax[k].mode=AXIS_SPIN;
+			ax[k].spin=0;
+		}
+	} else if (StartsWith(cmd,"WHERE")){
+		st->where++;
+		/** Report the axes asked for, in the order asked; both if none are named **/
+		char* r=reply+2;
+		int any=0;
+		for (const char* p=cmd+5; *p; p++){
+			if (*p!='X' && *p!='Y') continue;
+			r+=sprintf(r," %ld",lround(ax[*p=='Y'].pos));
+			any=1;
+		}
+		if (!any) r+=sprintf(r," %ld %ld",lround(ax[0].pos),lround(ax[1].pos));
+		strcpy(r,"\n");
+	} else if (StartsWith(cmd,"MOVEI")){
+		st->movei++;
+		found=ParseAxes(cmd+5,v);
+		for (int k = 0; k < 2; ++k) {
+			if (!(found & (1<<k))) continue;
+			ax[k].target=((ax[k].mode==AXIS_MOVE) ? ax[k].target : round(ax[k].pos)) + v[k];
+			ax[k].mode=AXIS_MOVE;
+		}
+	} else if (StartsWith(cmd,"HERE")){
+		st->here++;
+		found=ParseAxes(cmd+4,v);
+		for (int k = 0; k < 2; ++k) {
+			if (!(found & (1<<k))) continue;
+			ax[k].target+=v[k]-ax[k].pos;
+			ax[k].pos=v[k];
+		}
+	} else if (StartsWith(cmd,"CENTER")){
+		st->center++;
+		found=ParseAxes(cmd+6,v);
+		for (int k = 0; k < 2; ++k) {
+			ax[k].target=(found & (1<<k)) ? v[k] : 0;
+			ax[k].mode=AXIS_MOVE;
+		}
+	} else {
+		st->unknown++;
+		strcpy(reply,":N -1\n");
+	}
+}
+
+
+static void PrintUsage(){
+	printf("Usage: ludlemu [options]\n");
+	printf("\t-b baud\t\tbaud rate of the modelled line (115200)\n");
+	printf("\t-l ms\t\tlatency from the end of a command to its effect (2)\n");
+	printf("\t-a accel\tacceleration limit in stage units/s^2 (200000)\n");
+	printf("\t-m speed\tspeed limit in stage units/s (100000)\n");
+	printf("\t-s scale\tstage units/s per SPIN unit (1)\n");
+	printf("\t-x bytes\tlock up once this many reply bytes are unread (0, never)\n");
+	printf("\t-k path\t\tmake a symbolic link to the device here\n");
+	printf("\t-v\t\tprint every command\n");
+}
+
+static void PrintStats(const EmuStats* st, const EmuAxis* ax){
+	printf("\nCommands: %ld SPIN, %ld HALT, %ld WHERE, %ld MOVEI, %ld HERE, %ld CENTER, %ld unknown\n",
+			st->spin,st->halt,st->where,st->movei,st->here,st->center,st->unknown);
+	printf("Replies: %ld. Dropped commands: %ld. Most unread reply bytes: %d. Longest wait for the line: %.2f ms\n",
+			st->replies,st->dropped,st->maxUnread,1000*st->maxLag);
+	printf("Final position: %ld %ld\n",lround(ax[0].pos),lround(ax[1].pos));
+}
+
+
+int main(int argc, char** argv){
+	EmuOptions o;
+	o.baud=115200;
+	o.latency=0.002;
+	o.accel=200000;
+	o.maxSpeed=100000;
+	o.spinScale=1;
+	o.lockupBytes=0;
+	o.link=NULL;
+	o.verbose=0;
+
+	int c;
+	while ((c=getopt(argc,argv,"b:l:a:m:s:x:k:vh"))!=-1){
+		switch (c){
+		case 'b': o.baud=atoi(optarg); break;
+		case 'l': o.latency=atof(optarg)/1000; break;
+		case 'a': o.accel=atof(optarg); break;
+		case 'm': o.maxSpeed=atof(optarg); break;
+		case 's': o.spinScale=atof(optarg); break;
+		case 'x': o.lockupBytes=atoi(optarg); break;
+		case 'k': o.link=optarg; break;
+		case 'v': o.verbose=1; break;
+		default: PrintUsage(); return (c=='h') ? 0 : 1;
+		}
+	}
+	if (o.baud<=0 || o.accel<=0 || o.maxSpeed<=0){
+		printf("Error! Baud rate, acceleration and speed must be positive.\n");
+		return 1;
+	}
+	double byteTime=(double) EMU_BITS_PER_BYTE/o.baud;
+
+	/** Open the pseudo-terminal **/
+	int master=posix_openpt(O_RDWR | O_NOCTTY);
+	if (master<0 || grantpt(master)!=0 || unlockpt(master)!=0){
+		perror("Error! Unable to open a pseudo-terminal");
+		return 1;
+	}
+	const char* slaveName=ptsname(master);
+
+	/** Keep the slave open ourselves: no hang ups between clients, and we can see what is unread **/
+	int slave=open(slaveName,O_RDWR | O_NOCTTY);
+	if (slave<0){
+		perror("Error! Unable to open the slave side of the pseudo-terminal");
+		return 1;
+	}
+	struct termios tio;
+	tcgetattr(slave,&tio);
+	cfmakeraw(&tio);
+	tcsetattr(slave,TCSANOW,&tio);
+
+	if (o.link!=NULL){
+		unlink(o.link);
+		if (symlink(slaveName,o.link)!=0) perror("Error! Unable to make the link");
+	}
+	printf("LUDL MAC6000 emulator on %s%s%s\n",slaveName,o.link ? " -> " : "",o.link ? o.link : "");
+	printf("%d baud, %.1f ms latency, %.0f units/s^2, %.0f units/s, %g units/s per SPIN unit\n",
+			o.baud,1000*o.latency,o.accel,o.maxSpeed,o.spinScale);
+	fflush(stdout);
+
+	signal(SIGINT,OnSignal);
+	signal(SIGTERM,OnSignal);
+
+	static EmuQueue commands;
+	static EmuQueue replies;
+	EmuAxis ax[2];
+	EmuStats st;
+	memset(ax,0,sizeof(ax));
+	memset(&st,0,sizeof(st));
+
+	char line[EMU_CMD_LEN];
+	int lineLen=0;
+	double inFreeAt=0; /** when the line to the controller is free again **/
+	double outFreeAt=0; /** when the line back is free again **/
+	double tSim=Now();
+	int locked=0;
+
+	while (!Quit){
+		/** Sleep until input arrives or the next thing is due **/
+		double now=Now();
+		double next=now+EMU_TICK;
+		if (Peek(&commands)) next=fmin(next,Peek(&commands)->t);
+		if (Peek(&replies)) next=fmin(next,Peek(&replies)->t);
+		struct pollfd pfd={master,POLLIN,0};
+		int wait=(int) ceil(1000*(next-now));
+		poll(&pfd,1,wait>0 ? wait : 0);
+
+		/** Read what the client wrote **/
+		if (pfd.revents & POLLIN){
+			char buf[256];
+			int n=read(master,buf,sizeof(buf));
+			now=Now();
+			for (int k = 0; k < n; ++k) {
+				if (buf[k]=='\r' || buf[k]=='\n'){
+					if (lineLen==0) continue;
+					line[lineLen]='\0';
+					/** The command was on the line for as long as its bytes took **/
+					inFreeAt=fmax(now,inFreeAt)+(lineLen+1)*byteTime;
+					if (!locked && Push(&commands,inFreeAt+o.latency,line)!=0) st.dropped++;
+					lineLen=0;
+				} else if (lineLen<EMU_CMD_LEN-1){
+					line[lineLen++]=toupper((unsigned char) buf[k]);
+				}
+			}
+		}
+
+		/** Carry out commands that are due, at the moment they are due **/
+		now=Now();
+		EmuEvent* e;
+		while ((e=Peek(&commands))!=NULL && e->t<=now){
+			char reply[EMU_REPLY_LEN];
+			Advance(ax,&tSim,e->t,&o);
+			ApplyCommand(e->text,ax,&o,&st,reply);
+			if (o.verbose) printf("%.3f %-24s %s",e->t,e->text,reply);
+			double start=fmax(e->t,outFreeAt);
+			st.maxLag=fmax(st.maxLag,start - e->t);
+			outFreeAt=start+strlen(reply)*byteTime;
+			if (Push(&replies,outFreeAt,reply)!=0) st.dropped++;
+			Pop(&commands);
+		}
+		Advance(ax,&tSim,now,&o);
+
+		/** Send replies once they have made it across the line **/
+		while ((e=Peek(&replies))!=NULL && e->t<=now){
+			if (!locked && write(master,e->text,strlen(e->text))>0) st.replies++;
+			Pop(&replies);
+		}
+
+		/** How much has the client left unread? **/
+		int unread=0;
+		ioctl(slave,FIONREAD,&unread);
+		if (unread>st.maxUnread) st.maxUnread=unread;
+		if (o.lockupBytes>0 && !locked && unread>o.lockupBytes){
+			printf("%d reply bytes unread. Locking up like the real controller.\n",unread);
+			fflush(stdout);
+			locked=1;
+		}
+	}
+
+	PrintStats(&st,ax);
+	if (o.link!=NULL) unlink(o.link);
+	close(slave);
+	close(master);
+	return 0;
+}
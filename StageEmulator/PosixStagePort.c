@@ -0,0 +1,102 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * PosixStagePort.c
+ *
+ * See PosixStagePort.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "PosixStagePort.h"
+
+void* PSP_Open(const char* path){
+	int fd=open(path,O_RDWR | O_NOCTTY);
+	if (fd<0){
+		perror("Error! Unable to open the stage port");
+		return NULL;
+	}
+	struct termios tio;
+	if (tcgetattr(fd,&tio)!=0){
+		perror("Error! Unable to get the stage port settings");
+		close(fd);
+		return NULL;
+	}
+	cfmakeraw(&tio);
+	cfsetispeed(&tio,B115200);
+	cfsetospeed(&tio,B115200);
+	tio.c_cflag|=CSTOPB | CLOCAL | CREAD;
+	if (tcsetattr(fd,TCSANOW,&tio)!=0){
+		perror("Error! Unable to set the stage port settings");
+		close(fd);
+		return NULL;
+	}
+	/** Handles start at 1 so that a valid one is never NULL **/
+	return (void*) (intptr_t) (fd+1);
+}
+
+void PSP_Close(void* handle){
+	if (handle!=NULL) close((int) (intptr_t) handle - 1);
+}
+
+int PSP_Write(void* handle, const char* buf, int len){
+	int fd=(int) (intptr_t) handle - 1;
+	int sent=0;
+	while (sent<len){
+		int n=write(fd,buf+sent,len-sent);
+		if (n<0){
+			if (errno==EINTR) continue;
+			return -1;
+		}
+		sent+=n;
+	}
+	return sent;
+}
+
+int PSP_Read(void* handle, char* buf, int len, int timeoutMs){
+	int fd=(int) (intptr_t) handle - 1;
+	struct pollfd pfd={fd,POLLIN,0};
+	int r=poll(&pfd,1,timeoutMs);
+	if (r<0) return (errno==EINTR) ? 0 : -1;
+	if (r==0) return 0;
+	int n=read(fd,buf,len);
+	if (n<0) return (errno==EAGAIN || errno==EINTR) ? 0 : -1;
+	return n;
+}
@@ -0,0 +1,65 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * PosixStagePort.h
+ *
+ * The stage's serial line on Linux: a tty (a USB serial adapter, or the
+ * pseudo-terminal of ludlemu) in raw mode.
+ *
+ * PSP_Write() and PSP_Read() have the signatures of the Write and Read
+ * members of a StagePort (see MyLibs/StageIO.h), with the handle from
+ * PSP_Open().
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef POSIXSTAGEPORT_H_
+#define POSIXSTAGEPORT_H_
+
+/*
+ * Open the tty at path at 115200 baud, 8 data bits, no parity, 2 stop bits.
+ * Returns a handle, or NULL on error.
+ */
+void* PSP_Open(const char* path);
+
+void PSP_Close(void* handle);
+
+/*
+ * Write len bytes. Returns the number of bytes written or -1.
+ */
+int PSP_Write(void* handle, const char* buf, int len);
+
+/*
+ * Wait at most timeoutMs for at least one byte and read what is there.
+ * Returns the number of bytes read, 0 if there were none, or -1.
+ */
+int PSP_Read(void* handle, char* buf, int len, int timeoutMs);
+
+#endif /* POSIXSTAGEPORT_H_ */
@@ -0,0 +1,49 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * posix/mmsystem.h
+ *
+ * Timer resolution requests are a no-op on Linux. See posix/windows.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef POSIX_MMSYSTEM_H_
+#define POSIX_MMSYSTEM_H_
+
+static inline unsigned int timeBeginPeriod(unsigned int ms){
+	return 0;
+}
+
+static inline unsigned int timeEndPeriod(unsigned int ms){
+	return 0;
+}
+
+#endif /* POSIX_MMSYSTEM_H_ */
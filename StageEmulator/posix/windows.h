@@ -0,0 +1,179 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * posix/windows.h
+ *
+ * Just enough of the Win32 API, on top of pthreads, to build the stage I/O
+ * thread and the stage feedback loop (MyLibs/StageIO.c, StageControl.c and
+ * LatencyTrace.c) on Linux, so that they can be run against ludlemu.
+ *
+ * Only what those files use is here. A HANDLE is always a thread, and
+ * WaitForSingleObject() only joins it.
+ *
+ * Not used on the rig, which builds against the real windows.h.
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef POSIX_WINDOWS_H_
+#define POSIX_WINDOWS_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+
+#define WINAPI
+#define INFINITE 0xFFFFFFFF
+#define WAIT_OBJECT_0 0
+#define WAIT_FAILED 0xFFFFFFFF
+
+#define THREAD_PRIORITY_ABOVE_NORMAL 1
+#define THREAD_PRIORITY_HIGHEST 2
+#define THREAD_PRIORITY_TIME_CRITICAL 15
+
+typedef long LONG;
+typedef unsigned long DWORD;
+typedef void* LPVOID;
+typedef void* HANDLE;
+typedef DWORD (WINAPI *LPTHREAD_START_ROUTINE)(LPVOID);
+
+typedef struct {
+	long long QuadPart;
+} LARGE_INTEGER;
+
+
+/** Timers: the monotonic clock in ns **/
+static inline int QueryPerformanceFrequency(LARGE_INTEGER* freq){
+	freq->QuadPart=1000000000LL;
+	return 1;
+}
+
+static inline int QueryPerformanceCounter(LARGE_INTEGER* count){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	count->QuadPart=ts.tv_sec*1000000000LL + ts.tv_nsec;
+	return 1;
+}
+
+static inline void Sleep(DWORD ms){
+	usleep(ms*1000);
+}
+
+
+/** Critical sections are recursive, like on Windows **/
+typedef pthread_mutex_t CRITICAL_SECTION;
+
+static inline void InitializeCriticalSection(CRITICAL_SECTION* cs){
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr,PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(cs,&attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static inline void DeleteCriticalSection(CRITICAL_SECTION* cs){
+	pthread_mutex_destroy(cs);
+}
+
+static inline void EnterCriticalSection(CRITICAL_SECTION* cs){
+	pthread_mutex_lock(cs);
+}
+
+static inline void LeaveCriticalSection(CRITICAL_SECTION* cs){
+	pthread_mutex_unlock(cs);
+}
+
+
+/** Atomics **/
+static inline LONG InterlockedExchange(volatile LONG* target, LONG value){
+	LONG old=__sync_lock_test_and_set(target,value);
+	__sync_synchronize();
+	return old;
+}
+
+static inline LONG InterlockedIncrement(volatile LONG* target){
+	return __sync_add_and_fetch(target,1);
+}
+
+static inline LONG InterlockedCompareExchange(volatile LONG* target, LONG exchange, LONG comparand){
+	return __sync_val_compare_and_swap(target,comparand,exchange);
+}
+
+#define MemoryBarrier() __sync_synchronize()
+
+
+/** Threads **/
+typedef struct PosixThreadStruct{
+	pthread_t thread;
+	LPTHREAD_START_ROUTINE start;
+	LPVOID param;
+} PosixThread;
+
+static void* PosixThreadStart(void* arg){
+	PosixThread* t=(PosixThread*) arg;
+	t->start(t->param);
+	return NULL;
+}
+
+static inline HANDLE CreateThread(void* attr, size_t stack, LPTHREAD_START_ROUTINE start, LPVOID param, DWORD flags, DWORD* id){
+	PosixThread* t=(PosixThread*) malloc(sizeof(PosixThread));
+	if (t==NULL) return NULL;
+	t->start=start;
+	t->param=param;
+	if (pthread_create(&(t->thread),NULL,PosixThreadStart,t)!=0){
+		free(t);
+		return NULL;
+	}
+	if (id!=NULL) *id=0;
+	return (HANDLE) t;
+}
+
+static inline int SetThreadPriority(HANDLE thread, int priority){
+	return 1;
+}
+
+static inline DWORD WaitForSingleObject(HANDLE thread, DWORD ms){
+	if (thread==NULL || ms!=INFINITE) return WAIT_FAILED;
+	return (pthread_join(((PosixThread*) thread)->thread,NULL)==0) ? WAIT_OBJECT_0 : WAIT_FAILED;
+}
+
+static inline int CloseHandle(HANDLE thread){
+	free(thread);
+	return 1;
+}
+
+#endif /* POSIX_WINDOWS_H_ */
@@ -0,0 +1,286 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * stagebench.c
+ *
+ * Times the conversation with a LUDL MAC6000 (or ludlemu) over a tty.
+ *
+ *   1. One command at a time: SPIN, wait for :A, WHERE, wait for the
+ *      position. This is what the tracking loop did before StageIO, and is
+ *      written out here against the raw port as the baseline.
+ *   2. The stage I/O thread: the port is handed to MyLibs/StageIO.c, exactly
+ *      as MindControl uses it, and new spins are asked for -r times a
+ *      second while it polls the position as fast as it can.
+ *   3. Motion: through the stage I/O thread, spin along X for a while and
+ *      compare the measured speed with the commanded one.
+ *
+ * Usage: stagebench [-n commands] [-r spins/s] [-v spin] [-d ms] device
+ * Returns 0 if the stage answered everything, 1 otherwise.
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "LatencyTrace.h"
+#include "StageIO.h"
+#include "PosixStagePort.h"
+
+#define BENCH_TIMEOUT_MS 500
+#define BENCH_MAX_SAMPLES 100000
+
+/** Spins asked for per second, the feedback loop's default rate **/
+#define BENCH_SPIN_RATE 100
+
+typedef struct BenchStruct{
+	void* port;
+	char buf[512];
+	int have;
+} Bench;
+
+static double NowMs(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec*1000.0 + 1e-6*ts.tv_nsec;
+}
+
+/*
+ * Read one reply line (without the line feed).
+ * Returns 0, or -1 if nothing came back within timeoutMs.
+ */
+static int ReadLine(Bench* b, char* line, int len, int timeoutMs){
+	double giveUp=NowMs()+timeoutMs;
+	while (1){
+		char* nl=memchr(b->buf,'\n',b->have);
+		if (nl!=NULL){
+			int n=nl - b->buf;
+			int copy=(n<len-1) ? n : len-1;
+			memcpy(line,b->buf,copy);
+			line[copy]='\0';
+			if (copy>0 && line[copy-1]=='\r') line[copy-1]='\0';
+			b->have-=n+1;
+			memmove(b->buf,nl+1,b->have);
+			return 0;
+		}
+		int left=(int) (giveUp - NowMs());
+		if (left<=0 || b->have==(int) sizeof(b->buf)) return -1;
+		int r=PSP_Read(b->port,b->buf+b->have,sizeof(b->buf)-b->have,left);
+		if (r<0) return -1;
+		b->have+=r;
+	}
+}
+
+static int Send(Bench* b, const char* cmd){
+	return (PSP_Write(b->port,cmd,strlen(cmd))==(int) strlen(cmd)) ? 0 : -1;
+}
+
+static int CompareDouble(const void* a, const void* b){
+	double d=*(const double*) a - *(const double*) b;
+	return (d>0) - (d<0);
+}
+
+static void PrintTimes(const char* what, double* t, int n){
+	if (n==0){
+		printf("%s: nothing measured\n",what);
+		return;
+	}
+	qsort(t,n,sizeof(double),CompareDouble);
+	printf("%s: median %.2f ms, 99%% %.2f ms, max %.2f ms (%d samples)\n",
+			what,t[n/2],t[(int) (0.99*(n-1))],t[n-1],n);
+}
+
+
+/*
+ * SPIN then WHERE, waiting for each reply before sending anything else.
+ */
+static int OneAtATime(Bench* b, int n){
+	double* cycle=(double*) malloc(n*sizeof(double));
+	char line[128];
+	int errors=0;
+	double start=NowMs();
+	for (int k = 0; k < n; ++k) {
+		double t0=NowMs();
+		char cmd[64];
+		sprintf(cmd,"SPIN X=%d Y=0\r",(k % 2) ? 100 : -100);
+		if (Send(b,cmd)!=0 || ReadLine(b,line,sizeof(line),BENCH_TIMEOUT_MS)!=0) errors++;
+		if (Send(b,"WHERE X Y\r")!=0 || ReadLine(b,line,sizeof(line),BENCH_TIMEOUT_MS)!=0) errors++;
+		cycle[k]=NowMs()-t0;
+	}
+	double total=NowMs()-start;
+	Send(b,"HALT\r");
+	ReadLine(b,line,sizeof(line),BENCH_TIMEOUT_MS);
+
+	printf("\nOne command at a time: %d SPIN+WHERE pairs in %.0f ms (%.0f positions/s), %d unanswered\n",
+			n,total,1000*n/total,errors);
+	PrintTimes("  SPIN+WHERE",cycle,n);
+	free(cycle);
+	return errors;
+}
+
+/*
+ * Let the stage I/O thread run for durationMs, asking for a new spin rate
+ * times a second like the feedback loop does, and time every position it
+ * reads.
+ * Times from here on are on the LT_Now() clock, like the thread's.
+ */
+static int ThroughStageIO(StageIO* io, int rate, int durationMs){
+	double* rtt=(double*) malloc(BENCH_MAX_SAMPLES*sizeof(double));
+	int numRtt=0;
+	StagePosition pos;
+	double lastT=-1;
+
+	int sent0=io->NumSent;
+	int positions0=io->NumPositions;
+	int unanswered0=io->NumTimeouts + io->NumLost;
+	StageIO_SetPollInterval(io,1);
+
+	double start=LT_Now();
+	double nextSpin=start;
+	int k=0;
+	while (LT_Now() - start < durationMs){
+		if (LT_Now() >= nextSpin){
+			StageIO_SpinAxes(io,(k++ % 2) ? 100 : -100,0);
+			nextSpin+=1000.0/rate;
+		}
+		if (StageIO_GetPosition(io,&pos)==STAGEIO_OK && pos.t!=lastT){
+			lastT=pos.t;
+			if (numRtt<BENCH_MAX_SAMPLES) rtt[numRtt++]=pos.rtt;
+		}
+		usleep(1000);
+	}
+	double total=LT_Now()-start;
+	StageIO_Halt(io);
+
+	int positions=io->NumPositions - positions0;
+	int unanswered=io->NumTimeouts + io->NumLost - unanswered0;
+	printf("\nStage I/O thread, up to %d in flight, %d spins/s: %d commands and %d positions in %.0f ms (%.0f positions/s), %d unanswered\n",
+			STAGEIO_MAX_INFLIGHT,rate,io->NumSent - sent0,positions,total,1000*positions/total,unanswered);
+	PrintTimes("  WHERE round trip",rtt,numRtt);
+	free(rtt);
+	return unanswered;
+}
+
+/*
+ * Spin along X through the stage I/O thread and measure how fast the
+ * position changes.
+ */
+static int Motion(StageIO* io, int spin, int durationMs){
+	StagePosition pos;
+	long x0=0, y0=0;
+	double t0=0;
+	int errors=0;
+
+	StageIO_SetHere(io,0,0);
+	StageIO_SpinAxes(io,spin,0);
+
+	double start=LT_Now();
+	while (LT_Now() - start < durationMs){
+		usleep(10000);
+		if (StageIO_GetPosition(io,&pos)!=STAGEIO_OK){
+			errors++;
+			continue;
+		}
+		/** Measure over the second half, after the stage is up to speed **/
+		if (t0==0 && pos.t - start >= durationMs/2){
+			t0=pos.t;
+			x0=pos.x;
+			y0=pos.y;
+		}
+	}
+	StageIO_Halt(io);
+
+	printf("\nMotion: SPIN X=%d for %d ms\n",spin,durationMs);
+	if (t0>0 && pos.t>t0){
+		printf("  measured %.0f units/s along X, %.0f along Y\n",
+				1000*(pos.x-x0)/(pos.t-t0),1000*(pos.y-y0)/(pos.t-t0));
+	}
+	return errors;
+}
+
+
+int main(int argc, char** argv){
+	int n=1000;
+	int spin=5000;
+	int durationMs=2000;
+	int rate=BENCH_SPIN_RATE;
+
+	int c;
+	while ((c=getopt(argc,argv,"n:r:v:d:h"))!=-1){
+		switch (c){
+		case 'n': n=atoi(optarg); break;
+		case 'r': rate=atoi(optarg); break;
+		case 'v': spin=atoi(optarg); break;
+		case 'd': durationMs=atoi(optarg); break;
+		default:
+			printf("Usage: stagebench [-n commands] [-r spins/s] [-v spin] [-d ms] device\n");
+			return (c=='h') ? 0 : 1;
+		}
+	}
+	if (optind>=argc || n<=0 || rate<=0 || durationMs<=0){
+		printf("Usage: stagebench [-n commands] [-r spins/s] [-v spin] [-d ms] device\n");
+		return 1;
+	}
+
+	Bench b;
+	b.have=0;
+	b.port=PSP_Open(argv[optind]);
+	if (b.port==NULL) return 1;
+
+	/** Throw away anything left over from before **/
+	char junk[256];
+	while (PSP_Read(b.port,junk,sizeof(junk),20)>0);
+
+	int errors=0;
+	errors+=OneAtATime(&b,n);
+
+	/** From here on the stage I/O thread has the port to itself **/
+	StagePort port;
+	port.handle=b.port;
+	port.Write=PSP_Write;
+	port.Read=PSP_Read;
+	StageIO* io=StartStageIO(port);
+	if (io==NULL){
+		PSP_Close(b.port);
+		return 1;
+	}
+	errors+=ThroughStageIO(io,rate,durationMs);
+	errors+=Motion(io,spin,durationMs);
+	StageIO_PrintReport(io,stdout);
+	StopStageIO(&io);
+
+	PSP_Close(b.port);
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,242 @@
+
+/*
+ * Copyright 2010 Andrew Leifer et al <leifer@fas.harvard.edu>
+ * This file is part of MindControl.
+ *
+ * MindControl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU  General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MindControl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MindControl. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For the most up to date version of this software, see:
+ * http://github.com/samuellab/mindcontrol
+ *
+ *
+ *
+ * NOTE: If you use any portion of this code in your research, kindly cite:
+ * Leifer, A.M., Fang-Yen, C., Gershow, M., Alkema, M., and Samuel A. D.T.,
+ * 	"Optogenetic manipulation of neural activity with high spatial resolution in
+ *	freely moving Caenorhabditis elegans," Nature Methods, Submitted (2010).
+ */
+
+/*
+ * stageloop.c
+ *
+ * Closes the stage feedback loop (MyLibs/StageControl.c) around a stage on a
+ * tty, normally ludlemu, with a simulated camera, and reports how far the
+ * worm strays from the target with each control law.
+ *
+ * The worm crawls across the ground at about -s pixels/s (a straight line
+ * plus a sideways wiggle). Every frame (-f per second) the camera sees it
+ * where the worm is minus where the stage has carried the field of view,
+ * through the default calibration. The frame reaches the feedback loop -l ms
+ * after it was captured, like the real analysis latency.
+ *
+ * Where the stage was at capture comes from the stage I/O thread's latest
+ * position, carried forward with the velocity between its last two. At the
+ * speeds involved that is within a fraction of a pixel.
+ *
+ * The error is measured in the image at capture, after the first third of
+ * the run, so that the loop has caught the worm.
+ *
+ * Usage: stageloop [-a alg] [-s speed] [-f fps] [-l ms] [-r rate] [-d ms] device
+ * -a 0 (the default) runs both laws, one after the other.
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "LatencyTrace.h"
+#include "StageIO.h"
+#include "StageControl.h"
+#include "PosixStagePort.h"
+
+/** Where the worm should be kept, and the sliders' defaults **/
+#define LOOP_TARGET_X 512
+#define LOOP_TARGET_Y 384
+#define LOOP_GAIN 25
+#define LOOP_ACTIVE_ZONE 250
+#define LOOP_KP 4.0
+#define LOOP_KI 2.0
+#define LOOP_KFF 1.0
+
+typedef struct LoopOptionsStruct{
+	double speed; /** worm speed, pixels/s **/
+	double fps;
+	double latency; /** ms from capture to the feedback loop **/
+	int rate; /** of the feedback loop, Hz **/
+	double duration; /** ms **/
+} LoopOptions;
+
+/** Last two positions from the stage I/O thread **/
+typedef struct StageTrackStruct{
+	StagePosition last;
+	StagePosition prev;
+} StageTrack;
+
+/*
+ * Where the stage is at time t, carried forward from its latest positions.
+ * Returns -1 if no position has been read yet.
+ */
+static int StageAt(StageIO* io, StageTrack* tr, double t, double* x, double* y){
+	StagePosition pos;
+	if (StageIO_GetPosition(io,&pos)!=STAGEIO_OK) return -1;
+	if (pos.t!=tr->last.t){
+		tr->prev=tr->last;
+		tr->last=pos;
+	}
+	*x=tr->last.x;
+	*y=tr->last.y;
+	double dt=tr->last.t - tr->prev.t;
+	if (tr->prev.valid && dt>0){
+		*x+=(tr->last.x - tr->prev.x)*(t - tr->last.t)/dt;
+		*y+=(tr->last.y - tr->prev.y)*(t - tr->last.t)/dt;
+	}
+	return 0;
+}
+
+/*
+ * Where the worm is on the ground at time s (seconds), in pixels.
+ */
+static void WormAt(double s, double speed, double* x, double* y){
+	*x=0.8*speed*s + 0.6*speed*sin(2*s);
+	*y=-0.5*speed*s;
+}
+
+/*
+ * Track the worm with control law alg for o->duration ms.
+ * Prints and returns the RMS error in pixels, or -1 on error.
+ */
+static double RunLoop(StageIO* io, int alg, const LoopOptions* o){
+	StageControl* sc=StartStageControl(io,o->rate);
+	if (sc==NULL) return -1;
+	StageCalibration calib;
+	SC_DefaultCalibration(&calib);
+
+	StageTrack tr;
+	memset(&tr,0,sizeof(tr));
+	double sx0, sy0;
+	double start=LT_Now();
+	while (StageAt(io,&tr,start,&sx0,&sy0)!=0){
+		if (LT_Now() - start > 1000){
+			printf("Error! The stage never reported its position.\n");
+			StopStageControl(&sc);
+			return -1;
+		}
+		usleep(1000);
+	}
+
+	StageCtlSettings s;
+	s.on=1;
+	s.algID=alg;
+	s.targetX=LOOP_TARGET_X;
+	s.targetY=LOOP_TARGET_Y;
+	s.gain=LOOP_GAIN;
+	s.activeZone=LOOP_ACTIVE_ZONE;
+	s.kp=LOOP_KP;
+	s.ki=LOOP_KI;
+	s.kff=LOOP_KFF;
+	SC_SetSettings(sc,&s);
+
+	double period=1000/o->fps;
+	double sumSq=0, maxErr=0;
+	int n=0;
+	start=LT_Now();
+	for (int frame = 0; frame*period < o->duration; ++frame) {
+		/** Capture **/
+		double t=start + frame*period;
+		while (LT_Now() < t) usleep(200);
+		double sx, sy, wx, wy;
+		StageAt(io,&tr,t,&sx,&sy);
+		WormAt((t-start)/1000,o->speed,&wx,&wy);
+		double ix=LOOP_TARGET_X + wx + calib.A[0][0]*(sx-sx0) + calib.A[0][1]*(sy-sy0);
+		double iy=LOOP_TARGET_Y + wy + calib.A[1][0]*(sx-sx0) + calib.A[1][1]*(sy-sy0);
+
+		double err=hypot(ix-LOOP_TARGET_X,iy-LOOP_TARGET_Y);
+		if (frame*period > o->duration/3){
+			sumSq+=err*err;
+			if (err>maxErr) maxErr=err;
+			n++;
+		}
+
+		/** ...and the analysis hands it over a little later **/
+		while (LT_Now() < t + o->latency) usleep(200);
+		SC_SetMeasurement(sc,ix,iy,t,frame,1,NULL);
+	}
+
+	s.on=0;
+	SC_SetSettings(sc,&s);
+	usleep(50000);
+	StopStageControl(&sc);
+
+	double rms= (n>0) ? sqrt(sumSq/n) : 0;
+	printf("\nAlgorithm %d: RMS error %.1f px, max %.1f px over %d frames\n",alg,rms,maxErr,n);
+	return rms;
+}
+
+
+int main(int argc, char** argv){
+	int alg=0;
+	LoopOptions o;
+	o.speed=50;
+	o.fps=30;
+	o.latency=30;
+	o.rate=SC_DEFAULT_RATE;
+	o.duration=10000;
+
+	int c;
+	while ((c=getopt(argc,argv,"a:s:f:l:r:d:h"))!=-1){
+		switch (c){
+		case 'a': alg=atoi(optarg); break;
+		case 's': o.speed=atof(optarg); break;
+		case 'f': o.fps=atof(optarg); break;
+		case 'l': o.latency=atof(optarg); break;
+		case 'r': o.rate=atoi(optarg); break;
+		case 'd': o.duration=atof(optarg); break;
+		default:
+			printf("Usage: stageloop [-a alg] [-s speed] [-f fps] [-l ms] [-r rate] [-d ms] device\n");
+			return (c=='h') ? 0 : 1;
+		}
+	}
+	if (optind>=argc || alg<0 || alg>SC_ALG_PI_FF || o.fps<=0 || o.latency<0 || o.rate<=0 || o.duration<=0){
+		printf("Usage: stageloop [-a alg] [-s speed] [-f fps] [-l ms] [-r rate] [-d ms] device\n");
+		return 1;
+	}
+
+	void* handle=PSP_Open(argv[optind]);
+	if (handle==NULL) return 1;
+	StagePort port;
+	port.handle=handle;
+	port.Write=PSP_Write;
+	port.Read=PSP_Read;
+	StageIO* io=StartStageIO(port);
+	if (io==NULL){
+		PSP_Close(handle);
+		return 1;
+	}
+
+	printf("Worm at %.0f px/s, %.0f fps camera, %.0f ms latency, feedback loop at %d Hz\n",o.speed,o.fps,o.latency,o.rate);
+	int errors=0;
+	if (alg==0 || alg==SC_ALG_PROPORTIONAL) errors+= RunLoop(io,SC_ALG_PROPORTIONAL,&o) < 0;
+	if (alg==0 || alg==SC_ALG_PI_FF) errors+= RunLoop(io,SC_ALG_PI_FF,&o) < 0;
+
+	StageIO_PrintReport(io,stdout);
+	StopStageIO(&io);
+	PSP_Close(handle);
+	return errors ? 1 : 0;
+}
@@ -30,10 +30,10 @@
 #Optical Mind Control Annotation system
 #Andrew Leifer
 #leifer@fas.harvard.edu
-import string, sys
+import string, sys, mmap, struct
 
 from optparse import OptionParser
-usage = "usage: %prog [options] recentFrameInfo.txt output.yml\n\nOptical Mind Control annotation engine\nby Andrew Leifer, leifer@fas.harvard.edu"
+usage = "usage: %prog [options] recentExperiment.txt output.yml\n\nOptical Mind Control annotation engine\nby Andrew Leifer, leifer@fas.harvard.edu"
 parser = OptionParser(usage)
 parser.add_option("-u", "--user", action="store", type="string", dest="user", default="default", help="specify a username")
 (options, args)=parser.parse_args()
@@ -45,6 +45,44 @@ if len(args) !=2:
 	sys.exit(2)
 
 
+# The worm state stream that MindControl publishes in shared memory.
+# See MC_API_WormState in API/mc_api_dll.h and the Rings in
+# API/InterProcess/src/interprocess.h for the layout.
+RING_NAME='mcWormState'
+RING_MAGIC=0x49505231
+RING_LINE=64
+WORM_STATE=struct.Struct('<4d16i') # captureTime ... reserved
+WORM_STATE_FRAME=4 # index of frame in the unpacked record
+WORM_STATE_DLP=17 # index of DLPisOn
+
+def readLatestWormState():
+	"""Return the most recent worm state record as a tuple, or None."""
+	try:
+		hd=mmap.mmap(-1,RING_LINE,tagname=RING_NAME,access=mmap.ACCESS_READ)
+	except Exception:
+		return None
+	magic,recordSize,numRecords,slotSize,head=struct.unpack_from('<5i',hd,0)
+	hd.close()
+	if magic!=RING_MAGIC or recordSize!=WORM_STATE.size or head<1:
+		return None
+	ring=mmap.mmap(-1,RING_LINE+numRecords*slotSize,tagname=RING_NAME,access=mmap.ACCESS_READ)
+	state=None
+	for attempt in range(100):
+		head=struct.unpack_from('<i',ring,16)[0]
+		index=head-1
+		slot=RING_LINE+(index % numRecords)*slotSize
+		want=2*index+2
+		if struct.unpack_from('<i',ring,slot)[0]!=want:
+			continue
+		record=WORM_STATE.unpack_from(ring,slot+RING_LINE)
+		# Keep it only if MindControl did not write over it meanwhile
+		if struct.unpack_from('<i',ring,slot)[0]==want:
+			state=record
+			break
+	ring.close()
+	return state
+
+
 #Main 
 print('Welcome to the Optical Mind Control annotation system.')
 
@@ -68,7 +106,7 @@ while (s!='q'): #While the user doesn't quit
 	newExperiment=False
 	
 
-	#Open the the recent frame file
+	#Open the the recent experiment file
 	try:
 		r=open(recentframefile,'r')
 	except:
@@ -76,18 +114,26 @@ while (s!='q'): #While the user doesn't quit
 		continue
 
 
-	frameInfo=r.readlines()
+	expInfo=r.readlines()
 	r.close()
 	
-	# We expect there to be exactly four lines.
-	# The first line is the frame number
-	# The second line is the filename
-	# And the third line is the GIT SHA1 version hash
-	# And the fourth is an integer value 0 or 1 specifiying whether the DLP is on or not
-	if len(frameInfo) != 4: 
+	# We expect there to be exactly two lines.
+	# The first line is the filename
+	# And the second line is the GIT SHA1 version hash
+	if len(expInfo) != 2: 
 		print('\tError! ' +recentframefile + ' does not have expected format!\n')
 		continue
 
+	# The frame number and DLP state come from MindControl's shared memory
+	state=readLatestWormState()
+	if state is None:
+		print('\tError! MindControl does not appear to be running.\n')
+		continue
+
+	# Same layout as the old recentFrameNum.txt:
+	# frame number, filename, GIT SHA1 version hash, DLP on or not
+	frameInfo=[str(state[WORM_STATE_FRAME]),expInfo[0],expInfo[1],str(state[WORM_STATE_DLP])]
+
 	if ( (prevFrame!=frameInfo[0].strip()) ):
 		newFrame=True
 	else:
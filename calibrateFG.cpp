@@ -33,10 +33,24 @@
  *
  *  This routine works by flipping the mirrors so as to scan a point
  *  across the camera. The software records the location of the mirror
- *  and the corresponding light on the camera and then opens MATLAB
- *  to generate a lookup table to transform between camera space and
- *  mirror space based on the measured points. The calibration is stored in
- *  calib.dat
+ *  and the corresponding light on the camera and then fits a compact
+ *  calibration model (a homography plus a grid of residuals, see TransformLib.h)
+ *  to transform between camera space and mirror space based on the measured points.
+ *  The calibration is stored in calib.dat
+ *
+ *  The raw pairs of points are also written to calibPoints.yaml so that
+ *  MATLAB/makeLUTfromCalibData.m can still be used to make a legacy lookup table.
+ *
+ *  With -g the point scan is replaced by a Gray code structured light scan
+ *  (see GrayCode.h) that takes about forty frames and gives every camera pixel a
+ *  mirror coordinate. The dense correspondences are written to calibDense.dat
+ *  (in the legacy lookup table format) along with a confidence mask in
+ *  calibConfidence.png, and the model in calib.dat is fit to them.
+ *
+ *  With -s the Gray code scan is run against a simulated projector and camera
+ *  instead of the hardware, and the result is compared to the known warp.
+ *
+ *  Usage: calibrate_colbert_first.exe [-g] [-s] [-b skipbits]
  *
  */
 
@@ -72,8 +86,14 @@ using namespace std;
 #include "MyLibs/Talk2FrameGrabber.h"
 #include "MyLibs/Talk2DLP.h"
 #include "MyLibs/AndysComputations.h"
+#include "MyLibs/WormAnalysis.h"
+#include "MyLibs/TransformLib.h"
+#include "MyLibs/GrayCode.h"
 #include "version.h"
 
+/** In Gray code mode, sample the dense correspondences every this many camera pixels to fit the model **/
+#define GC_FIT_SAMPLE_STEP 16
+
 
 
 typedef struct CalibrationSessionStruct {
@@ -118,6 +138,11 @@ typedef struct CalibrationSessionStruct {
 	int StepSize;
 	int LoopsPerPt;
 
+	/** Mode **/
+	int GrayCodeMode; // 1 == structured light scan instead of point by point
+	int Simulate; // 1 == simulated projector and camera, no hardware
+	int SkipBits; // finest Gray code bits not to project
+
 }CalibrationSession;
 
 
@@ -170,6 +195,11 @@ CalibrationSession* CreateCalibrationSession(){
 	c->StepSize=0;
 	c->LoopsPerPt=0;
 
+	/** Mode **/
+	c->GrayCodeMode=0;
+	c->Simulate=0;
+	c->SkipBits=0;
+
 	return c;
 
 
@@ -501,6 +531,128 @@ int WriteOutCalibPointPairs(CvSeq *CalibSeq, int nsizex, int nsizey,int CCDsizex
 
 
 
+/*
+ * Show the pattern sent to the DLP and what the camera saw
+ */
+void DisplayCalibFrames(CalibrationSession* c){
+	CopyCharArrayToIplImage(c->toDLP->binary,c->toDLP->iplimg,c->DLPsize.width,c->DLPsize.height);
+	CopyCharArrayToIplImage(c->fromCCD->binary,c->fromCCD->iplimg,c->Camsize.width,c->Camsize.height);
+	cvShowImage("ToDLP",c->toDLP->iplimg);
+	cvShowImage("FromCamera",c->fromCCD->iplimg);
+	cvWaitKey(2);
+	return;
+}
+
+/*
+ * Project every Gray code pattern, decode the mirror coordinate seen by
+ * each camera pixel and write out the dense map, the confidence mask and a
+ * calibration model fit to the dense map.
+ *
+ * If c->Simulate the patterns go to a simulated projector and camera and the
+ * result is checked against the simulation's known warp.
+ */
+int CalibrateGrayCode(CalibrationSession* c){
+	GrayCodeCalib* gc=CreateGrayCodeCalib(c->DLPsize.width,c->DLPsize.height,c->Camsize.width,c->Camsize.height,c->SkipBits,GC_DEFAULT_MIN_CONTRAST);
+	if (gc==NULL) return -1;
+	SimProjCam* sim=NULL;
+	if (c->Simulate){
+		sim=CreateSimProjCam(c->DLPsize.width,c->DLPsize.height,c->Camsize.width,c->Camsize.height,2,3.0);
+		if (sim==NULL){
+			DestroyGrayCodeCalib(&gc);
+			return -1;
+		}
+	}
+
+	/** Project and capture each pattern **/
+	int NumPatterns=GrayCodeNumPatterns(gc);
+	printf("Projecting %d Gray code patterns..\n",NumPatterns);
+	int k;
+	for (k = 0; k < NumPatterns; k++) {
+		GrayCodeRenderPattern(gc,k,c->toDLP->binary);
+		if (sim!=NULL){
+			SimProjCamCapture(sim,c->toDLP->binary,c->fromCCD->binary);
+		} else {
+			T2DLP_SendFrame((unsigned char *) c->toDLP->binary, c->myDLP);
+			cvWaitKey(10);
+			/** The first frame may have been exposed before the pattern changed **/
+			AcquireFrame(c->fg);
+			AcquireFrame(c->fg);
+			CheckFGSizeMatch(c->fromCCD->iplimg,c->fg);
+			LoadFrameWithBin(c->fg->HostBuf,c->fromCCD);
+		}
+		GrayCodeAddCapture(gc,k,c->fromCCD->binary);
+		DisplayCalibFrames(c);
+	}
+	if (sim==NULL) T2DLP_clear(c->myDLP);
+
+	/** Decode every camera pixel **/
+	if (GrayCodeDecode(gc) <= 0){
+		printf("Gray code calibration failed: no camera pixel could be decoded.\n");
+		DestroyGrayCodeCalib(&gc);
+		DestroySimProjCam(&sim);
+		return -1;
+	}
+
+	/** Dense map and confidence mask **/
+	if (GrayCodeToLookUp(gc,c->CCD2DLPLookUp)==GC_OK){
+		WriteCalibrationToFile(c->CCD2DLPLookUp,c->Camsize,"calibDense.dat");
+	}
+	CopyCharArrayToIplImage(gc->Mask,c->temp->iplimg,c->Camsize.width,c->Camsize.height);
+	cvSaveImage("calibConfidence.png",c->temp->iplimg);
+
+	/** Fit the compact model to a subsample of the confident pixels **/
+	cvClearSeq(c->CalibSeq);
+	int x,y;
+	for (y = 0; y < c->Camsize.height; y+=GC_FIT_SAMPLE_STEP) {
+		for (x = 0; x < c->Camsize.width; x+=GC_FIT_SAMPLE_STEP) {
+			int i=y*c->Camsize.width+x;
+			if (gc->Mask[i]==0) continue;
+			PairOfPoints pair;
+			pair.alpha=cvPoint(gc->DecodedX[i],gc->DecodedY[i]); // DLP
+			pair.beta=cvPoint(x,y); // CCD
+			cvSeqPush(c->CalibSeq,&pair);
+		}
+	}
+	CalibModel* model=FitCalibModel(c->CalibSeq,c->DLPsize,c->Camsize,CALIBMODEL_GRID_STEP);
+	if (model!=NULL){
+		WriteCalibModelToFile(model,"calib.dat");
+	} else {
+		printf("Could not fit a calibration model. calib.dat was not written.\n");
+	}
+
+	/** In simulation we know the right answer **/
+	if (sim!=NULL){
+		double sumDecoded=0, sumModel=0, maxDecoded=0;
+		int n=0;
+		double u,v,mu,mv;
+		for (y = 0; y < c->Camsize.height; y++) {
+			for (x = 0; x < c->Camsize.width; x++) {
+				int i=y*c->Camsize.width+x;
+				if (gc->Mask[i]==0) continue;
+				SimProjCamTruth(sim,x,y,&u,&v);
+				double e=sqrt((gc->DecodedX[i]-u)*(gc->DecodedX[i]-u) + (gc->DecodedY[i]-v)*(gc->DecodedY[i]-v));
+				sumDecoded+=e;
+				if (e > maxDecoded) maxDecoded=e;
+				if (model!=NULL){
+					CalibModelCam2DLP(model,x,y,&mu,&mv);
+					sumModel+=sqrt((mu-u)*(mu-u) + (mv-v)*(mv-v));
+				}
+				n++;
+			}
+		}
+		int N=c->Camsize.width*c->Camsize.height;
+		printf("Simulation: %d of %d camera pixels decoded (%.1f%% coverage).\n",n,N,100.0*n/N);
+		printf("Simulation: over the decoded pixels, decoded error mean %.2f max %.2f mirrors, model error mean %.2f mirrors.\n",
+				sumDecoded/n,maxDecoded,model!=NULL ? sumModel/n : -1.0);
+	}
+
+	DestroyCalibModel(&model);
+	DestroyGrayCodeCalib(&gc);
+	DestroySimProjCam(&sim);
+	return 0;
+}
+
+
 int main (int argc, char** argv){
 
 
@@ -510,6 +662,34 @@ int main (int argc, char** argv){
 	/** Create session object **/
 	CalibrationSession* c = CreateCalibrationSession();
 
+	/** Command line options **/
+	int opt;
+	while ((opt = getopt(argc, argv, "gsb:?")) != -1) {
+		switch (opt) {
+		case 'g': /** Gray code structured light scan **/
+			c->GrayCodeMode=1;
+			break;
+
+		case 's': /** Simulated projector and camera, implies -g **/
+			c->GrayCodeMode=1;
+			c->Simulate=1;
+			break;
+
+		case 'b': /** Number of finest Gray code bits not to project **/
+			if (optarg != NULL) c->SkipBits=atoi(optarg);
+			break;
+
+		case '?':
+		default:
+			printf("Usage: calibrate_colbert_first.exe [-g] [-s] [-b skipbits]\n");
+			printf("\t-g\tGray code structured light calibration instead of point by point\n");
+			printf("\t-s\tRun the Gray code calibration on a simulated projector and camera\n");
+			printf("\t-b <n>\tDon't project the n finest Gray code bits\n");
+			DestroyCalibrationSession(c);
+			return 0;
+		}
+	}
+
 	/** Set the size of the objects **/
 	SetHardwareDimensions(c,cvSize(NSIZEX,NSIZEY),cvSize(NSIZEX,NSIZEY));
 
@@ -521,6 +701,16 @@ int main (int argc, char** argv){
 	c->StepSize=100; //pixels
 	c->LoopsPerPt=20; // Number of frames we use to calibrate a given point
 
+	/** A simulated Gray code calibration needs no hardware **/
+	if (c->Simulate){
+		SetupGUI(c);
+		CalibrateGrayCode(c);
+		cvDestroyAllWindows();
+		DestroyCalibrationSession(c);
+		printf("\n Good bye.\n");
+		return 0;
+	}
+
 	/** Start Camera **/
 	c->fg= TurnOnFrameGrabber();
 
@@ -558,35 +748,51 @@ int main (int argc, char** argv){
 
 
 
-	/*** Build Up a set of calibrated points ***/
-	int calx = 0;
-	int caly = 0;
+	if (c->GrayCodeMode){
+		/*** Structured light: every camera pixel at once ***/
+		CalibrateGrayCode(c);
+		cvDestroyAllWindows();
+	} else {
+
+		/*** Build Up a set of calibrated points ***/
+		int calx = 0;
+		int caly = 0;
 
 
-	printf(" Beginning calibration..\n");
+		printf(" Beginning calibration..\n");
 
-	while (caly < c->DLPsize.height ) {
-		calx = 0;
+		while (caly < c->DLPsize.height ) {
+			calx = 0;
 
-		while (calx < c->DLPsize.width) {
+			while (calx < c->DLPsize.width) {
 
-			CalibrateAPoint(cvPoint(calx,caly),c);
+				CalibrateAPoint(cvPoint(calx,caly),c);
 
-			calx = calx + c->StepSize;
+				calx = calx + c->StepSize;
+			}
+			caly = caly + c->StepSize;
 		}
-		caly = caly + c->StepSize;
+
+		T2DLP_clear(c->myDLP);
+
+		cvDestroyAllWindows();
+
+		/** Fit the calibration model. This must happen before the pairs are written out, which empties CalibSeq **/
+		CalibModel* model=FitCalibModel(c->CalibSeq,c->DLPsize,c->Camsize,CALIBMODEL_GRID_STEP);
+		if (model!=NULL){
+			WriteCalibModelToFile(model,"calib.dat");
+			DestroyCalibModel(&model);
+		} else {
+			printf("Could not fit a calibration model. calib.dat was not written.\n");
+		}
+
+		/** Keep the raw points too, e.g. to generate a legacy lookup table in Matlab **/
+		printf("Writing out Calibrated Pair of Points to YAML for later processing by MATLAB...\n");
+		WriteOutCalibPointPairs(c->CalibSeq,c->DLPsize.width, c->DLPsize.height, c->Camsize.width, c->Camsize.height);
+		printf("YAML file written.\n");
 	}
 
-	T2DLP_clear(c->myDLP);
 
-	cvDestroyAllWindows();
-	
-	/** Generate Look Up Table in Matlab **/
-	printf("Writing out Calibrated Pair of Points to YAML for later processing by MATLAB...\n");
-	WriteOutCalibPointPairs(c->CalibSeq,c->DLPsize.width, c->DLPsize.height, c->Camsize.width, c->Camsize.height);
-	printf("YAML file written.\n");
-	
-	
 	//T2Matlab_GenLookUpTable(c->CalibSeq, c->CCD2DLPLookUp, c->DLPsize.width, c->DLPsize.height, c->Camsize.width, c->Camsize.height);
 
 	/** Write calibration to file **/
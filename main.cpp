@@ -85,6 +85,9 @@ using namespace std;
 #include "MyLibs/IllumWormProtocol.h"
 #include "MyLibs/TransformLib.h"
 #include "API/mc_api_dll.h"
+#include "MyLibs/DLPOutput.h"
+#include "MyLibs/IllumScheduler.h"
+#include "MyLibs/ProtocolTimeline.h"
 #include "MyLibs/experiment.h"
 
 
@@ -94,10 +97,10 @@ using namespace std;
 /** Global Variables (for multithreading) **/
 UINT Thread(LPVOID lpdwParam);
 IplImage* CurrentImg;
-bool DispThreadHasStarted;
-bool MainThreadHasStopped;
-bool DispThreadHasStopped;
-bool UserWantsToStop;
+HANDLE DispThreadHasStarted; // event, set once the display thread's GUI is up
+HANDLE DispThreadHasStopped; // event, set when the display thread exits
+volatile LONG MainThreadHasStopped;
+volatile LONG UserWantsToStop;
 
 int main (int argc, char** argv){
 	int DEBUG=0;
@@ -131,6 +134,9 @@ int main (int argc, char** argv){
 	/** Load protocol YAML file **/
 	if (exp->pflag) LoadProtocol(exp);
 
+	/** Load protocol timeline **/
+	if (LoadTimeline(exp) == -1) return -1;
+
 	VerifyProtocol(exp->p);
 
 	/** Start Camera or Vid Input **/
@@ -139,12 +145,23 @@ int main (int argc, char** argv){
 	/** Prepare DLP ***/
 	if (!(exp->SimDLP)){
 		exp->myDLP= T2DLP_on();
+		/** Uploads to the DLP happen on their own thread **/
+		exp->dlpOut= StartDLPOutput(exp->myDLP, NSIZEX, NSIZEY, T2DLP_SendFrame);
+		DLPOut_SetLatencyTrace(exp->dlpOut, exp->Latency);
+		/** Illumination is switched on and off at precise times by its own thread **/
+		exp->illumSched= StartIllumScheduler(exp->dlpOut, NSIZEX, NSIZEY);
 	}
 
 	/** Setup Segmentation Gui **/
 	AssignWindowNames(exp);
 
 
+	/** Handshake with the display thread. Set up before it can possibly use them **/
+	DispThreadHasStarted=CreateEvent(NULL, TRUE, FALSE, NULL);
+	DispThreadHasStopped=CreateEvent(NULL, TRUE, FALSE, NULL);
+	InterlockedExchange(&MainThreadHasStopped, FALSE);
+	InterlockedExchange(&UserWantsToStop, FALSE);
+
 	/** Start New Thread **/
 	DWORD dwThreadId;
 	HANDLE hThread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) Thread, (void*) exp,
@@ -157,11 +174,7 @@ int main (int argc, char** argv){
 
 
 	// wait for thread
-	DispThreadHasStarted=FALSE;
-	DispThreadHasStopped=FALSE;
-	MainThreadHasStopped=FALSE;
-	while (!DispThreadHasStarted)
-		Sleep(10);
+	WaitForSingleObject(DispThreadHasStarted, INFINITE);
 
 	/** SetUp Data Recording **/
 	exp->e = SetupRecording(exp);
@@ -176,8 +189,7 @@ int main (int argc, char** argv){
 	/** Giant While Loop Where Everything Happens **/
 	//TICTOC::timer().tic("WholeLoop");
 	int VideoRanOut=0;
-	UserWantsToStop=0;
-	while (UserWantsToStop!=1) {
+	while (!UserWantsToStop) {
 		_TICTOC_TIC_FUNC
 		TICTOC::timer().tic("OneLoop");
 		if (isFrameReady(exp)) {
@@ -210,18 +222,18 @@ int main (int argc, char** argv){
 
 			/** Do we even bother doing analysis?**/
 			if (exp->Params->OnOff==0){
-				/**Don't perform any analysis**/;
+				/**Don't perform any analysis, just show the frame**/;
+				PublishRawFrame(exp);
 				continue;
 			}
 			
 			
 			/**** Functions to decide if Illumination Should be on Or Off ***/
 			/** Handle Transient Illumination Timing **/
-			//HandleIlluminationTiming(exp);
-
-			/** Perform stage unit->pixel calibration **/
-			//HandleCalibration(exp);
+			HandleIlluminationTiming(exp);
 
+			/** Step through the protocol on schedule **/
+			HandleProtocolTimeline(exp);
 
 			
 			/** Load Image into Our Worm Objects **/
@@ -237,15 +249,34 @@ int main (int argc, char** argv){
 			/** Do Segmentation **/
 			DoSegmentation(exp);
 			TICTOC::timer().toc("EntireSegmentation");
+			LT_Mark(exp->Latency, exp->Worm->frameNum, LT_SEGMENTED);
+
+			/** Perform stage unit->pixel calibration **/
+			HandleStageCalibration(exp);
+
+			/** Predict where the worm will be when this frame's pattern reaches the mirrors **/
+			PredictWormPose(exp);
+
+			/** With the scheduler a pattern goes out every frame, so the latency
+			 *  trace covers the whole pipeline even without illumination. **/
+			if (exp->illumSched != NULL) {
+				/** The scheduler keeps it off the mirrors while the illumination is off **/
+				ClearPackedPattern(exp->DLPPattern);
+				IlluminateWormFromProtocol(exp);
+				SendIlluminationToDLP(exp);
+			} else {
+				/** Darken the mirrors when the DLP goes off **/
+				ClearDLPifNotDisplayingNow(exp);
+			}
 				
 		
 
 			/*** DIsplay Some Monitoring Output ***/
-			//TICTOC::timer().tic("Mark recentering target");
-			if (exp->e == 0) CreateWormHUDS(exp->HUDS,exp->Worm,exp->Params,exp->IlluminationFrame);
-			//if (exp->e==0 && exp->stageIsPresent==1)
-				MarkRecenteringTarget(exp);
-			//TICTOC::timer().toc("Mark recentering target");
+			/** Only a snapshot; the display thread draws it at its own rate **/
+			if (exp->e == 0) PublishHUD(exp);
+
+			/** Let other programs see the images, if asked to with -b **/
+			if (exp->e == 0) BroadcastImages(exp);
 
 
 			// if (exp->e == 0 &&  EverySoOften(exp->Worm->frameNum,exp->Params->DispRate) ){
@@ -288,11 +319,12 @@ int main (int argc, char** argv){
 
 	//TICTOC::timer().toc("WholeLoop");
 	/** Tell the display thread that the main thread is shutting down**/
-	MainThreadHasStopped=TRUE;
+	InterlockedExchange(&MainThreadHasStopped, TRUE);
 
 	//TICTOC::timer().tic("FinishRecording()");
 	FinishRecording(exp);
 	//TICTOC::timer().toc("FinishRecording()");
+	FinishProtocolTimeline(exp);
 
 
 	if (!(exp->VidFromFile) && !(exp->UseFrameGrabber)){
@@ -308,18 +340,31 @@ int main (int argc, char** argv){
 
 
 	printf("%s",TICTOC::timer().generateReportCstr());
-    if (!DispThreadHasStopped){
+    if (WaitForSingleObject(DispThreadHasStopped, 0) != WAIT_OBJECT_0){
 	   printf("Waiting for DisplayThread to Stop...");
 
     }
-	while (!DispThreadHasStopped){
+	/** Returns as soon as it stops; the timeout is only there to show we are still waiting **/
+	while (WaitForSingleObject(DispThreadHasStopped, 500) == WAIT_TIMEOUT){
 		printf(".");
-		Sleep(500);
 		cvWaitKey(10);
 	}
+	CloseHandle(hThread);
+	CloseHandle(DispThreadHasStarted);
+	CloseHandle(DispThreadHasStopped);
+
+
 
+	/** Turn the illumination off and log when it actually switched **/
+	StopIllumination(exp);
 
+	/** Finish any pending DLP upload and stop the DLP output thread **/
+	StopDLPOutput(&(exp->dlpOut));
 
+	/** Camera-to-mirror latency of every step **/
+	ReportLatency(exp);
+
+	/** Nothing else uses the stage now: the main loop is done and the display thread has stopped **/
 	if (exp->stageIsPresent) {
 		ShutOffStage(exp);
 		printf("\nLast used stage centering coordinates x=%d, y=%d\n",exp->stageFeedbackTarget.x,exp->stageFeedbackTarget.y);
@@ -346,7 +391,7 @@ UINT Thread(LPVOID lpdwParam) {
 //	SetPriorityClass(GetCurrentProcess(), BELOW_NORMAL_PRIORITY_CLASS);
 
 	//printf("Beginning ProtocolStep Display\n");
-	DispThreadHasStarted = TRUE;
+	SetEvent(DispThreadHasStarted);
 	cvWaitKey(30);
 
 	/** Protocol WormSpace Display **/
@@ -382,12 +427,10 @@ UINT Thread(LPVOID lpdwParam) {
 
 			//TICTOC::timer().tic("DisplayThreadGuts");
 			TICTOC::timer().tic("cvShowImage");
-			if (exp->Params->OnOff){
-				cvShowImage(exp->WinDisp, exp->HUDS);
-				//cvShowImage(exp->WinDisp2,exp->Worm->ImgThresh);//exp->CurrentSelectedImg);
-			}else{
-				cvShowImage(exp->WinDisp, exp->fromCCD->iplimg);
-			}
+			/** Only redraw when the analysis thread has published a new frame.
+			 *  It is ours until the next one, so it is never half written. **/
+			if (RenderLatestHUD(exp)) cvShowImage(exp->WinDisp, exp->DispHUDS);
+			//cvShowImage(exp->WinDisp2,exp->Worm->ImgThresh);//exp->CurrentSelectedImg);
 			TICTOC::timer().toc("cvShowImage");
 			//printf("elapsed %f",etim);
 			 
@@ -421,14 +464,15 @@ UINT Thread(LPVOID lpdwParam) {
 				printf("\n\nEscape key pressed!\n\n");
 
 				/** Let the Other thread know that the user wants to stop **/
-				UserWantsToStop=1;
+				InterlockedExchange(&UserWantsToStop, TRUE);
 
-				/** Emergency Shut off the Stage **/
-				printf("Emergency stage shut off.");
-				if (exp->stageIsPresent) ShutOffStage(exp);
+				/** Emergency stop the Stage. The main thread still uses the stage
+				 *  objects until it notices, so it frees them once it is done **/
+				printf("Emergency stage halt.");
+				if (exp->stageIsPresent) HaltStage(exp);
 
 				/** Exit the display thread immediately **/
-				DispThreadHasStopped=TRUE;
+				SetEvent(DispThreadHasStopped);
 				printf("\nDisplayThread: Goodbye!\n");
 				return 0;
 
@@ -440,10 +484,9 @@ UINT Thread(LPVOID lpdwParam) {
 			if(EverySoOften(k,1)){ //This determines how often the stage is updated
 				
 				
-				if (exp->e != 0 && exp->stageIsPresent) {
-					printf("\tAuto-safety STAGE SHUTOFF from dispThread!\n");
-					ShutOffStage(exp);
-				} else {
+				/** After a frame error the feedback loop gets no new measurement,
+				 *  and stands still on its own once the last one is SC_STALE_MS old **/
+				if (exp->e == 0) {
 				
 					/** Do the Stage Tracking **/
 					TICTOC::timer().tic("HandleStageTracker()");
@@ -454,11 +497,6 @@ UINT Thread(LPVOID lpdwParam) {
 					TICTOC::timer().toc("HandleStageTracker()");
 				//printf("Stage tracker took: %d \n\n",TICTOC::clock("HandleStageTracker()"));
 				}
-
-				/** Write the Recent Frame Number to File to be accessed by the Annotation System **/
-				//TICTOC::timer().tic("WriteRecentFrameNumberToFile()");
-				WriteRecentFrameNumberToFile(exp);
-				//TICTOC::timer().toc("WriteRecentFrameNumberToFile()");
 			}
 
 			k++;
@@ -466,13 +504,13 @@ UINT Thread(LPVOID lpdwParam) {
 
 	}
 
-	if (exp->stageIsPresent) ShutOffStage(exp);
+	/** The main thread shuts off the stage once it has stopped using it **/
 
 	//if (exp->pflag) cvReleaseImage(&rectWorm);
 
 	//	printf("%s",TICTOC::timer().generateReportCstr());
 		printf("\nDisplayThread: Goodbye!\n");
-		DispThreadHasStopped=TRUE;
+		SetEvent(DispThreadHasStopped);
 	return 0;
 }
 
@@ -0,0 +1,156 @@
+/*
+ * testBoundaryGrid.c
+ *
+ * Checks that the BoundaryGrid queries in AndysOpenCVLib give exactly the same
+ * answers as the brute force FindNearestPt(), FindPerpPoint() and the original
+ * FindPerpPoint() based SegmentSides(), and times the two side by side.
+ *
+ * The boundaries are a worm shaped outline traced with cvFindContours() plus
+ * random walks with larger and larger steps between consecutive points.
+ *
+ * Prints the number of mismatches and returns nonzero if there were any.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "opencv2/core/core_c.h"
+#include "opencv2/imgproc/imgproc_c.h"
+#include "MyLibs/AndysOpenCVLib.h"
+
+#define NUM_TRIALS 200
+#define QUERIES_PER_TRIAL 400
+
+/*
+ * The brute force version of SegmentSides(), as it was before the grid.
+ */
+static void SegmentSidesLinear(const CvSeq *contourA, const CvSeq *contourB, const CvSeq *centerline, CvSeq *segmentedA, CvSeq *segmentedB){
+	int ptincrement = 3*((contourA->total > contourB->total ? contourA->total : contourB->total) / centerline->total + 1);
+	int lastA=0, lastB=0;
+	CvPoint current, forward, backward, tangent;
+	for (int j = 0; j < centerline->total; j++) {
+		backward = (j==0) ? *(CvPoint *) cvGetSeqElem (contourA, 0) : *(CvPoint *) cvGetSeqElem (centerline, j - 1);
+		current = *(CvPoint *) cvGetSeqElem (centerline, j);
+		forward = (j==centerline->total-1) ? *(CvPoint *) cvGetSeqElem (contourA, centerline->total-1) : *(CvPoint *) cvGetSeqElem (centerline, j+1);
+		tangent = cvPoint(forward.x - backward.x, forward.y - backward.y);
+		lastA = FindPerpPoint (current, tangent, contourA, lastA - ptincrement, lastA + ptincrement);
+		lastB = FindPerpPoint (current, tangent, contourB, lastB - ptincrement, lastB + ptincrement);
+		cvSeqPush (segmentedA, cvGetSeqElem(contourA, lastA));
+		cvSeqPush (segmentedB, cvGetSeqElem(contourB, lastB));
+	}
+}
+
+/*
+ * Outline of a wiggly worm from cvFindContours(), i.e. 8-connected
+ */
+static CvSeq* WormOutline(CvMemStorage* mem, int phase){
+	IplImage* img=cvCreateImage(cvSize(400,400),IPL_DEPTH_8U,1);
+	cvZero(img);
+	for (int i=0; i<120; i++){
+		CvPoint c=cvPoint(140+i,200+cvRound(25*sin((i+phase)/15.0)));
+		cvCircle(img,c,8-abs(i-60)/10,cvScalarAll(255),-1,8,0);
+	}
+	CvSeq* contours=NULL;
+	cvFindContours(img,mem,&contours,sizeof(CvContour),CV_RETR_EXTERNAL,CV_CHAIN_APPROX_NONE,cvPoint(0,0));
+	cvReleaseImage(&img);
+	return contours;
+}
+
+/*
+ * Random walk of n points with steps of up to maxStep pixels in x and y
+ */
+static CvSeq* RandomWalk(CvMemStorage* mem, int n, int maxStep){
+	CvSeq* seq=cvCreateSeq(CV_SEQ_ELTYPE_POINT,sizeof(CvSeq),sizeof(CvPoint),mem);
+	CvPoint pt=cvPoint(200,200);
+	for (int i=0; i<n; i++){
+		pt.x+=rand()%(2*maxStep+1)-maxStep;
+		pt.y+=rand()%(2*maxStep+1)-maxStep;
+		cvSeqPush(seq,&pt);
+	}
+	return seq;
+}
+
+int main(){
+	CvMemStorage* mem=cvCreateMemStorage(0);
+	BoundaryGrid* Grid=CreateBoundaryGrid(BGRID_DEFAULT_CELL_SIZE);
+	BoundaryGrid* GridA=CreateBoundaryGrid(BGRID_DEFAULT_CELL_SIZE);
+	BoundaryGrid* GridB=CreateBoundaryGrid(BGRID_DEFAULT_CELL_SIZE);
+	long queries=0, mismatches=0;
+	srand(1);
+
+	printf("Comparing BoundaryGrid queries against the brute force versions.\n");
+	for (int trial=0; trial<NUM_TRIALS; trial++){
+		cvClearMemStorage(mem);
+		CvSeq* Boundary= (trial%4==0) ? WormOutline(mem,trial) : RandomWalk(mem,50+rand()%600,2*(trial%4));
+		if (Boundary==NULL || LoadBoundaryGrid(Grid,Boundary)!=A_OK){
+			printf("Error! Could not load boundary for trial %d\n",trial);
+			return -1;
+		}
+		int n=Boundary->total;
+
+		for (int k=0; k<QUERIES_PER_TRIAL; k++){
+			CvPoint pt=cvPoint(100+rand()%200,100+rand()%200);
+			CvPoint a=FindNearestPt(pt,Boundary);
+			CvPoint b=FindNearestPtGrid(Grid,pt);
+			queries++;
+			if (a.x!=b.x || a.y!=b.y) mismatches++;
+
+			CvPoint t=cvPoint(rand()%21-10,rand()%21-10);
+			int last=rand()%n, inc=1+rand()%40;
+			int i1=FindPerpPoint(pt,t,Boundary,last-inc,last+inc);
+			int i2=FindPerpPointGrid(pt,t,Grid,last-inc,last+inc,PerpSearchRadiusGrid(Grid,pt,last,inc));
+			queries++;
+			if (i1!=i2) mismatches++;
+		}
+
+		/** Split the boundary in two and segment it along the midpoints **/
+		if (n>20){
+			CvSeq* A=cvSeqSlice(Boundary,cvSlice(0,n/2),mem,1);
+			CvSeq* B=cvSeqSlice(Boundary,cvSlice(n/2,2*(n/2)),mem,1);
+			cvSeqInvert(B);
+			CvSeq* centerline=cvCreateSeq(CV_SEQ_ELTYPE_POINT,sizeof(CvSeq),sizeof(CvPoint),mem);
+			FindCenterline(A,B,centerline);
+			CvSeq* segA=cvCreateSeq(CV_SEQ_ELTYPE_POINT,sizeof(CvSeq),sizeof(CvPoint),mem);
+			CvSeq* segB=cvCreateSeq(CV_SEQ_ELTYPE_POINT,sizeof(CvSeq),sizeof(CvPoint),mem);
+			CvSeq* refA=cvCreateSeq(CV_SEQ_ELTYPE_POINT,sizeof(CvSeq),sizeof(CvPoint),mem);
+			CvSeq* refB=cvCreateSeq(CV_SEQ_ELTYPE_POINT,sizeof(CvSeq),sizeof(CvPoint),mem);
+			SegmentSides(A,B,centerline,segA,segB,GridA,GridB);
+			SegmentSidesLinear(A,B,centerline,refA,refB);
+			for (int j=0; j<centerline->total; j++){
+				CvPoint* pa=(CvPoint*) cvGetSeqElem(segA,j);
+				CvPoint* ra=(CvPoint*) cvGetSeqElem(refA,j);
+				CvPoint* pb=(CvPoint*) cvGetSeqElem(segB,j);
+				CvPoint* rb=(CvPoint*) cvGetSeqElem(refB,j);
+				queries++;
+				if (pa->x!=ra->x || pa->y!=ra->y || pb->x!=rb->x || pb->y!=rb->y) mismatches++;
+			}
+		}
+	}
+	printf("%ld queries, %ld mismatches\n",queries,mismatches);
+
+	/** Time full boundary nearest point queries on a worm outline **/
+	cvClearMemStorage(mem);
+	CvSeq* Worm=WormOutline(mem,0);
+	int reps=20000;
+	clock_t start=clock();
+	long sum=0;
+	for (int k=0; k<reps; k++) sum+=FindNearestPt(cvPoint(140+k%120,190+k%20),Worm).x;
+	double linear=(double) (clock()-start)/CLOCKS_PER_SEC;
+	start=clock();
+	LoadBoundaryGrid(Grid,Worm);
+	for (int k=0; k<reps; k++) sum-=FindNearestPtGrid(Grid,cvPoint(140+k%120,190+k%20)).x;
+	double grid=(double) (clock()-start)/CLOCKS_PER_SEC;
+	printf("%d nearest point queries on a %d point outline: brute force %.1f ms, grid %.1f ms (checksum %ld)\n",
+			reps,Worm->total,1000*linear,1000*grid,sum);
+
+	DestroyBoundaryGrid(&Grid);
+	DestroyBoundaryGrid(&GridA);
+	DestroyBoundaryGrid(&GridB);
+	cvReleaseMemStorage(&mem);
+	if (mismatches>0){
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("Done.\n");
+	return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * testFillPoly.c
+ *
+ * Checks that FillPolyEvenOdd() in AndysOpenCVLib lights up the same pixels as
+ * cvFillPoly(...,8), on sample worm shaped strips and on random polygons that lie
+ * inside the image, and times the two side by side.
+ *
+ * Polygons that run off the edge of the image can differ by a few pixels along
+ * the border, because cvFillPoly() clips the outline before drawing it.
+ *
+ * Prints the number of differing pixels and returns nonzero if there were any.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "opencv2/core/core_c.h"
+#include "opencv2/imgproc/imgproc_c.h"
+#include "MyLibs/AndysOpenCVLib.h"
+
+#define NUM_TRIALS 2000
+#define MAX_PTS 100
+
+/*
+ * Worm shaped strip: down one side of a wiggly centerline and back up the other
+ */
+static int WormStrip(CvPoint* pts, int width, int height){
+	int n=5+rand()%40;
+	double phase=(rand()%600)/100.0;
+	double halfwidth=2+(rand()%100)/10.0;
+	for (int i=0; i<=n; i++){
+		double x=0.15*width+i*0.7*width/n;
+		double y=0.5*height+0.13*height*sin(phase+i/5.0);
+		pts[i]=cvPoint(cvRound(x),cvRound(y-halfwidth));
+		pts[2*n+1-i]=cvPoint(cvRound(x),cvRound(y+halfwidth));
+	}
+	return 2*(n+1);
+}
+
+/*
+ * Random polygon, often self intersecting, with all vertices inside the image
+ */
+static int RandomPolygon(CvPoint* pts, int width, int height){
+	int n=3+rand()%4;
+	for (int i=0; i<n; i++) pts[i]=cvPoint(rand()%width,rand()%height);
+	return n;
+}
+
+int main(){
+	CvSize size=cvSize(400,300);
+	IplImage* ref=cvCreateImage(size,IPL_DEPTH_8U,1);
+	unsigned char* arr=(unsigned char*) malloc(size.width*size.height);
+	ScanlineFiller* sf=CreateScanlineFiller();
+	CvPoint pts[MAX_PTS];
+	long filled=0, differ=0;
+	srand(1);
+
+	printf("Comparing FillPolyEvenOdd() against cvFillPoly().\n");
+	for (int trial=0; trial<NUM_TRIALS; trial++){
+		int n= (trial%2==0) ? WormStrip(pts,size.width,size.height) : RandomPolygon(pts,size.width,size.height);
+		CvPoint* poly=pts;
+
+		cvZero(ref);
+		cvFillPoly(ref,&poly,&n,1,cvScalar(255,255,255),8);
+		memset(arr,0,size.width*size.height);
+		FillPolyEvenOdd(sf,arr,size.width,size.height,pts,n,255);
+
+		for (int y=0; y<size.height; y++){
+			unsigned char* row=(unsigned char*) (ref->imageData + y*ref->widthStep);
+			for (int x=0; x<size.width; x++){
+				if (row[x]) filled++;
+				if (row[x]!=arr[y*size.width+x]) differ++;
+			}
+		}
+	}
+	printf("%ld pixels filled by cvFillPoly(), %ld differ\n",filled,differ);
+
+	/** Time a sample worm **/
+	int n=WormStrip(pts,size.width,size.height);
+	CvPoint* poly=pts;
+	int reps=2000;
+	clock_t start=clock();
+	for (int k=0; k<reps; k++) cvFillPoly(ref,&poly,&n,1,cvScalar(255,255,255),8);
+	double cv=(double) (clock()-start)/CLOCKS_PER_SEC;
+	start=clock();
+	for (int k=0; k<reps; k++) FillPolyEvenOdd(sf,arr,size.width,size.height,pts,n,255);
+	double scan=(double) (clock()-start)/CLOCKS_PER_SEC;
+	printf("%d fills of a %d point worm: cvFillPoly %.1f ms, FillPolyEvenOdd %.1f ms\n",reps,n,1000*cv,1000*scan);
+
+	DestroyScanlineFiller(&sf);
+	free(arr);
+	cvReleaseImage(&ref);
+	if (differ>0){
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("Done.\n");
+	return 0;
+}